@@ -16,13 +16,21 @@
  * =====================================================================================
  */
 
+#include <algorithm>
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 #if defined __SSE2__ || _M_IX86_FP == 2
 #include <emmintrin.h>
 #endif
+#if defined __GNUC__ && defined __x86_64__
+#define LDGM_X86
+#include <immintrin.h>
+#define TARGET(isa) __attribute__((target(isa)))
+#endif
 #include <string.h>
 #include <time.h>
+#include <vector>
 
 #include "ldgm-session-cpu.h"
 #include "timer-util.h"
@@ -53,85 +61,163 @@ static inline void *aligned_malloc(size_t size, size_t alignment)
 #endif
 
 
-static char*
-xor_using_sse (char* source, char* dest, int packet_size)
+/*
+ * XOR kernels - dest = src[0] ^ src[1] ^ ... ^ src[count - 1]
+ *
+ * All sources are combined in registers so that the destination is written
+ * only once regardless of the number of sources. Bytes from start to len are
+ * processed, so that a kernel can pass its tail to a narrower one.
+ */
+static void
+xor_sources_scalar (char *dest, char * const *src, int count, int start, int len)
 {
-    // int a = 0;
-    // int II = packet_size % 16;
-    // a=II*16;
-    // // uint64_t* p1 = (uint64_t*) (source);
-    // // uint64_t* p2 = (uint64_t*) (dest);
-
-    // __int128* p1 = (__int128*) (source);
-    // __int128* p2 = (__int128*) (dest);
-
-    // for(int i=0; i<II; i++){
-    //     *p2 ^= *p1;
-    //     p2++;
-    //     p1++;
-    // }
-    // while(a<packet_size){
-    //     *(dest + a) ^= *(source+a);
-    //     a++;
-    // }
-    //First, do as many 128-bit XORs as possible
-    int iter_bytes_16 = 0;
-    int iter_bytes_4 = 0;
-    int iter_bytes_1 = 0;
-#if defined __SSE2__ || _M_IX86_FP == 2
-    iter_bytes_16 = (packet_size/16)*16;
-
-    if ( iter_bytes_16 > 0)
-    {
-
-        //    printf ( "iter_bytes: %d\n", iter_bytes );
-        __m128i* wrd_ptr = (__m128i *) source;
-        __m128i* wrd_end = (__m128i *) (source + iter_bytes_16);
-        __m128i* dst_ptr = (__m128i *) dest;
-
-        //    printf ( "wrd_ptr address: %p\n", wrd_ptr );
-        do
-        {
-            __m128i xmm1 = _mm_loadu_si128(wrd_ptr);
-            __m128i xmm2 = _mm_loadu_si128(dst_ptr);
-
-            xmm1 = _mm_xor_si128(xmm1, xmm2);     //  XOR  4 32-bit words
-            _mm_storeu_si128(dst_ptr, xmm1);
-            ++wrd_ptr;
-            ++dst_ptr;
+    int i = start;
+    for ( ; i + 8 <= len; i += 8) {
+        uint64_t acc, tmp;
+        memcpy(&acc, src[0] + i, 8);
+        for ( int j = 1; j < count; ++j) {
+            memcpy(&tmp, src[j] + i, 8);
+            acc ^= tmp;
+        }
+        memcpy(dest + i, &acc, 8);
+    }
+    for ( ; i < len; ++i) {
+        char acc = src[0][i];
+        for ( int j = 1; j < count; ++j)
+            acc ^= src[j][i];
+        dest[i] = acc;
+    }
+}
 
-        } while (wrd_ptr < wrd_end);
+#if defined __SSE2__ || _M_IX86_FP == 2
+static void
+xor_sources_sse2 (char *dest, char * const *src, int count, int start, int len)
+{
+    int i = start;
+    for ( ; i + 64 <= len; i += 64) {
+        __m128i a0 = _mm_loadu_si128((const __m128i *) (src[0] + i));
+        __m128i a1 = _mm_loadu_si128((const __m128i *) (src[0] + i + 16));
+        __m128i a2 = _mm_loadu_si128((const __m128i *) (src[0] + i + 32));
+        __m128i a3 = _mm_loadu_si128((const __m128i *) (src[0] + i + 48));
+        for ( int j = 1; j < count; ++j) {
+            a0 = _mm_xor_si128(a0, _mm_loadu_si128((const __m128i *) (src[j] + i)));
+            a1 = _mm_xor_si128(a1, _mm_loadu_si128((const __m128i *) (src[j] + i + 16)));
+            a2 = _mm_xor_si128(a2, _mm_loadu_si128((const __m128i *) (src[j] + i + 32)));
+            a3 = _mm_xor_si128(a3, _mm_loadu_si128((const __m128i *) (src[j] + i + 48)));
+        }
+        _mm_storeu_si128((__m128i *) (dest + i), a0);
+        _mm_storeu_si128((__m128i *) (dest + i + 16), a1);
+        _mm_storeu_si128((__m128i *) (dest + i + 32), a2);
+        _mm_storeu_si128((__m128i *) (dest + i + 48), a3);
     }
+    for ( ; i + 16 <= len; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *) (src[0] + i));
+        for ( int j = 1; j < count; ++j)
+            a = _mm_xor_si128(a, _mm_loadu_si128((const __m128i *) (src[j] + i)));
+        _mm_storeu_si128((__m128i *) (dest + i), a);
+    }
+    if (i < len) {
+        xor_sources_scalar(dest, src, count, i, len);
+    }
+}
 #endif
-    //Check, whether further XORing is necessary
-    if ( iter_bytes_16 < packet_size )
-    {
-        char *mark_source = source + iter_bytes_16;
-        char *mark_dest = dest + iter_bytes_16;
 
-        iter_bytes_4 = ((packet_size - iter_bytes_16)/4)*4;
+#ifdef LDGM_X86
+TARGET("avx2") static void
+xor_sources_avx2 (char *dest, char * const *src, int count, int start, int len)
+{
+    int i = start;
+    for ( ; i + 128 <= len; i += 128) {
+        __m256i a0 = _mm256_loadu_si256((const __m256i *) (src[0] + i));
+        __m256i a1 = _mm256_loadu_si256((const __m256i *) (src[0] + i + 32));
+        __m256i a2 = _mm256_loadu_si256((const __m256i *) (src[0] + i + 64));
+        __m256i a3 = _mm256_loadu_si256((const __m256i *) (src[0] + i + 96));
+        for ( int j = 1; j < count; ++j) {
+            a0 = _mm256_xor_si256(a0, _mm256_loadu_si256((const __m256i *) (src[j] + i)));
+            a1 = _mm256_xor_si256(a1, _mm256_loadu_si256((const __m256i *) (src[j] + i + 32)));
+            a2 = _mm256_xor_si256(a2, _mm256_loadu_si256((const __m256i *) (src[j] + i + 64)));
+            a3 = _mm256_xor_si256(a3, _mm256_loadu_si256((const __m256i *) (src[j] + i + 96)));
+        }
+        _mm256_storeu_si256((__m256i *) (dest + i), a0);
+        _mm256_storeu_si256((__m256i *) (dest + i + 32), a1);
+        _mm256_storeu_si256((__m256i *) (dest + i + 64), a2);
+        _mm256_storeu_si256((__m256i *) (dest + i + 96), a3);
+    }
+    if (i < len) {
+        xor_sources_sse2(dest, src, count, i, len);
+    }
+}
 
-        for ( int i = 0; i < (packet_size - iter_bytes_16)/4; i++)
-        {
-            int *s = ((int*) mark_source) + i;
-            int *d = ((int*) mark_dest) + i;
-            *d ^= *s;
+TARGET("avx512f") static void
+xor_sources_avx512 (char *dest, char * const *src, int count, int start, int len)
+{
+    int i = start;
+    for ( ; i + 256 <= len; i += 256) {
+        __m512i a0 = _mm512_loadu_si512(src[0] + i);
+        __m512i a1 = _mm512_loadu_si512(src[0] + i + 64);
+        __m512i a2 = _mm512_loadu_si512(src[0] + i + 128);
+        __m512i a3 = _mm512_loadu_si512(src[0] + i + 192);
+        for ( int j = 1; j < count; ++j) {
+            a0 = _mm512_xor_si512(a0, _mm512_loadu_si512(src[j] + i));
+            a1 = _mm512_xor_si512(a1, _mm512_loadu_si512(src[j] + i + 64));
+            a2 = _mm512_xor_si512(a2, _mm512_loadu_si512(src[j] + i + 128));
+            a3 = _mm512_xor_si512(a3, _mm512_loadu_si512(src[j] + i + 192));
         }
+        _mm512_storeu_si512(dest + i, a0);
+        _mm512_storeu_si512(dest + i + 64, a1);
+        _mm512_storeu_si512(dest + i + 128, a2);
+        _mm512_storeu_si512(dest + i + 192, a3);
+    }
+    if (i < len) {
+        xor_sources_avx2(dest, src, count, i, len);
+    }
+}
+#endif
 
-        mark_source += iter_bytes_4;
-        mark_dest += iter_bytes_4;
+typedef void (*xor_sources_t)(char *dest, char * const *src, int count, int start, int len);
 
-        iter_bytes_1 = packet_size - iter_bytes_16 - iter_bytes_4;
+static enum ldgm_cpu_isa xor_isa = LDGM_CPU_SCALAR;
 
-        for ( int i = 0; i < iter_bytes_1; i++)
-        {
-            *(mark_dest + i) ^= *(mark_source+i);
-        }
+static xor_sources_t
+select_xor_sources (enum ldgm_cpu_isa max_isa)
+{
+#ifdef LDGM_X86
+    __builtin_cpu_init();
+    if (max_isa >= LDGM_CPU_AVX512 && __builtin_cpu_supports("avx512f")) {
+        xor_isa = LDGM_CPU_AVX512;
+        return xor_sources_avx512;
+    }
+    if (max_isa >= LDGM_CPU_AVX2 && __builtin_cpu_supports("avx2")) {
+        xor_isa = LDGM_CPU_AVX2;
+        return xor_sources_avx2;
+    }
+#endif
+#if defined __SSE2__ || _M_IX86_FP == 2
+    if (max_isa >= LDGM_CPU_SSE2) {
+        xor_isa = LDGM_CPU_SSE2;
+        return xor_sources_sse2;
     }
+#endif
+    xor_isa = LDGM_CPU_SCALAR;
+    return xor_sources_scalar;
+}
 
-//   printf ( "XORed: %d bytes using SSE, %d bytes as ints and %d bytes byte-per-byte.\n",iter_bytes_16, iter_bytes_4, iter_bytes_1);
+static xor_sources_t xor_sources = select_xor_sources(LDGM_CPU_AVX512);
 
-    return dest;
+enum ldgm_cpu_isa
+ldgm_cpu_set_max_isa (enum ldgm_cpu_isa max_isa)
+{
+    xor_sources = select_xor_sources(max_isa);
+    return xor_isa;
+}
+
+static void
+xor_into (char *dest, char * const *src, int count, int len)
+{
+    if (count == 0)
+        memset(dest, 0, len);
+    else
+        xor_sources(dest, src, count, 0, len);
 }
 
 void *
@@ -147,44 +233,38 @@ LDGM_session_cpu::alloc_buf (int buf_size)
 
 }
 
+/*
+ * Parity packets are computed in blocks of ENCODE_BLOCK_BYTES / (k + m)
+ * bytes (at least ENCODE_MIN_BLOCK) so that the corresponding part of all
+ * source and parity packets stays in cache while all parities are updated.
+ */
+#define ENCODE_BLOCK_BYTES (1024 * 1024)
+#define ENCODE_MIN_BLOCK 1024
+
 void
 LDGM_session_cpu::encode ( char* data_ptr, char* parity_ptr )
 {
-//    start encoding
-   // printf ( "packet_size: %d\n", this->packet_size );
-
-    char *parity_packet;
-
-	parity_packet = (char *) aligned_malloc(packet_size, 16);
-	if (!parity_packet)
-	{
-		printf ( "Error while using posix_memalign\n" );
-		return;
-	}
-	memset(parity_packet, 0, packet_size);
-
-    for ( int m = 0; m < param_m; ++m) {
-//	printf ( "m: %d\n", m );
-
-//	printf ( "max w: %d\n", max_row_weight );
-        //Find out which packets to XOR
-        for ( int k = 0; k < max_row_weight+2; ++k) {
-            int idx = pcm[m*(max_row_weight+2) + k];
-//	    printf ( "adept: %d\n", idx );
-            if (idx > -1 && idx < param_k) {
-//		printf ( "xoring idx: %d\n", idx );
-                char *ptr = data_ptr + idx*packet_size;
-                parity_packet = xor_using_sse(ptr, parity_packet, packet_size);
+    int row_len = max_row_weight + 2;
+    int block = ENCODE_BLOCK_BYTES / (param_k + param_m) / 64 * 64;
+    block = std::max(block, ENCODE_MIN_BLOCK);
+    std::vector<char *> src(row_len + 1);
+
+    for ( int offset = 0; offset < packet_size; offset += block) {
+        int len = std::min(block, packet_size - offset);
+        for ( int m = 0; m < param_m; ++m) {
+            int count = 0;
+            //Apply inverted staircase matrix
+            if (m > 0)
+                src[count++] = parity_ptr + (m-1)*packet_size + offset;
+            //Find out which packets to XOR
+            for ( int k = 0; k < row_len; ++k) {
+                int idx = pcm[m*row_len + k];
+                if (idx > -1 && idx < param_k)
+                    src[count++] = data_ptr + idx*packet_size + offset;
             }
+            xor_into(parity_ptr + m*packet_size + offset, src.data(), count, len);
         }
-
-        //Add the new parity packet to overall parity
-        memcpy ( parity_ptr + m*packet_size, parity_packet, packet_size );
     }
-
-	aligned_free(parity_packet);
-
-    return ;
 }		/* -----  end of method LDGM_session_cpu::encode  ----- */
 
 void
@@ -444,8 +524,9 @@ LDGM_session_cpu::iterate ( Tanner_graph *graph )
 {
     map<int, Node>::iterator it_c;
     vector<int> vec;
+    vector<char *> src;
 
-    static int recovered = 0;
+    int recovered = 0;
 
     //select the first constraint node
     it_c = graph->nodes.find ( param_k + param_m );
@@ -472,7 +553,6 @@ LDGM_session_cpu::iterate ( Tanner_graph *graph )
 //		printf ( "repairing first block\n" );
 //	    }
             it_v = graph->nodes.find(r_index);
-            memset(it_v->second.getDataPtr(), 0, packet_size);
             char *r_data = it_v->second.getDataPtr();
             //find other nodes connected to this constraint node and XOR their values
             int count = 0;
@@ -481,13 +561,13 @@ LDGM_session_cpu::iterate ( Tanner_graph *graph )
             {
                 if ( *j != r_index )
                 {
-//		    printf ( "decode, packet_size: %d\n", packet_size );
-                    char *g_data = (graph->nodes.find(*j))->second.getDataPtr();
-                    //XOR
-                    xor_using_sse(g_data, r_data, packet_size);
+                    src.push_back((graph->nodes.find(*j))->second.getDataPtr());
                     count++;
                 }
             }
+            //XOR all of them in one pass
+            xor_into(r_data, src.data(), count, packet_size);
+            src.clear();
             /*           //validate recovered packet
              *          for ( int i = 0; i < param_k; ++i) {
              *              if(!memcmp(r_data, lost_ptr + i*packet_size, packet_size)) {
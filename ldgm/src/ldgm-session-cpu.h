@@ -23,6 +23,21 @@
 #include "ldgm-session.h"
 //#include "timer-util.h"
 
+enum ldgm_cpu_isa {
+    LDGM_CPU_SCALAR,
+    LDGM_CPU_SSE2,
+    LDGM_CPU_AVX2,
+    LDGM_CPU_AVX512,
+};
+
+/**
+ * Limits instruction set used by the XOR kernels of the CPU coder (the best
+ * one supported by the CPU is used by default).
+ *
+ * @return the instruction set that will be actually used
+ */
+enum ldgm_cpu_isa ldgm_cpu_set_max_isa(enum ldgm_cpu_isa max_isa);
+
 /*
  * =====================================================================================
  *        Class:  LDGM_session_cpu
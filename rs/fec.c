@@ -10,6 +10,12 @@
 #include <string.h>
 #include <assert.h>
 
+#if defined __GNUC__ && (defined __x86_64__ || defined __i386__)
+#define FEC_X86
+#include <immintrin.h>
+#define TARGET(isa) __attribute__((target(isa)))
+#endif
+
 /*
  * Primitive polynomials - see Lin & Costello, Appendix A,
  * and  Lee & Messerschmitt, p. 453.
@@ -75,6 +81,14 @@ static gf gf_mul_table[256][256];
  * For efficiency, gf_exp[] has size 2*GF_SIZE, so that a simple
  * multiplication of two numbers can be resolved without calling modnn
  */
+/*
+ * Split multiplication tables for the SIMD kernels - c * x is computed as
+ * gf_mul_lo[c][x & 0xf] ^ gf_mul_hi[c][x >> 4], so that both halves can be
+ * looked up by a byte shuffle of a 16-byte table.
+ */
+static gf gf_mul_lo[256][16];
+static gf gf_mul_hi[256][16];
+
 static void
 _init_mul_table(void) {
   int i, j;
@@ -84,6 +98,12 @@ _init_mul_table(void) {
 
   for (j = 0; j < 256; j++)
       gf_mul_table[0][j] = gf_mul_table[j][0] = 0;
+
+  for (i = 0; i < 256; i++)
+      for (j = 0; j < 16; j++) {
+          gf_mul_lo[i][j] = gf_mul_table[i][j];
+          gf_mul_hi[i][j] = gf_mul_table[i][j << 4];
+      }
 }
 
 #define NEW_GF_MATRIX(rows, cols) \
@@ -170,7 +190,7 @@ generate_gf (void) {
 
 #define UNROLL 16               /* 1, 4, 8, 16 */
 static void
-_addmul1(gf*restrict dst, const gf*restrict src, gf c, size_t sz) {
+_addmul1_scalar(gf*restrict dst, const gf*restrict src, gf c, size_t sz) {
     USE_GF_MULC;
     const gf* lim = &dst[sz - UNROLL + 1];
 
@@ -205,6 +225,80 @@ _addmul1(gf*restrict dst, const gf*restrict src, gf c, size_t sz) {
         GF_ADDMULC (*dst, *src);
 }
 
+#ifdef FEC_X86
+TARGET("ssse3") static void
+_addmul1_ssse3(gf*restrict dst, const gf*restrict src, gf c, size_t sz) {
+    const __m128i lo = _mm_loadu_si128((const __m128i *) gf_mul_lo[c]);
+    const __m128i hi = _mm_loadu_si128((const __m128i *) gf_mul_hi[c]);
+    const __m128i mask = _mm_set1_epi8(0x0f);
+    size_t i = 0;
+
+    for (; i + 16 <= sz; i += 16) {
+        __m128i s = _mm_loadu_si128((const __m128i *) (src + i));
+        __m128i d = _mm_loadu_si128((const __m128i *) (dst + i));
+        __m128i l = _mm_shuffle_epi8(lo, _mm_and_si128(s, mask));
+        __m128i h = _mm_shuffle_epi8(hi, _mm_and_si128(_mm_srli_epi64(s, 4), mask));
+        _mm_storeu_si128((__m128i *) (dst + i), _mm_xor_si128(d, _mm_xor_si128(l, h)));
+    }
+    if (i < sz)
+        _addmul1_scalar(dst + i, src + i, c, sz - i);
+}
+
+TARGET("avx2") static void
+_addmul1_avx2(gf*restrict dst, const gf*restrict src, gf c, size_t sz) {
+    const __m256i lo = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) gf_mul_lo[c]));
+    const __m256i hi = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) gf_mul_hi[c]));
+    const __m256i mask = _mm256_set1_epi8(0x0f);
+    size_t i = 0;
+
+    for (; i + 64 <= sz; i += 64) {
+        __m256i s0 = _mm256_loadu_si256((const __m256i *) (src + i));
+        __m256i s1 = _mm256_loadu_si256((const __m256i *) (src + i + 32));
+        __m256i d0 = _mm256_loadu_si256((const __m256i *) (dst + i));
+        __m256i d1 = _mm256_loadu_si256((const __m256i *) (dst + i + 32));
+        __m256i l0 = _mm256_shuffle_epi8(lo, _mm256_and_si256(s0, mask));
+        __m256i l1 = _mm256_shuffle_epi8(lo, _mm256_and_si256(s1, mask));
+        __m256i h0 = _mm256_shuffle_epi8(hi, _mm256_and_si256(_mm256_srli_epi64(s0, 4), mask));
+        __m256i h1 = _mm256_shuffle_epi8(hi, _mm256_and_si256(_mm256_srli_epi64(s1, 4), mask));
+        _mm256_storeu_si256((__m256i *) (dst + i), _mm256_xor_si256(d0, _mm256_xor_si256(l0, h0)));
+        _mm256_storeu_si256((__m256i *) (dst + i + 32), _mm256_xor_si256(d1, _mm256_xor_si256(l1, h1)));
+    }
+    for (; i + 32 <= sz; i += 32) {
+        __m256i s = _mm256_loadu_si256((const __m256i *) (src + i));
+        __m256i d = _mm256_loadu_si256((const __m256i *) (dst + i));
+        __m256i l = _mm256_shuffle_epi8(lo, _mm256_and_si256(s, mask));
+        __m256i h = _mm256_shuffle_epi8(hi, _mm256_and_si256(_mm256_srli_epi64(s, 4), mask));
+        _mm256_storeu_si256((__m256i *) (dst + i), _mm256_xor_si256(d, _mm256_xor_si256(l, h)));
+    }
+    if (i < sz)
+        _addmul1_ssse3(dst + i, src + i, c, sz - i);
+}
+#endif
+
+/*
+ * The multiply-accumulate kernel is selected in init_fec() according to CPU
+ * capabilities.
+ */
+static void (*_addmul1)(gf*restrict dst, const gf*restrict src, gf c, size_t sz) = _addmul1_scalar;
+static enum fec_isa fec_max_isa = FEC_ISA_AVX2;
+static enum fec_isa fec_isa_used = FEC_ISA_SCALAR;
+
+static void
+select_addmul (void) {
+    _addmul1 = _addmul1_scalar;
+    fec_isa_used = FEC_ISA_SCALAR;
+#ifdef FEC_X86
+    __builtin_cpu_init();
+    if (fec_max_isa >= FEC_ISA_AVX2 && __builtin_cpu_supports("avx2")) {
+        _addmul1 = _addmul1_avx2;
+        fec_isa_used = FEC_ISA_AVX2;
+    } else if (fec_max_isa >= FEC_ISA_SSSE3 && __builtin_cpu_supports("ssse3")) {
+        _addmul1 = _addmul1_ssse3;
+        fec_isa_used = FEC_ISA_SSSE3;
+    }
+#endif
+}
+
 /*
  * computes C = AB where A is n*k, B is k*m, C is n*m
  */
@@ -400,9 +494,20 @@ static void
 init_fec (void) {
     generate_gf();
     _init_mul_table();
+    select_addmul();
     fec_initialized = 1;
 }
 
+enum fec_isa
+fec_set_max_isa (enum fec_isa isa) {
+    fec_max_isa = isa;
+    if (fec_initialized == 0)
+        init_fec ();
+    else
+        select_addmul ();
+    return fec_isa_used;
+}
+
 /*
  * This section contains the proper FEC encoding/decoding routines.
  * The encoding matrix is computed starting with a Vandermonde matrix,
@@ -463,8 +568,8 @@ fec_new(unsigned short k, unsigned short n) {
     return retval;
 }
 
-/* To make sure that we stay within cache in the inner loops of fec_encode().  (It would
-   probably help to also do this for fec_decode(). */
+/* To make sure that we stay within cache in the inner loops of fec_encode() and
+   fec_decode(). */
 #ifndef STRIDE
 #define STRIDE 8192
 #endif
@@ -515,15 +620,20 @@ fec_decode(const fec_t* code, const gf*restrict const*restrict const inpkts, gf*
     unsigned char outix=0;
     unsigned char row=0;
     unsigned char col=0;
+    size_t k;
     build_decode_matrix_into_space(code, index, code->k, m_dec);
 
-    for (row=0; row<code->k; row++) {
-        assert ((index[row] >= code->k) || (index[row] == row)); /* If the block whose number is i is present, then it is required to be in the i'th element. */
-        if (index[row] >= code->k) {
-            memset(outpkts[outix], 0, sz);
-            for (col=0; col < code->k; col++)
-                addmul(outpkts[outix], inpkts[col], m_dec[row * code->k + col], sz);
-            outix++;
+    for (k = 0; k < sz; k += STRIDE) {
+        size_t stride = ((sz-k) < STRIDE)?(sz-k):STRIDE;
+        outix = 0;
+        for (row=0; row<code->k; row++) {
+            assert ((index[row] >= code->k) || (index[row] == row)); /* If the block whose number is i is present, then it is required to be in the i'th element. */
+            if (index[row] >= code->k) {
+                memset(outpkts[outix]+k, 0, stride);
+                for (col=0; col < code->k; col++)
+                    addmul(outpkts[outix]+k, inpkts[col]+k, m_dec[row * code->k + col], stride);
+                outix++;
+            }
         }
     }
 }
@@ -42,6 +42,20 @@ void fec_encode(const fec_t* code, const gf*restrict const*restrict const src, g
  */
 void fec_decode(const fec_t* code, const gf*restrict const*restrict const inpkts, gf*restrict const*restrict const outpkts, const unsigned*restrict const index, size_t sz);
 
+enum fec_isa {
+  FEC_ISA_SCALAR,
+  FEC_ISA_SSSE3,
+  FEC_ISA_AVX2,
+};
+
+/**
+ * Limits instruction set used by the GF(256) multiply-accumulate kernels. By
+ * default, the best one supported by the CPU is used.
+ *
+ * @returns the instruction set that will be actually used
+ */
+enum fec_isa fec_set_max_isa(enum fec_isa isa);
+
 #if defined(_MSC_VER)
 #define alloca _alloca
 #else
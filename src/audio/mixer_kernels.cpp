@@ -0,0 +1,248 @@
+/**
+ * @file   audio/mixer_kernels.cpp
+ *
+ * Scalar, SSE2 and AVX2 implementations of audio mixer kernels.
+ */
+/*
+ * Copyright (c) 2019 CESNET z.s.p.o.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, is permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of CESNET nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESSED OR IMPLIED WARRANTIES, INCLUDING,
+ * BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#include "config_unix.h"
+#include "config_win32.h"
+#endif // HAVE_CONFIG_H
+
+#if defined __SSE2__
+#include <emmintrin.h>
+#endif
+#if defined __GNUC__ && defined __x86_64__
+#define MIXER_X86
+#include <immintrin.h>
+#define TARGET(isa) __attribute__((target(isa)))
+#endif
+
+#include "audio/mixer_kernels.h"
+
+#include <vector>
+
+static_assert(sizeof(mixer_mix_t) > sizeof(mixer_sample_t), "mixer_mix_t is not wider than mixer_sample_t");
+
+static void add_scalar(mixer_mix_t *mix, const mixer_sample_t *src, int count)
+{
+        for (int i = 0; i < count; ++i) {
+                mix[i] += src[i];
+        }
+}
+
+/**
+ * logarithmic_mix_algo::normalize() is odd and doesn't clamp below LOG_LUT_END
+ * so that table of positive values above the threshold gives the same
+ * results without computing logarithm for every sample.
+ */
+#define LOG_LUT_END (2 * std::numeric_limits<mixer_sample_t>::max())
+static const std::vector<mixer_sample_t> log_lut = [] {
+        std::vector<mixer_sample_t> lut(LOG_LUT_END - logarithmic_mix_algo::passthrough_max);
+        for (unsigned i = 0; i < lut.size(); ++i) {
+                lut[i] = logarithmic_mix_algo::normalize(logarithmic_mix_algo::passthrough_max + i);
+        }
+        return lut;
+}();
+
+template<typename mix_algo>
+static inline mixer_sample_t normalize(mixer_mix_t sample)
+{
+        return mix_algo::normalize(sample);
+}
+
+template<>
+inline mixer_sample_t normalize<logarithmic_mix_algo>(mixer_mix_t sample)
+{
+        if (sample >= logarithmic_mix_algo::passthrough_min && sample <= logarithmic_mix_algo::passthrough_max) {
+                return sample;
+        }
+        mixer_mix_t abs_val = sample < 0 ? -sample : sample;
+        if (abs_val < LOG_LUT_END) {
+                mixer_sample_t val = log_lut[abs_val - logarithmic_mix_algo::passthrough_max];
+                return sample < 0 ? -val : val;
+        }
+        return logarithmic_mix_algo::normalize(sample);
+}
+
+template<typename mix_algo>
+static void subtract_scalar(const mixer_mix_t *mix, mixer_sample_t *part, int count)
+{
+        for (int i = 0; i < count; ++i) {
+                part[i] = normalize<mix_algo>(mix[i] - part[i]);
+        }
+}
+
+#if defined __SSE2__
+static void add_sse2(mixer_mix_t *mix, const mixer_sample_t *src, int count)
+{
+        int i = 0;
+        for ( ; i + 8 <= count; i += 8) {
+                __m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+                __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16);
+                __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(s, s), 16);
+                _mm_storeu_si128((__m128i *)(mix + i), _mm_add_epi32(_mm_loadu_si128((__m128i *)(mix + i)), lo));
+                _mm_storeu_si128((__m128i *)(mix + i + 4), _mm_add_epi32(_mm_loadu_si128((__m128i *)(mix + i + 4)), hi));
+        }
+        add_scalar(mix + i, src + i, count - i);
+}
+
+template<typename mix_algo>
+static void subtract_sse2(const mixer_mix_t *mix, mixer_sample_t *part, int count)
+{
+        const __m128i min = _mm_set1_epi32(mix_algo::passthrough_min);
+        const __m128i max = _mm_set1_epi32(mix_algo::passthrough_max);
+        int i = 0;
+        for ( ; i + 8 <= count; i += 8) {
+                __m128i s = _mm_loadu_si128((const __m128i *)(part + i));
+                __m128i d0 = _mm_sub_epi32(_mm_loadu_si128((const __m128i *)(mix + i)),
+                                _mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16));
+                __m128i d1 = _mm_sub_epi32(_mm_loadu_si128((const __m128i *)(mix + i + 4)),
+                                _mm_srai_epi32(_mm_unpackhi_epi16(s, s), 16));
+                if (!mix_algo::saturates) {
+                        __m128i out = _mm_or_si128(_mm_or_si128(_mm_cmplt_epi32(d0, min), _mm_cmpgt_epi32(d0, max)),
+                                        _mm_or_si128(_mm_cmplt_epi32(d1, min), _mm_cmpgt_epi32(d1, max)));
+                        if (_mm_movemask_epi8(out) != 0) { // rare - normalize the whole vector in scalar code
+                                subtract_scalar<mix_algo>(mix + i, part + i, 8);
+                                continue;
+                        }
+                }
+                _mm_storeu_si128((__m128i *)(part + i), _mm_packs_epi32(d0, d1));
+        }
+        subtract_scalar<mix_algo>(mix + i, part + i, count - i);
+}
+#endif
+
+#ifdef MIXER_X86
+TARGET("avx2") static void add_avx2(mixer_mix_t *mix, const mixer_sample_t *src, int count)
+{
+        int i = 0;
+        for ( ; i + 16 <= count; i += 16) {
+                __m256i s = _mm256_loadu_si256((const __m256i *)(src + i));
+                __m256i lo = _mm256_cvtepi16_epi32(_mm256_castsi256_si128(s));
+                __m256i hi = _mm256_cvtepi16_epi32(_mm256_extracti128_si256(s, 1));
+                _mm256_storeu_si256((__m256i *)(mix + i), _mm256_add_epi32(_mm256_loadu_si256((__m256i *)(mix + i)), lo));
+                _mm256_storeu_si256((__m256i *)(mix + i + 8), _mm256_add_epi32(_mm256_loadu_si256((__m256i *)(mix + i + 8)), hi));
+        }
+        add_scalar(mix + i, src + i, count - i);
+}
+
+template<typename mix_algo>
+TARGET("avx2") static void subtract_avx2(const mixer_mix_t *mix, mixer_sample_t *part, int count)
+{
+        const __m256i min = _mm256_set1_epi32(mix_algo::passthrough_min);
+        const __m256i max = _mm256_set1_epi32(mix_algo::passthrough_max);
+        int i = 0;
+        for ( ; i + 16 <= count; i += 16) {
+                __m256i s = _mm256_loadu_si256((const __m256i *)(part + i));
+                __m256i d0 = _mm256_sub_epi32(_mm256_loadu_si256((const __m256i *)(mix + i)),
+                                _mm256_cvtepi16_epi32(_mm256_castsi256_si128(s)));
+                __m256i d1 = _mm256_sub_epi32(_mm256_loadu_si256((const __m256i *)(mix + i + 8)),
+                                _mm256_cvtepi16_epi32(_mm256_extracti128_si256(s, 1)));
+                if (!mix_algo::saturates) {
+                        __m256i out = _mm256_or_si256(_mm256_or_si256(_mm256_cmpgt_epi32(min, d0), _mm256_cmpgt_epi32(d0, max)),
+                                        _mm256_or_si256(_mm256_cmpgt_epi32(min, d1), _mm256_cmpgt_epi32(d1, max)));
+                        if (!_mm256_testz_si256(out, out)) { // rare - normalize the whole vector in scalar code
+                                subtract_scalar<mix_algo>(mix + i, part + i, 16);
+                                continue;
+                        }
+                }
+                // packs works within 128-bit lanes, restore the order afterwards
+                __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(d0, d1), 0xD8);
+                _mm256_storeu_si256((__m256i *)(part + i), packed);
+        }
+        subtract_scalar<mix_algo>(mix + i, part + i, count - i);
+}
+#endif
+
+static enum audio_mixer_isa select_isa(enum audio_mixer_isa max_isa)
+{
+#ifdef MIXER_X86
+        __builtin_cpu_init();
+        if (max_isa >= AUDIO_MIXER_AVX2 && __builtin_cpu_supports("avx2")) {
+                return AUDIO_MIXER_AVX2;
+        }
+#endif
+#if defined __SSE2__
+        if (max_isa >= AUDIO_MIXER_SSE2) {
+                return AUDIO_MIXER_SSE2;
+        }
+#endif
+        return AUDIO_MIXER_SCALAR;
+}
+
+static enum audio_mixer_isa mixer_isa = select_isa(AUDIO_MIXER_AVX2);
+
+enum audio_mixer_isa audio_mixer_set_max_isa(enum audio_mixer_isa max_isa)
+{
+        return mixer_isa = select_isa(max_isa);
+}
+
+void audio_mixer_add(mixer_mix_t *mix, const mixer_sample_t *src, int count)
+{
+        switch (mixer_isa) {
+#ifdef MIXER_X86
+        case AUDIO_MIXER_AVX2:
+                return add_avx2(mix, src, count);
+#endif
+#if defined __SSE2__
+        case AUDIO_MIXER_SSE2:
+                return add_sse2(mix, src, count);
+#endif
+        default:
+                return add_scalar(mix, src, count);
+        }
+}
+
+template<typename mix_algo>
+void audio_mixer_subtract(const mixer_mix_t *mix, mixer_sample_t *part, int count)
+{
+        switch (mixer_isa) {
+#ifdef MIXER_X86
+        case AUDIO_MIXER_AVX2:
+                return subtract_avx2<mix_algo>(mix, part, count);
+#endif
+#if defined __SSE2__
+        case AUDIO_MIXER_SSE2:
+                return subtract_sse2<mix_algo>(mix, part, count);
+#endif
+        default:
+                return subtract_scalar<mix_algo>(mix, part, count);
+        }
+}
+
+template void audio_mixer_subtract<linear_mix_algo>(const mixer_mix_t *, mixer_sample_t *, int);
+template void audio_mixer_subtract<logarithmic_mix_algo>(const mixer_mix_t *, mixer_sample_t *, int);
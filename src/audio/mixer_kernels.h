@@ -0,0 +1,126 @@
+/**
+ * @file   audio/mixer_kernels.h
+ *
+ * Sample kernels of the audio mixer (audio/playback/mixer.cpp) - accumulation
+ * of participant signals and computation of per-participant output
+ * (mix minus own signal) with normalization given by the mixing algorithm.
+ */
+/*
+ * Copyright (c) 2019 CESNET z.s.p.o.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, is permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of CESNET nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESSED OR IMPLIED WARRANTIES, INCLUDING,
+ * BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AUDIO_MIXER_KERNELS_H_
+#define AUDIO_MIXER_KERNELS_H_
+
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+typedef int16_t mixer_sample_t; ///< sample format of participant signals
+typedef int32_t mixer_mix_t;    ///< sample format of mixed signal, must be wider than mixer_sample_t
+
+enum audio_mixer_isa {
+        AUDIO_MIXER_SCALAR,
+        AUDIO_MIXER_SSE2,
+        AUDIO_MIXER_AVX2,
+};
+
+/**
+ * In this mixer, no normalization takes place. After mixing and substracting each
+ * participant signal, values are clamped (there is no point doing it prior that -
+ * non-normalized mixed value can be out-of-bounds while resulting value with
+ * substracted with substracted source may be ok.
+ */
+struct linear_mix_algo {
+        static constexpr bool saturates = true; ///< normalize() is just a saturation
+        static constexpr mixer_mix_t passthrough_min = std::numeric_limits<mixer_sample_t>::min();
+        static constexpr mixer_mix_t passthrough_max = std::numeric_limits<mixer_sample_t>::max();
+        static mixer_sample_t normalize(mixer_mix_t sample) {
+                if (sample < passthrough_min) {
+                        return passthrough_min;
+                }
+                if (sample > passthrough_max) {
+                        return passthrough_max;
+                }
+                return sample;
+        }
+};
+
+/**
+ * Logarithmic mixing according to:
+ * https://www.voegler.eu/pub/audio/digital-audio-mixing-and-normalization.html
+ * Copy (as the original link doesn't seem to be present any more) can be found here:
+ * http://www.voidcn.com/blog/caohongfei881/article/p-3815311.html
+ * Threshold is 0.5.
+ */
+struct logarithmic_mix_algo {
+        static constexpr bool saturates = false;
+        static constexpr double t = 0.5;
+        static constexpr double alpha = 5.71144;
+        static constexpr mixer_mix_t passthrough_min = std::numeric_limits<mixer_sample_t>::min() / 2;
+        static constexpr mixer_mix_t passthrough_max = std::numeric_limits<mixer_sample_t>::max() / 2;
+        static mixer_sample_t normalize(mixer_mix_t sample) {
+                if (sample >= passthrough_min && sample <= passthrough_max) {
+                        return sample;
+                }
+                double sample_norm = (double) sample / std::numeric_limits<mixer_sample_t>::max();
+                double ret = sample_norm / fabs(sample_norm) * (t + (1.0 - t) * log(1.0 + alpha * (fabs(sample_norm) - t) / (2 - t)) / log(1.0 + alpha)) * std::numeric_limits<mixer_sample_t>::max();
+                return linear_mix_algo::normalize(ret);
+        }
+};
+
+/**
+ * Adds participant signal to the mix.
+ */
+void audio_mixer_add(mixer_mix_t *mix, const mixer_sample_t *src, int count);
+
+/**
+ * Replaces participant signal in-place with the mix without that participant
+ * normalized with mix_algo.
+ *
+ * @tparam mix_algo linear_mix_algo or logarithmic_mix_algo
+ */
+template<typename mix_algo>
+void audio_mixer_subtract(const mixer_mix_t *mix, mixer_sample_t *part, int count);
+
+extern template void audio_mixer_subtract<linear_mix_algo>(const mixer_mix_t *, mixer_sample_t *, int);
+extern template void audio_mixer_subtract<logarithmic_mix_algo>(const mixer_mix_t *, mixer_sample_t *, int);
+
+/**
+ * Limits instruction set used by the kernels (the best one supported by the
+ * CPU is used by default).
+ *
+ * @return the instruction set that will be actually used
+ */
+enum audio_mixer_isa audio_mixer_set_max_isa(enum audio_mixer_isa max_isa);
+
+#endif // AUDIO_MIXER_KERNELS_H_
@@ -46,12 +46,15 @@
 #include "audio/audio_capture.h"
 #include "audio/audio_playback.h"
 #include "audio/codec.h"
+#include "audio/mixer_kernels.h"
+#include "audio/utils.h"
 #include "debug.h"
 #include "lib_common.h"
 #include "module.h"
 #include "rtp/rtp.h"
 #include "transmit.h"
 #include "utils/audio_buffer.h"
+#include "utils/worker.h"
 #include <chrono>
 #include <condition_variable>
 #include <iostream>
@@ -62,16 +65,14 @@
 
 #define SAMPLE_RATE 48000
 #define BPS     2 /// @todo 4?
-#define CHANNELS 1
+#define DEFAULT_CHANNELS 1
 #define FRAMES_PER_SEC 25
 static_assert(SAMPLE_RATE % FRAMES_PER_SEC == 0, "Sample rate not divisible by frames per sec!");
 #define SAMPLES_PER_FRAME (SAMPLE_RATE / FRAMES_PER_SEC)
 
 #define PARTICIPANT_TIMEOUT_S 60
-typedef int16_t sample_type_source;
-typedef int32_t sample_type_mixed;
-static_assert(sizeof(sample_type_source) == BPS, "sample_type source doesn't match BPS");
-static_assert(sizeof(sample_type_mixed) > sizeof(sample_type_source), "sample_type_mixed is not wider than sample_type_source");
+#define STATS_INTERVAL_S 10
+static_assert(sizeof(mixer_sample_t) == BPS, "mixer_sample_t doesn't match BPS");
 
 using namespace std;
 using namespace std::chrono;
@@ -122,14 +123,19 @@ static void mixer_dummy_rtp_callback(struct rtp *session [[gnu::unused]], rtp_ev
 }
 
 struct am_participant {
-        am_participant(struct socket_udp_local *l, struct sockaddr_storage *ss, string const & audio_codec) {
+        am_participant(struct socket_udp_local *l, struct sockaddr_storage *ss, string const & audio_codec, int channels) {
                 assert(l != nullptr && ss != nullptr);
-                m_buffer = audio_buffer_init(SAMPLE_RATE, BPS, CHANNELS, get_commandline_param("low-latency-audio") ? 50 : 5);
+                m_buffer = audio_buffer_init(SAMPLE_RATE, BPS, channels, get_commandline_param("low-latency-audio") ? 50 : 5);
                 assert(m_buffer != NULL);
                 struct sockaddr *sa = (struct sockaddr *) ss;
                 assert(ss->ss_family == AF_INET || ss->ss_family == AF_INET6);
                 socklen_t len = ss->ss_family == AF_INET ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6);
 
+                char host[NI_MAXHOST], serv[NI_MAXSERV];
+                if (getnameinfo(sa, len, host, sizeof host, serv, sizeof serv, NI_NUMERICHOST | NI_NUMERICSERV) == 0) {
+                        audio_buffer_set_name(m_buffer, (string("participant ") + host + ":" + serv).c_str());
+                }
+
                 m_network_device = rtp_init_with_udp_socket(l, sa, len, mixer_dummy_rtp_callback);
                 assert(m_network_device != NULL);
                 m_tx_session = tx_init(NULL, 1500, TX_MEDIA_AUDIO, NULL, NULL, RATE_UNLIMITED);
@@ -140,6 +146,8 @@ struct am_participant {
                         LOG(LOG_LEVEL_ERROR) << "Audio coder init failed!\n";
                         throw 1;
                 }
+                m_frame.init(channels, AC_PCM, BPS, SAMPLE_RATE);
+                m_channel_data.resize(channels);
         }
         ~am_participant() {
                 if (m_tx_session) {
@@ -161,6 +169,9 @@ struct am_participant {
 		m_network_device = move(other.m_network_device);
 		m_tx_session = move(other.m_tx_session);
 		last_seen = move(other.last_seen);
+		m_samples = move(other.m_samples);
+		m_frame = move(other.m_frame);
+		m_channel_data = move(other.m_channel_data);
 		other.m_audio_coder = nullptr;
 		other.m_buffer = nullptr;
 		other.m_tx_session = nullptr;
@@ -175,59 +186,9 @@ struct am_participant {
         struct rtp *m_network_device;
         struct tx *m_tx_session;
         chrono::steady_clock::time_point last_seen;
-};
-
-template<typename source_t, typename intermediate_t>
-class generic_mix_algo {
-public:
-        virtual intermediate_t add_to_mix(intermediate_t dst, source_t sample) {
-                return dst + sample;
-        }
-
-        virtual intermediate_t get_mixed_without_source_sample(intermediate_t mix, source_t source_sample) {
-                return mix - source_sample;
-        }
-
-        virtual intermediate_t normalize(intermediate_t sample) = 0;
-};
-
-/**
- * In this mixer, no normalization takes place. After mixing and substracting each
- * participant signal, values are clamped (there is no point doing it prior that -
- * non-normalized mixed value can be out-of-bounds while resulting value with
- * substracted with substracted source may be ok.
- */
-template<typename source_t, typename intermediate_t>
-class linear_mix_algo : public generic_mix_algo<source_t, intermediate_t> {
-public:
-        intermediate_t normalize(intermediate_t sample) override {
-                // clamp the value since linear mixer doesn't normalize values
-                return min<intermediate_t>(max<intermediate_t>(sample, numeric_limits<source_t>::min()), numeric_limits<source_t>::max());
-        }
-};
-
-/**
- * Logarithmic mixing according to:
- * https://www.voegler.eu/pub/audio/digital-audio-mixing-and-normalization.html
- * Copy (as the original link doesn't seem to be present any more) can be found here:
- * http://www.voidcn.com/blog/caohongfei881/article/p-3815311.html
- * Threshold is 0.5.
- */
-template<typename source_t, typename intermediate_t>
-class logarithmic_mix_algo : public generic_mix_algo<source_t, intermediate_t> {
-public:
-        static constexpr double t = 0.5;
-        static constexpr double alpha = 5.71144;
-        intermediate_t normalize(intermediate_t sample) override {
-		if (sample >= numeric_limits<source_t>::min() / 2 &&
-				sample <= numeric_limits<source_t>::max() / 2) {
-			return sample;
-		} else {
-                        double sample_norm = (double) sample / numeric_limits<source_t>::max();
-                        double ret = sample_norm / fabs(sample_norm) * (t + (1.0 - t) * log(1.0 + alpha * (fabs(sample_norm) - t) / (2 - t)) / log(1.0 + alpha)) * numeric_limits<source_t>::max();
-                        return ret;
-                }
-        }
+        vector<mixer_sample_t> m_samples; ///< interleaved, contains participant's output after mixing
+        audio_frame2 m_frame;             ///< output frame passed to the coder
+        vector<char *> m_channel_data;    ///< channel pointers of m_frame, deinterleaving destination
 };
 
 struct state_audio_mixer final {
@@ -240,12 +201,18 @@ struct state_audio_mixer final {
                         while ((item = strtok_r(copy, ":", &save_ptr))) {
                                 if (strncmp(item, "codec=", strlen("codec=")) == 0) {
                                         audio_codec = item + strlen("codec=");
+                                } else if (strncmp(item, "channels=", strlen("channels=")) == 0) {
+                                        channels = atoi(item + strlen("channels="));
+                                        if (channels <= 0) {
+                                                LOG(LOG_LEVEL_ERROR) << "Wrong channel count: " << item + strlen("channels=") << "\n";
+                                                throw 1;
+                                        }
                                 } else if (strncmp(item, "algo=", strlen("algo=")) == 0) {
                                         string algo = item + strlen("algo=");
                                         if (algo == "linear") {
-                                                mixing_algorithm = decltype(mixing_algorithm)(new linear_mix_algo<sample_type_source, sample_type_mixed>());
+                                                worker_fn = &state_audio_mixer::worker<linear_mix_algo>;
                                         } else if (algo == "logarithmic") {
-                                                mixing_algorithm = decltype(mixing_algorithm)(new logarithmic_mix_algo<sample_type_source, sample_type_mixed>());
+                                                worker_fn = &state_audio_mixer::worker<logarithmic_mix_algo>;
                                         } else {
                                                 LOG(LOG_LEVEL_ERROR) << "Unknown mixing algorithm: " << algo << "\n";
                                                 throw 1;
@@ -267,13 +234,14 @@ struct state_audio_mixer final {
                         audio_codec_done(audio_coder);
                 }
 
-                thread_id = thread(&state_audio_mixer::worker, this);
+                thread_id = thread(worker_fn, this);
         }
         ~state_audio_mixer() {
                 thread_id.join();
         }
         state_audio_mixer(state_audio_mixer const&)            = delete;
         state_audio_mixer& operator=(state_audio_mixer const&) = delete;
+        template<typename mix_algo>
         void worker();
 
         map<sockaddr_storage, am_participant, sockaddr_storage_less> participants;
@@ -281,11 +249,21 @@ struct state_audio_mixer final {
 
         struct socket_udp_local *recv_socket{};
         string audio_codec{"PCM"};
+        int channels = DEFAULT_CHANNELS;
 private:
         thread thread_id;
-        unique_ptr<generic_mix_algo<sample_type_source, sample_type_mixed>> mixing_algorithm{new linear_mix_algo<sample_type_source, sample_type_mixed>()};
+        void (state_audio_mixer::*worker_fn)() = &state_audio_mixer::worker<linear_mix_algo>;
+
+        // buffers reused among ticks (accessed only by worker)
+        vector<mixer_mix_t> mixed;
+        vector<am_participant *> active;
 };
 
+/**
+ * Mixing algorithm is a template parameter so that the whole tick processing
+ * is compiled for the algorithm selected at init.
+ */
+template<typename mix_algo>
 void state_audio_mixer::worker()
 {
         chrono::steady_clock::time_point next_frame_time = chrono::steady_clock::now();
@@ -293,6 +271,14 @@ void state_audio_mixer::worker()
         static_assert(SAMPLES_PER_FRAME * 1000ll % SAMPLE_RATE == 0, "Sample rate is not evenly divisible by number of samples in frame");
         const chrono::milliseconds interval(SAMPLES_PER_FRAME*1000ll/SAMPLE_RATE);
 
+        const int sample_count = SAMPLES_PER_FRAME * channels;
+        const size_t data_len = sample_count * sizeof(mixer_sample_t);
+        mixed.resize(sample_count);
+
+        chrono::steady_clock::time_point stats_start = next_frame_time;
+        chrono::steady_clock::duration stats_busy{};
+        int stats_ticks = 0;
+
         while (!should_exit) {
                 this_thread::sleep_until(next_frame_time);
                 next_frame_time += interval;
@@ -315,56 +301,51 @@ void state_audio_mixer::worker()
                         }
                 }
 
-                size_t data_len_source = SAMPLES_PER_FRAME * sizeof(sample_type_source) * CHANNELS;
-                vector<sample_type_mixed> mixed(SAMPLES_PER_FRAME * CHANNELS);
-                vector<audio_frame2> participant_frames(participants.size());
-                int participant_index = 0;
-
                 // mix all together
+                fill(mixed.begin(), mixed.end(), 0);
+                active.clear();
                 for (auto & p : participants) {
-                        participant_frames[participant_index].init(CHANNELS, AC_PCM, BPS, SAMPLE_RATE);
-                        static_assert(CHANNELS == 1, "Currently only one channel is implemented here.");
-                        participant_frames[participant_index].resize(0, data_len_source);
-                        char *particip_data = (char *) participant_frames[participant_index].get_data(0);
-                        int ret = audio_buffer_read(p.second.m_buffer, particip_data, data_len_source);
-                        memset(particip_data, 0, data_len_source - ret);
-
-                        sample_type_source *src = (sample_type_source *) particip_data;
-                        auto dst = mixed.begin();
-                        for (int i = 0; i < SAMPLES_PER_FRAME * CHANNELS; ++i) {
-                                *dst = mixing_algorithm->add_to_mix(*dst, *src);
-                                ++dst;
-                                ++src;
-                        }
-                        participant_index++;
+                        am_participant *part = &p.second;
+                        part->m_samples.resize(sample_count);
+                        char *particip_data = (char *) part->m_samples.data();
+                        int ret = audio_buffer_read(part->m_buffer, particip_data, data_len);
+                        memset(particip_data + ret, 0, data_len - ret);
+                        audio_mixer_add(mixed.data(), part->m_samples.data(), sample_count);
+                        active.push_back(part);
                 }
+                // participants are removed only by this thread so the pointers remain valid
+                plk.unlock();
 
-                // substract each source signal from the mix coming to that participant
-                for (auto & pb : participant_frames) {
-                        auto mix = mixed.begin();
-                        sample_type_source *part = (sample_type_source *) pb.get_data(0);
-                        for (int i = 0; i < SAMPLES_PER_FRAME * CHANNELS; ++i) {
-                                *part = mixing_algorithm->normalize(mixing_algorithm->get_mixed_without_source_sample(*mix, *part));
-                                ++mix;
-                                ++part;
+                // substract each source signal from the mix coming to that participant, encode and send
+                parallel_for(0, active.size(), [this, sample_count, data_len](int start, int end) {
+                        for (int i = start; i < end; ++i) {
+                                am_participant *part = active[i];
+                                audio_mixer_subtract<mix_algo>(mixed.data(), part->m_samples.data(), sample_count);
+                                for (int ch = 0; ch < channels; ++ch) {
+                                        part->m_frame.resize(ch, SAMPLES_PER_FRAME * BPS);
+                                        part->m_channel_data[ch] = const_cast<char *>(part->m_frame.get_data(ch));
+                                }
+                                deinterleave_channels(part->m_channel_data.data(), (const char *) part->m_samples.data(),
+                                                BPS, data_len, channels);
+
+                                const audio_frame2 *uncompressed = &part->m_frame;
+                                const audio_frame2 *compressed = NULL;
+                                while((compressed = audio_codec_compress(part->m_audio_coder, uncompressed))) {
+                                        audio_tx_send(part->m_tx_session, part->m_network_device, compressed);
+                                        uncompressed = NULL;
+                                }
                         }
+                });
+
+                stats_busy += chrono::steady_clock::now() - now;
+                stats_ticks += 1;
+                if (now - stats_start > seconds(STATS_INTERVAL_S)) {
+                        LOG(LOG_LEVEL_VERBOSE) << "[Audio mixer] " << active.size() << " participants, mix+send time per tick: " <<
+                                duration_cast<duration<double, milli>>(stats_busy).count() / stats_ticks << " ms\n";
+                        stats_start = now;
+                        stats_busy = {};
+                        stats_ticks = 0;
                 }
-
-                // send
-                participant_index = 0;
-                for (auto & p : participants) {
-
-			audio_frame2 *uncompressed = &participant_frames[participant_index];
-			const audio_frame2 *compressed = NULL;
-			while((compressed = audio_codec_compress(p.second.m_audio_coder, uncompressed))) {
-				audio_tx_send(p.second.m_tx_session, p.second.m_network_device, compressed);
-				uncompressed = NULL;
-			}
-
-
-                        participant_index++;
-                }
-                plk.unlock();
         }
 }
 
@@ -375,10 +356,12 @@ static void audio_play_mixer_help(const char *driver_name [[gnu::unused]])
 static void usage()
 {
         printf("Usage:\n"
-               "\t%s -r mixer[:codec=<codec>][:algo={linear|logarithmic}]\n"
+               "\t%s -r mixer[:codec=<codec>][:channels=<n>][:algo={linear|logarithmic}]\n"
                "\n"
                "<codec>\n"
                "\taudio codec to use\n"
+               "<n>\n"
+               "\tnumber of mixed channels (default %d)\n"
                "linear\n"
                "\tlinear sum of signals (with clamping)\n"
                "logarithmic\n"
@@ -394,7 +377,7 @@ static void usage()
                "\ton machine that is a part of the conference, you should use something like:\n"
                "\t\t%s -s <your_capture> -P 5004:5004:5010:5006\n"
                "\tfor the " PACKAGE_NAME " instance that is part of the conference (not mixer!)\n",
-               uv_argv[0], uv_argv[0]);
+               uv_argv[0], DEFAULT_CHANNELS, uv_argv[0]);
 }
 
 static void audio_play_mixer_probe(struct device_info **available_devices, int *count)
@@ -425,7 +408,7 @@ static void audio_play_mixer_put_frame(void *state, struct audio_frame *frame [[
         auto ss = *(struct sockaddr_storage *) frame->network_source;
 
         if (s->participants.find(ss) == s->participants.end()) {
-                s->participants.emplace(ss, am_participant{s->recv_socket, &ss, s->audio_codec});
+                s->participants.emplace(ss, am_participant{s->recv_socket, &ss, s->audio_codec, s->channels});
         }
 
         audio_buffer_write(s->participants.at(ss).m_buffer, frame->data, frame->data_len);
@@ -446,7 +429,7 @@ static bool audio_play_mixer_ctl(void *state, int request, void *data, size_t *l
         switch (request) {
         case AUDIO_PLAYBACK_CTL_QUERY_FORMAT:
                 if (*len >= sizeof(struct audio_desc)) {
-                        struct audio_desc desc { BPS, SAMPLE_RATE, CHANNELS, AC_PCM };
+                        struct audio_desc desc { BPS, SAMPLE_RATE, s->channels, AC_PCM };
                         memcpy(data, &desc, sizeof desc);
                         *len = sizeof desc;
                         return true;
@@ -474,9 +457,10 @@ static bool audio_play_mixer_ctl(void *state, int request, void *data, size_t *l
         }
 }
 
-static int audio_play_mixer_reconfigure(void *state [[gnu::unused]], struct audio_desc desc)
+static int audio_play_mixer_reconfigure(void *state, struct audio_desc desc)
 {
-        audio_desc requested{BPS, SAMPLE_RATE, CHANNELS, AC_PCM};
+        struct state_audio_mixer *s = (struct state_audio_mixer *) state;
+        audio_desc requested{BPS, SAMPLE_RATE, s->channels, AC_PCM};
         assert(desc == requested);
         return TRUE;
 }
@@ -100,11 +100,12 @@ audio_frame2::audio_frame2(const struct audio_frame *old) :
                 codec(old ? AC_PCM : AC_NONE), duration(0.0)
 {
         if (old) {
+                vector<char *> data(old->ch_count);
                 for (int i = 0; i < old->ch_count; i++) {
                         resize(i, old->data_len / old->ch_count);
-                        char *data = channels[i].data.get();
-                        demux_channel(data, old->data, old->bps, old->data_len, old->ch_count, i);
+                        data[i] = channels[i].data.get();
                 }
+                deinterleave_channels(data.data(), old->data, old->bps, old->data_len, old->ch_count);
         }
 }
 
@@ -46,11 +46,22 @@
 #include "audio/codec.h"
 #include "audio/utils.h" 
 #include "debug.h"
+#include <algorithm>
 #include <assert.h>
 #include <limits.h>
 #include <math.h>
 #include <stdio.h>
 #include <string.h>
+#include <vector>
+
+#if defined __SSE2__
+#include <emmintrin.h>
+#endif
+#if defined __GNUC__ && defined __x86_64__
+#define AUDIO_UTILS_X86
+#include <immintrin.h>
+#define TARGET(isa) __attribute__((target(isa)))
+#endif
 
 
 #ifdef WORDS_BIGENDIAN
@@ -137,27 +148,493 @@ struct audio_desc audio_desc_from_audio_channel(audio_channel *channel) {
         };
 }
 
-void change_bps(char *out, int out_bps, const char *in, int in_bps, int in_len /* bytes */)
+/*
+ * Sample kernels - public functions below dispatch to variants specialised for
+ * sample size (and channel count where the layout depends on it), byte-shuffle
+ * friendly layouts have also SIMD variants. All variants give identical output.
+ */
+
+/// loads little-endian sample sign-extended to 32 bits
+template<int bps> static inline int32_t load_sample(const char *in);
+template<> inline int32_t load_sample<1>(const char *in) {
+        return (int8_t) *in;
+}
+template<> inline int32_t load_sample<2>(const char *in) {
+        int16_t val;
+        memcpy(&val, in, sizeof val);
+        return val;
+}
+template<> inline int32_t load_sample<3>(const char *in) {
+        uint32_t val = (uint8_t) in[0] | (uint8_t) in[1] << 8 | (uint32_t) (uint8_t) in[2] << 16;
+        return (int32_t) (val << 8) >> 8;
+}
+template<> inline int32_t load_sample<4>(const char *in) {
+        int32_t val;
+        memcpy(&val, in, sizeof val);
+        return val;
+}
+
+/// stores bps lowest bytes of the value (no clamping)
+template<int bps> static inline void store_sample(char *out, int32_t val) {
+        memcpy(out, &val, bps);
+}
+
+template<int bps> static inline void copy_sample(char *out, const char *in) {
+        memcpy(out, in, bps);
+}
+
+template<int bps> struct sample_limits {
+        static constexpr int32_t max = (int32_t) ((1ll << (bps * 8 - 1)) - 1);
+        static constexpr int32_t min = (int32_t) -(1ll << (bps * 8 - 1));
+};
+
+/// clamps value to the range of bps sample, equivalent to truncation to int32_t followed by clamping
+template<int bps, typename T> static inline int32_t clamp_sample(T val) {
+        return val > sample_limits<bps>::max ? sample_limits<bps>::max :
+                val < sample_limits<bps>::min ? sample_limits<bps>::min : (int32_t) val;
+}
+
+/// keeps most significant bytes of the sample when narrowing, zero-fills low bytes when widening
+template<int in_bps, int out_bps, bool narrowing = (in_bps > out_bps)> struct bps_shift;
+template<int in_bps, int out_bps> struct bps_shift<in_bps, out_bps, true> {
+        static int32_t apply(int32_t val) { return val >> (8 * (in_bps - out_bps)); }
+};
+template<int in_bps, int out_bps> struct bps_shift<in_bps, out_bps, false> {
+        static int32_t apply(int32_t val) { return (int32_t) ((uint32_t) val << (8 * (out_bps - in_bps))); }
+};
+
+template<int in_bps, int out_bps>
+static void change_bps_scalar(char *out, const char *in, int samples)
 {
-        int i;
+        for (int i = 0; i < samples; ++i) {
+                store_sample<out_bps>(out, bps_shift<in_bps, out_bps>::apply(load_sample<in_bps>(in)));
+                in += in_bps;
+                out += out_bps;
+        }
+}
 
-        assert ((unsigned int) out_bps <= sizeof(int32_t));
+typedef void (*change_bps_func_t)(char *out, const char *in, int samples);
+#define CHANGE_BPS_ROW(in_bps) { nullptr, change_bps_scalar<in_bps, 1>, change_bps_scalar<in_bps, 2>, \
+        change_bps_scalar<in_bps, 3>, change_bps_scalar<in_bps, 4> }
+static const change_bps_func_t change_bps_scalar_funcs[5][5] = { { nullptr },
+        CHANGE_BPS_ROW(1), CHANGE_BPS_ROW(2), CHANGE_BPS_ROW(3), CHANGE_BPS_ROW(4) };
+#undef CHANGE_BPS_ROW
+
+template<int bps>
+static void copy_strided(char *out, int out_stride, const char *in, int in_stride, int samples)
+{
+        for (int i = 0; i < samples; ++i) {
+                copy_sample<bps>(out, in);
+                in += in_stride;
+                out += out_stride;
+        }
+}
+
+typedef void (*copy_strided_func_t)(char *out, int out_stride, const char *in, int in_stride, int samples);
+static const copy_strided_func_t copy_strided_funcs[5] = { nullptr, copy_strided<1>, copy_strided<2>,
+        copy_strided<3>, copy_strided<4> };
+
+/// out = clamp(in * scale [+ out]) computed in double precision
+template<int bps, bool mix>
+static void mux_scaled(char *out, int out_stride, const char *in, int samples, double scale)
+{
+        for (int i = 0; i < samples; ++i) {
+                double val = (double) load_sample<bps>(in) * scale;
+                if (mix) {
+                        val += load_sample<bps>(out);
+                }
+                store_sample<bps>(out, clamp_sample<bps>(val));
+                in += bps;
+                out += out_stride;
+        }
+}
+
+typedef void (*mux_scaled_func_t)(char *out, int out_stride, const char *in, int samples, double scale);
+static const mux_scaled_func_t mux_scaled_funcs[2][5] = {
+        { nullptr, mux_scaled<1, false>, mux_scaled<2, false>, mux_scaled<3, false>, mux_scaled<4, false> },
+        { nullptr, mux_scaled<1, true>, mux_scaled<2, true>, mux_scaled<3, true>, mux_scaled<4, true> },
+};
+
+/// saturating out += in, integer equivalent of mux_scaled<bps, true> with scale 1.0
+template<int bps>
+static void mix_unscaled(char *out, int out_stride, const char *in, int samples)
+{
+        for (int i = 0; i < samples; ++i) {
+                int64_t val = (int64_t) load_sample<bps>(in) + load_sample<bps>(out);
+                store_sample<bps>(out, clamp_sample<bps>(val));
+                in += bps;
+                out += out_stride;
+        }
+}
+
+typedef void (*mix_unscaled_func_t)(char *out, int out_stride, const char *in, int samples);
+static const mix_unscaled_func_t mix_unscaled_funcs[5] = { nullptr, mix_unscaled<1>, mix_unscaled<2>,
+        mix_unscaled<3>, mix_unscaled<4> };
+
+template<int bps>
+static double avg_volume(const char *data, int stride, int samples)
+{
+        if (samples == 0) {
+                return 0.0;
+        }
+        int64_t sum = 0; // exact - at most 2^31 * INT_MAX
+        for (int i = 0; i < samples; ++i) {
+                int32_t val = load_sample<bps>(data);
+                sum += val < 0 ? -(int64_t) val : val;
+                data += stride;
+        }
+        return (double) sum / samples / sample_limits<bps>::max;
+}
+
+typedef double (*avg_volume_func_t)(const char *data, int stride, int samples);
+static const avg_volume_func_t avg_volume_funcs[5] = { nullptr, avg_volume<1>, avg_volume<2>,
+        avg_volume<3>, avg_volume<4> };
+
+/// frames of unspecialised channel counts are transposed in blocks so that the
+/// interleaved block stays in cache while visiting all channel planes
+#define TRANSPOSE_BLOCK_FRAMES 64
+
+/**
+ * @tparam channels channel count, 0 if given at runtime by channel_count
+ * @param start     first frame to process (preceding ones were done by SIMD)
+ */
+template<int bps, int channels>
+static void deinterleave_scalar(char * const *out, const char *in, int start, int frames, int channel_count)
+{
+        const int ch_count = channels > 0 ? channels : channel_count;
+        if (channels > 0) {
+                in += start * ch_count * bps;
+                for (int f = start; f < frames; ++f) {
+                        for (int ch = 0; ch < ch_count; ++ch) {
+                                copy_sample<bps>(out[ch] + f * bps, in);
+                                in += bps;
+                        }
+                }
+                return;
+        }
+        for (int f0 = start; f0 < frames; f0 += TRANSPOSE_BLOCK_FRAMES) {
+                const int f1 = std::min(f0 + TRANSPOSE_BLOCK_FRAMES, frames);
+                for (int ch = 0; ch < ch_count; ++ch) {
+                        copy_strided<bps>(out[ch] + f0 * bps, bps, in + (f0 * ch_count + ch) * bps, ch_count * bps, f1 - f0);
+                }
+        }
+}
 
-        for(i = 0; i < in_len / in_bps; i++) {
-                int32_t in_value = format_from_in_bps(in, in_bps);
+template<int bps, int channels>
+static void interleave_scalar(char *out, const char * const *in, int start, int frames, int channel_count)
+{
+        const int ch_count = channels > 0 ? channels : channel_count;
+        if (channels > 0) {
+                out += start * ch_count * bps;
+                for (int f = start; f < frames; ++f) {
+                        for (int ch = 0; ch < ch_count; ++ch) {
+                                copy_sample<bps>(out, in[ch] + f * bps);
+                                out += bps;
+                        }
+                }
+                return;
+        }
+        for (int f0 = start; f0 < frames; f0 += TRANSPOSE_BLOCK_FRAMES) {
+                const int f1 = std::min(f0 + TRANSPOSE_BLOCK_FRAMES, frames);
+                for (int ch = 0; ch < ch_count; ++ch) {
+                        copy_strided<bps>(out + (f0 * ch_count + ch) * bps, ch_count * bps, in[ch] + f0 * bps, bps, f1 - f0);
+                }
+        }
+}
 
-                int32_t out_value;
+/// index to transpose function tables - specialised 2, 4 and 8 channels, 0 for others
+static int channels_index(int channel_count)
+{
+        return channel_count == 2 ? 1 : channel_count == 4 ? 2 : channel_count == 8 ? 3 : 0;
+}
+
+typedef void (*deinterleave_func_t)(char * const *out, const char *in, int start, int frames, int channel_count);
+typedef void (*interleave_func_t)(char *out, const char * const *in, int start, int frames, int channel_count);
+#define TRANSPOSE_ROW(func, bps) { func<bps, 0>, func<bps, 2>, func<bps, 4>, func<bps, 8> }
+static const deinterleave_func_t deinterleave_scalar_funcs[5][4] = { { nullptr },
+        TRANSPOSE_ROW(deinterleave_scalar, 1), TRANSPOSE_ROW(deinterleave_scalar, 2),
+        TRANSPOSE_ROW(deinterleave_scalar, 3), TRANSPOSE_ROW(deinterleave_scalar, 4) };
+static const interleave_func_t interleave_scalar_funcs[5][4] = { { nullptr },
+        TRANSPOSE_ROW(interleave_scalar, 1), TRANSPOSE_ROW(interleave_scalar, 2),
+        TRANSPOSE_ROW(interleave_scalar, 3), TRANSPOSE_ROW(interleave_scalar, 4) };
+#undef TRANSPOSE_ROW
+
+#if defined __SSE2__
+static inline __m128i load128(const char *p) {
+        return _mm_loadu_si128((const __m128i *)(const void *) p);
+}
+
+static inline void store128(char *p, __m128i val) {
+        _mm_storeu_si128((__m128i *)(void *) p, val);
+}
+
+static inline void transpose4x4_epi32(__m128i *r)
+{
+        __m128i t0 = _mm_unpacklo_epi32(r[0], r[1]);
+        __m128i t1 = _mm_unpacklo_epi32(r[2], r[3]);
+        __m128i t2 = _mm_unpackhi_epi32(r[0], r[1]);
+        __m128i t3 = _mm_unpackhi_epi32(r[2], r[3]);
+        r[0] = _mm_unpacklo_epi64(t0, t1);
+        r[1] = _mm_unpackhi_epi64(t0, t1);
+        r[2] = _mm_unpacklo_epi64(t2, t3);
+        r[3] = _mm_unpackhi_epi64(t2, t3);
+}
+
+static inline void transpose8x8_epi16(__m128i *r)
+{
+        __m128i a[8], b[8];
+        for (int i = 0; i < 4; ++i) {
+                a[2 * i] = _mm_unpacklo_epi16(r[2 * i], r[2 * i + 1]);
+                a[2 * i + 1] = _mm_unpackhi_epi16(r[2 * i], r[2 * i + 1]);
+        }
+        for (int i = 0; i < 2; ++i) {
+                b[4 * i] = _mm_unpacklo_epi32(a[4 * i], a[4 * i + 2]);
+                b[4 * i + 1] = _mm_unpackhi_epi32(a[4 * i], a[4 * i + 2]);
+                b[4 * i + 2] = _mm_unpacklo_epi32(a[4 * i + 1], a[4 * i + 3]);
+                b[4 * i + 3] = _mm_unpackhi_epi32(a[4 * i + 1], a[4 * i + 3]);
+        }
+        for (int i = 0; i < 4; ++i) {
+                r[2 * i] = _mm_unpacklo_epi64(b[i], b[i + 4]);
+                r[2 * i + 1] = _mm_unpackhi_epi64(b[i], b[i + 4]);
+        }
+}
+
+/// @returns number of processed frames
+static int deinterleave_sse2(char * const *out, const char *in, int bps, int frames, int channel_count)
+{
+        int f = 0;
+        if (bps == 2 && channel_count == 2) {
+                for ( ; f + 8 <= frames; f += 8) {
+                        __m128i a = load128(in + f * 4);
+                        __m128i b = load128(in + f * 4 + 16);
+                        // samples are sign-extended so the saturating pack is exact
+                        store128(out[0] + f * 2, _mm_packs_epi32(_mm_srai_epi32(_mm_slli_epi32(a, 16), 16),
+                                                _mm_srai_epi32(_mm_slli_epi32(b, 16), 16)));
+                        store128(out[1] + f * 2, _mm_packs_epi32(_mm_srai_epi32(a, 16), _mm_srai_epi32(b, 16)));
+                }
+        } else if (bps == 4 && channel_count == 2) {
+                for ( ; f + 4 <= frames; f += 4) {
+                        __m128 a = _mm_castsi128_ps(load128(in + f * 8));
+                        __m128 b = _mm_castsi128_ps(load128(in + f * 8 + 16));
+                        store128(out[0] + f * 4, _mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0))));
+                        store128(out[1] + f * 4, _mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1))));
+                }
+        } else if (bps == 4 && channel_count % 4 == 0) {
+                for ( ; f + 4 <= frames; f += 4) {
+                        for (int ch = 0; ch < channel_count; ch += 4) {
+                                __m128i r[4];
+                                for (int i = 0; i < 4; ++i) {
+                                        r[i] = load128(in + ((f + i) * channel_count + ch) * 4);
+                                }
+                                transpose4x4_epi32(r);
+                                for (int i = 0; i < 4; ++i) {
+                                        store128(out[ch + i] + f * 4, r[i]);
+                                }
+                        }
+                }
+        } else if (bps == 2 && channel_count % 8 == 0) {
+                for ( ; f + 8 <= frames; f += 8) {
+                        for (int ch = 0; ch < channel_count; ch += 8) {
+                                __m128i r[8];
+                                for (int i = 0; i < 8; ++i) {
+                                        r[i] = load128(in + ((f + i) * channel_count + ch) * 2);
+                                }
+                                transpose8x8_epi16(r);
+                                for (int i = 0; i < 8; ++i) {
+                                        store128(out[ch + i] + f * 2, r[i]);
+                                }
+                        }
+                }
+        }
+        return f;
+}
 
-                if(in_bps > out_bps) {
-                        out_value = in_value >> (in_bps * 8 - out_bps * 8);
+/// @returns number of processed frames
+static int interleave_sse2(char *out, const char * const *in, int bps, int frames, int channel_count)
+{
+        int f = 0;
+        if (bps == 2 && channel_count == 2) {
+                for ( ; f + 8 <= frames; f += 8) {
+                        __m128i l = load128(in[0] + f * 2);
+                        __m128i r = load128(in[1] + f * 2);
+                        store128(out + f * 4, _mm_unpacklo_epi16(l, r));
+                        store128(out + f * 4 + 16, _mm_unpackhi_epi16(l, r));
+                }
+        } else if (bps == 4 && channel_count == 2) {
+                for ( ; f + 4 <= frames; f += 4) {
+                        __m128i l = load128(in[0] + f * 4);
+                        __m128i r = load128(in[1] + f * 4);
+                        store128(out + f * 8, _mm_unpacklo_epi32(l, r));
+                        store128(out + f * 8 + 16, _mm_unpackhi_epi32(l, r));
+                }
+        } else if (bps == 4 && channel_count % 4 == 0) {
+                for ( ; f + 4 <= frames; f += 4) {
+                        for (int ch = 0; ch < channel_count; ch += 4) {
+                                __m128i r[4];
+                                for (int i = 0; i < 4; ++i) {
+                                        r[i] = load128(in[ch + i] + f * 4);
+                                }
+                                transpose4x4_epi32(r);
+                                for (int i = 0; i < 4; ++i) {
+                                        store128(out + ((f + i) * channel_count + ch) * 4, r[i]);
+                                }
+                        }
+                }
+        } else if (bps == 2 && channel_count % 8 == 0) {
+                for ( ; f + 8 <= frames; f += 8) {
+                        for (int ch = 0; ch < channel_count; ch += 8) {
+                                __m128i r[8];
+                                for (int i = 0; i < 8; ++i) {
+                                        r[i] = load128(in[ch + i] + f * 2);
+                                }
+                                transpose8x8_epi16(r);
+                                for (int i = 0; i < 8; ++i) {
+                                        store128(out + ((f + i) * channel_count + ch) * 2, r[i]);
+                                }
+                        }
+                }
+        }
+        return f;
+}
+#endif // defined __SSE2__
+
+#ifdef AUDIO_UTILS_X86
+/**
+ * Fills pshufb mask converting 16 / max(in_bps, out_bps) samples.
+ * @returns number of samples converted by one shuffle
+ */
+static int change_bps_mask(int8_t *mask, int in_bps, int out_bps)
+{
+        int samples = 16 / std::max(in_bps, out_bps);
+        memset(mask, -128, 16); // zero
+        for (int s = 0; s < samples; ++s) {
+                for (int b = 0; b < out_bps; ++b) {
+                        int src = b + in_bps - out_bps;
+                        if (src >= 0) {
+                                mask[s * out_bps + b] = s * in_bps + src;
+                        }
+                }
+        }
+        return samples;
+}
+
+TARGET("ssse3") static void change_bps_ssse3(char *out, int out_bps, const char *in, int in_bps, int samples)
+{
+        alignas(16) int8_t mask_data[16];
+        const int block = change_bps_mask(mask_data, in_bps, out_bps);
+        const __m128i mask = _mm_load_si128((const __m128i *)(const void *) mask_data);
+        // both 16 B load and store must stay within buffers
+        const int min_bps = std::min(in_bps, out_bps);
+        const int min_samples = (16 + min_bps - 1) / min_bps;
+        int i = 0;
+        for ( ; samples - i >= min_samples; i += block) {
+                __m128i val = _mm_loadu_si128((const __m128i *)(const void *)(in + i * in_bps));
+                _mm_storeu_si128((__m128i *)(void *)(out + i * out_bps), _mm_shuffle_epi8(val, mask));
+        }
+        change_bps_scalar_funcs[in_bps][out_bps](out + i * out_bps, in + i * in_bps, samples - i);
+}
+
+TARGET("avx2") static void change_bps_avx2(char *out, int out_bps, const char *in, int in_bps, int samples)
+{
+        alignas(16) int8_t mask_data[16];
+        const int block = change_bps_mask(mask_data, in_bps, out_bps);
+        const __m256i mask = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i *)(const void *) mask_data));
+        const int min_bps = std::min(in_bps, out_bps);
+        const int min_samples = block + (16 + min_bps - 1) / min_bps;
+        int i = 0;
+        for ( ; samples - i >= min_samples; i += 2 * block) {
+                __m128i lo = _mm_loadu_si128((const __m128i *)(const void *)(in + i * in_bps));
+                __m128i hi = _mm_loadu_si128((const __m128i *)(const void *)(in + (i + block) * in_bps));
+                __m256i val = _mm256_shuffle_epi8(_mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1), mask);
+                _mm_storeu_si128((__m128i *)(void *)(out + i * out_bps), _mm256_castsi256_si128(val));
+                _mm_storeu_si128((__m128i *)(void *)(out + (i + block) * out_bps), _mm256_extracti128_si256(val, 1));
+        }
+        change_bps_scalar_funcs[in_bps][out_bps](out + i * out_bps, in + i * in_bps, samples - i);
+}
+
+/**
+ * Extracts channel from 2-channel 16/32-bit or 4-channel 16-bit stream.
+ * @param in   pointer to the first sample of extracted channel
+ * @returns number of processed samples
+ */
+TARGET("ssse3") static int demux_ssse3(char *out, const char *in, int bps, int channels, int samples)
+{
+        const int frame = bps * channels;
+        if (channels < 2 || (bps != 2 && bps != 4) || (frame != 4 && frame != 8)) {
+                return 0;
+        }
+        const int frames_per_load = 16 / frame;
+        const int out_bytes = frames_per_load * bps;
+        alignas(16) int8_t mask_data[16];
+        memset(mask_data, -128, sizeof mask_data);
+        for (int f = 0; f < frames_per_load; ++f) {
+                for (int b = 0; b < bps; ++b) {
+                        mask_data[f * bps + b] = f * frame + b;
+                }
+        }
+        const __m128i mask = _mm_load_si128((const __m128i *)(const void *) mask_data);
+        int i = 0;
+        // one frame more so that load starting at channel offset doesn't overrun
+        for ( ; samples - i > frames_per_load; i += frames_per_load) {
+                __m128i val = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(const void *)(in + i * frame)), mask);
+                if (out_bytes == 8) {
+                        _mm_storel_epi64((__m128i *)(void *)(out + i * bps), val);
                 } else {
-                        out_value = in_value << (out_bps * 8 - in_bps * 8);
+                        int32_t low = _mm_cvtsi128_si32(val);
+                        memcpy(out + i * bps, &low, sizeof low);
                 }
+        }
+        return i;
+}
+#endif // defined AUDIO_UTILS_X86
 
-                format_to_out_bps(out, out_bps, out_value);
+static enum audio_utils_isa select_isa(enum audio_utils_isa max_isa)
+{
+#ifdef AUDIO_UTILS_X86
+        __builtin_cpu_init();
+        if (max_isa >= AUDIO_UTILS_AVX2 && __builtin_cpu_supports("avx2")) {
+                return AUDIO_UTILS_AVX2;
+        }
+        if (max_isa >= AUDIO_UTILS_SSSE3 && __builtin_cpu_supports("ssse3")) {
+                return AUDIO_UTILS_SSSE3;
+        }
+#endif
+#if defined __SSE2__
+        if (max_isa >= AUDIO_UTILS_SSE2) {
+                return AUDIO_UTILS_SSE2;
+        }
+#endif
+        return AUDIO_UTILS_SCALAR;
+}
 
-                in += in_bps;
-                out += out_bps;
+static enum audio_utils_isa utils_isa = select_isa(AUDIO_UTILS_AVX2);
+
+enum audio_utils_isa audio_utils_set_max_isa(enum audio_utils_isa max_isa)
+{
+        return utils_isa = select_isa(max_isa);
+}
+
+void change_bps(char *out, int out_bps, const char *in, int in_bps, int in_len /* bytes */)
+{
+        assert (in_bps > 0 && (unsigned int) in_bps <= sizeof(int32_t));
+        assert ((unsigned int) out_bps <= sizeof(int32_t));
+
+        int samples = in_len / in_bps;
+
+        if (in_bps == out_bps) {
+                memcpy(out, in, samples * in_bps);
+                return;
+        }
+
+        switch (utils_isa) {
+#ifdef AUDIO_UTILS_X86
+        case AUDIO_UTILS_AVX2:
+                return change_bps_avx2(out, out_bps, in, in_bps, samples);
+        case AUDIO_UTILS_SSSE3:
+                return change_bps_ssse3(out, out_bps, in, in_bps, samples);
+#endif
+        default:
+                return change_bps_scalar_funcs[in_bps][out_bps](out, in, samples);
         }
 }
 
@@ -192,113 +669,102 @@ void audio_frame_multiply_channel(struct audio_frame *frame, int new_channel_cou
 void demux_channel(char *out, char *in, int bps, int in_len, int in_stream_channels, int pos_in_stream)
 {
         int samples = in_len / (in_stream_channels * bps);
-        int i;
+        int done = 0;
 
-        assert (bps <= 4);
+        assert (bps > 0 && bps <= 4);
 
         in += pos_in_stream * bps;
 
-        for (i = 0; i < samples; ++i) {
-                memcpy(out, in, bps);
-
-                out += bps;
-                in += in_stream_channels * bps;
-
+#ifdef AUDIO_UTILS_X86
+        if (utils_isa >= AUDIO_UTILS_SSSE3) {
+                done = demux_ssse3(out, in, bps, in_stream_channels, samples);
         }
+#endif
+        copy_strided_funcs[bps](out + done * bps, bps, in + done * in_stream_channels * bps,
+                        in_stream_channels * bps, samples - done);
 }
 
 void remux_channel(char *out, const char *in, int bps, int in_len, int in_stream_channels, int out_stream_channels, int pos_in_stream, int pos_out_stream)
 {
         int samples = in_len / (in_stream_channels * bps);
-        int i;
 
-        assert (bps <= 4);
+        assert (bps > 0 && bps <= 4);
 
-        in += pos_in_stream * bps;
-        out += pos_out_stream * bps;
-
-        for (i = 0; i < samples; ++i) {
-                memcpy(out, in, bps);
-
-                out += bps * out_stream_channels;
-                in += bps * in_stream_channels;
-
-        }
+        copy_strided_funcs[bps](out + pos_out_stream * bps, out_stream_channels * bps,
+                        in + pos_in_stream * bps, in_stream_channels * bps, samples);
 }
 
 void mux_channel(char *out, const char *in, int bps, int in_len, int out_stream_channels, int pos_in_stream, double scale)
 {
         int samples = in_len / bps;
-        int i;
         
-        assert (bps <= 4);
+        assert (bps > 0 && bps <= 4);
 
         out += pos_in_stream * bps;
 
         if(scale == 1.0) {
-                for (i = 0; i < samples; ++i) {
-                        memcpy(out, in, bps);
-
-                        in += bps;
-                        out += out_stream_channels * bps;
-
-                }
+                copy_strided_funcs[bps](out, out_stream_channels * bps, in, bps, samples);
         } else {
-                for (i = 0; i < samples; ++i) {
-                        int32_t in_value = format_from_in_bps(in, bps);
-
-                        in_value *= scale;
-
-                        format_to_out_bps(out, bps, in_value);
-
-                        in += bps;
-                        out += out_stream_channels * bps;
-                }
+                mux_scaled_funcs[0][bps](out, out_stream_channels * bps, in, samples, scale);
         }
 }
 
 void mux_and_mix_channel(char *out, const char *in, int bps, int in_len, int out_stream_channels, int pos_in_stream, double scale)
 {
-        int i;
+        int samples = in_len / bps;
 
-        assert (bps <= 4);
+        assert (bps > 0 && bps <= 4);
 
         out += pos_in_stream * bps;
 
-        for(i = 0; i < in_len / bps; i++) {
-                int32_t in_value = format_from_in_bps(in, bps);
-                int32_t out_value = format_from_in_bps(out, bps);
-
-                int32_t new_value = (double)in_value * scale + out_value;
-
-                format_to_out_bps(out, bps, new_value);
-
-                in += bps;
-                out += out_stream_channels * bps;
+        if (scale == 1.0) {
+                mix_unscaled_funcs[bps](out, out_stream_channels * bps, in, samples);
+        } else {
+                mux_scaled_funcs[1][bps](out, out_stream_channels * bps, in, samples, scale);
         }
 }
 
 double get_avg_volume(char *data, int bps, int in_len, int stream_channels, int pos_in_stream)
 {
-        float average_vol = 0;
-        int i;
-
-        assert ((unsigned int) bps <= sizeof(int32_t));
+        assert (bps > 0 && (unsigned int) bps <= sizeof(int32_t));
 
-        data += pos_in_stream * bps;
+        return avg_volume_funcs[bps](data + pos_in_stream * bps, bps * stream_channels, in_len / bps);
+}
 
-        for(i = 0; i < in_len / bps; i++) {
-                int32_t in_value = format_from_in_bps(data, bps);
+void deinterleave_channels(char * const *out, const char *in, int bps, int in_len, int channel_count)
+{
+        assert (bps > 0 && bps <= 4 && channel_count > 0);
 
-                //if(pos_in_stream) fprintf(stderr, "%d-%d ", pos_in_stream, data);
+        int frames = in_len / (bps * channel_count);
+        int done = 0;
+        if (channel_count == 1) {
+                memcpy(out[0], in, frames * bps);
+                return;
+        }
+#if defined __SSE2__
+        if (utils_isa >= AUDIO_UTILS_SSE2) {
+                done = deinterleave_sse2(out, in, bps, frames, channel_count);
+        }
+#endif
+        deinterleave_scalar_funcs[bps][channels_index(channel_count)](out, in, done, frames, channel_count);
+}
 
-                average_vol = average_vol * (i / ((double) i + 1)) + 
-                        fabs(((double) in_value / ((1 << (bps * 8 - 1)) - 1)) / (i + 1));
+void interleave_channels(char *out, const char * const *in, int bps, int in_len, int channel_count)
+{
+        assert (bps > 0 && bps <= 4 && channel_count > 0);
 
-                data += bps * stream_channels;
+        int frames = in_len / bps;
+        int done = 0;
+        if (channel_count == 1) {
+                memcpy(out, in[0], frames * bps);
+                return;
         }
-
-        return average_vol;
+#if defined __SSE2__
+        if (utils_isa >= AUDIO_UTILS_SSE2) {
+                done = interleave_sse2(out, in, bps, frames, channel_count);
+        }
+#endif
+        interleave_scalar_funcs[bps][channels_index(channel_count)](out, in, done, frames, channel_count);
 }
 
 void float2int(char *out, const char *in, int len)
@@ -391,14 +857,6 @@ void interleaved2noninterleaved(char *out, const char *in, int bps, int in_len,
                 out_ch[i] = out + in_len / channel_count * i;
         }
 
-        int offset = 0;
-        int index = 0;
-        while (offset < in_len) {
-                memcpy(out_ch[index], in, bps);
-                out_ch[index] += bps;
-                index = (index + 1) % channel_count;
-                in += bps;
-                offset += bps;
-        }
+        deinterleave_channels(out_ch.data(), in, bps, in_len, channel_count);
 }
 
@@ -62,6 +62,20 @@ void audio_channel_demux(const audio_frame2 *, int, audio_channel*);
 extern "C" {
 #endif
 
+enum audio_utils_isa {
+        AUDIO_UTILS_SCALAR,
+        AUDIO_UTILS_SSE2,
+        AUDIO_UTILS_SSSE3,
+        AUDIO_UTILS_AVX2,
+};
+
+/**
+ * Limits instruction set used by the sample format and channel conversion
+ * functions (the best one supported by the CPU is used by default).
+ *
+ * @return the instruction set that will be actually used
+ */
+enum audio_utils_isa audio_utils_set_max_isa(enum audio_utils_isa max_isa);
 
 bool audio_desc_eq(struct audio_desc, struct audio_desc);
 struct audio_desc audio_desc_from_audio_frame(struct audio_frame *);
@@ -93,6 +107,19 @@ void remux_channel(char *out, const char *in, int bps, int in_len, int in_stream
 
 void interleaved2noninterleaved(char *out, const char *in, int bps, int in_len /* bytes */, int channel_count);
 
+/**
+ * Splits interleaved stream to per-channel buffers.
+ * @param out    array of channel_count pointers to output buffers
+ * @param in_len length of interleaved input in bytes
+ */
+void deinterleave_channels(char * const *out, const char *in, int bps, int in_len, int channel_count);
+/**
+ * Interleaves per-channel buffers to a single stream.
+ * @param in     array of channel_count pointers to input buffers
+ * @param in_len length of each input channel in bytes
+ */
+void interleave_channels(char *out, const char * const *in, int bps, int in_len, int channel_count);
+
 /*
  * Additional function that allosw mixing channels
  *
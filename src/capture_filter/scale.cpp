@@ -0,0 +1,213 @@
+/*
+ * FILE:    capture_filter/scale.cpp
+ * AUTHORS: Martin Benes     <martinbenesh@gmail.com>
+ *          Lukas Hejtmanek  <xhejtman@ics.muni.cz>
+ *          Petr Holub       <hopet@ics.muni.cz>
+ *          Milos Liska      <xliska@fi.muni.cz>
+ *          Jiri Matela      <matela@ics.muni.cz>
+ *          Dalibor Matura   <255899@mail.muni.cz>
+ *          Ian Wesley-Smith <iwsmith@cct.lsu.edu>
+ *
+ * Copyright (c) 2005-2010 CESNET z.s.p.o.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, is permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *
+ *      This product includes software developed by CESNET z.s.p.o.
+ *
+ * 4. Neither the name of CESNET nor the names of its contributors may be used
+ *    to endorse or promote products derived from this software without specific
+ *    prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESSED OR IMPLIED WARRANTIES, INCLUDING,
+ * BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#include "config_unix.h"
+#include "config_win32.h"
+#endif /* HAVE_CONFIG_H */
+
+#include <memory>
+
+#include "capture_filter.h"
+#include "capture_filter/scale_utils.h"
+#include "debug.h"
+#include "lib_common.h"
+#include "video.h"
+#include "video_codec.h"
+#include "utils/video_frame_pool.h"
+
+using namespace std;
+
+struct module;
+
+static int init(struct module *parent, const char *cfg, void **state);
+static void done(void *state);
+static struct video_frame *filter(void *state, struct video_frame *in);
+
+struct state_scale {
+        int num = 2, denom = 1;               ///< scale factor, used if target_width is 0
+        int target_width = 0, target_height = 0;
+        enum scale_filter filter_type = SCALE_FILTER_AUTO;
+
+        struct video_desc saved_desc{};
+        struct video_scaler *scaler = nullptr; ///< NULL if input format is not supported
+        video_frame_pool<default_data_allocator> pool;
+};
+
+static void usage()
+{
+        printf("Scales input frames in its native pixel format (UYVY, YUYV, v210, RGB, RGBA).\n\n");
+        printf("scale usage:\n");
+        printf("\tscale[:<numerator>/<denominator>|:<width>x<height>][:filter=box|bilinear|bicubic|lanczos]\n\n");
+        printf("Default scale factor is 2/1. Default filter is box for 1/2 and 1/4 downscale and bilinear otherwise.\n");
+        printf("Examples:\n"
+                        "\tscale:1/4 - proxy stream at quarter resolution\n"
+                        "\tscale:1280x720:filter=lanczos - scales input to 1280x720\n");
+}
+
+static int init(struct module *, const char *cfg, void **state)
+{
+        auto s = new state_scale();
+
+        char *tmp = strdup(cfg ? cfg : "");
+        char *save_ptr = NULL;
+        char *item, *cfg_str = tmp;
+        while ((item = strtok_r(cfg_str, ":", &save_ptr))) {
+                cfg_str = NULL;
+                char *endptr = NULL;
+                if (strcmp(item, "help") == 0) {
+                        usage();
+                        free(tmp);
+                        delete s;
+                        return 1;
+                } else if (strncmp(item, "filter=", strlen("filter=")) == 0) {
+                        const char *name = item + strlen("filter=");
+                        if (strcmp(name, "box") == 0) {
+                                s->filter_type = SCALE_FILTER_BOX;
+                        } else if (strcmp(name, "bilinear") == 0) {
+                                s->filter_type = SCALE_FILTER_BILINEAR;
+                        } else if (strcmp(name, "bicubic") == 0) {
+                                s->filter_type = SCALE_FILTER_BICUBIC;
+                        } else if (strcmp(name, "lanczos") == 0) {
+                                s->filter_type = SCALE_FILTER_LANCZOS;
+                        } else {
+                                endptr = item;
+                        }
+                } else if (strchr(item, 'x')) {
+                        s->target_width = strtol(item, &endptr, 10);
+                        s->target_height = strtol(strchr(item, 'x') + 1, &endptr, 10);
+                } else {
+                        s->num = strtol(item, &endptr, 10);
+                        s->denom = 1;
+                        if (*endptr == '/') {
+                                s->denom = strtol(endptr + 1, &endptr, 10);
+                        }
+                }
+
+                if ((endptr && *endptr != '\0') || s->num <= 0 || s->denom <= 0 ||
+                                s->target_width < 0 || s->target_height < 0 ||
+                                (s->target_width > 0) != (s->target_height > 0)) {
+                        log_msg(LOG_LEVEL_ERROR, "[scale] Wrong config: %s\n", item);
+                        usage();
+                        free(tmp);
+                        delete s;
+                        return -1;
+                }
+        }
+        free(tmp);
+
+        *state = s;
+        return 0;
+}
+
+static void done(void *state)
+{
+        auto s = (struct state_scale *) state;
+
+        video_scaler_destroy(s->scaler);
+        delete s;
+}
+
+static struct video_frame *filter(void *state, struct video_frame *in)
+{
+        auto s = (struct state_scale *) state;
+
+        struct video_desc in_desc = video_desc_from_frame(in);
+        if (!video_desc_eq(in_desc, s->saved_desc)) {
+                s->saved_desc = in_desc;
+                video_scaler_destroy(s->scaler);
+                struct video_desc desc = in_desc;
+                if (s->target_width > 0) {
+                        desc.width = s->target_width;
+                        desc.height = s->target_height;
+                } else {
+                        desc.width = in_desc.width * s->num / s->denom;
+                        desc.height = in_desc.height * s->num / s->denom;
+                }
+                s->scaler = video_scaler_create(in_desc.color_spec, in_desc.width, in_desc.height,
+                                desc.width, desc.height, s->filter_type);
+                if (!s->scaler) {
+                        log_msg(LOG_LEVEL_ERROR, "[scale] Cannot scale %s %ux%u to %ux%u, passing frames unchanged.\n",
+                                        get_codec_name(in_desc.color_spec), in_desc.width, in_desc.height,
+                                        desc.width, desc.height);
+                } else {
+                        if (desc.color_spec != RGB && desc.color_spec != RGBA) {
+                                desc.width &= ~1u;
+                        }
+                        s->pool.reconfigure(desc, vc_get_linesize(desc.width, desc.color_spec) * desc.height);
+                        log_msg(LOG_LEVEL_NOTICE, "[scale] Scaling from %ux%u to %ux%u\n", in_desc.width,
+                                        in_desc.height, desc.width, desc.height);
+                }
+        }
+
+        if (!s->scaler) {
+                return in;
+        }
+
+        shared_ptr<video_frame> out = s->pool.get_frame();
+        for (unsigned int i = 0; i < in->tile_count; ++i) {
+                video_scaler_process(s->scaler, in->tiles[i].data, out->tiles[i].data);
+        }
+        VIDEO_FRAME_DISPOSE(in);
+
+        struct video_frame *ret = out.get();
+        ret->callbacks.dispose_udata = new shared_ptr<video_frame>(out);
+        ret->callbacks.dispose = [](struct video_frame *f) { delete static_cast<shared_ptr<video_frame> *>(f->callbacks.dispose_udata); };
+
+        return ret;
+}
+
+static const struct capture_filter_info capture_filter_scale = {
+        init,
+        done,
+        filter,
+};
+
+REGISTER_MODULE(scale, &capture_filter_scale, LIBRARY_CLASS_CAPTURE_FILTER, CAPTURE_FILTER_ABI_VERSION);
+
@@ -0,0 +1,711 @@
+/**
+ * @file   capture_filter/scale_utils.cpp
+ *
+ * Frames are unpacked line by line to component planes (luma and both
+ * chroma planes at half width for 4:2:2 formats, one plane per channel for
+ * RGB(A)), filtered horizontally into an intermediate buffer with 14-bit
+ * fixed-point coefficients and then filtered vertically and packed back.
+ * Each output position has its own precomputed set of coefficients
+ * (polyphase filter), downscaling widens the filter support to avoid
+ * aliasing.
+ *
+ * Box downscaling by 2 or 4 of 8-bit formats is done directly on packed
+ * data.
+ */
+/*
+ * Copyright (c) 2019 CESNET z.s.p.o.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, is permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of CESNET nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESSED OR IMPLIED WARRANTIES, INCLUDING,
+ * BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#include "config_unix.h"
+#include "config_win32.h"
+#endif // HAVE_CONFIG_H
+
+#if defined __GNUC__ && defined __x86_64__
+#define SCALER_X86
+#include <immintrin.h>
+#define TARGET(isa) __attribute__((target(isa)))
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "capture_filter/scale_utils.h"
+#include "utils/worker.h"
+#include "video_codec.h"
+
+#define COEF_BITS 14
+#define MAX_PLANES 4
+#define CHUNK_SIZE (64 * 1024) ///< approximate amount of output data processed by one parallel_for chunk
+
+using namespace std;
+
+/**
+ * Polyphase filter table - output sample i is computed from input samples
+ * start[i] .. start[i] + taps - 1 with coefficients coeffs[i * taps ...].
+ */
+struct filter_table {
+        int taps;
+        vector<int> start;
+        vector<int16_t> coeffs;
+        vector<int32_t> coeff_pairs;    ///< coeffs as (2k, 2k+1) pairs interleaved per 8 outputs, for SIMD gather
+};
+
+struct scale_plane {
+        int in_width;
+        int out_width;
+        struct filter_table h;
+        vector<int16_t> inter;         ///< horizontally filtered lines (in_height x out_width)
+};
+
+/// per-chunk line buffers, one set is used by each concurrently running chunk
+struct scale_scratch {
+        vector<uint16_t> unpacked[MAX_PLANES]; ///< box sums or unpacked input lines
+        vector<int16_t> filtered[MAX_PLANES];  ///< vertically filtered lines
+};
+
+struct video_scaler {
+        codec_t codec;
+        int in_width, in_height;
+        int out_width, out_height;
+        int depth;                      ///< bits per component
+        int box_factor;                 ///< 2 or 4 if packed box downscale is used, 0 otherwise
+        int plane_count;
+        struct scale_plane planes[MAX_PLANES];
+        struct filter_table v;
+
+        mutex scratch_lock;
+        vector<unique_ptr<scale_scratch>> free_scratch; ///< idle line buffers
+};
+
+static enum video_scaler_isa select_isa(enum video_scaler_isa max_isa)
+{
+#ifdef SCALER_X86
+        __builtin_cpu_init();
+        if (max_isa >= VIDEO_SCALER_AVX2 && __builtin_cpu_supports("avx2")) {
+                return VIDEO_SCALER_AVX2;
+        }
+#endif
+        return VIDEO_SCALER_SCALAR;
+}
+
+static enum video_scaler_isa scaler_isa = select_isa(VIDEO_SCALER_AVX2);
+
+enum video_scaler_isa video_scaler_set_max_isa(enum video_scaler_isa max_isa)
+{
+        return scaler_isa = select_isa(max_isa);
+}
+
+/**
+ * @name Filter Tables
+ * @{
+ */
+static double filter_radius(enum scale_filter filter)
+{
+        switch (filter) {
+        case SCALE_FILTER_BOX:
+                return 0.5;
+        case SCALE_FILTER_BICUBIC:
+                return 2.0;
+        case SCALE_FILTER_LANCZOS:
+                return 3.0;
+        default:
+                return 1.0;
+        }
+}
+
+static double filter_kernel(enum scale_filter filter, double x)
+{
+        x = fabs(x);
+        switch (filter) {
+        case SCALE_FILTER_BOX:
+                return x < 0.5 ? 1.0 : 0.0;
+        case SCALE_FILTER_BICUBIC: // Keys, a = -0.5
+                if (x < 1.0) {
+                        return (1.5 * x - 2.5) * x * x + 1.0;
+                } else if (x < 2.0) {
+                        return ((-0.5 * x + 2.5) * x - 4.0) * x + 2.0;
+                }
+                return 0.0;
+        case SCALE_FILTER_LANCZOS:
+                if (x < 1e-9) {
+                        return 1.0;
+                } else if (x < 3.0) {
+                        return 3.0 * sin(M_PI * x) * sin(M_PI * x / 3.0) / (M_PI * M_PI * x * x);
+                }
+                return 0.0;
+        default:
+                return x < 1.0 ? 1.0 - x : 0.0;
+        }
+}
+
+static void init_filter_table(struct filter_table *t, int in_size, int out_size, enum scale_filter filter)
+{
+        double ratio = (double) in_size / out_size;
+        double scale = min(1.0, 1.0 / ratio);
+        double support = filter_radius(filter) / scale;
+        t->taps = min<int>(ceil(2.0 * support), in_size);
+        t->start.resize(out_size);
+        t->coeffs.assign((size_t) out_size * t->taps, 0);
+
+        vector<double> weights(t->taps);
+        for (int i = 0; i < out_size; ++i) {
+                double center = (i + 0.5) * ratio - 0.5;
+                int ideal_start = floor(center - support) + 1;
+                int start = max(0, min(ideal_start, in_size - t->taps));
+                t->start[i] = start;
+
+                // weights of samples outside the picture are folded to the edge samples
+                fill(weights.begin(), weights.end(), 0.0);
+                double sum = 0.0;
+                for (int k = 0; k < t->taps; ++k) {
+                        int idx = max(0, min(ideal_start + k, in_size - 1));
+                        double w = filter_kernel(filter, (ideal_start + k - center) * scale);
+                        weights[idx - start] += w;
+                        sum += w;
+                }
+                if (sum == 0.0) { // may happen only with box filter when upscaling
+                        weights[max(0, min((int) lround(center), in_size - 1)) - start] = sum = 1.0;
+                }
+
+                int16_t *coeffs = &t->coeffs[(size_t) i * t->taps];
+                int total = 0;
+                int largest = 0;
+                for (int k = 0; k < t->taps; ++k) {
+                        coeffs[k] = lround(weights[k] / sum * (1 << COEF_BITS));
+                        total += coeffs[k];
+                        if (coeffs[k] > coeffs[largest]) {
+                                largest = k;
+                        }
+                }
+                coeffs[largest] += (1 << COEF_BITS) - total;
+        }
+
+        // start is padded with zeros so that SIMD kernels may compute whole blocks of 8
+        const int pairs = (t->taps + 1) / 2;
+        const int blocks = (out_size + 7) / 8;
+        t->start.resize(blocks * 8);
+        t->coeff_pairs.assign((size_t) blocks * pairs * 8, 0);
+        for (int i = 0; i < out_size; ++i) {
+                const int16_t *coeffs = &t->coeffs[(size_t) i * t->taps];
+                for (int k = 0; k < t->taps; ++k) {
+                        int32_t &pair = t->coeff_pairs[((size_t) i / 8 * pairs + k / 2) * 8 + i % 8];
+                        pair |= (uint32_t) (uint16_t) coeffs[k] << (k % 2 * 16);
+                }
+        }
+}
+/**
+ * @}
+ */
+
+/**
+ * @name Pixel Format Unpacking and Packing
+ * Planes are padded to multiple of 6 pixels (v210 block).
+ * @{
+ */
+static int plane_count(codec_t codec)
+{
+        return codec == RGB ? 3 : codec == RGBA ? 4 : 3;
+}
+
+/// @returns width of plane p for picture of given width
+static int plane_width(codec_t codec, int p, int width)
+{
+        if ((codec == UYVY || codec == YUYV || codec == v210) && p > 0) {
+                return (width + 1) / 2;
+        }
+        return width;
+}
+
+static int padded_width(int width)
+{
+        return (width + 5) / 6 * 6;
+}
+
+template<int bpp>
+static void unpack_rgb(const unsigned char *src, int width, uint16_t *const *planes)
+{
+        for (int i = 0; i < width; ++i) {
+                for (int c = 0; c < bpp; ++c) {
+                        planes[c][i] = src[bpp * i + c];
+                }
+        }
+}
+
+template<int bpp>
+static void pack_rgb(const int16_t *const *planes, int width, unsigned char *dst)
+{
+        for (int i = 0; i < width; ++i) {
+                for (int c = 0; c < bpp; ++c) {
+                        dst[bpp * i + c] = planes[c][i];
+                }
+        }
+}
+
+static void unpack_line(codec_t codec, const unsigned char *src, int width, uint16_t *const *planes)
+{
+        switch (codec) {
+        case UYVY:
+        case YUYV:
+        {
+                int y_off = codec == UYVY ? 1 : 0;
+                int c_off = codec == UYVY ? 0 : 1;
+                for (int i = 0; i < width / 2; ++i) {
+                        planes[0][2 * i] = src[4 * i + y_off];
+                        planes[0][2 * i + 1] = src[4 * i + 2 + y_off];
+                        planes[1][i] = src[4 * i + c_off];
+                        planes[2][i] = src[4 * i + 2 + c_off];
+                }
+                break;
+        }
+        case v210:
+                for (int g = 0; g < (width + 5) / 6; ++g) {
+                        uint32_t w[4];
+                        memcpy(w, src + 16 * g, sizeof w);
+                        uint16_t *y = planes[0] + 6 * g, *cb = planes[1] + 3 * g, *cr = planes[2] + 3 * g;
+                        cb[0] = w[0] & 0x3FF; y[0] = (w[0] >> 10) & 0x3FF; cr[0] = (w[0] >> 20) & 0x3FF;
+                        y[1] = w[1] & 0x3FF; cb[1] = (w[1] >> 10) & 0x3FF; y[2] = (w[1] >> 20) & 0x3FF;
+                        cr[1] = w[2] & 0x3FF; y[3] = (w[2] >> 10) & 0x3FF; cb[2] = (w[2] >> 20) & 0x3FF;
+                        y[4] = w[3] & 0x3FF; cr[2] = (w[3] >> 10) & 0x3FF; y[5] = (w[3] >> 20) & 0x3FF;
+                }
+                break;
+        case RGB:
+                unpack_rgb<3>(src, width, planes);
+                break;
+        default:
+                unpack_rgb<4>(src, width, planes);
+        }
+}
+
+static void pack_line(codec_t codec, const int16_t *const *planes, int width, unsigned char *dst)
+{
+        switch (codec) {
+        case UYVY:
+        case YUYV:
+        {
+                int y_off = codec == UYVY ? 1 : 0;
+                int c_off = codec == UYVY ? 0 : 1;
+                for (int i = 0; i < width / 2; ++i) {
+                        dst[4 * i + y_off] = planes[0][2 * i];
+                        dst[4 * i + 2 + y_off] = planes[0][2 * i + 1];
+                        dst[4 * i + c_off] = planes[1][i];
+                        dst[4 * i + 2 + c_off] = planes[2][i];
+                }
+                break;
+        }
+        case v210:
+                for (int g = 0; g < (width + 5) / 6; ++g) {
+                        const int16_t *y = planes[0] + 6 * g, *cb = planes[1] + 3 * g, *cr = planes[2] + 3 * g;
+                        uint32_t w[4] = {
+                                (uint32_t) cb[0] | (uint32_t) y[0] << 10 | (uint32_t) cr[0] << 20,
+                                (uint32_t) y[1] | (uint32_t) cb[1] << 10 | (uint32_t) y[2] << 20,
+                                (uint32_t) cr[1] | (uint32_t) y[3] << 10 | (uint32_t) cb[2] << 20,
+                                (uint32_t) y[4] | (uint32_t) cr[2] << 10 | (uint32_t) y[5] << 20,
+                        };
+                        memcpy(dst + 16 * g, w, sizeof w);
+                }
+                break;
+        case RGB:
+                pack_rgb<3>(planes, width, dst);
+                break;
+        default:
+                pack_rgb<4>(planes, width, dst);
+        }
+}
+/**
+ * @}
+ */
+
+/**
+ * @name Filter Kernels
+ * Intermediate values carry (14 - depth) fractional bits.
+ * @{
+ */
+template<int taps>
+static void filter_h_taps(const uint16_t *src, const struct filter_table *t, int depth, int16_t *dst, int width)
+{
+        const int16_t *c = t->coeffs.data();
+        const int *start = t->start.data();
+        const int32_t round = 1 << (depth - 1);
+        for (int i = 0; i < width; ++i, c += taps) {
+                const uint16_t *s = src + start[i];
+                int32_t acc = round;
+                for (int k = 0; k < taps; ++k) {
+                        acc += c[k] * s[k];
+                }
+                dst[i] = acc >> depth;
+        }
+}
+
+static void filter_h_scalar(const uint16_t *src, const struct filter_table *t, int depth, int16_t *dst, int width)
+{
+        switch (t->taps) { // common tap counts are unrolled
+        case 1: return filter_h_taps<1>(src, t, depth, dst, width);
+        case 2: return filter_h_taps<2>(src, t, depth, dst, width);
+        case 3: return filter_h_taps<3>(src, t, depth, dst, width);
+        case 4: return filter_h_taps<4>(src, t, depth, dst, width);
+        case 6: return filter_h_taps<6>(src, t, depth, dst, width);
+        case 8: return filter_h_taps<8>(src, t, depth, dst, width);
+        }
+
+        const int16_t *c = t->coeffs.data();
+        for (int i = 0; i < width; ++i, c += t->taps) {
+                const uint16_t *s = src + t->start[i];
+                int32_t acc = 1 << (depth - 1);
+                for (int k = 0; k < t->taps; ++k) {
+                        acc += c[k] * s[k];
+                }
+                dst[i] = acc >> depth;
+        }
+}
+
+#ifdef SCALER_X86
+/// @note src must be readable one sample past the last one referenced by the table
+TARGET("avx2") static void filter_h_avx2(const uint16_t *src, const struct filter_table *t, int depth, int16_t *dst, int width)
+{
+        const int pairs = (t->taps + 1) / 2;
+        const __m256i round = _mm256_set1_epi32(1 << (depth - 1));
+        const __m128i shift_cnt = _mm_cvtsi32_si128(depth);
+        const int32_t *c = t->coeff_pairs.data();
+        for (int x = 0; x < width; x += 8) {
+                const __m256i idx = _mm256_loadu_si256((const __m256i *)(const void *)(t->start.data() + x));
+                __m256i acc = round;
+                for (int k = 0; k < pairs; ++k, c += 8) {
+                        __m256i s = _mm256_i32gather_epi32((const int *)(const void *)(src + 2 * k), idx, 2);
+                        acc = _mm256_add_epi32(acc, _mm256_madd_epi16(s, _mm256_loadu_si256((const __m256i *)(const void *) c)));
+                }
+                acc = _mm256_sra_epi32(acc, shift_cnt);
+                __m128i out = _mm_packs_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+                if (x + 8 <= width) {
+                        _mm_storeu_si128((__m128i *)(void *)(dst + x), out);
+                } else {
+                        alignas(16) int16_t tail[8];
+                        _mm_store_si128((__m128i *)(void *) tail, out);
+                        memcpy(dst + x, tail, (width - x) * sizeof(int16_t));
+                }
+        }
+}
+#endif
+
+static void filter_v_scalar(const int16_t *src, size_t stride, const int16_t *coeffs, int taps,
+                int depth, int16_t *dst, int width)
+{
+        const int shift = 2 * COEF_BITS - depth;
+        const int maxval = (1 << depth) - 1;
+        for (int x = 0; x < width; ++x) {
+                int32_t acc = 0;
+                for (int k = 0; k < taps; ++k) {
+                        acc += coeffs[k] * src[k * stride + x];
+                }
+                dst[x] = max(0, min((acc + (1 << (shift - 1))) >> shift, maxval));
+        }
+}
+
+#ifdef SCALER_X86
+TARGET("avx2") static void filter_v_avx2(const int16_t *src, size_t stride, const int16_t *coeffs, int taps,
+                int depth, int16_t *dst, int width)
+{
+        const int shift = 2 * COEF_BITS - depth;
+        const __m256i round = _mm256_set1_epi32(1 << (shift - 1));
+        const __m128i shift_cnt = _mm_cvtsi32_si128(shift);
+        const __m256i maxval = _mm256_set1_epi16((1 << depth) - 1);
+        int x = 0;
+        for ( ; x + 16 <= width; x += 16) {
+                __m256i acc_lo = round, acc_hi = round;
+                for (int k = 0; k < taps; k += 2) {
+                        __m256i r0 = _mm256_loadu_si256((const __m256i *)(const void *)(src + k * stride + x));
+                        __m256i r1 = _mm256_setzero_si256();
+                        uint32_t c = (uint16_t) coeffs[k];
+                        if (k + 1 < taps) {
+                                r1 = _mm256_loadu_si256((const __m256i *)(const void *)(src + (k + 1) * stride + x));
+                                c |= (uint32_t) (uint16_t) coeffs[k + 1] << 16;
+                        }
+                        __m256i cc = _mm256_set1_epi32(c);
+                        acc_lo = _mm256_add_epi32(acc_lo, _mm256_madd_epi16(_mm256_unpacklo_epi16(r0, r1), cc));
+                        acc_hi = _mm256_add_epi32(acc_hi, _mm256_madd_epi16(_mm256_unpackhi_epi16(r0, r1), cc));
+                }
+                __m256i out = _mm256_packs_epi32(_mm256_sra_epi32(acc_lo, shift_cnt), _mm256_sra_epi32(acc_hi, shift_cnt));
+                out = _mm256_min_epi16(_mm256_max_epi16(out, _mm256_setzero_si256()), maxval);
+                _mm256_storeu_si256((__m256i *)(void *)(dst + x), out);
+        }
+        filter_v_scalar(src + x, stride, coeffs, taps, depth, dst + x, width - x);
+}
+#endif
+
+/// sums f lines of 8-bit samples
+static void sum_lines_scalar(const unsigned char *src, size_t linesize, int f, uint16_t *dst, size_t len)
+{
+        for (size_t x = 0; x < len; ++x) {
+                uint16_t sum = 0;
+                for (int k = 0; k < f; ++k) {
+                        sum += src[k * linesize + x];
+                }
+                dst[x] = sum;
+        }
+}
+
+#ifdef SCALER_X86
+TARGET("avx2") static void sum_lines_avx2(const unsigned char *src, size_t linesize, int f, uint16_t *dst, size_t len)
+{
+        size_t x = 0;
+        for ( ; x + 16 <= len; x += 16) {
+                __m256i sum = _mm256_setzero_si256();
+                for (int k = 0; k < f; ++k) {
+                        sum = _mm256_add_epi16(sum, _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(const void *)(src + k * linesize + x))));
+                }
+                _mm256_storeu_si256((__m256i *)(void *)(dst + x), sum);
+        }
+        sum_lines_scalar(src + x, linesize, f, dst + x, len - x);
+}
+#endif
+
+/**
+ * Box downscale of a line of packed 8-bit format from sums of f input lines.
+ */
+static void box_line(codec_t codec, const uint16_t *sum, int f, int out_width, unsigned char *dst)
+{
+        const int shift = f == 2 ? 2 : 4; // log2(f * f)
+        const int round = 1 << (shift - 1);
+        if (codec == UYVY || codec == YUYV) {
+                int y_off = codec == UYVY ? 1 : 0;
+                int c_off = codec == UYVY ? 0 : 1;
+                for (int m = 0; m < out_width / 2; ++m) {
+                        int y0 = 0, y1 = 0, cb = 0, cr = 0;
+                        for (int dx = 0; dx < f; ++dx) {
+                                y0 += sum[2 * (2 * m * f + dx) + y_off];
+                                y1 += sum[2 * ((2 * m + 1) * f + dx) + y_off];
+                                cb += sum[4 * (m * f + dx) + c_off];
+                                cr += sum[4 * (m * f + dx) + 2 + c_off];
+                        }
+                        dst[4 * m + y_off] = (y0 + round) >> shift;
+                        dst[4 * m + 2 + y_off] = (y1 + round) >> shift;
+                        dst[4 * m + c_off] = (cb + round) >> shift;
+                        dst[4 * m + 2 + c_off] = (cr + round) >> shift;
+                }
+        } else {
+                int bpp = plane_count(codec);
+                for (int x = 0; x < out_width; ++x) {
+                        for (int c = 0; c < bpp; ++c) {
+                                int acc = 0;
+                                for (int dx = 0; dx < f; ++dx) {
+                                        acc += sum[(x * f + dx) * bpp + c];
+                                }
+                                dst[x * bpp + c] = (acc + round) >> shift;
+                        }
+                }
+        }
+}
+/**
+ * @}
+ */
+
+bool video_scaler_supports(codec_t codec)
+{
+        return codec == UYVY || codec == YUYV || codec == v210 || codec == RGB || codec == RGBA;
+}
+
+static unique_ptr<scale_scratch> scratch_alloc(struct video_scaler *s)
+{
+        unique_ptr<scale_scratch> ret(new scale_scratch());
+        if (s->box_factor) {
+                ret->unpacked[0].resize(vc_get_linesize(s->in_width, s->codec));
+                return ret;
+        }
+        for (int p = 0; p < s->plane_count; ++p) {
+                ret->unpacked[p].resize(padded_width(s->in_width) + 1); // + 1 for filter_h_avx2 overread
+                ret->filtered[p].resize(padded_width(s->out_width));
+        }
+        return ret;
+}
+
+/// takes idle line buffers, new ones are allocated only if more chunks run concurrently than ever before
+static unique_ptr<scale_scratch> scratch_get(struct video_scaler *s)
+{
+        {
+                lock_guard<mutex> lk(s->scratch_lock);
+                if (!s->free_scratch.empty()) {
+                        unique_ptr<scale_scratch> ret = move(s->free_scratch.back());
+                        s->free_scratch.pop_back();
+                        return ret;
+                }
+        }
+        return scratch_alloc(s);
+}
+
+static void scratch_put(struct video_scaler *s, unique_ptr<scale_scratch> &&scratch)
+{
+        lock_guard<mutex> lk(s->scratch_lock);
+        s->free_scratch.push_back(move(scratch));
+}
+
+struct video_scaler *video_scaler_create(codec_t codec, int in_width, int in_height,
+                int out_width, int out_height, enum scale_filter filter)
+{
+        if (!video_scaler_supports(codec) || in_width <= 0 || in_height <= 0) {
+                return NULL;
+        }
+        if (codec != RGB && codec != RGBA) {
+                in_width &= ~1;
+                out_width &= ~1;
+        }
+        if (out_width <= 0 || out_height <= 0) {
+                return NULL;
+        }
+
+        auto s = new video_scaler();
+        s->codec = codec;
+        s->in_width = in_width;
+        s->in_height = in_height;
+        s->out_width = out_width;
+        s->out_height = out_height;
+        s->depth = codec == v210 ? 10 : 8;
+        s->plane_count = plane_count(codec);
+
+        int box_factor = 0;
+        for (int f : { 2, 4 }) {
+                if (in_width == out_width * f && in_height == out_height * f) {
+                        box_factor = f;
+                }
+        }
+        if (filter == SCALE_FILTER_AUTO) {
+                filter = box_factor ? SCALE_FILTER_BOX : SCALE_FILTER_BILINEAR;
+        }
+        if (filter == SCALE_FILTER_BOX && box_factor && s->depth == 8) {
+                s->box_factor = box_factor;
+        }
+
+        if (!s->box_factor) {
+                for (int p = 0; p < s->plane_count; ++p) {
+                        struct scale_plane *plane = &s->planes[p];
+                        plane->in_width = plane_width(codec, p, in_width);
+                        plane->out_width = plane_width(codec, p, out_width);
+                        init_filter_table(&plane->h, plane->in_width, plane->out_width, filter);
+                        plane->inter.resize((size_t) in_height * plane->out_width);
+                }
+                init_filter_table(&s->v, in_height, out_height, filter);
+        }
+
+        // one set of line buffers for each thread that may run a chunk
+        for (unsigned i = 0; i < max(thread::hardware_concurrency(), 1U); ++i) {
+                s->free_scratch.push_back(scratch_alloc(s));
+        }
+
+        return s;
+}
+
+void video_scaler_destroy(struct video_scaler *s)
+{
+        delete s;
+}
+
+void video_scaler_process(struct video_scaler *s, const char *in, char *out)
+{
+        const unsigned char *src = (const unsigned char *) in;
+        unsigned char *dst = (unsigned char *) out;
+        const size_t in_linesize = vc_get_linesize(s->in_width, s->codec);
+        const size_t out_linesize = vc_get_linesize(s->out_width, s->codec);
+        const int out_grain = max<size_t>(CHUNK_SIZE / out_linesize, 1);
+        auto sum_lines = sum_lines_scalar;
+        auto filter_h = filter_h_scalar;
+        auto filter_v = filter_v_scalar;
+#ifdef SCALER_X86
+        if (scaler_isa == VIDEO_SCALER_AVX2) {
+                sum_lines = sum_lines_avx2;
+                filter_h = filter_h_avx2;
+                filter_v = filter_v_avx2;
+        }
+#endif
+
+        if (s->box_factor) {
+                const int f = s->box_factor;
+                parallel_for(0, s->out_height, [=](int start, int end) {
+                                unique_ptr<scale_scratch> scratch = scratch_get(s);
+                                uint16_t *sum = scratch->unpacked[0].data();
+                                for (int y = start; y < end; ++y) {
+                                        sum_lines(src + (size_t) y * f * in_linesize, in_linesize, f, sum, in_linesize);
+                                        box_line(s->codec, sum, f, s->out_width, dst + y * out_linesize);
+                                }
+                                scratch_put(s, move(scratch));
+                        }, out_grain);
+                return;
+        }
+
+        // horizontal pass
+        parallel_for(0, s->in_height, [=](int start, int end) {
+                        unique_ptr<scale_scratch> scratch = scratch_get(s);
+                        uint16_t *planes[MAX_PLANES];
+                        for (int p = 0; p < s->plane_count; ++p) {
+                                planes[p] = scratch->unpacked[p].data();
+                        }
+                        for (int y = start; y < end; ++y) {
+                                unpack_line(s->codec, src + y * in_linesize, s->in_width, planes);
+                                for (int p = 0; p < s->plane_count; ++p) {
+                                        struct scale_plane *plane = &s->planes[p];
+                                        filter_h(planes[p], &plane->h, s->depth,
+                                                        &plane->inter[(size_t) y * plane->out_width], plane->out_width);
+                                }
+                        }
+                        scratch_put(s, move(scratch));
+                }, max<size_t>(CHUNK_SIZE / in_linesize, 1));
+
+        // vertical pass
+        parallel_for(0, s->out_height, [=](int start, int end) {
+                        unique_ptr<scale_scratch> scratch = scratch_get(s);
+                        vector<int16_t> *lines = scratch->filtered;
+                        const int16_t *planes[MAX_PLANES];
+                        for (int p = 0; p < s->plane_count; ++p) {
+                                planes[p] = lines[p].data();
+                        }
+                        for (int y = start; y < end; ++y) {
+                                const int16_t *coeffs = &s->v.coeffs[(size_t) y * s->v.taps];
+                                for (int p = 0; p < s->plane_count; ++p) {
+                                        struct scale_plane *plane = &s->planes[p];
+                                        filter_v(&plane->inter[(size_t) s->v.start[y] * plane->out_width],
+                                                        plane->out_width, coeffs, s->v.taps, s->depth,
+                                                        lines[p].data(), plane->out_width);
+                                        // pad to whole v210 block
+                                        fill(lines[p].begin() + plane->out_width, lines[p].end(),
+                                                        lines[p][plane->out_width - 1]);
+                                }
+                                pack_line(s->codec, planes, s->out_width, dst + y * out_linesize);
+                        }
+                        scratch_put(s, move(scratch));
+                }, out_grain);
+}
+
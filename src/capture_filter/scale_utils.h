@@ -0,0 +1,93 @@
+/**
+ * @file   capture_filter/scale_utils.h
+ *
+ * Native video scaler - separable polyphase filtering performed directly in
+ * the source pixel format (without conversion to RGB).
+ */
+/*
+ * Copyright (c) 2019 CESNET z.s.p.o.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, is permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of CESNET nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESSED OR IMPLIED WARRANTIES, INCLUDING,
+ * BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SCALE_UTILS_H_
+#define SCALE_UTILS_H_
+
+#include "types.h"
+
+enum scale_filter {
+        SCALE_FILTER_AUTO,     ///< box for 2:1 and 4:1 downscale, bilinear otherwise
+        SCALE_FILTER_BOX,
+        SCALE_FILTER_BILINEAR,
+        SCALE_FILTER_BICUBIC,
+        SCALE_FILTER_LANCZOS,  ///< Lanczos with 3 lobes
+};
+
+enum video_scaler_isa {
+        VIDEO_SCALER_SCALAR,
+        VIDEO_SCALER_AVX2,
+};
+
+struct video_scaler;
+
+/// @returns whether the codec can be processed by the scaler (UYVY, YUYV, v210, RGB, RGBA)
+bool video_scaler_supports(codec_t codec);
+
+/**
+ * Creates scaler for given geometry. Coefficient tables and intermediate
+ * buffers (line buffers for as many chunks as there are CPU cores) are
+ * allocated here so that video_scaler_process() doesn't allocate. More line
+ * buffers are allocated only if more chunks run concurrently (eg. with
+ * worker-threads set above the core count) and they are then reused.
+ *
+ * Width of 4:2:2 formats is rounded down to an even number.
+ *
+ * @returns scaler state, NULL if codec is not supported
+ */
+struct video_scaler *video_scaler_create(codec_t codec, int in_width, int in_height,
+                int out_width, int out_height, enum scale_filter filter);
+/**
+ * Scales a frame. Lines are processed in parallel.
+ *
+ * @param in  input buffer with line length vc_get_linesize(in_width)
+ * @param out output buffer with line length vc_get_linesize(out_width)
+ */
+void video_scaler_process(struct video_scaler *s, const char *in, char *out);
+void video_scaler_destroy(struct video_scaler *s);
+
+/**
+ * Limits instruction set used by the kernels (the best one supported by the
+ * CPU is used by default).
+ *
+ * @return the instruction set that will be actually used
+ */
+enum video_scaler_isa video_scaler_set_max_isa(enum video_scaler_isa max_isa);
+
+#endif // SCALE_UTILS_H_
@@ -51,9 +51,14 @@
 
 #include <string.h>
 #include <openssl/aes.h>
+#include <openssl/evp.h>
+
+#define GCM_IV_LEN 12
+#define GCM_TAG_LEN 16
 
 struct openssl_decrypt {
         AES_KEY key;
+        EVP_CIPHER_CTX *gcm_ctx;
 
         unsigned char ivec[AES_BLOCK_SIZE];
         unsigned char ecount[AES_BLOCK_SIZE];
@@ -78,6 +83,15 @@ static int openssl_decrypt_init(struct openssl_decrypt **state,
         AES_set_encrypt_key(hash, 128, &s->key);
         // for ECB it should be AES_set_decrypt_key(hash, 128, &s->key);
 
+        s->gcm_ctx = EVP_CIPHER_CTX_new();
+        if (!s->gcm_ctx ||
+                        EVP_DecryptInit_ex(s->gcm_ctx, EVP_aes_128_gcm(), NULL, hash, NULL) != 1 ||
+                        EVP_CIPHER_CTX_ctrl(s->gcm_ctx, EVP_CTRL_GCM_SET_IVLEN, GCM_IV_LEN, NULL) != 1) {
+                EVP_CIPHER_CTX_free(s->gcm_ctx);
+                free(s);
+                return -1;
+        }
+
         *state = s;
         return 0;
 }
@@ -86,6 +100,7 @@ static void openssl_decrypt_destroy(struct openssl_decrypt *s)
 {
         if(!s)
                 return;
+        EVP_CIPHER_CTX_free(s->gcm_ctx);
         free(s);
 }
 
@@ -127,11 +142,45 @@ static void openssl_decrypt_block(struct openssl_decrypt *s,
         }
 }
 
+/**
+ * Decrypts and authenticates packet produced by gcm_encrypt() in openssl_encrypt.cpp
+ *
+ * @retval 0 if authentication tag doesn't match
+ */
+static int gcm_decrypt(EVP_CIPHER_CTX *ctx, const char *ciphertext, int ciphertext_len,
+                const char *aad, int aad_len, char *plaintext)
+{
+        uint32_t data_len;
+        if (ciphertext_len < (int) sizeof(uint32_t)) {
+                return 0;
+        }
+        memcpy(&data_len, ciphertext, sizeof(uint32_t));
+        if ((uint64_t) data_len + sizeof(uint32_t) + GCM_IV_LEN + GCM_TAG_LEN > (uint64_t) ciphertext_len) {
+                return 0;
+        }
+        const unsigned char *iv = (const unsigned char *) ciphertext + sizeof(uint32_t);
+        const unsigned char *in = iv + GCM_IV_LEN;
+        int len;
+        if (EVP_DecryptInit_ex(ctx, NULL, NULL, NULL, iv) != 1 ||
+                        (aad_len > 0 && EVP_DecryptUpdate(ctx, NULL, &len, (const unsigned char *) aad, aad_len) != 1) ||
+                        EVP_DecryptUpdate(ctx, NULL, &len, (const unsigned char *) ciphertext, sizeof(uint32_t)) != 1 ||
+                        EVP_DecryptUpdate(ctx, (unsigned char *) plaintext, &len, in, data_len) != 1 ||
+                        EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, GCM_TAG_LEN, const_cast<unsigned char *>(in + data_len)) != 1 ||
+                        EVP_DecryptFinal_ex(ctx, (unsigned char *) plaintext + len, &len) != 1) {
+                return 0;
+        }
+        return data_len;
+}
+
 static int openssl_decrypt(struct openssl_decrypt *decrypt,
                 const char *ciphertext, int ciphertext_len,
                 const char *aad, int aad_len,
                 char *plaintext, enum openssl_mode mode)
 {
+        if (mode == MODE_AES128_GCM) {
+                return gcm_decrypt(decrypt->gcm_ctx, ciphertext, ciphertext_len, aad, aad_len, plaintext);
+        }
+
         UNUSED(ciphertext_len);
         uint32_t data_len;
         memcpy(&data_len, ciphertext, sizeof(uint32_t));
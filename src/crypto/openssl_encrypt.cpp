@@ -46,11 +46,18 @@
 #include "crypto/openssl_encrypt.h"
 #include "debug.h"
 #include "lib_common.h"
+#include "utils/worker.h"
 
+#include <atomic>
 #include <string.h>
 #include <openssl/aes.h>
+#include <openssl/evp.h>
 #include <openssl/rand.h>
 
+#define GCM_IV_LEN 12
+#define GCM_TAG_LEN 16
+#define GCM_BATCH_GRAIN 16 ///< minimal number of packets encrypted by one worker
+
 struct openssl_encrypt {
         AES_KEY key;
 
@@ -59,8 +66,27 @@ struct openssl_encrypt {
         unsigned char ivec[16];
         unsigned int num;
         unsigned char ecount[16];
+
+        unsigned char hash[16];       ///< key
+        EVP_CIPHER_CTX *gcm_ctx;
+        unsigned char gcm_salt[4];    ///< random prefix of GCM IV
+        uint64_t gcm_counter;         ///< per-packet part of GCM IV
 };
 
+static EVP_CIPHER_CTX *gcm_ctx_new(const unsigned char *key)
+{
+        EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+        if (!ctx) {
+                return NULL;
+        }
+        if (EVP_EncryptInit_ex(ctx, EVP_aes_128_gcm(), NULL, key, NULL) != 1 ||
+                        EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, GCM_IV_LEN, NULL) != 1) {
+                EVP_CIPHER_CTX_free(ctx);
+                return NULL;
+        }
+        return ctx;
+}
+
 static int openssl_encrypt_init(struct openssl_encrypt **state, const char *passphrase,
                 enum openssl_mode mode)
 {
@@ -76,12 +102,23 @@ static int openssl_encrypt_init(struct openssl_encrypt **state, const char *pass
         MD5Final(hash, &context);
 
         AES_set_encrypt_key(hash, 128, &s->key);
+        memcpy(s->hash, hash, sizeof hash);
         if (!RAND_bytes(s->ivec, 8)) {
                 free(s);
                 return -1;
         }
         s->mode = mode;
-        assert(s->mode == MODE_AES128_CFB || MODE_AES128_CTR); // only functional by now
+        assert(s->mode == MODE_AES128_CFB || s->mode == MODE_AES128_CTR ||
+                        s->mode == MODE_AES128_GCM);
+
+        if (s->mode == MODE_AES128_GCM) {
+                if (!RAND_bytes(s->gcm_salt, sizeof s->gcm_salt) ||
+                                !RAND_bytes((unsigned char *) &s->gcm_counter, sizeof s->gcm_counter) ||
+                                (s->gcm_ctx = gcm_ctx_new(s->hash)) == NULL) {
+                        free(s);
+                        return -1;
+                }
+        }
 
         *state = s;
         return 0;
@@ -127,17 +164,55 @@ static void openssl_encrypt_block(struct openssl_encrypt *s, unsigned char *plai
                         AES_ecb_encrypt(plaintext, ciphertext,
                                         &s->key, AES_ENCRYPT);
                         break;
+                default: // GCM is not block-wise
+                        abort();
         }
 }
 
 static void openssl_encrypt_destroy(struct openssl_encrypt *s)
 {
+        if (s->gcm_ctx) {
+                EVP_CIPHER_CTX_free(s->gcm_ctx);
+        }
         free(s);
 }
 
+/**
+ * Output format: data_len (4 B) | IV (12 B) | ciphertext | tag (16 B)
+ *
+ * AAD and data_len are authenticated.
+ */
+static int gcm_encrypt(EVP_CIPHER_CTX *ctx, const unsigned char *salt, uint64_t counter,
+                char *plaintext, int data_len, char *aad, int aad_len, char *ciphertext)
+{
+        int len;
+        uint32_t data_len32 = data_len;
+        memcpy(ciphertext, &data_len32, sizeof(uint32_t));
+        unsigned char *iv = (unsigned char *) ciphertext + sizeof(uint32_t);
+        memcpy(iv, salt, 4);
+        memcpy(iv + 4, &counter, sizeof counter);
+        unsigned char *out = iv + GCM_IV_LEN;
+
+        if (EVP_EncryptInit_ex(ctx, NULL, NULL, NULL, iv) != 1 ||
+                        (aad_len > 0 && EVP_EncryptUpdate(ctx, NULL, &len, (unsigned char *) aad, aad_len) != 1) ||
+                        EVP_EncryptUpdate(ctx, NULL, &len, (unsigned char *) ciphertext, sizeof(uint32_t)) != 1 ||
+                        EVP_EncryptUpdate(ctx, out, &len, (unsigned char *) plaintext, data_len) != 1 ||
+                        EVP_EncryptFinal_ex(ctx, out + len, &len) != 1 ||
+                        EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, GCM_TAG_LEN, out + data_len) != 1) {
+                log_msg(LOG_LEVEL_ERROR, "[Encrypt] AES-GCM encryption failed!\n");
+                return 0;
+        }
+        return sizeof(uint32_t) + GCM_IV_LEN + data_len + GCM_TAG_LEN;
+}
+
 static int openssl_encrypt(struct openssl_encrypt *encryption,
                 char *plaintext, int data_len, char *aad, int aad_len, char *ciphertext)
 {
+        if (encryption->mode == MODE_AES128_GCM) {
+                return gcm_encrypt(encryption->gcm_ctx, encryption->gcm_salt, encryption->gcm_counter++,
+                                plaintext, data_len, aad, aad_len, ciphertext);
+        }
+
         uint32_t crc = 0xffffffff;
         memcpy(ciphertext, &data_len, sizeof(uint32_t));
         ciphertext += sizeof(uint32_t);
@@ -167,6 +242,42 @@ static int openssl_encrypt(struct openssl_encrypt *encryption,
         return data_len + sizeof(crc) + 16 + sizeof(uint32_t);
 }
 
+static int openssl_encrypt_batch(struct openssl_encrypt *encryption,
+                struct openssl_encrypt_packet *packets, int count, int aad_len)
+{
+        if (encryption->mode != MODE_AES128_GCM) { // CFB and CTR state is chained among packets
+                for (int i = 0; i < count; ++i) {
+                        packets[i].ciphertext_len = openssl_encrypt(encryption,
+                                        packets[i].plaintext, packets[i].plaintext_len,
+                                        packets[i].aad, aad_len, packets[i].ciphertext);
+                }
+                return 0;
+        }
+
+        uint64_t counter = encryption->gcm_counter;
+        encryption->gcm_counter += count;
+        std::atomic<bool> failed{false};
+        parallel_for(0, count, [encryption, packets, aad_len, counter, &failed](int start, int end) {
+                EVP_CIPHER_CTX *ctx = gcm_ctx_new(encryption->hash);
+                if (!ctx) {
+                        log_msg(LOG_LEVEL_ERROR, "[Encrypt] Unable to create AES-GCM context!\n");
+                        failed = true;
+                        return;
+                }
+                for (int i = start; i < end; ++i) {
+                        packets[i].ciphertext_len = gcm_encrypt(ctx, encryption->gcm_salt, counter + i,
+                                        packets[i].plaintext, packets[i].plaintext_len,
+                                        packets[i].aad, aad_len, packets[i].ciphertext);
+                        if (packets[i].ciphertext_len == 0) {
+                                failed = true;
+                        }
+                }
+                EVP_CIPHER_CTX_free(ctx);
+        }, GCM_BATCH_GRAIN);
+
+        return failed ? -1 : 0;
+}
+
 static int openssl_get_overhead(struct openssl_encrypt *s)
 {
         switch(s->mode) {
@@ -174,6 +285,9 @@ static int openssl_get_overhead(struct openssl_encrypt *s)
                 case MODE_AES128_CTR:
                         return sizeof(uint32_t) /* data_len */ +
                                 16 /* nonce + counter */ + sizeof(uint32_t) /* crc */;
+                case MODE_AES128_GCM:
+                        return sizeof(uint32_t) /* data_len */ +
+                                GCM_IV_LEN + GCM_TAG_LEN;
                 default:
                         abort();
         }
@@ -184,6 +298,7 @@ static const struct openssl_encrypt_info functions = {
         openssl_encrypt_destroy,
         openssl_encrypt,
         openssl_get_overhead,
+        openssl_encrypt_batch,
 };
 
 REGISTER_MODULE(openssl_encrypt, &functions, LIBRARY_CLASS_UNDEFINED, OPENSSL_ENCRYPT_ABI_VERSION);
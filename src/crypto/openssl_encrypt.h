@@ -46,16 +46,28 @@ enum openssl_mode {
         MODE_AES128_NONE = 0,
         MODE_AES128_CTR = 1, // no autenticity, only integrity (CRC)
         MODE_AES128_CFB = 2,
-        MODE_AES128_MAX = MODE_AES128_CFB,
+        MODE_AES128_GCM = 3, // authenticated encryption
+        MODE_AES128_MAX = MODE_AES128_GCM,
         MODE_AES128_ECB = -1, // do not use
 };
 
 
-#define MAX_CRYPTO_EXTRA_DATA 24 // == maximal overhead of available encryptions
+#define MAX_CRYPTO_EXTRA_DATA 32 // == maximal overhead of available encryptions
 #define MAX_CRYPTO_PAD 0 // CTR does not need padding
 #define MAX_CRYPTO_EXCEED (MAX_CRYPTO_EXTRA_DATA + MAX_CRYPTO_PAD)
 
-#define OPENSSL_ENCRYPT_ABI_VERSION 1
+#define OPENSSL_ENCRYPT_ABI_VERSION 2
+
+/**
+ * Packet description for openssl_encrypt_info::encrypt_batch()
+ */
+struct openssl_encrypt_packet {
+        char *plaintext;
+        int plaintext_len;
+        char *aad;          ///< AAD, length is given by encrypt_batch() parameter
+        char *ciphertext;   ///< buffer of at least (plaintext_len + MAX_CRYPTO_EXCEED) bytes
+        int ciphertext_len; ///< [out] size of written ciphertext
+};
 
 struct openssl_encrypt_info {
         /**
@@ -96,6 +108,20 @@ struct openssl_encrypt_info {
          * @returns max overhead (must be <= MAX_CRYPTO_EXCEED)
          */
         int (*get_overhead)(struct openssl_encrypt *encryption);
+        /**
+         * Encrypts multiple packets. The result is the same as if encrypt() was called
+         * for every packet in order, but the packets may be encrypted in parallel
+         * if the mode allows it (GCM).
+         *
+         * @param[in] encryption    state
+         * @param[in,out] packets   packets to be encrypted
+         * @param[in] count         number of packets
+         * @param[in] aad_len       length of AAD of every packet
+         * @retval    0             success
+         * @retval   <0             some of the packets could not have been encrypted
+         */
+        int (*encrypt_batch)(struct openssl_encrypt *encryption,
+                        struct openssl_encrypt_packet *packets, int count, int aad_len);
 };
 
 #endif // __cplusplus
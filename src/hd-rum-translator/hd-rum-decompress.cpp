@@ -42,14 +42,17 @@ struct state_transcoder_decompress : public frame_recv_delegate {
                 inline message(shared_ptr<video_frame> && f) : type(FRAME), frame(std::move(f)) {}
                 inline message() : type(QUIT) {}
                 inline message(int ri) : type(REMOVE_INDEX), remove_index(ri) {}
-                inline message(void *ns) : type(NEW_RECOMPRESS), new_recompress_state(ns) {}
+                inline message(void *ns, bool a) : type(NEW_RECOMPRESS), new_recompress{ns, a} {}
                 inline message(message && original);
                 inline ~message();
                 enum { FRAME, REMOVE_INDEX, NEW_RECOMPRESS, QUIT } type;
                 union {
                         shared_ptr<video_frame> frame;
                         int remove_index;
-                        void *new_recompress_state;
+                        struct {
+                                void *state;
+                                bool active;
+                        } new_recompress;
                 };
         };
 
@@ -113,7 +116,7 @@ inline state_transcoder_decompress::message::message(message && original)
                         remove_index = original.remove_index;
                         break;
                 case NEW_RECOMPRESS:
-                        new_recompress_state = original.new_recompress_state;
+                        new_recompress = original.new_recompress;
                         break;
                 case QUIT:
                         break;
@@ -137,18 +140,43 @@ void hd_rum_decompress_set_active(void *state, void *recompress_port, bool activ
         for (auto && port : s->output_ports) {
                 if (port.state == recompress_port) {
                         port.active = active;
+                        recompress_set_active(recompress_port, active);
                 }
         }
 }
 
+/**
+ * Passes a copy of the packet to the embedded receiver. The packet is
+ * injected directly in its receive queue if possible, otherwise it is sent
+ * over the loopback.
+ */
 ssize_t hd_rum_decompress_write(void *state, void *buf, size_t count)
 {
         struct state_transcoder_decompress *s = (struct state_transcoder_decompress *) state;
 
+        if (rtp_inject_rtp_data(s->video_rxtx->m_network_devices[0], (char *) buf, count, NULL, NULL)) {
+                return count;
+        }
         return rtp_send_raw_rtp_data(s->video_rxtx->m_network_devices[0],
                         (char *) buf, count);
 }
 
+/**
+ * Hands the packet over to the embedded receiver without copying.
+ *
+ * @param buf     packet, must be preceded by UDP_INJECT_HEADROOM bytes of
+ *                writable space, its content is modified by the receiver
+ * @param deleter called as deleter(buf, udata) when the packet is no longer used
+ * @retval false  packet was not accepted, caller keeps the ownership
+ */
+bool hd_rum_decompress_write_owned(void *state, char *buf, size_t count,
+                void (*deleter)(char *buf, void *udata), void *udata)
+{
+        struct state_transcoder_decompress *s = (struct state_transcoder_decompress *) state;
+
+        return rtp_inject_rtp_data(s->video_rxtx->m_network_devices[0], buf, count, deleter, udata);
+}
+
 void state_transcoder_decompress::worker()
 {
         bool should_exit = false;
@@ -168,7 +196,8 @@ void state_transcoder_decompress::worker()
                         output_ports.erase(output_ports.begin() + msg.remove_index);
                         break;
                 case message::NEW_RECOMPRESS:
-                        output_ports.emplace_back(msg.new_recompress_state, true);
+                        output_ports.emplace_back(msg.new_recompress.state, msg.new_recompress.active);
+                        recompress_set_active(msg.new_recompress.state, msg.new_recompress.active);
                         break;
                 case message::FRAME:
                         for (unsigned int i = 0; i < output_ports.size(); ++i) {
@@ -300,12 +329,12 @@ void hd_rum_decompress_remove_port(void *state, int index) {
 }
 
 
-void hd_rum_decompress_append_port(void *state, void *recompress_state)
+void hd_rum_decompress_append_port(void *state, void *recompress_state, bool active)
 {
         struct state_transcoder_decompress *s = (struct state_transcoder_decompress *) state;
 
         unique_lock<mutex> l(s->lock);
-        s->received_frame.push(recompress_state);
+        s->received_frame.emplace(recompress_state, active);
         s->have_frame_cv.notify_one();
         s->frame_consumed_cv.wait(l, [s]{ return s->received_frame.size() == 0; });
 }
@@ -11,11 +11,13 @@ struct hd_rum_output_conf{
 };
 
 ssize_t hd_rum_decompress_write(void *state, void *buf, size_t count);
+bool hd_rum_decompress_write_owned(void *state, char *buf, size_t count,
+                void (*deleter)(char *buf, void *udata), void *udata);
 void *hd_rum_decompress_init(struct module *parent, struct hd_rum_output_conf conf, const char *capture_filter);
 void hd_rum_decompress_done(void *state);
 void hd_rum_decompress_set_active(void *decompress_state, void *recompress_state, bool active);
 void hd_rum_decompress_remove_port(void *decompress_state, int index);
-void hd_rum_decompress_append_port(void *decompress_state, void *recompress_state);
+void hd_rum_decompress_append_port(void *decompress_state, void *recompress_state, bool active);
 int hd_rum_decompress_get_num_active_ports(void *decompress_state);
 
 #ifdef __cplusplus
@@ -8,19 +8,37 @@
 
 #include "debug.h"
 #include "host.h"
+#include "messaging.h"
+#include "module.h"
 #include "rtp/rtp.h"
+#include "video_compress.h"
 
 #include "video_rxtx/ultragrid_rtp.h"
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 using namespace std;
 
+struct recompress_group;
+
+/**
+ * Output port - sends frames compressed by its group (only FEC, packetization
+ * and sending is done per port).
+ */
 struct state_recompress {
-        state_recompress(unique_ptr<ultragrid_rtp_video_rxtx> && vr, string const & h, int tp)
+        state_recompress(unique_ptr<ultragrid_rtp_video_rxtx> && vr, string const & h, int tp,
+                        const char *c, int m, const char *f, long long b)
                 : video_rxtx(std::move(vr)), host(h), t0(chrono::system_clock::now()),
-                frames(0), tx_port(tp) {
+                frames(0), tx_port(tp), compress(c), mtu(m), fec(f ? f : ""), bitrate(b) {
         }
 
         unique_ptr<ultragrid_rtp_video_rxtx> video_rxtx;
@@ -29,8 +47,211 @@ struct state_recompress {
         chrono::system_clock::time_point t0;
         int frames;
         int tx_port;
+
+        string compress;                ///< requested compression
+        string compress_params;         ///< parameters set with "compress param", applied on top of compress
+        int mtu;
+        string fec;
+        long long bitrate;
+
+        struct module compress_mod;     ///< receives compress messages addressed to this port
+        mutex lock;                     ///< serializes compress changes with frame processing
+
+        atomic<bool> active{false};
+        struct recompress_group *group = nullptr; ///< NULL until the port is first used (forwarding ports)
 };
 
+/**
+ * Ports with identical compression, FEC, MTU and bitrate share one
+ * compression. Ports join the group when they start transcoding, leave it
+ * when deleted and move to another group when their compression is changed.
+ */
+struct recompress_group {
+        string key;
+        struct module mod;                      ///< parent of the compress module
+        struct compress_state *compress = nullptr;
+        thread sender_thread;
+
+        mutex lock;                             ///< protects members and sending
+        condition_variable sent_cv;
+        bool sending = false;                   ///< sender is passing a frame to (a snapshot of) members
+        vector<state_recompress *> members;
+
+        shared_ptr<video_frame> last_input;     ///< last frame passed to compress (decompress worker only)
+};
+
+static mutex groups_lock;
+static map<string, struct recompress_group *> groups;
+
+/// Passes compressed frames of the group to its active members.
+static void group_sender(struct recompress_group *g)
+{
+        vector<state_recompress *> ports;
+        while (shared_ptr<video_frame> frame = compress_pop(g->compress)) {
+                {
+                        lock_guard<mutex> lk(g->lock);
+                        ports = g->members;
+                        g->sending = true;
+                }
+                for (auto port : ports) {
+                        if (!port->active) {
+                                continue;
+                        }
+                        port->frames += 1;
+                        chrono::system_clock::time_point now = chrono::system_clock::now();
+                        double seconds = chrono::duration_cast<chrono::microseconds>(now - port->t0).count() / 1000000.0;
+                        if(seconds > 5) {
+                                double fps = port->frames / seconds;
+                                log_msg(LOG_LEVEL_INFO, "[0x%08lx->%s:%d:0x%08lx] %d frames in %g seconds = %g FPS (group of %zu)\n",
+                                                (unsigned long) frame->ssrc,
+                                                port->host.c_str(), port->tx_port,
+                                                (unsigned long) port->video_rxtx->get_ssrc(),
+                                                port->frames, seconds, fps, ports.size());
+                                port->t0 = now;
+                                port->frames = 0;
+                        }
+                        port->video_rxtx->send(frame);
+                }
+                {
+                        lock_guard<mutex> lk(g->lock);
+                        g->sending = false;
+                }
+                g->sent_cv.notify_all();
+        }
+}
+
+/// @returns group for settings of the port, creates it if there is none; must be called with groups_lock held
+static struct recompress_group *get_group(struct module *root, state_recompress *port)
+{
+        string key = port->compress + "|" + port->compress_params + "|" + port->fec + "|" +
+                to_string(port->mtu) + "|" + to_string(port->bitrate);
+        auto it = groups.find(key);
+        if (it != groups.end()) {
+                return it->second;
+        }
+
+        auto g = new recompress_group();
+        g->key = key;
+        module_init_default(&g->mod);
+        g->mod.cls = MODULE_CLASS_DATA;
+        module_register(&g->mod, root);
+        if (compress_init(&g->mod, port->compress.c_str(), &g->compress) != 0) {
+                module_done(&g->mod);
+                delete g;
+                return nullptr;
+        }
+        if (!port->compress_params.empty()) {
+                auto msg = (struct msg_change_compress_data *) new_message(sizeof(struct msg_change_compress_data));
+                msg->what = CHANGE_PARAMS;
+                strncpy(msg->config_string, port->compress_params.c_str(), sizeof msg->config_string - 1);
+                free_response(send_message_to_receiver(CAST_MODULE(g->compress), (struct message *) msg));
+        }
+        g->sender_thread = thread(group_sender, g);
+        groups[key] = g;
+        return g;
+}
+
+/// adds port to the group matching its settings; must be called with groups_lock held
+static bool group_join(state_recompress *port)
+{
+        struct recompress_group *g = get_group(get_root_module(&port->compress_mod), port);
+        if (!g) {
+                return false;
+        }
+
+        lock_guard<mutex> lk(g->lock);
+        g->members.push_back(port);
+        port->group = g;
+        if (g->members.size() > 1) {
+                log_msg(LOG_LEVEL_NOTICE, "Output port %s shares compression \"%s\" with %zu other port(s).\n",
+                                port->video_rxtx->m_port_id.c_str(), port->compress.c_str(), g->members.size() - 1);
+        }
+        return true;
+}
+
+/// removes port from its group (if any) and destroys the group if empty; must be called with groups_lock held
+static void group_leave(state_recompress *port)
+{
+        struct recompress_group *g = port->group;
+        if (!g) {
+                return;
+        }
+        port->group = nullptr;
+
+        {
+                unique_lock<mutex> lk(g->lock);
+                g->members.erase(remove(g->members.begin(), g->members.end(), port), g->members.end());
+                // the sender may be still passing a frame to the port
+                g->sent_cv.wait(lk, [g]{ return !g->sending; });
+                if (!g->members.empty()) {
+                        return;
+                }
+        }
+
+        groups.erase(g->key);
+        compress_frame(g->compress, nullptr); // poisoned pill
+        g->sender_thread.join();
+        module_done(CAST_MODULE(g->compress));
+        module_done(&g->mod);
+        delete g;
+}
+
+/**
+ * Moves port to the group for the new compression settings. If it fails, the
+ * port is kept with the old settings.
+ */
+static bool port_change_compress(state_recompress *port, string const & compress, string const & params)
+{
+        lock_guard<mutex> lk(groups_lock);
+        string old_compress = port->compress;
+        string old_params = port->compress_params;
+        bool joined = port->group != nullptr;
+
+        port->compress = compress;
+        port->compress_params = params;
+        if (!joined) { // will be used when the port starts transcoding
+                return true;
+        }
+
+        group_leave(port);
+        if (group_join(port)) {
+                return true;
+        }
+
+        log_msg(LOG_LEVEL_ERROR, "Unable to change compression of output port %s to \"%s\"!\n",
+                        port->video_rxtx->m_port_id.c_str(), compress.c_str());
+        port->compress = old_compress;
+        port->compress_params = old_params;
+        group_join(port);
+        return false;
+}
+
+/**
+ * Processes compress messages as soon as they arrive, so that the sender gets
+ * the response even if the port is not transcoding at the moment (forwarding
+ * or inactive port, no input).
+ */
+static void port_process_messages(struct module *mod)
+{
+        auto port = static_cast<state_recompress *>(mod->priv_data);
+        lock_guard<mutex> lk(port->lock);
+        struct msg_change_compress_data *msg;
+        while ((msg = (struct msg_change_compress_data *) check_message(&port->compress_mod))) {
+                bool ret;
+                if (msg->what == CHANGE_PARAMS) {
+                        ret = port_change_compress(port, port->compress, msg->config_string);
+                } else {
+                        ret = port_change_compress(port, msg->config_string, "");
+                }
+                free_message((struct message *) msg,
+                                new_response(ret ? RESPONSE_OK : RESPONSE_INT_SERV_ERR, NULL));
+        }
+}
+
+/**
+ * @param compress compression of the port or NULL for a forwarding port,
+ *                 which transmits uncompressed if switched to transcoding
+ */
 void *recompress_init(struct module *parent,
                 const char *host, const char *compress, unsigned short rx_port,
                 unsigned short tx_port, int mtu, char *fec, long long bitrate)
@@ -43,7 +264,7 @@ void *recompress_init(struct module *parent,
         // common
         params["parent"].ptr = parent;
         params["exporter"].ptr = NULL;
-        params["compression"].ptr = (void *) compress;
+        params["compression"].ptr = NULL; // compressed by the group
         params["rxtx_mode"].i = MODE_SENDER;
         params["paused"].b = false;
 
@@ -64,6 +285,7 @@ void *recompress_init(struct module *parent,
         params["decoder_mode"].l = VIDEO_NORMAL;
         params["display_device"].ptr = NULL;
 
+        state_recompress *port;
         try {
                 auto rxtx = video_rxtx::create("ultragrid_rtp", params);
                 if (strchr(host, ':') != NULL) {
@@ -72,36 +294,69 @@ void *recompress_init(struct module *parent,
                         rxtx->m_port_id = string(host) + ":" + to_string(tx_port);
                 }
 
-                return new state_recompress(
+                port = new state_recompress(
                                 decltype(state_recompress::video_rxtx)(dynamic_cast<ultragrid_rtp_video_rxtx *>(rxtx)),
                                 host,
-                                tx_port
+                                tx_port,
+                                compress ? compress : "none",
+                                mtu, fec, bitrate
                                 );
         } catch (...) {
                 return nullptr;
         }
+
+        // take place of the compress of the port sender so that "compress" messages reach us
+        module_init_default(&port->compress_mod);
+        port->compress_mod.cls = MODULE_CLASS_COMPRESS;
+        port->compress_mod.priv_data = port;
+        port->compress_mod.new_message = port_process_messages;
+        module_register(&port->compress_mod, get_module(parent, "sender"));
+
+        if (compress) {
+                lock_guard<mutex> lk(groups_lock);
+                if (!group_join(port)) {
+                        module_done(&port->compress_mod);
+                        port->video_rxtx->join();
+                        delete port;
+                        return nullptr;
+                }
+        }
+
+        return port;
 }
 
+/**
+ * Passes frame to the compression of the port group. The frame is compressed
+ * only once if it is passed for more ports of the same group.
+ *
+ * @note
+ * Must be called from a single thread.
+ */
 void recompress_process_async(void *state, shared_ptr<video_frame> frame)
 {
         auto s = static_cast<state_recompress *>(state);
+        lock_guard<mutex> port_lk(s->lock);
 
-        s->frames += 1;
+        if (!s->group) {
+                lock_guard<mutex> lk(groups_lock);
+                if (!group_join(s)) {
+                        return;
+                }
+        }
+        struct recompress_group *g = s->group;
 
-        chrono::system_clock::time_point now = chrono::system_clock::now();
-        double seconds = chrono::duration_cast<chrono::microseconds>(now - s->t0).count() / 1000000.0;
-        if(seconds > 5) {
-                double fps = s->frames / seconds;
-                log_msg(LOG_LEVEL_INFO, "[0x%08lx->%s:%d:0x%08lx] %d frames in %g seconds = %g FPS\n",
-                                frame->ssrc,
-                                s->host.c_str(), s->tx_port,
-                                s->video_rxtx->get_ssrc(),
-                                s->frames, seconds, fps);
-                s->t0 = now;
-                s->frames = 0;
+        if (g->last_input == frame) {
+                return;
         }
+        g->last_input = frame;
+        compress_frame(g->compress, std::move(frame));
+}
+
+void recompress_set_active(void *state, bool active)
+{
+        auto s = static_cast<state_recompress *>(state);
 
-        s->video_rxtx->send(frame);
+        s->active = active;
 }
 
 void recompress_assign_ssrc(void *state, uint32_t ssrc)
@@ -122,8 +377,13 @@ void recompress_done(void *state)
 {
         auto s = static_cast<state_recompress *>(state);
 
+        module_done(&s->compress_mod);
+        {
+                lock_guard<mutex> lk(groups_lock);
+                group_leave(s);
+        }
+
         s->video_rxtx->join();
 
         delete s;
 }
-
@@ -15,6 +15,7 @@ void *recompress_init(struct module *parent, const char *host, const char *compr
                 unsigned short rx_port, unsigned short tx_port, int mtu, char *fec,
                 long long bitrate);
 void recompress_assign_ssrc(void *state, uint32_t ssrc);
+void recompress_set_active(void *state, bool active);
 void recompress_done(void *state);
 uint32_t recompress_get_ssrc(void *state);
 
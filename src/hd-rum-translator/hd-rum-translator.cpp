@@ -22,18 +22,28 @@
 #include "module.h"
 #include "rtp/net_udp.h"
 #include "utils/misc.h"
+#include "utils/spsc_queue.h"
 #include "tv.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cinttypes>
+#include <condition_variable>
 #include <map>
+#include <mutex>
+#include <new>
 #include <string>
+#include <thread>
 #include <vector>
 
 using namespace std;
 
-struct item;
+struct fwd_sender;
+struct packet_buf_prefix;
 
 #define REPLICA_MAGIC 0xd2ff3323
+#define DEFAULT_REPLICA_BACKLOG 2048 ///< packets, used if sender threads are enabled
+#define SENDER_BATCH 64 ///< max packets sent to one replica at once
 
 struct replica {
     replica(const char *addr, uint16_t rx_port, uint16_t tx_port, int bufsize, struct module *parent, int force_ip_version) {
@@ -55,10 +65,14 @@ struct replica {
         module_register(&mod, parent);
         type = replica::type_t::NONE;
         recompress = nullptr;
+        backlog = nullptr;
+        sender = nullptr;
     }
 
     ~replica() {
         assert(magic == REPLICA_MAGIC);
+        assert(sender == nullptr);
+        delete backlog;
         module_done(&mod);
         udp_exit(sock);
     }
@@ -76,47 +90,68 @@ struct replica {
     enum type_t type;
     socket_udp *sock;
     void *recompress;
+
+    // used only if forwarding is done by sender threads
+    spsc_queue<char *> *backlog;        ///< packets waiting for the sender
+    struct fwd_sender *sender;          ///< thread that sends to this replica
+    std::atomic<unsigned long long> dropped{0}; ///< packets dropped due to full backlog
+};
+
+/**
+ * Thread forwarding packets to a subset of replicas (that don't need
+ * transcoding). Packets are passed from the writer in per-replica
+ * backlogs.
+ */
+struct fwd_sender {
+    std::thread thread;
+    std::mutex lock;
+    std::condition_variable cv;
+    std::atomic<bool> pending{false};   ///< some of replica backlogs may be non-empty
+    bool should_exit = false;
+
+    std::mutex replicas_lock;           ///< held while sending, writer locks it when changing replicas
+    vector<replica *> replicas;
 };
 
 struct hd_rum_translator_state {
-    hd_rum_translator_state() : mod(), control_state(nullptr), queue(nullptr), qhead(nullptr),
-            qtail(nullptr), qempty(1), qfull(0), decompress(nullptr) {
+    hd_rum_translator_state() : mod(), control_state(nullptr), queue(nullptr), decompress(nullptr) {
         module_init_default(&mod);
         mod.cls = MODULE_CLASS_ROOT;
-        pthread_mutex_init(&qempty_mtx, NULL);
-        pthread_mutex_init(&qfull_mtx, NULL);
-        pthread_cond_init(&qempty_cond, NULL);
-        pthread_cond_init(&qfull_cond, NULL);
     }
     ~hd_rum_translator_state() {
-        pthread_mutex_destroy(&qempty_mtx);
-        pthread_mutex_destroy(&qfull_mtx);
-        pthread_cond_destroy(&qempty_cond);
-        pthread_cond_destroy(&qfull_cond);
         module_done(&mod);
     }
     struct module mod;
     struct control_state *control_state;
-    struct item *queue;
-    struct item *qhead;
-    struct item *qtail;
-    int qempty;
-    int qfull;
-    pthread_mutex_t qempty_mtx;
-    pthread_mutex_t qfull_mtx;
-    pthread_cond_t qempty_cond;
-    pthread_cond_t qfull_cond;
+
+    /// received packets passed from the reader (main thread) to the writer
+    spsc_queue<char *> *queue;
+    std::mutex queue_lock;
+    std::condition_variable queue_cv;
+    std::atomic<bool> writer_waiting{false}; ///< queue was empty, writer waits for notification
+    std::atomic<bool> reader_waiting{false}; ///< queue was full, reader waits for notification
+
+    // packet buffer pool - buffers are taken by the reader only
+    vector<char *> buf_slabs;
+    struct packet_buf_prefix *free_bufs = nullptr;              ///< reader's private list
+    std::atomic<struct packet_buf_prefix *> returned_bufs{nullptr}; ///< released by other threads
 
     vector<replica *> replicas;
     void *decompress;
+
+    vector<struct fwd_sender *> senders; ///< empty if the writer forwards packets itself
+    int replica_backlog = DEFAULT_REPLICA_BACKLOG;
+
+    std::atomic<unsigned long long> fwd_bytes{0};
+    std::atomic<unsigned long long> fwd_packets{0};
+    std::atomic<unsigned long long> fwd_drops{0};
 };
 
 /*
  * Prototypes
  */
-static struct item *qinit(int qsize);
-static void qdestroy(struct item *queue);
 static void *writer(void *arg);
+static void sender_run(struct hd_rum_translator_state *s, struct fwd_sender *sender);
 static void signal_handler(int signal);
 void exit_uv(int status);
 
@@ -162,6 +197,7 @@ static void signal_handler(int signal)
 struct wsa_aux_storage {
     WSAOVERLAPPED *overlapped;
     int ref;
+    struct hd_rum_translator_state *state;
 };
 #define ALIGNMENT std::alignment_of<wsa_aux_storage>::value
 #define OFFSET ((MAX_PKT_SIZE + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT)
@@ -170,42 +206,127 @@ struct wsa_aux_storage {
 #define SIZE MAX_PKT_SIZE
 #endif
 
-struct item {
-    struct item *next;
-    long size;
-    char *buf;
+/**
+ * Stored in front of each packet buffer (in a separate cache line). The
+ * buffer is shared by the writer and all sender threads that forward it (and
+ * possibly the transcoding receiver) and it is returned to the pool when the
+ * last one releases it. The space between the prefix and the packet data is
+ * used by the transcoding receiver when the buffer is handed over to it.
+ */
+struct packet_buf_prefix {
+    std::atomic<int> ref;
+    long size;                          ///< received length, 0 is a poisoned pill
+    struct packet_buf_prefix *next;     ///< free list link
 };
+#define PACKET_BUF_OFFSET (64 + UDP_INJECT_HEADROOM)
+#define PACKET_BUF_STRIDE (PACKET_BUF_OFFSET + (SIZE + 63) / 64 * 64)
+#define PACKET_POOL_SLAB 256
+static_assert(sizeof(struct packet_buf_prefix) <= PACKET_BUF_OFFSET - UDP_INJECT_HEADROOM, "packet prefix too big");
 
-static struct item *qinit(int qsize)
+static struct packet_buf_prefix *packet_buf_get_prefix(char *buf)
 {
-    struct item *queue;
-    int i;
+    return (struct packet_buf_prefix *)(void *) (buf - PACKET_BUF_OFFSET);
+}
 
-    printf("initializing packet queue for %d items\n", qsize);
+/**
+ * Takes a buffer from the pool, may be called only from the reader thread.
+ * The pool grows by a slab of cache-line-aligned buffers if empty.
+ * @returns buffer with reference count set to 1
+ */
+static char *packet_buf_get(struct hd_rum_translator_state *s)
+{
+    if (s->free_bufs == nullptr) {
+        s->free_bufs = s->returned_bufs.exchange(nullptr, std::memory_order_acquire);
+    }
+    if (s->free_bufs == nullptr) {
+        char *slab = (char *) aligned_malloc(PACKET_POOL_SLAB * PACKET_BUF_STRIDE, 64);
+        if (slab == NULL) {
+            fprintf(stderr, "not enough memory\n");
+            exit(2);
+        }
+        s->buf_slabs.push_back(slab);
+        for (int i = 0; i < PACKET_POOL_SLAB; ++i) {
+            struct packet_buf_prefix *p = new (slab + i * PACKET_BUF_STRIDE) packet_buf_prefix();
+            p->next = s->free_bufs;
+            s->free_bufs = p;
+        }
+    }
+    struct packet_buf_prefix *p = s->free_bufs;
+    s->free_bufs = p->next;
+    p->ref.store(1, std::memory_order_relaxed);
+    return (char *) p + PACKET_BUF_OFFSET;
+}
+
+/// Returns the buffer to the pool if this was the last reference, may be called from any thread.
+static void packet_buf_release(struct hd_rum_translator_state *s, char *buf)
+{
+    struct packet_buf_prefix *p = packet_buf_get_prefix(buf);
+    if (p->ref.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+        return;
+    }
+    p->next = s->returned_bufs.load(std::memory_order_relaxed);
+    while (!s->returned_bufs.compare_exchange_weak(p->next, p, std::memory_order_release,
+                std::memory_order_relaxed)) {
+    }
+}
+
+/// deleter of packets handed over to hd_rum_decompress_write_owned()
+static void packet_buf_deleter(char *buf, void *udata)
+{
+    packet_buf_release((struct hd_rum_translator_state *) udata, buf);
+}
 
-    queue = (struct item *) calloc(qsize, sizeof(struct item));
-    if (queue == NULL) {
-        fprintf(stderr, "not enough memory\n");
-        exit(2);
+static void packet_pool_destroy(struct hd_rum_translator_state *s)
+{
+    for (auto slab : s->buf_slabs) {
+        aligned_free(slab);
     }
+    s->buf_slabs.clear();
+}
+
+/*
+ * The reader and the writer sleep on queue_cv only when the queue is full or
+ * empty, respectively, so the other side signals it only if the waiting flag
+ * is set (the fence pairs with the flag store made under the lock).
+ */
 
-    for (i = 0; i < qsize; i++) {
-        queue[i].buf = (char *) malloc(SIZE);
-        queue[i].next = queue + i + 1;
+/// Passes packet to the writer, blocks if the queue is full.
+static void queue_push(struct hd_rum_translator_state *s, char *buf)
+{
+    if (!s->queue->push(buf)) {
+        unique_lock<mutex> lk(s->queue_lock);
+        s->reader_waiting = true;
+        s->queue_cv.wait(lk, [s, buf]{ return s->queue->push(buf); });
+        s->reader_waiting = false;
+    }
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (s->writer_waiting) {
+        lock_guard<mutex> lk(s->queue_lock);
+        s->queue_cv.notify_all();
     }
-    queue[qsize - 1].next = queue;
+}
 
-    return queue;
+/// Takes a packet from the queue if there is any, doesn't block.
+static bool queue_pop(struct hd_rum_translator_state *s, char **buf)
+{
+    if (!s->queue->pop(*buf)) {
+        return false;
+    }
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (s->reader_waiting) {
+        lock_guard<mutex> lk(s->queue_lock);
+        s->queue_cv.notify_all();
+    }
+    return true;
 }
 
-static void qdestroy(struct item *queue)
+/// Waits until the writer has some packets to process.
+static void queue_wait(struct hd_rum_translator_state *s)
 {
-    struct item *q = queue;
-    do {
-        free(q->buf);
-        q = q->next;
-    } while (q != queue);
-    free(queue);
+    unique_lock<mutex> lk(s->queue_lock);
+    s->writer_waiting = true;
+    s->queue_cv.wait(lk, [s]{ return !s->queue->empty(); });
+    s->writer_waiting = false;
 }
 
 static struct response *change_replica_type(struct hd_rum_translator_state *s,
@@ -239,11 +360,181 @@ static VOID CALLBACK wsa_deleter(DWORD /* dwErrorCode */,
     struct wsa_aux_storage *aux = (struct wsa_aux_storage *) ((char *) lpOverlapped->Pointer + OFFSET);
     if (--aux->ref == 0) {
         free(aux->overlapped);
-        free(lpOverlapped->Pointer);
     }
+    packet_buf_release(aux->state, (char *) lpOverlapped->Pointer);
 }
 #endif
 
+/**
+ * Sends up to SENDER_BATCH packets from the replica backlog (with one
+ * sendmmsg() call if supported).
+ * @returns number of packets sent
+ */
+static int sender_send_backlog(struct hd_rum_translator_state *s, struct replica *r)
+{
+    char *bufs[SENDER_BATCH];
+    int count = 0;
+    while (count < SENDER_BATCH && r->backlog->pop(bufs[count])) {
+        count += 1;
+    }
+    if (count == 0) {
+        return 0;
+    }
+
+    unsigned long long bytes = 0;
+#ifndef WIN32
+    udp_async_start(r->sock, count);
+#endif
+    for (int i = 0; i < count; ++i) {
+        long size = packet_buf_get_prefix(bufs[i])->size;
+#ifdef WIN32
+        ssize_t ret = udp_send(r->sock, bufs[i], size);
+#else
+        struct iovec vec;
+        vec.iov_base = bufs[i];
+        vec.iov_len = size;
+        ssize_t ret = udp_sendv(r->sock, &vec, 1, NULL);
+#endif
+        if (ret < 0) {
+            perror("Hd-rum-translator send");
+        } else {
+            bytes += size;
+        }
+    }
+#ifndef WIN32
+    udp_async_wait(r->sock); // buffers are no longer referenced by the socket
+#endif
+
+    for (int i = 0; i < count; ++i) {
+        packet_buf_release(s, bufs[i]);
+    }
+    s->fwd_bytes.fetch_add(bytes, std::memory_order_relaxed);
+    s->fwd_packets.fetch_add(count, std::memory_order_relaxed);
+
+    return count;
+}
+
+static void sender_run(struct hd_rum_translator_state *s, struct fwd_sender *sender)
+{
+    while (true) {
+        {
+            unique_lock<mutex> lk(sender->lock);
+            sender->cv.wait(lk, [sender]{ return sender->pending.load() || sender->should_exit; });
+            if (sender->should_exit) {
+                break;
+            }
+        }
+        sender->pending.store(false);
+
+        lock_guard<mutex> lk(sender->replicas_lock);
+        int sent;
+        do { // round-robin so that a slow replica doesn't delay the others
+            sent = 0;
+            for (auto r : sender->replicas) {
+                sent += sender_send_backlog(s, r);
+            }
+        } while (sent > 0);
+    }
+}
+
+static void sender_notify(struct fwd_sender *sender)
+{
+    if (!sender->pending.exchange(true)) {
+        lock_guard<mutex> lk(sender->lock);
+        sender->cv.notify_one();
+    }
+}
+
+/// Assigns the replica to the sender thread with the least replicas.
+static void sender_attach_replica(struct hd_rum_translator_state *s, struct replica *r)
+{
+    if (s->senders.empty()) {
+        return;
+    }
+    struct fwd_sender *sender = s->senders[0];
+    for (auto it : s->senders) {
+        if (it->replicas.size() < sender->replicas.size()) {
+            sender = it;
+        }
+    }
+    r->backlog = new spsc_queue<char *>(s->replica_backlog);
+    lock_guard<mutex> lk(sender->replicas_lock);
+    sender->replicas.push_back(r);
+    r->sender = sender;
+}
+
+/// Removes replica from its sender thread and releases packets left in its backlog.
+static void sender_detach_replica(struct hd_rum_translator_state *s, struct replica *r)
+{
+    if (r->sender == nullptr) {
+        return;
+    }
+    {
+        lock_guard<mutex> lk(r->sender->replicas_lock);
+        auto & replicas = r->sender->replicas;
+        replicas.erase(std::find(replicas.begin(), replicas.end(), r));
+    }
+    r->sender = nullptr;
+    char *buf;
+    while (r->backlog->pop(buf)) {
+        packet_buf_release(s, buf);
+    }
+}
+
+static void senders_start(struct hd_rum_translator_state *s, int count)
+{
+    for (int i = 0; i < count; ++i) {
+        struct fwd_sender *sender = new fwd_sender();
+        sender->thread = std::thread(sender_run, s, sender);
+        s->senders.push_back(sender);
+    }
+}
+
+static void senders_stop(struct hd_rum_translator_state *s)
+{
+    for (auto sender : s->senders) {
+        {
+            lock_guard<mutex> lk(sender->lock);
+            sender->should_exit = true;
+        }
+        sender->cv.notify_one();
+        sender->thread.join();
+    }
+    for (auto r : s->replicas) {
+        sender_detach_replica(s, r);
+    }
+    for (auto sender : s->senders) {
+        delete sender;
+    }
+    s->senders.clear();
+}
+
+/**
+ * Passes the packet to the backlogs of all forwarding replicas, each of them
+ * holds a reference to the buffer until the packet is sent. The caller keeps
+ * its own reference.
+ */
+static void forward_to_senders(struct hd_rum_translator_state *s, char *buf)
+{
+    struct packet_buf_prefix *prefix = packet_buf_get_prefix(buf);
+
+    for (auto r : s->replicas) {
+        if (r->type != replica::type_t::USE_SOCK) {
+            continue;
+        }
+        prefix->ref.fetch_add(1, std::memory_order_relaxed);
+        if (r->backlog->push(buf)) {
+            sender_notify(r->sender);
+        } else {
+            prefix->ref.fetch_sub(1, std::memory_order_relaxed);
+            if (r->dropped.fetch_add(1, std::memory_order_relaxed) == 0) {
+                log_msg(LOG_LEVEL_WARNING, "Output port %s cannot keep up, dropping packets.\n", r->mod.name);
+            }
+            s->fwd_drops.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+}
+
 static void *writer(void *arg)
 {
     struct hd_rum_translator_state *s =
@@ -287,6 +578,7 @@ static void *writer(void *arg)
                 }
                 if (index >= 0) {
                     hd_rum_decompress_remove_port(s->decompress, index);
+                    sender_detach_replica(s, s->replicas[index]);
                     delete s->replicas[index];
                     s->replicas.erase(s->replicas.begin() + index);
                     log_msg(LOG_LEVEL_NOTICE, "Deleted output port %d.\n", index);
@@ -333,6 +625,7 @@ static void *writer(void *arg)
                     continue;
                 }
                 s->replicas.push_back(rep);
+                sender_attach_replica(s, rep);
 
                 if (compress) {
                     rep->type = replica::type_t::RECOMPRESS;
@@ -341,24 +634,22 @@ static void *writer(void *arg)
                             host, compress,
                             0, tx_port, 1500, fec, RATE_UNLIMITED);
                     if (!rep->recompress) {
+                        sender_detach_replica(s, rep);
                         delete s->replicas[s->replicas.size() - 1];
                         s->replicas.erase(s->replicas.end() - 1);
 
                         log_msg(LOG_LEVEL_ERROR, "Unable to create recompress!\n");
                     } else {
-                        hd_rum_decompress_append_port(s->decompress, rep->recompress);
-                        hd_rum_decompress_set_active(s->decompress, rep->recompress, true);
+                        hd_rum_decompress_append_port(s->decompress, rep->recompress, true);
                         log_msg(LOG_LEVEL_NOTICE, "Created new transcoding output port %s:%d:0x%08lx.\n", host, tx_port, recompress_get_ssrc(rep->recompress));
                     }
                 } else {
                     rep->type = replica::type_t::USE_SOCK;
-                    char compress[] = "none";
                     char *fec = NULL;
                     rep->recompress = recompress_init(&rep->mod,
-                            host, compress,
+                            host, NULL,
                             0, tx_port, 1500, fec, RATE_UNLIMITED);
-                    hd_rum_decompress_append_port(s->decompress, rep->recompress);
-                    hd_rum_decompress_set_active(s->decompress, rep->recompress, false);
+                    hd_rum_decompress_append_port(s->decompress, rep->recompress, false);
                     log_msg(LOG_LEVEL_NOTICE, "Created new forwarding output port %s:%d.\n", host, tx_port);
                 }
             } else {
@@ -369,69 +660,85 @@ static void *writer(void *arg)
         }
 
         // then process incoming packets
-        while (s->qhead != s->qtail) {
-            if(s->qhead->size == 0) { // poisoned pill
+        char *buf;
+        while (queue_pop(s, &buf)) {
+            long size = packet_buf_get_prefix(buf)->size;
+            if (size == 0) { // poisoned pill
+                packet_buf_release(s, buf);
                 return NULL;
             }
 
             // pass it for transcoding if needed
             if (hd_rum_decompress_get_num_active_ports(s->decompress) > 0) {
-                ssize_t ret = hd_rum_decompress_write(s->decompress, s->qhead->buf, s->qhead->size);
-                if (ret < 0) {
+                // the receiver rewrites the packet in place so it can take
+                // over the buffer only if it isn't forwarded as well
+                bool forwarded = std::any_of(s->replicas.begin(), s->replicas.end(),
+                        [](struct replica *r) { return r->type == replica::type_t::USE_SOCK; });
+                bool passed = false;
+                if (!forwarded) {
+                    packet_buf_get_prefix(buf)->ref.fetch_add(1, std::memory_order_relaxed);
+                    passed = hd_rum_decompress_write_owned(s->decompress, buf, size, packet_buf_deleter, s);
+                    if (!passed) {
+                        packet_buf_get_prefix(buf)->ref.fetch_sub(1, std::memory_order_relaxed);
+                    }
+                }
+                if (!passed && hd_rum_decompress_write(s->decompress, buf, size) < 0) {
                     perror("hd_rum_decompress_write");
                 }
             }
 
             // distribute it to output ports that don't need transcoding
+            if (!s->senders.empty()) {
+                forward_to_senders(s, buf);
+            } else {
 #ifdef WIN32
-            // send it asynchronously in MSW (performance optimalization)
-            SleepEx(0, TRUE); // allow system to call our completion routines in APC
-            int ref = 0;
-            for (unsigned int i = 0; i < s->replicas.size(); i++) {
-                if(s->replicas[i]->type == replica::type_t::USE_SOCK) {
-                    ref++;
+                // send it asynchronously in MSW (performance optimalization)
+                SleepEx(0, TRUE); // allow system to call our completion routines in APC
+                int ref = 0;
+                for (unsigned int i = 0; i < s->replicas.size(); i++) {
+                    if(s->replicas[i]->type == replica::type_t::USE_SOCK) {
+                        ref++;
+                    }
                 }
-            }
-            struct wsa_aux_storage *aux = (struct wsa_aux_storage *) ((char *) s->qhead->buf + OFFSET);
-            memset(aux, 0, sizeof *aux);
-            aux->overlapped = (WSAOVERLAPPED *) calloc(ref, sizeof(WSAOVERLAPPED));
-            aux->ref = ref;
-            int overlapped_idx = 0;
-            for (unsigned int i = 0; i < s->replicas.size(); i++) {
-                if(s->replicas[i]->type == replica::type_t::USE_SOCK) {
-                    aux->overlapped[overlapped_idx].Pointer = s->qhead->buf;
-                    ssize_t ret = udp_send_wsa_async(s->replicas[i]->sock, s->qhead->buf, s->qhead->size, wsa_deleter, &aux->overlapped[overlapped_idx]);
-                    if (ret < 0) {
-                        perror("Hd-rum-translator send");
+                struct wsa_aux_storage *aux = (struct wsa_aux_storage *) (buf + OFFSET);
+                memset(aux, 0, sizeof *aux);
+                aux->overlapped = (WSAOVERLAPPED *) calloc(ref, sizeof(WSAOVERLAPPED));
+                aux->ref = ref;
+                aux->state = s;
+                // each completion routine releases one reference
+                packet_buf_get_prefix(buf)->ref.fetch_add(ref);
+                int overlapped_idx = 0;
+                for (unsigned int i = 0; i < s->replicas.size(); i++) {
+                    if(s->replicas[i]->type == replica::type_t::USE_SOCK) {
+                        aux->overlapped[overlapped_idx].Pointer = buf;
+                        ssize_t ret = udp_send_wsa_async(s->replicas[i]->sock, buf, size, wsa_deleter, &aux->overlapped[overlapped_idx]);
+                        if (ret < 0) {
+                            perror("Hd-rum-translator send");
+                        } else {
+                            s->fwd_bytes.fetch_add(size, std::memory_order_relaxed);
+                            s->fwd_packets.fetch_add(1, std::memory_order_relaxed);
+                        }
+                        overlapped_idx += 1;
                     }
-                    overlapped_idx += 1;
                 }
-            }
-            // reallocate the buffer since the last one will be freeed automaticaly
-            s->qhead->buf = (char *) malloc(SIZE);
 #else
-            for (unsigned int i = 0; i < s->replicas.size(); i++) {
-                if(s->replicas[i]->type == replica::type_t::USE_SOCK) {
-                    ssize_t ret = udp_send(s->replicas[i]->sock, s->qhead->buf, s->qhead->size);
-                    if (ret < 0) {
-                        perror("Hd-rum-translator send");
+                for (unsigned int i = 0; i < s->replicas.size(); i++) {
+                    if(s->replicas[i]->type == replica::type_t::USE_SOCK) {
+                        ssize_t ret = udp_send(s->replicas[i]->sock, buf, size);
+                        if (ret < 0) {
+                            perror("Hd-rum-translator send");
+                        } else {
+                            s->fwd_bytes.fetch_add(size, std::memory_order_relaxed);
+                            s->fwd_packets.fetch_add(1, std::memory_order_relaxed);
+                        }
                     }
                 }
-            }
 #endif
-            s->qhead = s->qhead->next;
-
-            pthread_mutex_lock(&s->qfull_mtx);
-            s->qfull = 0;
-            pthread_cond_signal(&s->qfull_cond);
-            pthread_mutex_unlock(&s->qfull_mtx);
+            }
+            packet_buf_release(s, buf);
         }
 
-        pthread_mutex_lock(&s->qempty_mtx);
-        if (s->qempty)
-            pthread_cond_wait(&s->qempty_cond, &s->qempty_mtx);
-        s->qempty = 1;
-        pthread_mutex_unlock(&s->qempty_mtx);
+        queue_wait(s);
     }
 
     return NULL;
@@ -445,9 +752,11 @@ static void usage(const char *progname) {
                 "\t\t--blend - enable blending from original to newly received stream, increases latency\n"
                 "\t\t--conference <width>:<height>[:fps] - enable combining of multiple inputs, increases latency\n"
                 "\t\t--capture-filter <cfg_string> - apply video capture filter to incoming video\n"
+                "\t\t--sender-threads <n>[:<backlog>] - forward packets from <n> threads, each output port\n"
+                "\t\t\tqueues up to <backlog> packets (default %d) and drops packets once full\n"
                 "\t\t--help\n"
                 "\t\t--verbose\n"
-                "\t\t-v\n");
+                "\t\t-v\n", DEFAULT_REPLICA_BACKLOG);
         printf("\tand hostX_options may be:\n"
                 "\t\t-P [<rx_port>:]<tx_port> - TX port to be used (optionally also RX)\n"
                 "\t\t-c <compression> - compression\n"
@@ -484,6 +793,8 @@ struct cmdline_parameters {
     struct hd_rum_output_conf out_conf = {NORMAL, NULL};
     const char *capture_filter = NULL;
     bool verbose = false;
+    int sender_threads = 0;
+    int replica_backlog = DEFAULT_REPLICA_BACKLOG;
 };
 
 /**
@@ -513,6 +824,16 @@ static bool parse_fmt(int argc, char **argv, struct cmdline_parameters *parsed)
             parsed->out_conf.arg = item;
         } else if(strcmp(argv[start_index], "--capture-filter") == 0) {
             parsed->capture_filter = argv[++start_index];
+        } else if(strcmp(argv[start_index], "--sender-threads") == 0) {
+            char *item = argv[++start_index];
+            parsed->sender_threads = atoi(item);
+            if (strchr(item, ':')) {
+                parsed->replica_backlog = atoi(strchr(item, ':') + 1);
+            }
+            if (parsed->sender_threads < 0 || parsed->replica_backlog <= 0) {
+                fprintf(stderr, "Error: invalid sender threads specification '%s'\n", item);
+                exit(EXIT_FAIL_USAGE);
+            }
         } else if(strcmp(argv[start_index], "--help") == 0) {
             usage(argv[0]);
             return false;
@@ -639,7 +960,6 @@ int main(int argc, char **argv)
     int bufsize;
     socket_udp *sock_in;
     pthread_t thread;
-    int err = 0;
     int i;
     struct cmdline_parameters params;
 
@@ -703,7 +1023,14 @@ int main(int argc, char **argv)
         return 1;
     }
 
-    state.qhead = state.qtail = state.queue = qinit(qsize);
+    printf("initializing packet queue for %d items\n", qsize);
+    state.queue = new spsc_queue<char *>(qsize);
+    state.replica_backlog = params.replica_backlog;
+    senders_start(&state, params.sender_threads);
+    if (params.sender_threads > 0) {
+        printf("forwarding from %d threads, backlog %d packets per output port\n",
+                params.sender_threads, params.replica_backlog);
+    }
 
     /* input socket */
     if ((sock_in = udp_init_if("localhost", NULL, params.port, 0, 255, false, false)) == NULL) {
@@ -746,16 +1073,15 @@ int main(int argc, char **argv)
             fputs(s.c_str(), stderr);
             return EXIT_FAILURE;
         }
+        sender_attach_replica(&state, state.replicas[i]);
 
         if(params.hosts[i].compression == NULL) {
             state.replicas[i]->type = replica::type_t::USE_SOCK;
-            char compress[] = "none";
             char *fec = NULL;
             state.replicas[i]->recompress = recompress_init(&state.replicas[i]->mod,
-                    params.hosts[i].addr, compress,
+                    params.hosts[i].addr, NULL,
                     0, tx_port, params.hosts[i].mtu, fec, params.hosts[i].bitrate);
-            hd_rum_decompress_append_port(state.decompress, state.replicas[i]->recompress);
-            hd_rum_decompress_set_active(state.decompress, state.replicas[i]->recompress, false);
+            hd_rum_decompress_append_port(state.decompress, state.replicas[i]->recompress, false);
         } else {
             state.replicas[i]->type = replica::type_t::RECOMPRESS;
 
@@ -769,8 +1095,7 @@ int main(int argc, char **argv)
             }
             // we don't care about this clients, we only tell decompressor to
             // take care about them
-            hd_rum_decompress_append_port(state.decompress, state.replicas[i]->recompress);
-            hd_rum_decompress_set_active(state.decompress, state.replicas[i]->recompress, true);
+            hd_rum_decompress_append_port(state.decompress, state.replicas[i]->recompress, true);
         }
     }
 
@@ -785,67 +1110,59 @@ int main(int argc, char **argv)
     gettimeofday(&t0, NULL);
 
     unsigned long long int last_data = 0ull;
+    unsigned long long int last_fwd_data = 0ull;
 
     /* main loop */
+    char *buf = NULL;
     while (!should_exit) {
+        if (buf == NULL) {
+            buf = packet_buf_get(&state);
+        }
         struct timeval timeout = { 1, 0 };
-        while (state.qtail->next != state.qhead
-               && (state.qtail->size = udp_recv_timeout(sock_in, state.qtail->buf, SIZE, &timeout)) > 0
-               && !should_exit) {
-            received_data += state.qtail->size;
-            received_pkts += 1;
-
-            state.qtail = state.qtail->next;
-
-            pthread_mutex_lock(&state.qempty_mtx);
-            state.qempty = 0;
-            pthread_cond_signal(&state.qempty_cond);
-            pthread_mutex_unlock(&state.qempty_mtx);
-
-            struct timeval t;
-            gettimeofday(&t, NULL);
-            double seconds = tv_diff(t, t0);
-            if (seconds > 5.0) {
-                unsigned long long int cur_data = (received_data - last_data);
-                unsigned long long int bps = cur_data / seconds;
-                string port_list = format_port_list(&state);
-                string statline = "FWD receivedBytes " + to_string(received_data) + " receivedPackets " + to_string(received_pkts) + " timestamp " + to_string(time_since_epoch_in_ms());
-                if (!port_list.empty()) {
-                    statline += " portList " + format_port_list(&state);
-                }
-                control_report_stats(state.control_state, statline);
-                log_msg(LOG_LEVEL_INFO, "Received %llu bytes in %g seconds = %llu B/s.\n", cur_data, seconds, bps);
-                t0 = t;
-                last_data = received_data;
+        int size = udp_recv_timeout(sock_in, buf, SIZE, &timeout);
+        if (size <= 0) {
+            continue;
+        }
+        packet_buf_get_prefix(buf)->size = size;
+        queue_push(&state, buf);
+        buf = NULL;
+
+        received_data += size;
+        received_pkts += 1;
+
+        struct timeval t;
+        gettimeofday(&t, NULL);
+        double seconds = tv_diff(t, t0);
+        if (seconds > 5.0) {
+            unsigned long long int cur_data = (received_data - last_data);
+            unsigned long long int bps = cur_data / seconds;
+            string port_list = format_port_list(&state);
+            unsigned long long int fwd_data = state.fwd_bytes.load(std::memory_order_relaxed);
+            unsigned long long int fwd_drops = state.fwd_drops.load(std::memory_order_relaxed);
+            string statline = "FWD receivedBytes " + to_string(received_data) + " receivedPackets " + to_string(received_pkts) +
+                " forwardedBytes " + to_string(fwd_data) + " forwardedPackets " + to_string(state.fwd_packets.load(std::memory_order_relaxed)) +
+                " droppedPackets " + to_string(fwd_drops) + " timestamp " + to_string(time_since_epoch_in_ms());
+            if (!port_list.empty()) {
+                statline += " portList " + format_port_list(&state);
             }
-            timeout = { 1, 0 };
+            control_report_stats(state.control_state, statline);
+            log_msg(LOG_LEVEL_INFO, "Received %llu bytes in %g seconds = %llu B/s, forwarded %.3f Gbit/s (%llu packets dropped).\n",
+                    cur_data, seconds, bps, (fwd_data - last_fwd_data) * 8 / seconds / 1000000000.0, fwd_drops);
+            t0 = t;
+            last_data = received_data;
+            last_fwd_data = fwd_data;
         }
-
-        if (state.qtail->size <= 0)
-            continue;
-
-        pthread_mutex_lock(&state.qfull_mtx);
-        if (state.qfull)
-            pthread_cond_wait(&state.qfull_cond, &state.qfull_mtx);
-        state.qfull = 1;
-        pthread_mutex_unlock(&state.qfull_mtx);
-    }
-
-    if (state.qtail->size < 0 && !should_exit) {
-        printf("read: %s\n", strerror(err));
-        return 2;
     }
 
     // pass poisoned pill to the worker
-    state.qtail->size = 0;
-    state.qtail = state.qtail->next;
-
-    pthread_mutex_lock(&state.qempty_mtx);
-    state.qempty = 0;
-    pthread_cond_signal(&state.qempty_cond);
-    pthread_mutex_unlock(&state.qempty_mtx);
+    if (buf == NULL) {
+        buf = packet_buf_get(&state);
+    }
+    packet_buf_get_prefix(buf)->size = 0;
+    queue_push(&state, buf);
 
     pthread_join(thread, NULL);
+    senders_stop(&state);
 
     if(state.decompress) {
         hd_rum_decompress_done(state.decompress);
@@ -859,7 +1176,8 @@ int main(int argc, char **argv)
 
     udp_exit(sock_in);
 
-    qdestroy(state.queue);
+    delete state.queue;
+    packet_pool_destroy(&state);
 
     printf("Exit\n");
 
@@ -55,24 +55,38 @@
 #include "net_udp.h"
 #include "rtp.h"
 #include "utils/net.h"
+#include "utils/spsc_queue.h"
 
 #ifdef NEED_ADDRINFO_H
 #include "addrinfo.h"
 #endif
 
+#ifdef HAVE_SENDMMSG
+#include <netinet/udp.h>
+#endif
+
 #include <algorithm>
+#include <atomic>
 #include <condition_variable>
 #include <chrono>
 #include <mutex>
-#include <queue>
+#include <vector>
 
+using std::atomic;
 using std::condition_variable;
+using std::cv_status;
+using std::lock_guard;
 using std::max;
+using std::min;
 using std::mutex;
-using std::queue;
 using std::unique_lock;
+using std::vector;
 
 #define DEFAULT_MAX_UDP_READER_QUEUE_LEN (1920/3*8*1080/1152) //< 10-bit FullHD frame divided by 1280 MTU packets (minus headers)
+#define UDP_READER_BATCH 64 ///< datagrams received by one recvmmsg() call
+#define UDP_POOL_SLAB_PACKETS 256 ///< packet buffers allocated at once when the pool is exhausted
+#define UDP_READER_STATS_INTERVAL_SEC 5
+#define UDP_INJECT_MAX_WAIT_MS 2 ///< how long udp_inject_data() waits for space in the receive queue
 
 static int resolve_address(socket_udp *s, const char *addr, uint16_t tx_port);
 static void *udp_reader(void *arg);
@@ -126,11 +140,82 @@ struct ip_mreq {
 #endif
 
 struct item {
-    inline item(uint8_t *b, int s) :  buf(b), size(s) {}
     uint8_t *buf;
     int size;
 };
 
+struct udp_packet_pool;
+
+/**
+ * Header preceding every buffer returned by udp_packet_alloc() or passed by
+ * udp_recv_data(), the buffer can then be freed by udp_packet_free() regardless
+ * of its origin.
+ */
+struct alignas(16) udp_packet_prefix {
+        struct udp_packet_pool *pool;   ///< NULL if allocated with malloc
+        union {
+                struct udp_packet_prefix *next; ///< link in the pool free list
+                uint64_t placement;             ///< placement tag of a used buffer, see udp_packet_placement()
+        };
+        /// set if the buffer is owned by the caller of udp_inject_data()
+        void (*deleter)(char *data, void *udata);
+        void *deleter_udata;
+};
+static_assert(sizeof(struct udp_packet_prefix) + RTP_PACKET_HEADER_SIZE <= UDP_INJECT_HEADROOM,
+                "UDP_INJECT_HEADROOM too small");
+
+/**
+ * Pool of RTP_MAX_PACKET_LEN packet buffers filled by udp_reader()
+ *
+ * Buffers are allocated in slabs and never returned to the system until the
+ * pool is destroyed. Only the reader thread takes buffers, the buffers are
+ * returned to lock-free stack from any thread and the reader grabs the whole
+ * stack at once when its private free list is exhausted.
+ *
+ * The pool outlives the socket if some packets are still in use (eg. by
+ * the playout buffer) - it holds one reference for the socket and one for
+ * each buffer handed out.
+ */
+struct udp_packet_pool {
+        atomic<struct udp_packet_prefix *> returned{nullptr};
+        struct udp_packet_prefix *free_list = nullptr; ///< reader thread only
+        vector<void *> slabs;
+        atomic<int> refcount{1};
+};
+
+#ifdef HAVE_SENDMMSG
+#define UDP_BATCH_MAX_PACKETS 1024 ///< packets per sendmmsg call (UIO_MAXIOV)
+#define UDP_BATCH_IOV_PER_PACKET 3 ///< RTP header, payload header and data - see rtp_send_data_hdr()
+#define UDP_GSO_MAX_SEGMENTS 64
+#define UDP_GSO_MAX_BYTES 65000
+
+enum udp_batch_mode {
+        UDP_BATCH_NONE,
+        UDP_BATCH_MMSG, ///< packets are sent with one sendmmsg() call per batch
+        UDP_BATCH_GSO,  ///< as UDP_BATCH_MMSG but equally sized packets are coalesced with UDP_SEGMENT
+};
+
+/**
+ * Packets queued between udp_async_start() and udp_async_wait() (Linux)
+ *
+ * I/O vectors of consecutive packets are stored contiguously so that a run
+ * of packets can be passed as a single GSO datagram.
+ */
+struct udp_send_batch {
+        enum udp_batch_mode mode;
+        bool active;
+        int max;                ///< allocated packet slots
+        int count;              ///< packets queued since last flush
+        struct iovec *iov;      ///< max * UDP_BATCH_IOV_PER_PACKET items
+        int *iov_start;         ///< index of first iovec of packet, max + 1 items
+        size_t *len;            ///< datagram lengths
+        void **dispose_udata;
+        struct mmsghdr *msgs;
+        int *msg_first;         ///< index of first packet of message
+        char *cmsg_buf;         ///< control message (segment size) per message
+};
+#endif
+
 /*
  * Local part of the socket
  *
@@ -147,11 +232,20 @@ struct socket_udp_local {
 
         // for multithreaded receiving
         pthread_t thread_id;
-        queue<struct item> packets;
-        unsigned int max_packets;
+        spsc_queue<struct item> *packets;
+        spsc_queue<struct item> *injected;  ///< packets passed by udp_inject_data()
+        struct udp_packet_pool *pool;
         mutex lock;
         condition_variable boss_cv;
         condition_variable reader_cv;
+        atomic<bool> reader_waiting{false};
+        atomic<bool> injector_waiting{false};
+        atomic<unsigned long long> kernel_drops{0}; ///< datagrams dropped by kernel (SO_RXQ_OVFL)
+        atomic<unsigned long long> overruns{0};     ///< times the reader found the queue full
+        atomic<unsigned long long> inject_drops{0}; ///< injected datagrams dropped because of full queue
+
+        mutex placement_lock;   ///< held by the reader while receiving with placement
+        struct udp_placement *placement = nullptr;
 
         bool should_exit;
         fd_t should_exit_fd[2];
@@ -175,8 +269,13 @@ struct _socket_udp {
         int overlapped_max;
         int overlapped_count;
 #endif
+#ifdef HAVE_SENDMMSG
+        struct udp_send_batch batch;
+#endif
 };
 
+static void udp_init_async_state(socket_udp *s);
+static void udp_pool_release(struct udp_packet_pool *pool);
 static void udp_clean_async_state(socket_udp *s);
 
 #ifdef WIN32
@@ -810,15 +909,25 @@ socket_udp *udp_init_if(const char *addr, const char *iface, uint16_t rx_port,
 
         s->local->multithreaded = multithreaded;
         if (multithreaded) {
-                if (!get_commandline_param("udp-queue-len")) {
-                        s->local->max_packets = DEFAULT_MAX_UDP_READER_QUEUE_LEN;
-                } else {
-                        s->local->max_packets = atoi(get_commandline_param("udp-queue-len"));
+                unsigned int max_packets = DEFAULT_MAX_UDP_READER_QUEUE_LEN;
+                if (get_commandline_param("udp-queue-len")) {
+                        max_packets = atoi(get_commandline_param("udp-queue-len"));
                 }
+                s->local->packets = new spsc_queue<struct item>(max_packets);
+                s->local->injected = new spsc_queue<struct item>(max_packets);
+                s->local->pool = new udp_packet_pool();
+#ifdef SO_RXQ_OVFL
+                int one = 1;
+                if (SETSOCKOPT(s->local->fd, SOL_SOCKET, SO_RXQ_OVFL, (sockopt_t) &one, sizeof one) != 0) {
+                        socket_error("setsockopt SO_RXQ_OVFL");
+                }
+#endif
                 platform_pipe_init(s->local->should_exit_fd);
                 pthread_create(&s->local->thread_id, NULL, udp_reader, s);
         }
 
+        udp_init_async_state(s);
+
         return s;
 
 error:
@@ -846,6 +955,8 @@ socket_udp *udp_init_with_local(struct socket_udp_local *l, struct sockaddr *sa,
         memcpy(&s->sock, sa, len);
         s->sock_len = len;
 
+        udp_init_async_state(s);
+
         return s;
 }
 
@@ -880,6 +991,8 @@ void udp_fd_zero_r(struct udp_fd_r *fd_struct)
  **/
 void udp_exit(socket_udp * s)
 {
+        udp_async_wait(s);
+
         switch (s->local->mode) {
         case IPv4:
                 udp_leave_mcast_grp4(((struct sockaddr_in *)&s->sock)->sin_addr.s_addr, s->local->fd);
@@ -897,12 +1010,17 @@ void udp_exit(socket_udp * s)
                         int ret = send(s->local->should_exit_fd[1], &c, 1, 0);
                         assert (ret == 1);
                         s->local->should_exit = true;
-                        s->local->reader_cv.notify_one();
+                        s->local->reader_cv.notify_all();
                         pthread_join(s->local->thread_id, NULL);
-                        while (!s->local->packets.empty()) {
-                                auto it = s->local->packets.front();
-                                free(it.buf);
-                                s->local->packets.pop();
+                        struct item it;
+                        while (s->local->packets->pop(it) || s->local->injected->pop(it)) {
+                                udp_packet_free(it.buf - RTP_PACKET_HEADER_SIZE);
+                        }
+                        delete s->local->packets;
+                        delete s->local->injected;
+                        udp_pool_release(s->local->pool);
+                        if (s->local->placement) {
+                                s->local->placement->release(s->local->placement);
                         }
                         platform_pipe_close(s->local->should_exit_fd[1]);
                 }
@@ -964,12 +1082,137 @@ int udp_sendv(socket_udp * s, LPWSABUF vector, int count, void *d)
         }
 }
 #else
+#ifdef HAVE_SENDMMSG
+static void udp_batch_flush(socket_udp *s);
+
+/**
+ * Queues the packet to be sent with next udp_batch_flush().
+ *
+ * @returns length of queued datagram
+ */
+static int udp_batch_add(socket_udp *s, struct iovec *vector, int count, void *d)
+{
+        struct udp_send_batch *b = &s->batch;
+        assert(count <= UDP_BATCH_IOV_PER_PACKET);
+
+        if (b->count == b->max) {
+                udp_batch_flush(s);
+        }
+
+        int first_iov = b->iov_start[b->count];
+        size_t len = 0;
+        for (int i = 0; i < count; ++i) {
+                b->iov[first_iov + i] = vector[i];
+                len += vector[i].iov_len;
+        }
+        b->len[b->count] = len;
+        b->dispose_udata[b->count] = d;
+        b->count += 1;
+        b->iov_start[b->count] = first_iov + count;
+
+        return len;
+}
+
+/**
+ * Sends queued packets starting from packet first.
+ *
+ * In GSO mode, runs of equally sized packets are passed as a single
+ * datagram with UDP_SEGMENT set (last packet of the run may be shorter).
+ * If the kernel refuses GSO (eg. payload exceeds path MTU), the socket
+ * permanently falls back to plain sendmmsg().
+ */
+static void udp_batch_send(socket_udp *s, int first)
+{
+        struct udp_send_batch *b = &s->batch;
+        int nmsgs = 0;
+
+        for (int i = first; i < b->count; ) {
+                int run_start = i;
+                size_t seg_len = b->len[i];
+                size_t total = seg_len;
+                i += 1;
+                if (b->mode == UDP_BATCH_GSO) {
+                        while (i < b->count && i - run_start < UDP_GSO_MAX_SEGMENTS &&
+                                        b->len[i] <= seg_len && total + b->len[i] <= UDP_GSO_MAX_BYTES) {
+                                total += b->len[i];
+                                i += 1;
+                                if (b->len[i - 1] < seg_len) {
+                                        break;
+                                }
+                        }
+                }
+
+                struct msghdr *msg = &b->msgs[nmsgs].msg_hdr;
+                memset(msg, 0, sizeof *msg);
+                msg->msg_name = (void *) &s->sock;
+                msg->msg_namelen = s->sock_len;
+                msg->msg_iov = b->iov + b->iov_start[run_start];
+                msg->msg_iovlen = b->iov_start[i] - b->iov_start[run_start];
+#ifdef UDP_SEGMENT
+                if (i - run_start > 1) {
+                        char *cmsg_buf = b->cmsg_buf + nmsgs * CMSG_SPACE(sizeof(uint16_t));
+                        memset(cmsg_buf, 0, CMSG_SPACE(sizeof(uint16_t)));
+                        msg->msg_control = cmsg_buf;
+                        msg->msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+                        struct cmsghdr *cm = CMSG_FIRSTHDR(msg);
+                        cm->cmsg_level = SOL_UDP;
+                        cm->cmsg_type = UDP_SEGMENT;
+                        cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+                        uint16_t gso_size = seg_len;
+                        memcpy(CMSG_DATA(cm), &gso_size, sizeof gso_size);
+                }
+#endif
+                b->msg_first[nmsgs] = run_start;
+                nmsgs += 1;
+        }
+
+        int sent = 0;
+        while (sent < nmsgs) {
+                int ret = sendmmsg(s->local->fd, b->msgs + sent, nmsgs - sent, 0);
+                if (ret >= 0) {
+                        sent += ret;
+                        continue;
+                }
+                if (errno == EINTR) {
+                        continue;
+                }
+                if (b->mode == UDP_BATCH_GSO && b->msgs[sent].msg_hdr.msg_controllen > 0) {
+                        log_msg(LOG_LEVEL_WARNING, "[NET UDP] UDP GSO not usable, falling back to sendmmsg.\n");
+                        b->mode = UDP_BATCH_MMSG;
+                        udp_batch_send(s, b->msg_first[sent]);
+                        return;
+                }
+                socket_error("sendmmsg");
+                sent += 1; // skip the failed datagram
+        }
+}
+
+static void udp_batch_flush(socket_udp *s)
+{
+        struct udp_send_batch *b = &s->batch;
+
+        udp_batch_send(s, 0);
+
+        for (int i = 0; i < b->count; ++i) {
+                free(b->dispose_udata[i]);
+        }
+        b->count = 0;
+        b->iov_start[0] = 0;
+}
+#endif // defined HAVE_SENDMMSG
+
 int udp_sendv(socket_udp * s, struct iovec *vector, int count, void *d)
 {
         struct msghdr msg;
 
         assert(s != NULL);
 
+#ifdef HAVE_SENDMMSG
+        if (s->batch.active) {
+                return udp_batch_add(s, vector, count, d);
+        }
+#endif
+
         msg.msg_name = (void *) & s->sock;
         msg.msg_namelen = s->sock_len;
         msg.msg_iov = vector;
@@ -985,59 +1228,287 @@ int udp_sendv(socket_udp * s, struct iovec *vector, int count, void *d)
 }
 #endif // WIN32
 
+static void udp_pool_release(struct udp_packet_pool *pool)
+{
+        if (--pool->refcount > 0) {
+                return;
+        }
+        for (auto slab : pool->slabs) {
+                free(slab);
+        }
+        delete pool;
+}
+
+/**
+ * Takes a buffer from the pool, may be called only from the reader thread.
+ * @returns pointer to the rtp_packet (after the prefix)
+ */
+static uint8_t *udp_pool_get(struct udp_packet_pool *pool)
+{
+        const size_t stride = sizeof(struct udp_packet_prefix) + ((RTP_MAX_PACKET_LEN + 15) & ~15);
+        if (pool->free_list == nullptr) {
+                pool->free_list = pool->returned.exchange(nullptr, std::memory_order_acquire);
+        }
+        if (pool->free_list == nullptr) {
+                uint8_t *slab = (uint8_t *) malloc(UDP_POOL_SLAB_PACKETS * stride);
+                pool->slabs.push_back(slab);
+                for (int i = 0; i < UDP_POOL_SLAB_PACKETS; ++i) {
+                        struct udp_packet_prefix *p = (struct udp_packet_prefix *)(void *) (slab + i * stride);
+                        p->pool = pool;
+                        p->deleter = NULL;
+                        p->next = pool->free_list;
+                        pool->free_list = p;
+                }
+        }
+        struct udp_packet_prefix *p = pool->free_list;
+        pool->free_list = p->next;
+        p->placement = 0;
+        ++pool->refcount;
+        return (uint8_t *) (p + 1);
+}
+
+/**
+ * Allocates a packet buffer from heap that can be freed with udp_packet_free().
+ */
+void *udp_packet_alloc(size_t len)
+{
+        struct udp_packet_prefix *p = (struct udp_packet_prefix *) malloc(sizeof(struct udp_packet_prefix) + len);
+        p->pool = NULL;
+        p->placement = 0;
+        p->deleter = NULL;
+        return p + 1;
+}
+
+/**
+ * Frees packet buffer obtained from udp_recv_data() or udp_packet_alloc(). In
+ * the former case, the buffer is returned to the pool of the receiving socket.
+ */
+void udp_packet_free(void *packet)
+{
+        if (packet == NULL) {
+                return;
+        }
+        struct udp_packet_prefix *p = (struct udp_packet_prefix *) packet - 1;
+        if (p->deleter) {
+                p->deleter((char *) packet + RTP_PACKET_HEADER_SIZE, p->deleter_udata);
+                return;
+        }
+        struct udp_packet_pool *pool = p->pool;
+        if (pool == NULL) {
+                free(p);
+                return;
+        }
+        p->next = pool->returned.load(std::memory_order_relaxed);
+        while (!pool->returned.compare_exchange_weak(p->next, p, std::memory_order_release, std::memory_order_relaxed)) {
+        }
+        udp_pool_release(pool);
+}
+
+/**
+ * Receives up to count datagrams into packets.
+ *
+ * @returns number of datagrams received, sizes are stored in sizes
+ */
+static int udp_reader_recv(struct socket_udp_local *l, uint8_t **packets, int *sizes, int count)
+{
+#ifdef HAVE_RECVMMSG
+        struct mmsghdr msgs[UDP_READER_BATCH];
+#ifdef SO_RXQ_OVFL
+        char cmsg_buf[UDP_READER_BATCH][CMSG_SPACE(sizeof(uint32_t))];
+#endif
+        // payloads of predicted datagrams are scattered to the placement
+        // destination: {header, placed payload, rest of the datagram}
+        struct iovec iov[UDP_READER_BATCH][3];
+        char *dst[UDP_READER_BATCH] = {};
+        int dst_len[UDP_READER_BATCH] = {};
+        unique_lock<mutex> placement_lk(l->placement_lock);
+        struct udp_placement *placement = l->placement;
+        if (placement != nullptr && !placement->begin(placement, count, dst, dst_len)) {
+                placement = nullptr;
+        }
+        if (placement == nullptr) {
+                placement_lk.unlock();
+        }
+        memset(msgs, 0, count * sizeof msgs[0]);
+        for (int i = 0; i < count; ++i) {
+                char *buf = (char *) packets[i] + RTP_PACKET_HEADER_SIZE;
+                const int buf_len = RTP_MAX_PACKET_LEN - RTP_PACKET_HEADER_SIZE;
+                if (placement != nullptr && dst[i] != nullptr && placement->hdr_len + dst_len[i] <= buf_len) {
+                        iov[i][0] = { buf, (size_t) placement->hdr_len };
+                        iov[i][1] = { dst[i], (size_t) dst_len[i] };
+                        iov[i][2] = { buf + placement->hdr_len + dst_len[i],
+                                (size_t) (buf_len - placement->hdr_len - dst_len[i]) };
+                        msgs[i].msg_hdr.msg_iovlen = 3;
+                } else {
+                        dst[i] = nullptr;
+                        iov[i][0] = { buf, (size_t) buf_len };
+                        msgs[i].msg_hdr.msg_iovlen = 1;
+                }
+                msgs[i].msg_hdr.msg_iov = iov[i];
+#ifdef SO_RXQ_OVFL
+                msgs[i].msg_hdr.msg_control = cmsg_buf[i];
+                msgs[i].msg_hdr.msg_controllen = sizeof cmsg_buf[i];
+#endif
+        }
+        int ret = recvmmsg(l->fd, msgs, count, MSG_DONTWAIT, NULL);
+        if (ret <= 0) {
+                if (ret == -1 && errno != EAGAIN && errno != EWOULDBLOCK) {
+                        socket_error("recvmmsg");
+                }
+                if (placement != nullptr) {
+                        placement->end(placement);
+                }
+                return 0;
+        }
+        for (int i = 0; i < ret; ++i) {
+                sizes[i] = msgs[i].msg_len;
+                if (placement == nullptr) {
+                        continue;
+                }
+                char *buf = (char *) packets[i] + RTP_PACKET_HEADER_SIZE;
+                uint64_t tag = placement->commit(placement, buf, sizes[i], dst[i], dst_len[i]);
+                if (dst[i] == nullptr) {
+                        continue;
+                }
+                if (tag == 0 && sizes[i] > placement->hdr_len) { // mispredicted - move the payload back
+                        memcpy(buf + placement->hdr_len, dst[i], min(dst_len[i], sizes[i] - placement->hdr_len));
+                }
+                ((struct udp_packet_prefix *) (void *) packets[i] - 1)->placement = tag;
+        }
+        if (placement != nullptr) {
+                placement->end(placement);
+        }
+#ifdef SO_RXQ_OVFL
+        struct msghdr *last = &msgs[ret - 1].msg_hdr;
+        for (struct cmsghdr *cm = CMSG_FIRSTHDR(last); cm != NULL; cm = CMSG_NXTHDR(last, cm)) {
+                if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SO_RXQ_OVFL) {
+                        uint32_t drops;
+                        memcpy(&drops, CMSG_DATA(cm), sizeof drops);
+                        l->kernel_drops = drops;
+                }
+        }
+#endif
+        return ret;
+#else
+        UNUSED(count);
+        int size = recvfrom(l->fd, (char *) packets[0] + RTP_PACKET_HEADER_SIZE,
+                        RTP_MAX_PACKET_LEN - RTP_PACKET_HEADER_SIZE,
+                        0, 0, 0);
+        if (size <= 0) {
+                /// @todo
+                /// In MSW, this block is called as often as packet is sent if
+                /// we got WSAECONNRESET error (noone is listening). This can have
+                /// negative performance impact.
+                socket_error("recvfrom");
+                return 0;
+        }
+        sizes[0] = size;
+        return 1;
+#endif
+}
+
+static void udp_reader_report_stats(struct socket_udp_local *l, unsigned long long *last_drops,
+                unsigned long long *last_overruns, unsigned long long *last_inject_drops)
+{
+        unsigned long long drops = l->kernel_drops;
+        unsigned long long overruns = l->overruns;
+        unsigned long long inject_drops = l->inject_drops;
+        if (drops != *last_drops || overruns != *last_overruns) {
+                log_msg(LOG_LEVEL_WARNING, "[NET UDP] %llu datagrams dropped by kernel, "
+                                "%llu receive queue overruns in last %d seconds.\n",
+                                drops - *last_drops, overruns - *last_overruns,
+                                UDP_READER_STATS_INTERVAL_SEC);
+        }
+        if (inject_drops != *last_inject_drops) {
+                log_msg(LOG_LEVEL_WARNING, "[NET UDP] %llu injected datagrams dropped in last %d seconds.\n",
+                                inject_drops - *last_inject_drops, UDP_READER_STATS_INTERVAL_SEC);
+        }
+        *last_drops = drops;
+        *last_overruns = overruns;
+        *last_inject_drops = inject_drops;
+}
+
 /**
  * When receiving data in separate thread, this function fetches data
  * from socket and puts it in queue.
+ *
+ * Datagrams are received in batches (recvmmsg() if available) into buffers
+ * taken from the socket packet pool and passed to the consumer through
+ * a lock-free queue. The consumer is woken up once per batch.
  */
 static void *udp_reader(void *arg)
 {
         socket_udp *s = (socket_udp *) arg;
+        struct socket_udp_local *l = s->local;
+#ifdef HAVE_RECVMMSG
+        const int batch = UDP_READER_BATCH;
+#else
+        const int batch = 1;
+#endif
+        uint8_t *packets[UDP_READER_BATCH] = {};
+        int sizes[UDP_READER_BATCH];
+        unsigned long long last_drops = 0, last_overruns = 0, last_inject_drops = 0;
+        auto last_report = std::chrono::steady_clock::now();
 
-        while (1) {
+        while (!l->should_exit) {
                 fd_set fds;
                 FD_ZERO(&fds);
-                FD_SET(s->local->fd, &fds);
-                FD_SET(s->local->should_exit_fd[0], &fds);
-                int nfds = max(s->local->fd, s->local->should_exit_fd[0]) + 1;
+                FD_SET(l->fd, &fds);
+                FD_SET(l->should_exit_fd[0], &fds);
+                int nfds = max(l->fd, l->should_exit_fd[0]) + 1;
 
                 int rc = select(nfds, &fds, NULL, NULL, NULL);
                 if (rc <= 0) {
                         perror("select");
                         continue;
                 }
-                if (FD_ISSET(s->local->should_exit_fd[0], &fds)) {
+                if (FD_ISSET(l->should_exit_fd[0], &fds)) {
                         break;
                 }
-                uint8_t *packet = (uint8_t *) malloc(RTP_MAX_PACKET_LEN);
-                uint8_t *buffer = ((uint8_t *) packet) + RTP_PACKET_HEADER_SIZE;
-
-                int size = recvfrom(s->local->fd, (char *) buffer,
-                                RTP_MAX_PACKET_LEN - RTP_PACKET_HEADER_SIZE,
-                                0, 0, 0);
-
-                if (size <= 0) {
-                        /// @todo
-                        /// In MSW, this block is called as often as packet is sent if
-                        /// we got WSAECONNRESET error (noone is listening). This can have
-                        /// negative performance impact.
-                        socket_error("recvfrom");
-                        continue;
+                for (int i = 0; i < batch; ++i) {
+                        if (packets[i] == NULL) {
+                                packets[i] = udp_pool_get(l->pool);
+                        }
                 }
 
-                unique_lock<mutex> lk(s->local->lock);
-                s->local->reader_cv.wait(lk, [s]{return s->local->packets.size() < s->local->max_packets || s->local->should_exit;});
-                if (s->local->should_exit) {
-                        free(packet);
-                        break;
+                int count = udp_reader_recv(l, packets, sizes, batch);
+
+                for (int i = 0; i < count; ++i) {
+                        struct item it{packets[i] + RTP_PACKET_HEADER_SIZE, sizes[i]};
+                        if (!l->packets->push(it)) {
+                                l->overruns++;
+                                unique_lock<mutex> lk(l->lock);
+                                l->reader_waiting = true;
+                                while (!l->packets->push(it) && !l->should_exit) {
+                                        l->reader_cv.wait_for(lk, std::chrono::milliseconds(1));
+                                }
+                                l->reader_waiting = false;
+                                if (l->should_exit) {
+                                        break;
+                                }
+                        }
+                        packets[i] = NULL;
                 }
 
-                s->local->packets.emplace(packet, size);
+                if (count > 0) {
+                        // pair with the predicate check in udp_not_empty()
+                        unique_lock<mutex> lk(l->lock);
+                        lk.unlock();
+                        l->boss_cv.notify_one();
+                }
+
+                auto now = std::chrono::steady_clock::now();
+                if (now - last_report > std::chrono::seconds(UDP_READER_STATS_INTERVAL_SEC)) {
+                        udp_reader_report_stats(l, &last_drops, &last_overruns, &last_inject_drops);
+                        last_report = now;
+                }
+        }
 
-                lk.unlock();
-                s->local->boss_cv.notify_one();
+        for (int i = 0; i < batch; ++i) {
+                udp_packet_free(packets[i]);
         }
 
-        platform_pipe_close(s->local->should_exit_fd[0]);
+        platform_pipe_close(l->should_exit_fd[0]);
 
         return NULL;
 }
@@ -1090,15 +1561,20 @@ bool udp_not_empty(socket_udp * s, struct timeval *timeout)
 {
         assert(s->local->multithreaded);
 
+        auto not_empty = [s]{ return !s->local->packets->empty() || !s->local->injected->empty(); };
+        if (not_empty()) {
+                return true;
+        }
+
         unique_lock<mutex> lk(s->local->lock);
         if (timeout) {
                 std::chrono::microseconds tmout_us =
                         std::chrono::microseconds(timeout->tv_sec * 1000000ll + timeout->tv_usec);
-                s->local->boss_cv.wait_for(lk, tmout_us, [s]{return !s->local->packets.empty();});
+                s->local->boss_cv.wait_for(lk, tmout_us, not_empty);
         } else {
-                s->local->boss_cv.wait(lk, [s]{return !s->local->packets.empty();});
+                s->local->boss_cv.wait(lk, not_empty);
         }
-        return !s->local->packets.empty();
+        return not_empty();
 }
 
 /**
@@ -1126,27 +1602,156 @@ int udp_recvfrom(socket_udp *s, char *buffer, int buflen, struct sockaddr *src_a
 }
 
 /**
- * Receives data from multithreaded socket.
+ * Receives data from multithreaded socket. There must be a packet available
+ * (see udp_not_empty()).
  *
  * @param[in] s       UDP socket state
- * @param[out] buffer data received from socket. Must be freed by caller!
+ * @param[out] buffer data received from socket (preceded by RTP_PACKET_HEADER_SIZE
+ *                    bytes of space). Must be freed by caller with udp_packet_free()!
  * @returns           length of the received datagram
  */
 int udp_recv_data(socket_udp * s, char **buffer)
 {
         assert(s->local->multithreaded);
-        int ret;
-        unique_lock<mutex> lk(s->local->lock);
+        struct item it;
+
+        bool ret = s->local->packets->pop(it) || s->local->injected->pop(it);
+        assert(ret);
+        UNUSED(ret);
+        *buffer = (char *) it.buf - RTP_PACKET_HEADER_SIZE;
+
+        if (s->local->reader_waiting || s->local->injector_waiting) {
+                s->local->reader_cv.notify_all();
+        }
 
-        auto it = s->local->packets.front();
-        *buffer = (char *) it.buf;
-        ret = it.size;
-        s->local->packets.pop();
+        return it.size;
+}
+
+/**
+ * Passes a datagram to the receiving side of a multithreaded socket as if it
+ * was received from network (bypassing the socket). If the receive queue is
+ * full, waits at most UDP_INJECT_MAX_WAIT_MS for the receiver and then drops
+ * the datagram (the caller, eg. a reflector forwarding to other ports, must
+ * not be stalled by a slow receiver). Must be called from a single thread per
+ * socket.
+ *
+ * @param data    datagram, if deleter is set, it must be preceded by
+ *                UDP_INJECT_HEADROOM bytes of writable space and is owned by
+ *                the socket until deleter(data, udata) is called. Otherwise
+ *                the data are copied.
+ * @returns       false if the socket isn't multithreaded or is being closed
+ *                (the ownership of data is not transferred then), true if
+ *                the datagram was queued or dropped
+ */
+bool udp_inject_data(socket_udp *s, char *data, int len, void (*deleter)(char *data, void *udata), void *udata)
+{
+        struct socket_udp_local *l = s->local;
+        if (!l->multithreaded) {
+                return false;
+        }
 
+        char *buf = data;
+        if (deleter) {
+                struct udp_packet_prefix *p = (struct udp_packet_prefix *)(void *) (data - RTP_PACKET_HEADER_SIZE) - 1;
+                p->pool = NULL;
+                p->placement = 0;
+                p->deleter = deleter;
+                p->deleter_udata = udata;
+        } else {
+                buf = (char *) udp_packet_alloc(RTP_PACKET_HEADER_SIZE + len) + RTP_PACKET_HEADER_SIZE;
+                memcpy(buf, data, len);
+        }
+
+        struct item it{(uint8_t *) buf, len};
+        if (!l->injected->push(it)) {
+                l->overruns++;
+                bool pushed;
+                {
+                        unique_lock<mutex> lk(l->lock);
+                        l->injector_waiting = true;
+                        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(UDP_INJECT_MAX_WAIT_MS);
+                        while (!(pushed = l->injected->push(it)) && !l->should_exit &&
+                                        l->reader_cv.wait_until(lk, deadline) == cv_status::no_timeout) {
+                        }
+                        l->injector_waiting = false;
+                }
+                if (!pushed) {
+                        if (!deleter) {
+                                udp_packet_free(buf - RTP_PACKET_HEADER_SIZE);
+                        }
+                        if (l->should_exit) {
+                                return false;
+                        }
+                        l->inject_drops++;
+                        if (deleter) {
+                                deleter(data, udata);
+                        }
+                        return true;
+                }
+        }
+
+        // pair with the predicate check in udp_not_empty()
+        unique_lock<mutex> lk(l->lock);
         lk.unlock();
-        s->local->reader_cv.notify_one();
+        l->boss_cv.notify_one();
 
-        return ret;
+        return true;
+}
+
+/**
+ * Returns statistics of the multithreaded receiver.
+ *
+ * @param[out] kernel_drops datagrams dropped by kernel because of socket buffer overflow
+ * @param[out] overruns     number of times the receive queue was full
+ */
+void udp_get_recv_stats(socket_udp *s, unsigned long long *kernel_drops, unsigned long long *overruns)
+{
+        if (!s->local->multithreaded) {
+                *kernel_drops = *overruns = 0;
+                return;
+        }
+        *kernel_drops = s->local->kernel_drops;
+        *overruns = s->local->overruns;
+}
+
+/**
+ * Sets receive placement for multithreaded socket (replacing previous one).
+ *
+ * Placement is supported only if datagrams are received with recvmmsg(), in
+ * other cases the placement is never used. Takes the reference to placement
+ * (released also on failure).
+ *
+ * @retval false  socket is not multithreaded
+ */
+bool udp_set_placement(socket_udp *s, struct udp_placement *placement)
+{
+        struct socket_udp_local *l = s->local;
+        if (!l->multithreaded) {
+                if (placement) {
+                        placement->release(placement);
+                }
+                return false;
+        }
+        struct udp_placement *old = nullptr;
+        {
+                lock_guard<mutex> lk(l->placement_lock);
+                old = l->placement;
+                l->placement = placement;
+        }
+        if (old) {
+                old->release(old);
+        }
+        return true;
+}
+
+/**
+ * @returns placement tag of the packet returned by udp_recv_data() (see
+ *          struct udp_placement::commit()), 0 if the payload is in the packet
+ */
+uint64_t udp_packet_placement(const void *packet)
+{
+        const struct udp_packet_prefix *p = (const struct udp_packet_prefix *) packet - 1;
+        return p->deleter ? 0 : p->placement;
 }
 
 #ifndef WIN32
@@ -1380,16 +1985,49 @@ void udp_flush_recv_buf(socket_udp *s)
         free(buf);
 }
 
+ADD_TO_PARAM(udp_send_batch, "udp-send-batch",
+                "* udp-send-batch={none|mmsg|gso}\n"
+                "  Batched sending of video packets (Linux only) - none, sendmmsg or sendmmsg\n"
+                "  with UDP GSO coalescing of equally sized packets (default, falls back to mmsg)\n");
+static void udp_init_async_state(socket_udp *s)
+{
+#ifdef HAVE_SENDMMSG
+        s->batch.mode = UDP_BATCH_GSO;
+        const char *mode = get_commandline_param("udp-send-batch");
+        if (mode != NULL) {
+                if (strcmp(mode, "none") == 0) {
+                        s->batch.mode = UDP_BATCH_NONE;
+                } else if (strcmp(mode, "mmsg") == 0) {
+                        s->batch.mode = UDP_BATCH_MMSG;
+                } else if (strcmp(mode, "gso") != 0) {
+                        log_msg(LOG_LEVEL_WARNING, "[NET UDP] Unknown batch mode %s, using gso.\n", mode);
+                }
+        }
+#ifndef UDP_SEGMENT
+        if (s->batch.mode == UDP_BATCH_GSO) {
+                s->batch.mode = UDP_BATCH_MMSG;
+        }
+#endif
+#else
+        UNUSED(s);
+#endif
+}
+
 /**
- * By calling this function under MSW, caller indicates that following packets
+ * By calling this function, caller indicates that following packets
  * can be send in asynchronous manner. Caller should then call udp_async_wait()
  * to ensure that all packets were actually sent.
+ *
+ * Under MSW, overlapped I/O is used. In Linux, packets are queued and sent in
+ * batches with sendmmsg() (see udp_async_flush()).
+ *
+ * @returns maximal number of packets sent at once (1 if the socket doesn't batch)
  */
-void udp_async_start(socket_udp *s, int nr_packets)
+int udp_async_start(socket_udp *s, int nr_packets)
 {
 #ifdef WIN32
         if (!s->local->is_wsa_overlapped) {
-                return;
+                return 1;
         }
 
         if (nr_packets > s->overlapped_max) {
@@ -1406,9 +2044,48 @@ void udp_async_start(socket_udp *s, int nr_packets)
 
         s->overlapped_count = 0;
         s->overlapping_active = true;
+        return 1;
+#elif defined HAVE_SENDMMSG
+        struct udp_send_batch *b = &s->batch;
+        if (b->mode == UDP_BATCH_NONE) {
+                return 1;
+        }
+
+        nr_packets = std::min(nr_packets, UDP_BATCH_MAX_PACKETS);
+        if (nr_packets > b->max) {
+                b->iov = (struct iovec *) realloc(b->iov, nr_packets * UDP_BATCH_IOV_PER_PACKET * sizeof(struct iovec));
+                b->iov_start = (int *) realloc(b->iov_start, (nr_packets + 1) * sizeof(int));
+                b->len = (size_t *) realloc(b->len, nr_packets * sizeof(size_t));
+                b->dispose_udata = (void **) realloc(b->dispose_udata, nr_packets * sizeof(void *));
+                b->msgs = (struct mmsghdr *) realloc(b->msgs, nr_packets * sizeof(struct mmsghdr));
+                b->msg_first = (int *) realloc(b->msg_first, nr_packets * sizeof(int));
+                b->cmsg_buf = (char *) realloc(b->cmsg_buf, nr_packets * CMSG_SPACE(sizeof(uint16_t)));
+                b->max = nr_packets;
+        }
+
+        b->count = 0;
+        b->iov_start[0] = 0;
+        b->active = true;
+        return b->max;
 #else
         UNUSED(nr_packets);
         UNUSED(s);
+        return 1;
+#endif
+}
+
+/**
+ * Sends packets queued so far without leaving the async mode. Used by the
+ * traffic shaper to release one batch per shaping interval.
+ */
+void udp_async_flush(socket_udp *s)
+{
+#ifdef HAVE_SENDMMSG
+        if (s->batch.active && s->batch.count > 0) {
+                udp_batch_flush(s);
+        }
+#else
+        UNUSED(s);
 #endif
 }
 
@@ -1434,6 +2111,12 @@ void udp_async_wait(socket_udp *s)
                 free(s->dispose_udata[i]);
         }
         s->overlapping_active = false;
+#elif defined HAVE_SENDMMSG
+        if (!s->batch.active) {
+                return;
+        }
+        udp_async_flush(s);
+        s->batch.active = false;
 #else
         UNUSED(s);
 #endif
@@ -1448,6 +2131,14 @@ static void udp_clean_async_state(socket_udp *s)
         free(s->overlapped);
         free(s->overlapped_events);
         free(s->dispose_udata);
+#elif defined HAVE_SENDMMSG
+        free(s->batch.iov);
+        free(s->batch.iov_start);
+        free(s->batch.len);
+        free(s->batch.dispose_udata);
+        free(s->batch.msgs);
+        free(s->batch.msg_first);
+        free(s->batch.cmsg_buf);
 #else
         UNUSED(s);
 #endif
@@ -1568,9 +2259,9 @@ int udp_recv_timeout(socket_udp *s, char *buffer, int buflen, struct timeval *ti
                         char *data = NULL;
                         len = udp_recv_data(s, (char **) &data);
                         if (len > 0) {
-                                memcpy(buffer, data, len);
+                                memcpy(buffer, data + RTP_PACKET_HEADER_SIZE, min(len, buflen));
                         }
-                        free(data);
+                        udp_packet_free(data);
                 }
         } else {
                 udp_fd_zero_r(&fd);
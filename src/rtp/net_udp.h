@@ -65,7 +65,8 @@ int         udp_send(socket_udp *s, char *buffer, int buflen);
 int         udp_sendto(socket_udp *s, char *buffer, int buflen, struct sockaddr *dst_addr, socklen_t addrlen);
 
 int         udp_recvv(socket_udp *s, struct msghdr *m);
-void        udp_async_start(socket_udp *s, int nr_packets);
+int         udp_async_start(socket_udp *s, int nr_packets);
+void        udp_async_flush(socket_udp *s);
 void        udp_async_wait(socket_udp *s);
 #ifdef WIN32
 int         udp_sendv(socket_udp *s, LPWSABUF vector, int count, void *d);
@@ -95,8 +96,50 @@ void	    udp_fd_zero_r(struct udp_fd_r *);
 void        udp_fd_set_r(socket_udp *s, struct udp_fd_r *);
 int         udp_fd_isset_r(socket_udp *s, struct udp_fd_r *);
 
+#define UDP_INJECT_HEADROOM 64 ///< space that must precede data passed to udp_inject_data() without copying
+
+/**
+ * Receive placement - lets the consumer of a multithreaded socket receive
+ * payloads of datagrams directly to their final location (eg. a video
+ * framebuffer). First hdr_len bytes of every datagram are always received to
+ * the packet buffer, the rest is received to the destination predicted by
+ * begin(). Callbacks are called from the reader thread.
+ */
+struct udp_placement {
+        int hdr_len;    ///< length of headers received to the packet buffer
+        /**
+         * Predicts destinations of the payloads of next count datagrams.
+         * @param[out] dst destination of i-th payload, left NULL if the payload
+         *                 should be received to the packet buffer
+         * @param[out] len maximal length of i-th payload received to dst
+         * @retval true  placement is active, commit() is called for every received
+         *               datagram and end() thereafter
+         * @retval false placement is not active
+         */
+        bool (*begin)(struct udp_placement *p, int count, char **dst, int *len);
+        /**
+         * Checks if a payload was received to its final location.
+         * @param buf      received datagram (payload is not present if received to dst)
+         * @param size     size of the datagram
+         * @param dst, len predicted location of the payload (as returned by begin()),
+         *                 dst is NULL if not predicted
+         * @returns        nonzero tag if the payload is placed (passed to the consumer
+         *                 with udp_packet_placement()), 0 if it must be moved to the packet buffer
+         */
+        uint64_t (*commit)(struct udp_placement *p, const char *buf, int size, char *dst, int len);
+        void (*end)(struct udp_placement *p);
+        void (*release)(struct udp_placement *p);
+};
+
+bool        udp_set_placement(socket_udp *s, struct udp_placement *placement);
+uint64_t    udp_packet_placement(const void *packet);
+
 int         udp_recv_data(socket_udp * s, char **buffer);
+bool        udp_inject_data(socket_udp *s, char *data, int len, void (*deleter)(char *data, void *udata), void *udata);
 bool        udp_not_empty(socket_udp *s, struct timeval *timeout);
+void        udp_get_recv_stats(socket_udp *s, unsigned long long *kernel_drops, unsigned long long *overruns);
+void       *udp_packet_alloc(size_t len);
+void        udp_packet_free(void *packet);
 int         udp_port_pair_is_free(const char *addr, int force_ip_version, int even_port);
 bool        udp_is_ipv6(socket_udp *s);
 
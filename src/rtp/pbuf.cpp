@@ -63,17 +63,27 @@
 #include "rtp/ptime.h"
 #include "rtp/pbuf.h"
 
+#include <vector>
+
 #define PBUF_MAGIC	0xcafebabe
 
 #define STATS_INTERVAL 100
 
+#define CDATA_SLAB_SIZE 1024 ///< number of coded_data nodes allocated at once
+#define MAX_FRAME_PACKETS (1<<15) ///< seqno span of a frame (must be less than half of seqno range)
+
 struct pbuf_node {
         struct pbuf_node *nxt;
         struct pbuf_node *prv;
         uint32_t rtp_timestamp; /* RTP timestamp for the frame           */
         std::chrono::high_resolution_clock::time_point arrival_time;    /* Arrival time of first packet in frame */
         std::chrono::high_resolution_clock::time_point playout_time;    /* Playout time for the frame            */
-        struct coded_data *cdata;       /*                                       */
+        struct coded_data *cdata;       /* List of coded data in descending seqno order, built
+                                           lazily from slots by link_cdata() */
+        std::vector<struct coded_data *> slots; /* Coded data indexed by seqno - first_seq,
+                                                   NULL for missing packets */
+        uint16_t first_seq;     /* Seqno of the packet in slots[0]       */
+        bool linked;            /* cdata list corresponds to slots       */
         int decoded;            /* Non-zero if we've decoded this frame  */
         int mbit;               /* determines if mbit of frame had been seen */
         uint32_t magic;         /* For debugging                         */
@@ -97,9 +107,14 @@ struct pbuf {
         int last_rtp_seq;
         uint32_t last_display_ts;
         int longest_gap; // longest loss
+
+        // node allocators - nodes are recycled instead of being freed
+        struct coded_data *free_cdata_list; ///< unused coded_data nodes linked by nxt
+        std::vector<struct coded_data *> cdata_slabs;
+        struct pbuf_node *free_pnode_list; ///< unused frame nodes linked by nxt
 };
 
-static void free_cdata(struct coded_data *head);
+static void free_pnode(struct pbuf *playout_buf, struct pbuf_node *node);
 static int frame_complete(struct pbuf_node *frame);
 
 /*********************************************************************************/
@@ -161,7 +176,7 @@ struct pbuf *pbuf_init(volatile int *delay_ms)
 {
         struct pbuf *playout_buf = NULL;
 
-        playout_buf = (struct pbuf *) calloc(1, sizeof(struct pbuf));
+        playout_buf = new struct pbuf();
         if (playout_buf != NULL) {
                 playout_buf->frst = NULL;
                 playout_buf->last = NULL;
@@ -206,101 +221,173 @@ void pbuf_destroy(struct pbuf *playout_buf) {
                         if (curr->prv != NULL) {
                                 curr->prv->nxt = curr->nxt;
                         }
-                        free_cdata(curr->cdata);
-                        delete curr;
+                        free_pnode(playout_buf, curr);
                         curr = temp;
                 }
-                free(playout_buf);
+                while (playout_buf->free_pnode_list != NULL) {
+                        struct pbuf_node *tmp = playout_buf->free_pnode_list;
+                        playout_buf->free_pnode_list = tmp->nxt;
+                        delete tmp;
+                }
+                for (auto slab : playout_buf->cdata_slabs) {
+                        free(slab);
+                }
+                delete playout_buf;
         }
 }
 
-static void add_coded_unit(struct pbuf_node *node, rtp_packet * pkt)
+static struct coded_data *alloc_cdata(struct pbuf *playout_buf)
+{
+        if (playout_buf->free_cdata_list == NULL) {
+                struct coded_data *slab = (struct coded_data *)
+                        malloc(CDATA_SLAB_SIZE * sizeof(struct coded_data));
+                if (slab == NULL) {
+                        return NULL;
+                }
+                playout_buf->cdata_slabs.push_back(slab);
+                for (int i = 0; i < CDATA_SLAB_SIZE; ++i) {
+                        slab[i].nxt = playout_buf->free_cdata_list;
+                        playout_buf->free_cdata_list = &slab[i];
+                }
+        }
+        struct coded_data *ret = playout_buf->free_cdata_list;
+        playout_buf->free_cdata_list = ret->nxt;
+        return ret;
+}
+
+/**
+ * Returns the frame node together with all its packets to the free lists.
+ */
+static void free_pnode(struct pbuf *playout_buf, struct pbuf_node *node)
+{
+        for (auto cdata : node->slots) {
+                if (cdata != NULL) {
+                        rtp_packet_free(cdata->data);
+                        cdata->nxt = playout_buf->free_cdata_list;
+                        playout_buf->free_cdata_list = cdata;
+                }
+        }
+        node->slots.clear(); // keeps capacity for the next frame
+        node->nxt = playout_buf->free_pnode_list;
+        playout_buf->free_pnode_list = node;
+}
+
+/**
+ * Builds the nxt/prv list of coded data of the frame, in descending seqno
+ * order, as expected by decoders.
+ */
+static void link_cdata(struct pbuf_node *node)
+{
+        struct coded_data *prv = NULL;
+
+        node->cdata = NULL;
+        for (int i = node->slots.size() - 1; i >= 0; --i) {
+                struct coded_data *curr = node->slots[i];
+                if (curr == NULL) {
+                        continue;
+                }
+                curr->prv = prv;
+                curr->nxt = NULL;
+                if (prv != NULL) {
+                        prv->nxt = curr;
+                } else {
+                        node->cdata = curr;
+                }
+                prv = curr;
+        }
+        node->linked = true;
+}
+
+static void add_coded_unit(struct pbuf *playout_buf, struct pbuf_node *node, rtp_packet * pkt)
 {
         /* Add "pkt" to the frame represented by "node". The "node" has    */
         /* previously been created, and has some coded data already...     */
 
-        /* New arrivals are added at the head of the list, which is stored */
-        /* in descending order of packets as they arrive (NOT necessarily  */
-        /* descending sequence number order, as the network might reorder) */
-
-        struct coded_data *tmp, *curr, *prv;
+        /* Packets are stored in an array indexed by the sequence number   */
+        /* relative to the first packet of the frame, so that the insertion */
+        /* is O(1) even if the network reorders packets. The linked list   */
+        /* passed to the decoder is built by link_cdata().                 */
 
         assert(node->rtp_timestamp == pkt->ts);
-        assert(node->cdata != NULL);
+        assert(!node->slots.empty());
+
+        int idx = (int16_t)(pkt->seq - node->first_seq);
+        if (idx < 0) {
+                // packet preceding the first received one - prepend slots
+                if ((int) node->slots.size() - idx > MAX_FRAME_PACKETS) {
+                        rtp_packet_free(pkt);
+                        return;
+                }
+                node->slots.insert(node->slots.begin(), -idx, NULL);
+                node->first_seq = pkt->seq;
+                idx = 0;
+        } else if (idx >= (int) node->slots.size()) {
+                if (idx >= MAX_FRAME_PACKETS) {
+                        rtp_packet_free(pkt);
+                        return;
+                }
+                node->slots.resize(idx + 1, NULL);
+        }
 
-        tmp = (struct coded_data *) malloc(sizeof(struct coded_data));
+        if (node->slots[idx] != NULL) {
+                /* duplicate packet */
+                rtp_packet_free(pkt);
+                return;
+        }
+
+        struct coded_data *tmp = alloc_cdata(playout_buf);
         if (tmp == NULL) {
                 /* this is bad, out of memory, drop the packet... */
-                free(pkt);
+                rtp_packet_free(pkt);
                 return;
         }
 
         tmp->seqno = pkt->seq;
         tmp->data = pkt;
+        node->slots[idx] = tmp;
         node->mbit |= pkt->m;
-        if((int16_t)(tmp->seqno - node->cdata->seqno) > 0){
-                tmp->prv = NULL;
-                tmp->nxt = node->cdata;
-                node->cdata->prv = tmp;
-                node->cdata = tmp;
-        } else {
-                curr = node->cdata;
-                if (curr == NULL){
-                        /* this is bad, out of memory, drop the packet... */
-                        free(pkt);
-                        free(tmp);
-                } else {
-                        while (curr != NULL &&  ((int16_t)(tmp->seqno - curr->seqno) < 0)){
-                                prv = curr;
-                                curr = curr->nxt;
-                        }
-                        if (curr == NULL) {
-                                tmp->nxt = NULL;
-                                tmp->prv = prv;
-                                prv->nxt = tmp;
-                        }else if ((int16_t)(tmp->seqno - curr->seqno) > 0){
-                                tmp->nxt = curr;
-                                tmp->prv = curr->prv;
-                                tmp->prv->nxt = tmp;
-                                curr->prv = tmp;
-                        } else {
-                                /* this is bad, something went terribly wrong... */
-                                free(pkt);
-                                free(tmp);
-                        }
-                }
-        }
+        node->linked = false;
 }
 
-static struct pbuf_node *create_new_pnode(rtp_packet * pkt, long long playout_delay_us)
+static struct pbuf_node *create_new_pnode(struct pbuf *playout_buf, rtp_packet * pkt, long long playout_delay_us)
 {
         struct pbuf_node *tmp;
 
         perf_record(UVP_CREATEPBUF, pkt->ts);
 
-        tmp = new struct pbuf_node();
-        if (tmp != NULL) {
-                tmp->magic = PBUF_MAGIC;
-                tmp->rtp_timestamp = pkt->ts;
-                tmp->mbit = pkt->m;
-                tmp->playout_time =
-                        tmp->arrival_time = std::chrono::high_resolution_clock::now();
-                tmp->playout_time += std::chrono::microseconds(playout_delay_us);
-
-                tmp->cdata = (struct coded_data *) malloc(sizeof(struct coded_data));
-                if (tmp->cdata != NULL) {
-                        tmp->cdata->nxt = NULL;
-                        tmp->cdata->prv = NULL;
-                        tmp->cdata->seqno = pkt->seq;
-                        tmp->cdata->data = pkt;
-                } else {
-                        free(pkt);
-                        delete tmp;
-                        return NULL;
-                }
+        struct coded_data *cdata = alloc_cdata(playout_buf);
+        if (cdata == NULL) {
+                rtp_packet_free(pkt);
+                return NULL;
+        }
+
+        if (playout_buf->free_pnode_list != NULL) {
+                tmp = playout_buf->free_pnode_list;
+                playout_buf->free_pnode_list = tmp->nxt;
         } else {
-                free(pkt);
+                tmp = new struct pbuf_node();
         }
+
+        tmp->nxt = NULL;
+        tmp->prv = NULL;
+        tmp->magic = PBUF_MAGIC;
+        tmp->rtp_timestamp = pkt->ts;
+        tmp->mbit = pkt->m;
+        tmp->decoded = 0;
+        tmp->completed = false;
+        tmp->playout_time =
+                tmp->arrival_time = std::chrono::high_resolution_clock::now();
+        tmp->playout_time += std::chrono::microseconds(playout_delay_us);
+
+        cdata->nxt = NULL;
+        cdata->prv = NULL;
+        cdata->seqno = pkt->seq;
+        cdata->data = pkt;
+        tmp->first_seq = pkt->seq;
+        tmp->slots.push_back(cdata);
+        tmp->cdata = cdata;
+        tmp->linked = true;
+
         return tmp;
 }
 
@@ -366,7 +453,7 @@ void pbuf_insert(struct pbuf *playout_buf, rtp_packet * pkt)
 
         if (playout_buf->frst == NULL && playout_buf->last == NULL) {
                 /* playout buffer is empty - add new frame */
-                playout_buf->frst = create_new_pnode(pkt, playout_buf->playout_delay_us + 1000 * (playout_buf->offset_ms ? *playout_buf->offset_ms : 0));
+                playout_buf->frst = create_new_pnode(playout_buf, pkt, playout_buf->playout_delay_us + 1000 * (playout_buf->offset_ms ? *playout_buf->offset_ms : 0));
                 playout_buf->last = playout_buf->frst;
                 return;
         }
@@ -374,11 +461,14 @@ void pbuf_insert(struct pbuf *playout_buf, rtp_packet * pkt)
         if (playout_buf->last->rtp_timestamp == pkt->ts) {
                 /* Packet belongs to last frame in playout_buf this is the */
                 /* most likely scenario - although...                      */
-                add_coded_unit(playout_buf->last, pkt);
+                add_coded_unit(playout_buf, playout_buf->last, pkt);
         } else {
                 if (playout_buf->last->rtp_timestamp < pkt->ts) {
                         /* Packet belongs to a new frame... */
-                        tmp = create_new_pnode(pkt, playout_buf->playout_delay_us + 1000 * (playout_buf->offset_ms ? *playout_buf->offset_ms : 0));
+                        tmp = create_new_pnode(playout_buf, pkt, playout_buf->playout_delay_us + 1000 * (playout_buf->offset_ms ? *playout_buf->offset_ms : 0));
+                        if (tmp == NULL) {
+                                return;
+                        }
                         playout_buf->last->nxt = tmp;
                         playout_buf->last->completed = true;
                         tmp->prv = playout_buf->last;
@@ -398,7 +488,7 @@ void pbuf_insert(struct pbuf *playout_buf, rtp_packet * pkt)
                                 }
                                 if (curr->rtp_timestamp == pkt->ts) {
                                         /* Packet belongs to a previous existing frame... */
-                                        add_coded_unit(curr, pkt);
+                                        add_coded_unit(playout_buf, curr, pkt);
                                 } else {
                                         /* Packet belongs to a frame that is not present */
                                         discard_pkt = true;
@@ -409,25 +499,13 @@ void pbuf_insert(struct pbuf *playout_buf, rtp_packet * pkt)
                                         debug_msg
                                                 ("Oops... dropped packet with M bit set\n");
                                 }
-                                free(pkt);
+                                rtp_packet_free(pkt);
                         }
                 }
         }
         pbuf_validate(playout_buf);
 }
 
-static void free_cdata(struct coded_data *head)
-{
-        struct coded_data *tmp;
-
-        while (head != NULL) {
-                free(head->data);
-                tmp = head;
-                head = head->nxt;
-                free(tmp);
-        }
-}
-
 void pbuf_remove(struct pbuf *playout_buf, std::chrono::high_resolution_clock::time_point const & curr_time)
 {
         /* Remove previously decoded frames that have passed their playout  */
@@ -454,8 +532,7 @@ void pbuf_remove(struct pbuf *playout_buf, std::chrono::high_resolution_clock::t
                         if (curr->prv != NULL) {
                                 curr->prv->nxt = curr->nxt;
                         }
-                        free_cdata(curr->cdata);
-                        delete curr;
+                        free_pnode(playout_buf, curr);
                 } else {
                         /* The playout buffer is stored in order, so once  */
                         /* we see one packet that has not yet reached it's */
@@ -510,6 +587,9 @@ pbuf_decode(struct pbuf *playout_buf, std::chrono::high_resolution_clock::time_p
                         if (frame_complete(curr)) {
                                 struct pbuf_stats stats = { playout_buf->received_pkts_cum,
                                         playout_buf->expected_pkts_cum };
+                                if (!curr->linked) {
+                                        link_cdata(curr);
+                                }
                                 int ret = decode_func(curr->cdata, data, &stats);
                                 curr->decoded = 1;
                                 return ret;
@@ -103,6 +103,7 @@ rs::rs(const char *c_cfg)
 rs::~rs()
 {
         fec_free((fec_t *) state);
+        free(m_scratch);
 }
 
 shared_ptr<video_frame> rs::encode(shared_ptr<video_frame> in)
@@ -270,27 +271,29 @@ void rs::decode(char *in, int in_len, char **out, int *len,
                 return;
         }
 
-        char **output = (char **) malloc(m_k * sizeof(char *));
-        for (unsigned int i = 0; i < m_k; ++i) {
-                output[i] = (char *) malloc(ss);
+        // reconstructed packets are written to the scratch preallocated for the session
+        size_t scratch_len = repaired_slots.count() * ss;
+        if (m_scratch_len < scratch_len) {
+                free(m_scratch);
+                m_scratch = (char *) malloc(scratch_len);
+                m_scratch_len = scratch_len;
+        }
+        m_output.resize(repaired_slots.count());
+        for (unsigned int i = 0; i < repaired_slots.count(); ++i) {
+                m_output[i] = m_scratch + i * ss;
         }
 
         fec_decode((const fec_t *) state, (const gf *const *) pkt,
-                        (gf *const *) output, index, ss);
+                        (gf *const *) m_output.data(), index, ss);
 
         i = 0;
         for (unsigned int j = 0; j < m_k; ++j) {
                 if (repaired_slots.test(j)) {
-                        memcpy((void *) (in + j * ss), output[i], ss);
+                        memcpy((void *) (in + j * ss), m_output[i], ss);
                         i++;
                 }
         }
 
-        for (unsigned int i = 0; i < m_k; ++i) {
-                free(output[i]);
-        }
-        free(output);
-
         uint32_t out_sz;
         memcpy(&out_sz, in, sizeof(out_sz));
         //fprintf(stderr, "       %d\n", out_sz);
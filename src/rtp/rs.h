@@ -40,6 +40,7 @@
 
 #include <map>
 #include <memory>
+#include <vector>
 
 #include "fec.h"
 
@@ -57,6 +58,9 @@ private:
         int get_ss(int hdr_len, int len);
         void *state;
         unsigned int m_k, m_n;
+        char *m_scratch = nullptr; ///< decoder output buffers for reconstructed packets
+        size_t m_scratch_len = 0;
+        std::vector<char *> m_output; ///< pointers to m_scratch passed to the decoder
 };
 
 #endif /* __RS_H__ */
@@ -1218,7 +1218,7 @@ rtp_t rtp_init_with_udp_socket(struct socket_udp_local *l, struct sockaddr *sa,
         session->send_rtcp_to_origin = true;
 
         session->rtp_socket = udp_init_with_local(l, sa, len);
-        session->rtcp_socket = udp_init_if("localhost", NULL, 0, 0, ttl, true, false);
+        session->rtcp_socket = udp_init_if("localhost", NULL, 0, 0, ttl, 0, false);
 
         init_opt(session);
 
@@ -1541,11 +1541,71 @@ void rtp_set_recv_iov(struct rtp *session, struct msghdr *m)
         session->mhdr = m;
 }
 
+/**
+ * Frees RTP packet passed to the application in RX_RTP event. The packet
+ * buffer may originate in a packet pool of the receiving socket so it must
+ * not be freed with free().
+ */
+void rtp_packet_free(rtp_packet *packet)
+{
+        udp_packet_free(packet);
+}
+
 int rtp_send_raw_rtp_data(struct rtp *session, char *data, int buflen)
 {
         return udp_send(session->rtp_socket, data, buflen);
 }
 
+/**
+ * Passes a raw RTP packet directly to the receiving side of the session
+ * without a round trip through the network stack.
+ *
+ * @see udp_inject_data() for the data ownership rules
+ * @retval false if not supported by the session (not multithreaded receiver)
+ */
+bool rtp_inject_rtp_data(struct rtp *session, char *data, int buflen,
+                void (*deleter)(char *data, void *udata), void *udata)
+{
+        if (!session->mt_recv) {
+                return false;
+        }
+        return udp_inject_data(session->rtp_socket, data, buflen, deleter, udata);
+}
+
+/**
+ * Sets placement of received payloads (see struct udp_placement), the
+ * placement hdr_len is set to the length of the RTP header without CSRCs and
+ * extensions followed by phdr_len bytes of payload header. A previously set
+ * placement is replaced, so only one stream of the session is placed.
+ *
+ * Takes the reference to placement (released also on failure).
+ *
+ * @retval false if not supported by the session (not multithreaded receiver,
+ *               encryption or TFRC enabled)
+ */
+bool rtp_set_recv_placement(struct rtp *session, struct udp_placement *placement, int phdr_len)
+{
+        if (!session->mt_recv || session->encryption_enabled || session->tfrc_on) {
+                if (placement) {
+                        placement->release(placement);
+                }
+                return false;
+        }
+        if (placement) {
+                placement->hdr_len = 12 + phdr_len;
+        }
+        return udp_set_placement(session->rtp_socket, placement);
+}
+
+/**
+ * @returns placement tag of the packet (see struct udp_placement), 0 if the
+ *          payload was received to the packet
+ */
+uint64_t rtp_packet_placement(const rtp_packet *packet)
+{
+        return udp_packet_placement(packet);
+}
+
 static int rtp_recv_data(struct rtp *session, uint32_t curr_rtp_ts)
 {
         int buflen;
@@ -1559,7 +1619,7 @@ static int rtp_recv_data(struct rtp *session, uint32_t curr_rtp_ts)
                 buffer = ((uint8_t *) packet) + RTP_PACKET_HEADER_SIZE;
         } else {
                 if (!session->opt->reuse_bufs || (packet == NULL)) {
-                        packet = (rtp_packet *) malloc(RTP_MAX_PACKET_LEN + (session->opt->record_source ? sizeof(struct sockaddr_storage) : 0));
+                        packet = (rtp_packet *) udp_packet_alloc(RTP_MAX_PACKET_LEN + (session->opt->record_source ? sizeof(struct sockaddr_storage) : 0));
                         buffer = ((uint8_t *) packet) + RTP_PACKET_HEADER_SIZE;
                 }
                 struct sockaddr_storage *sin = NULL;
@@ -1573,7 +1633,7 @@ static int rtp_recv_data(struct rtp *session, uint32_t curr_rtp_ts)
                                         RTP_MAX_PACKET_LEN - RTP_PACKET_HEADER_SIZE,
                                         (struct sockaddr *) sin, sin ? &addrlen : 0);
                 if (buflen <= 0) {
-                        free(packet);
+                        rtp_packet_free(packet);
                 }
         }
 
@@ -1685,7 +1745,7 @@ static void rtp_process_data(struct rtp *session, uint32_t curr_rtp_ts,
                 }
 
                 if (!session->opt->reuse_bufs) {
-                        free(packet);
+                        rtp_packet_free(packet);
                 }
         }
 }
@@ -4051,9 +4111,14 @@ bool rtp_is_ipv6(struct rtp *session)
         return udp_is_ipv6(session->rtp_socket);
 }
 
-void rtp_async_start(struct rtp *session, int nr_packets)
+int rtp_async_start(struct rtp *session, int nr_packets)
+{
+       return udp_async_start(session->rtp_socket, nr_packets);
+}
+
+void rtp_async_flush(struct rtp *session)
 {
-       udp_async_start(session->rtp_socket, nr_packets);
+       udp_async_flush(session->rtp_socket);
 }
 
 void rtp_async_wait(struct rtp *session)
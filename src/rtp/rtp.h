@@ -250,6 +250,8 @@ int 		 rtcp_recv_r(struct rtp *session,
 int 		 rtp_recv_poll_r(struct rtp **sessions, 
 			  struct timeval *timeout, uint32_t curr_rtp_ts);
 int 		 rtp_send_raw_rtp_data(struct rtp *session, char *buffer, int buffer_len);
+bool		 rtp_inject_rtp_data(struct rtp *session, char *data, int buflen,
+			  void (*deleter)(char *data, void *udata), void *udata);
 
 int 		 rtp_send_data(struct rtp *session, 
 			       uint32_t rtp_ts, char pt, int m, 
@@ -283,6 +285,10 @@ int              rtp_set_my_ssrc(struct rtp *session, uint32_t ssrc);
 
 uint8_t		*rtp_get_userdata(struct rtp *session);
 void 		 rtp_set_recv_iov(struct rtp *session, struct msghdr *m);
+void             rtp_packet_free(rtp_packet *packet);
+struct udp_placement;
+bool             rtp_set_recv_placement(struct rtp *session, struct udp_placement *placement, int phdr_len);
+uint64_t         rtp_packet_placement(const rtp_packet *packet);
 
 int              rtp_set_recv_buf(struct rtp *session, int bufsize);
 int              rtp_set_send_buf(struct rtp *session, int bufsize);
@@ -293,7 +299,7 @@ int              rtp_compute_fract_lost(struct rtp *session, uint32_t ssrc);
 bool             rtp_is_ipv6(struct rtp *session);
 
 /*
- * Async API - MSW specific
+ * Async API - MSW overlapped I/O, Linux sendmmsg() batching
  *
  * Using async API hugely improves performance.
  * Usage is simple - prior to sending a bulk of packets (eg. video frame), rtp_async_start()
@@ -301,8 +307,12 @@ bool             rtp_is_ipv6(struct rtp *session);
  * be altered up to rtp_async_wait() call, which waits upon completition of async operations
  * started after rtp_async_start(). Caller is responsible that rtp_send_data_hdr() is not called
  * more than nr_packet times.
+ *
+ * rtp_async_start() returns number of packets the socket sends at once (1 if not batching),
+ * rtp_async_flush() sends packets queued so far (eg. at the end of shaping interval).
  */
-void             rtp_async_start(struct rtp *session, int nr_packets);
+int              rtp_async_start(struct rtp *session, int nr_packets);
+void             rtp_async_flush(struct rtp *session);
 void             rtp_async_wait(struct rtp *session);
 
 struct socket_udp_local *rtp_get_udp_local_socket(struct rtp *session);
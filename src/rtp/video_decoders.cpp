@@ -85,16 +85,20 @@
 #include "module.h"
 #include "perf.h"
 #include "rtp/fec.h"
+#include "rtp/net_udp.h"
 #include "rtp/rtp.h"
 #include "rtp/rtp_callback.h"
 #include "rtp/pbuf.h"
 #include "rtp/video_decoders.h"
 #include "utils/synchronized_queue.h"
 #include "utils/timed_message.h"
+#include "utils/worker.h"
 #include "video.h"
 #include "video_decompress.h"
 #include "video_display.h"
 
+#include <algorithm>
+#include <atomic>
 #include <condition_variable>
 #ifdef RECONFIGURE_IN_FUTURE_THREAD
 #include <future>
@@ -111,6 +115,9 @@
 #endif
 
 
+#define DEFAULT_FEC_FRAMES_IN_FLIGHT 2
+#define LINE_DECODE_GRAIN 32 ///< minimal count of lines line-decoded by one worker
+
 using namespace std;
 
 struct state_video_decoder;
@@ -127,6 +134,7 @@ static bool reconfigure_decoder(struct state_video_decoder *decoder,
 static int check_for_mode_change(struct state_video_decoder *decoder, uint32_t *hdr);
 static void wait_for_framebuffer_swap(struct state_video_decoder *decoder);
 static void *fec_thread(void *args);
+static void *fec_collect_thread(void *args);
 static void *decompress_thread(void *args);
 static void cleanup(struct state_video_decoder *decoder);
 static void decoder_process_message(struct module *);
@@ -169,6 +177,9 @@ struct line_decoder {
         unsigned int         dst_linesize; ///< destination linesize
         unsigned int         dst_pitch;    ///< framebuffer pitch - it can be larger if SDL resolution is larger than data */
         unsigned int         src_linesize; ///< source linesize
+        bool                 direct;       /**< decode_line is plain memcpy and source and destination
+                                            * line layouts match so that a packet payload can be placed
+                                            * to the framebuffer at its data offset as a whole */
 };
 
 struct reported_statistics_cumul {
@@ -180,6 +191,9 @@ struct reported_statistics_cumul {
         unsigned long long int     nano_per_frame_decompress = 0;
         unsigned long long int     nano_per_frame_error_correction = 0;
         unsigned long long int     nano_per_frame_expected = 0;
+        unsigned long long int     copied_bytes_total = 0;
+        unsigned long long int     staged_bytes_total = 0;
+        unsigned long long int     zero_copy_bytes_total = 0;
         unsigned long int     reported_frames = 0;
         void print() {
                 char buff[256];
@@ -193,6 +207,16 @@ struct reported_statistics_cumul {
                 else
                         sprintf(buff + bytes, "\n");
                 log_msg(LOG_LEVEL_INFO, buff);
+                if (reported_frames > 0) {
+                        log_msg(LOG_LEVEL_VERBOSE, "Video dec copies per frame: %llu B copied to framebuffer, %llu B staged, "
+                                        "%llu B received to framebuffer.\n",
+                                        copied_bytes_total / reported_frames,
+                                        staged_bytes_total / reported_frames,
+                                        zero_copy_bytes_total / reported_frames);
+                        log_msg(LOG_LEVEL_VERBOSE, "Video dec time per frame: %.3f ms FEC, %.3f ms decompress.\n",
+                                        nano_per_frame_error_correction / 1000000.0 / reported_frames,
+                                        nano_per_frame_decompress / 1000000.0 / reported_frames);
+                }
         }
 };
 
@@ -234,6 +258,9 @@ struct frame_msg {
                                 " nanoPerFrameDecompress " << (stats.nano_per_frame_decompress += nanoPerFrameDecompress) <<
                                 " nanoPerFrameErrorCorrection " << (stats.nano_per_frame_error_correction += nanoPerFrameErrorCorrection) <<
                                 " nanoPerFrameExpected " << (stats.nano_per_frame_expected += nanoPerFrameExpected) <<
+                                " copiedBytes " << (stats.copied_bytes_total += copied_bytes) <<
+                                " stagedBytes " << (stats.staged_bytes_total += staged_bytes) <<
+                                " zeroCopyBytes " << (stats.zero_copy_bytes_total += zero_copy_bytes) <<
                                 " reportedFrames " << (stats.reported_frames += 1);
                         if ((stats.displayed + stats.dropped + stats.missing) % 600 == 599) {
                                 stats.print();
@@ -255,6 +282,9 @@ struct frame_msg {
         unsigned long long int nanoPerFrameDecompress = 0;
         unsigned long long int nanoPerFrameErrorCorrection = 0;
         unsigned long long int nanoPerFrameExpected = 0;
+        unsigned long long int copied_bytes = 0; ///< bytes copied from packets directly to the display framebuffer
+        unsigned long long int staged_bytes = 0; ///< bytes copied to an intermediate buffer (FEC, compressed or encrypted data)
+        unsigned long long int zero_copy_bytes = 0; ///< bytes received directly to the display framebuffer
         bool is_displayed = false;
         bool is_corrupted = false;
 };
@@ -271,6 +301,218 @@ struct main_msg_reconfigure {
         unique_ptr<frame_msg> last_frame;
         bool force;
 };
+
+/**
+ * FEC states used to decode one frame in flight (one state per substream).
+ */
+struct fec_slot {
+        ~fec_slot() {
+                for (auto f : states) {
+                        delete f;
+                }
+        }
+        /// (re)creates FEC states if parameters have changed
+        bool prepare(struct fec_desc const & d, unsigned int substreams) {
+                if (states.size() == substreams && desc.type == d.type && desc.k == d.k &&
+                                desc.m == d.m && desc.c == d.c && desc.seed == d.seed) {
+                        return true;
+                }
+                for (auto f : states) {
+                        delete f;
+                }
+                states.clear();
+                desc = d;
+                for (unsigned int i = 0; i < substreams; ++i) {
+                        fec *f = fec::create_from_desc(d);
+                        if (f == NULL) {
+                                desc = fec_desc(FEC_NONE);
+                                return false;
+                        }
+                        states.push_back(f);
+                }
+                return true;
+        }
+        vector<fec *> states;
+        struct fec_desc desc{FEC_NONE};
+};
+
+struct fec_job {
+        unique_ptr<frame_msg> data;
+        struct fec_slot *slot = nullptr;
+        task_result_handle_t handle = nullptr; ///< FEC decode task, NULL if frame doesn't carry FEC
+        vector<char *> out_buffer;
+        vector<int> out_len;
+        unsigned long long int nano_fec = 0;
+};
+
+/**
+ * Receive placement of uncompressed video (see struct udp_placement) - the
+ * UDP reader receives payloads of the frame expected next directly to the
+ * display framebuffer obtained for it, decode_video_frame() then skips the
+ * copy of packets tagged with the tag of the framebuffer.
+ *
+ * Packets of the most recent frame are tracked so that the predicted
+ * destinations always lie beyond the data already received. Mispredicted
+ * payloads thus never overwrite valid data and they are copied by the
+ * decoder as usual.
+ */
+struct video_recv_placement {
+        struct udp_placement ops; ///< must be first
+        atomic<int> refcount{1};
+        mutex lock;             ///< held by the reader from begin() to end()
+        bool tracking = false;  ///< packets are being tracked
+        bool armed = false;     ///< framebuffer for buffer_id is set
+        uint64_t tag = 0;       ///< tag of the armed framebuffer
+        uint32_t ssrc = 0;
+        uint32_t buffer_id = 0; ///< armed buffer ID
+        struct region {
+                char *base;
+                int size;
+        };
+        vector<region> regions; ///< substreams of the armed framebuffer
+
+        bool tracked_valid = false;    ///< tracked_id is set
+        bool tracked_complete = false; ///< tracked frame is tracked since its first packet
+        uint32_t tracked_id = 0;       ///< most recent buffer ID
+        vector<int> hw;                ///< end of received data of tracked frame per substream
+        int last_substream = 0;
+        int payload_len = 0;           ///< length of last non-final payload
+};
+
+static bool recv_placement_begin(struct udp_placement *p, int count, char **dst, int *len)
+{
+        auto *s = (struct video_recv_placement *) p;
+        s->lock.lock();
+        if (!s->tracking) {
+                s->lock.unlock();
+                return false;
+        }
+        if (!s->armed || s->payload_len == 0 || !s->tracked_valid) {
+                return true;
+        }
+        int substream = 0;
+        int pos = 0;
+        if (s->tracked_complete && s->tracked_id == s->buffer_id) {
+                substream = s->last_substream;
+                pos = s->hw[substream];
+        } else if (((s->tracked_id + 1) & 0x3fffff) != s->buffer_id) {
+                return true; // armed frame is not the one expected next
+        }
+        for (int i = 0; i < count; ++i, pos += s->payload_len) {
+                int l = min(s->payload_len, s->regions[substream].size - pos);
+                if (l <= 0) {
+                        break;
+                }
+                dst[i] = s->regions[substream].base + pos;
+                len[i] = l;
+        }
+        return true;
+}
+
+static uint64_t recv_placement_commit(struct udp_placement *p, const char *buf, int size, char *dst, int len)
+{
+        auto *s = (struct video_recv_placement *) p;
+        // only RTP headers without CSRCs, extensions and padding are handled
+        if (size <= p->hdr_len || (unsigned char) buf[0] != 0x80 || (buf[1] & 0x7f) != PT_VIDEO) {
+                return 0;
+        }
+        uint32_t hdr[4];
+        memcpy(hdr, buf + 8, sizeof hdr); // SSRC followed by video_payload_hdr_t
+        if (ntohl(hdr[0]) != s->ssrc) {
+                return 0;
+        }
+        unsigned substream = ntohl(hdr[1]) >> 22;
+        uint32_t buffer_id = ntohl(hdr[1]) & 0x3fffff;
+        int data_pos = ntohl(hdr[2]);
+        int buffer_length = ntohl(hdr[3]);
+        int payload_len = size - p->hdr_len;
+        if (substream >= s->hw.size()) {
+                return 0;
+        }
+        if (!s->tracked_valid || buffer_id != s->tracked_id) {
+                if (s->tracked_valid && ((buffer_id - s->tracked_id) & 0x3fffff) >= 0x200000) {
+                        return 0; // late packet of previous frame
+                }
+                s->tracked_complete = s->tracked_valid;
+                s->tracked_valid = true;
+                s->tracked_id = buffer_id;
+                fill(s->hw.begin(), s->hw.end(), 0);
+        }
+        s->hw[substream] = max(s->hw[substream], data_pos + payload_len);
+        s->last_substream = substream;
+        if (data_pos + payload_len < buffer_length) {
+                s->payload_len = payload_len;
+        }
+
+        if (dst != nullptr && s->armed && s->tracked_complete && buffer_id == s->buffer_id &&
+                        dst == s->regions[substream].base + data_pos && payload_len <= len) {
+                return s->tag;
+        }
+        return 0;
+}
+
+static void recv_placement_end(struct udp_placement *p)
+{
+        ((struct video_recv_placement *) p)->lock.unlock();
+}
+
+static void recv_placement_release(struct udp_placement *p)
+{
+        auto *s = (struct video_recv_placement *) p;
+        if (--s->refcount == 0) {
+                delete s;
+        }
+}
+
+static struct video_recv_placement *recv_placement_create()
+{
+        auto *s = new video_recv_placement();
+        s->ops.begin = recv_placement_begin;
+        s->ops.commit = recv_placement_commit;
+        s->ops.end = recv_placement_end;
+        s->ops.release = recv_placement_release;
+        return s;
+}
+
+/**
+ * Arms the placement for next frame with buffer ID buffer_id. Tracking starts
+ * with the first call, the frame is then not armed because its packets might
+ * have been already received.
+ *
+ * @returns tag of the framebuffer, 0 if not armed
+ */
+static uint64_t recv_placement_arm(struct video_recv_placement *s, uint32_t ssrc, uint32_t buffer_id,
+                vector<video_recv_placement::region> &&regions)
+{
+        lock_guard<mutex> lk(s->lock);
+        if (!s->tracking || s->ssrc != ssrc || s->hw.size() != regions.size()) {
+                s->tracking = true;
+                s->ssrc = ssrc;
+                s->tracked_valid = s->tracked_complete = false;
+                s->hw.assign(regions.size(), 0);
+                s->armed = false;
+                return 0;
+        }
+        s->buffer_id = buffer_id;
+        s->regions = move(regions);
+        s->armed = true;
+        s->tag += 1;
+        return s->tag;
+}
+
+/**
+ * Disarms the placement - the framebuffer is not written after the call
+ * returns.
+ * @param stop  stop also the tracking (the stream is no longer placed)
+ */
+static void recv_placement_disarm(struct video_recv_placement *s, bool stop)
+{
+        lock_guard<mutex> lk(s->lock);
+        s->armed = false;
+        if (stop) {
+                s->tracking = false;
+        }
+}
 }
 
 /**
@@ -287,13 +529,16 @@ struct state_video_decoder
                 control = (struct control_state *) get_module(get_root_module(parent), "control");
         }
         ~state_video_decoder() {
+                recv_placement_disarm(placement, true);
+                placement->ops.release(&placement->ops);
                 module_done(&mod);
         }
         struct module mod;
         struct control_state *control = {};
 
         thread decompress_thread_id,
-                  fec_thread_id;
+                  fec_thread_id,
+                  fec_collect_thread_id;
         struct video_desc received_vid_desc = {}; ///< description of the network video
         struct video_desc display_desc = {};      ///< description of the mode that display is currently configured to
 
@@ -328,6 +573,9 @@ struct state_video_decoder
         int               pitch = 0;
 
         synchronized_queue<unique_ptr<frame_msg>, 1> fec_queue;
+        vector<unique_ptr<fec_slot>> fec_slots;     ///< one for every frame that can be in flight
+        synchronized_queue<fec_slot *, -1> free_fec_slots;
+        synchronized_queue<fec_job *, -1> fec_done_queue; ///< in-flight frames in order of arrival
 
         enum video_mode   video_mode = {} ;  ///< video mode set for this decoder
         bool          merged_fb = false; ///< flag if the display device driver requires tiled video or not
@@ -345,6 +593,9 @@ struct state_video_decoder
         bool             reconfiguration_in_progress = false;
 #endif
         struct reported_statistics_cumul stats = {}; ///< stats to be reported through control socket
+
+        struct video_recv_placement *placement = recv_placement_create();
+        uint64_t placement_tag = 0; ///< placement tag of @ref frame, 0 if not armed
 };
 
 /**
@@ -357,60 +608,162 @@ static void wait_for_framebuffer_swap(struct state_video_decoder *decoder) {
         decoder->buffer_swapped_cv.wait(lk, [decoder]{return decoder->buffer_swapped;});
 }
 
+/**
+ * Arms receive placement to decoder::frame for the frame following msg if
+ * the payloads can be placed as they are (uncompressed video without FEC
+ * and encryption with line layout identical to the framebuffer).
+ */
+static void arm_recv_placement(struct state_video_decoder *decoder, struct frame_msg *msg)
+{
+        if (decoder->frame == NULL || decoder->decoder_type != LINE_DECODER || decoder->decrypt ||
+                        msg->recv_frame->fec_params.type != FEC_NONE) {
+                return;
+        }
+        vector<video_recv_placement::region> regions(decoder->max_substreams);
+        for (unsigned int i = 0; i < decoder->max_substreams; ++i) {
+                struct line_decoder *ld = &decoder->line_decoder[i];
+                if (!ld->direct) {
+                        return;
+                }
+                struct tile *tile = vf_get_tile(decoder->frame, decoder->merged_fb ? 0 : i);
+                regions[i].base = tile->data + ld->base_offset;
+                regions[i].size = min<long>((long) tile->data_len - ld->base_offset,
+                                (long) ld->src_linesize * decoder->received_vid_desc.height);
+        }
+        decoder->placement_tag = recv_placement_arm(decoder->placement, msg->nofec_frame->ssrc,
+                        (msg->buffer_num[0] + 1) & 0x3fffff, move(regions));
+}
+
 #define ENCRYPTED_ERR "Receiving encrypted video data but " \
         "no decryption key entered!\n"
 #define NOT_ENCRYPTED_ERR "Receiving unencrypted video data " \
         "while expecting encrypted.\n"
 
+/**
+ * Decodes FEC of all substreams of a frame. Runs in a worker thread, the
+ * substreams are decoded in parallel each with its own FEC state.
+ */
+static void *fec_decode_task(void *arg) {
+        struct fec_job *job = (struct fec_job *) arg;
+        struct video_frame *recv_frame = job->data->recv_frame;
+        auto t0 = std::chrono::high_resolution_clock::now();
+
+        parallel_for(0, job->slot->states.size(), [job, recv_frame](int start, int end) {
+                for (int pos = start; pos < end; ++pos) {
+                        job->slot->states[pos]->decode(recv_frame->tiles[pos].data,
+                                        recv_frame->tiles[pos].data_len,
+                                        &job->out_buffer[pos], &job->out_len[pos],
+                                        job->data->pckt_list[pos]);
+                }
+        });
+
+        job->nano_fec =
+                std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now() - t0).count();
+        return NULL;
+}
+
+/**
+ * Dispatches received frames to FEC decoding. At most decoder->fec_slots
+ * frames are in flight, the frames are handed over to fec_collect_thread()
+ * in the order of arrival.
+ */
 static void *fec_thread(void *args) {
         struct state_video_decoder *decoder =
                 (struct state_video_decoder *) args;
 
-        fec *fec_state = NULL;
-        struct fec_desc desc(FEC_NONE);
-
         while(1) {
                 unique_ptr<frame_msg> data = decoder->fec_queue.pop();
+                struct fec_job *job = new fec_job();
 
                 if (!data->recv_frame) { // poisoned
-                        decoder->decompress_queue.push(move(data));
+                        job->data = move(data);
+                        decoder->fec_done_queue.push(job);
                         break; // exit from loop
                 }
 
-                struct video_frame *frame = decoder->frame;
-                struct tile *tile = NULL;
-                auto t0 = std::chrono::high_resolution_clock::now();
+                job->slot = decoder->free_fec_slots.pop(); // blocks if too many frames are in flight
 
                 if (data->recv_frame->fec_params.type != FEC_NONE) {
-                        if(!fec_state || desc.k != data->recv_frame->fec_params.k ||
-                                        desc.m != data->recv_frame->fec_params.m ||
-                                        desc.c != data->recv_frame->fec_params.c ||
-                                        desc.seed != data->recv_frame->fec_params.seed
-                          ) {
-                                delete fec_state;
-                                desc = data->recv_frame->fec_params;
-                                fec_state = fec::create_from_desc(desc);
-                                if(fec_state == NULL) {
-                                        log_msg(LOG_LEVEL_FATAL, "[decoder] Unable to initialize FEC.\n");
-                                        exit_uv(1);
-                                        goto cleanup;
-                                }
+                        if (!job->slot->prepare(data->recv_frame->fec_params, decoder->max_substreams)) {
+                                log_msg(LOG_LEVEL_FATAL, "[decoder] Unable to initialize FEC.\n");
+                                exit_uv(1);
+                                decoder->free_fec_slots.push(job->slot);
+                                delete job;
+                                continue;
                         }
+                        job->out_buffer.resize(decoder->max_substreams);
+                        job->out_len.resize(decoder->max_substreams);
+                        job->data = move(data);
+                        job->handle = task_run_async(fec_decode_task, job);
+                } else {
+                        job->data = move(data);
+                }
+
+                decoder->fec_done_queue.push(job);
+        }
+
+        return NULL;
+}
+
+/**
+ * Decodes FEC-decoded substream pos to the framebuffer. Lines are decoded in
+ * parallel.
+ */
+static void line_decode_tile(struct state_video_decoder *decoder, int pos, char *src, int len)
+{
+        struct video_frame *frame = decoder->frame;
+        int divisor = decoder->merged_fb ? 1 : decoder->max_substreams;
+        struct tile *tile = vf_get_tile(frame, pos % divisor);
+        struct line_decoder *line_decoder = &decoder->line_decoder[pos];
+        int src_linesize = line_decoder->src_linesize;
+        int dst_linesize = vc_get_linesize(tile->width, frame->color_spec);
+        int lines = (len + src_linesize - 1) / src_linesize;
+
+        parallel_for(0, lines, [=](int start, int end) {
+                unsigned char *s = (unsigned char *) src + start * src_linesize;
+                unsigned char *d = (unsigned char *) tile->data + line_decoder->base_offset + start * dst_linesize;
+                for (int y = start; y < end; ++y) {
+                        line_decoder->decode_line(d, s, src_linesize,
+                                        line_decoder->shifts[0],
+                                        line_decoder->shifts[1],
+                                        line_decoder->shifts[2]);
+                        s += src_linesize;
+                        d += dst_linesize;
+                }
+        }, LINE_DECODE_GRAIN);
+}
+
+/**
+ * Takes FEC-decoded frames in order, checks them, line-decodes them if needed
+ * and passes them to the decompress thread.
+ */
+static void *fec_collect_thread(void *args) {
+        struct state_video_decoder *decoder =
+                (struct state_video_decoder *) args;
+
+        while(1) {
+                struct fec_job *job = decoder->fec_done_queue.pop();
+                if (job->handle) {
+                        wait_task(job->handle);
+                }
+                unique_ptr<frame_msg> data = move(job->data);
+
+                if (!data->recv_frame) { // poisoned
+                        decoder->decompress_queue.push(move(data));
+                        delete job;
+                        break; // exit from loop
                 }
 
+                struct video_frame *frame = decoder->frame;
+                auto t0 = std::chrono::high_resolution_clock::now();
+
                 data->nofec_frame = vf_alloc(data->recv_frame->tile_count);
                 data->nofec_frame->ssrc = data->recv_frame->ssrc;
 
                 if (data->recv_frame->fec_params.type != FEC_NONE) {
-                        bool buffer_swapped = false;
-                        for (int pos = 0; pos < get_video_mode_tiles_x(decoder->video_mode)
-                                        * get_video_mode_tiles_y(decoder->video_mode); ++pos) {
-                                char *fec_out_buffer = NULL;
-                                int fec_out_len = 0;
-
-                                fec_state->decode(data->recv_frame->tiles[pos].data,
-                                                data->recv_frame->tiles[pos].data_len,
-                                                &fec_out_buffer, &fec_out_len, data->pckt_list[pos]);
+                        for (int pos = 0; pos < (int) decoder->max_substreams; ++pos) {
+                                char *fec_out_buffer = job->out_buffer[pos];
+                                int fec_out_len = job->out_len[pos];
 
                                 if (data->recv_frame->tiles[pos].data_len != (unsigned int) sum_map(data->pckt_list[pos])) {
                                         verbose_msg("Frame incomplete - substream %d, buffer %d: expected %u bytes, got %u.\n", pos,
@@ -428,8 +781,8 @@ static void *fec_thread(void *args) {
                                 video_payload_hdr_t video_hdr;
                                 memcpy(&video_hdr, fec_out_buffer,
                                                 sizeof(video_payload_hdr_t));
-                                fec_out_buffer += sizeof(video_payload_hdr_t);
-                                fec_out_len -= sizeof(video_payload_hdr_t);
+                                job->out_buffer[pos] += sizeof(video_payload_hdr_t);
+                                job->out_len[pos] -= sizeof(video_payload_hdr_t);
 
                                 struct video_desc network_desc;
                                 parse_video_hdr(video_hdr, &network_desc);
@@ -444,41 +797,20 @@ static void *fec_thread(void *args) {
                                 }
 
                                 if(decoder->decoder_type == EXTERNAL_DECODER) {
-                                        data->nofec_frame->tiles[pos].data_len = fec_out_len;
-                                        data->nofec_frame->tiles[pos].data = fec_out_buffer;
-                                } else { // linedecoder
-                                        if (!buffer_swapped) {
-                                                buffer_swapped = true;
-                                                wait_for_framebuffer_swap(decoder);
-                                                unique_lock<mutex> lk(decoder->lock);
-                                                decoder->buffer_swapped = false;
-                                        }
-
-                                        int divisor;
-
-                                        if (!decoder->merged_fb) {
-                                                divisor = decoder->max_substreams;
-                                        } else {
-                                                divisor = 1;
-                                        }
+                                        data->nofec_frame->tiles[pos].data_len = job->out_len[pos];
+                                        data->nofec_frame->tiles[pos].data = job->out_buffer[pos];
+                                }
+                        }
 
-                                        tile = vf_get_tile(frame, pos % divisor);
-
-                                        struct line_decoder *line_decoder =
-                                                &decoder->line_decoder[pos];
-
-                                        int data_pos = 0;
-                                        char *src = fec_out_buffer;
-                                        char *dst = tile->data + line_decoder->base_offset;
-                                        while(data_pos < (int) fec_out_len) {
-                                                line_decoder->decode_line((unsigned char*)dst, (unsigned char *) src, line_decoder->src_linesize,
-                                                                line_decoder->shifts[0],
-                                                                line_decoder->shifts[1],
-                                                                line_decoder->shifts[2]);
-                                                src += line_decoder->src_linesize;
-                                                dst += vc_get_linesize(tile->width ,frame->color_spec);
-                                                data_pos += line_decoder->src_linesize;
-                                        }
+                        if (decoder->decoder_type != EXTERNAL_DECODER) { // linedecoder
+                                wait_for_framebuffer_swap(decoder);
+                                {
+                                        unique_lock<mutex> lk(decoder->lock);
+                                        decoder->buffer_swapped = false;
+                                }
+                                for (int pos = 0; pos < (int) decoder->max_substreams; ++pos) {
+                                        line_decode_tile(decoder, pos, job->out_buffer[pos], job->out_len[pos]);
+                                        data->copied_bytes += job->out_len[pos];
                                 }
                         }
                 } else { /* PT_VIDEO */
@@ -500,16 +832,15 @@ static void *fec_thread(void *args) {
                         }
                 }
 
-                data->nanoPerFrameErrorCorrection =
+                data->nanoPerFrameErrorCorrection = job->nano_fec +
                         std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now() - t0).count();
 
                 decoder->decompress_queue.push(move(data));
 cleanup:
-                ;
+                decoder->free_fec_slots.push(job->slot);
+                delete job;
         }
 
-        delete fec_state;
-
         return NULL;
 }
 
@@ -539,6 +870,12 @@ static void *decompress_thread(void *args) {
                         break;
                 }
 
+                // no more packets may be received to the framebuffer from now
+                if (decoder->placement_tag != 0) {
+                        recv_placement_disarm(decoder->placement, false);
+                        decoder->placement_tag = 0;
+                }
+
                 auto t0 = std::chrono::high_resolution_clock::now();
 
                 if(decoder->decoder_type == EXTERNAL_DECODER) {
@@ -618,6 +955,7 @@ static void *decompress_thread(void *args) {
                                 msg->is_displayed = true;
                         }
                         decoder->frame = display_get_frame(decoder->display);
+                        arm_recv_placement(decoder, msg.get());
                 }
 
 skip_frame:
@@ -641,6 +979,9 @@ static void decoder_set_video_mode(struct state_video_decoder *decoder, enum vid
                         * get_video_mode_tiles_y(decoder->video_mode);
 }
 
+ADD_TO_PARAM(decoder_fec_frames, "decoder-fec-frames",
+                "* decoder-fec-frames=<n>\n"
+                "  Number of received frames that can be FEC-decoded concurrently (default 2)\n");
 /**
  * @brief Initializes video decompress state.
  * @param video_mode  video_mode expected to be received from network
@@ -678,6 +1019,15 @@ struct state_video_decoder *video_decoder_init(struct module *parent,
 
         decoder_set_video_mode(s, video_mode);
 
+        int fec_frames = DEFAULT_FEC_FRAMES_IN_FLIGHT;
+        if (get_commandline_param("decoder-fec-frames")) {
+                fec_frames = max(atoi(get_commandline_param("decoder-fec-frames")), 1);
+        }
+        for (int i = 0; i < fec_frames; ++i) {
+                s->fec_slots.emplace_back(new fec_slot());
+                s->free_fec_slots.push(s->fec_slots.back().get());
+        }
+
         if(!video_decoder_register_display(s, display)) {
                 delete s;
                 return NULL;
@@ -700,6 +1050,7 @@ static void video_decoder_start_threads(struct state_video_decoder *decoder)
         assert(decoder->display); // we want to run threads only if decoder is active
 
         decoder->decompress_thread_id = thread(decompress_thread, decoder);
+        decoder->fec_collect_thread_id = thread(fec_collect_thread, decoder);
         decoder->fec_thread_id = thread(fec_thread, decoder);
 }
 
@@ -717,6 +1068,7 @@ static void video_decoder_stop_threads(struct state_video_decoder *decoder)
         decoder->fec_queue.push(move(msg));
 
         decoder->fec_thread_id.join();
+        decoder->fec_collect_thread_id.join();
         decoder->decompress_thread_id.join();
 }
 
@@ -778,6 +1130,8 @@ void video_decoder_remove_display(struct state_video_decoder *decoder)
 {
         if (decoder->display) {
                 video_decoder_stop_threads(decoder);
+                recv_placement_disarm(decoder->placement, true);
+                decoder->placement_tag = 0;
                 control_report_event(decoder->control, string("RECV stream ended"));
                 if (decoder->frame) {
                         display_put_frame(decoder->display, decoder->frame, PUTF_DISCARD);
@@ -833,6 +1187,19 @@ void video_decoder_destroy(struct state_video_decoder *decoder)
         delete decoder;
 }
 
+/**
+ * Returns receive placement of the decoder to be set to the receiving RTP
+ * session with rtp_set_recv_placement(), payloads of uncompressed video are
+ * then received directly to the display framebuffer when possible.
+ *
+ * @returns new reference to the placement
+ */
+struct udp_placement *video_decoder_get_recv_placement(struct state_video_decoder *decoder)
+{
+        decoder->placement->refcount++;
+        return &decoder->placement->ops;
+}
+
 /**
  * This function selects, according to given video description, appropriate
  *
@@ -1002,6 +1369,8 @@ static bool reconfigure_decoder(struct state_video_decoder *decoder,
 
         // this code forces flushing the pipelined data
         video_decoder_stop_threads(decoder);
+        recv_placement_disarm(decoder->placement, true);
+        decoder->placement_tag = 0;
         if (decoder->frame)
                 display_put_frame(decoder->display, decoder->frame, PUTF_DISCARD);
         decoder->frame = NULL;
@@ -1152,6 +1521,12 @@ static bool reconfigure_decoder(struct state_video_decoder *decoder,
                         }
                         decoder->merged_fb = false;
                 }
+                for (int i = 0; i < src_x_tiles * src_y_tiles; ++i) {
+                        struct line_decoder *ld = &decoder->line_decoder[i];
+                        ld->direct = ld->decode_line == (decoder_t) memcpy &&
+                                ld->src_linesize == ld->dst_linesize &&
+                                ld->dst_pitch == ld->dst_linesize;
+                }
         } else if (decoder->decoder_type == EXTERNAL_DECODER) {
                 int buf_size;
 
@@ -1298,6 +1673,7 @@ int decode_video_frame(struct coded_data *cdata, void *decoder_data, struct pbuf
 
         int pt;
         bool buffer_swapped = false;
+        unsigned long long int copied_bytes = 0, staged_bytes = 0, zero_copy_bytes = 0;
 
         perf_record(UVP_DECODEFRAME, cdata);
 
@@ -1354,6 +1730,8 @@ int decode_video_frame(struct coded_data *cdata, void *decoder_data, struct pbuf
                 uint32_t substream;
                 pckt = cdata->data;
                 enum openssl_mode crypto_mode;
+                // nonzero if the payload was received directly to a framebuffer
+                uint64_t placement = rtp_packet_placement(pckt);
 
                 pt = pckt->pt;
                 hdr = (uint32_t *)(void *) pckt->data;
@@ -1451,6 +1829,7 @@ int decode_video_frame(struct coded_data *cdata, void *decoder_data, struct pbuf
                         }
                         data = (char *) plaintext;
                         len = data_len;
+                        staged_bytes += len;
                 }
 
                 if (pt == PT_VIDEO || pt == PT_ENCRYPT_VIDEO)
@@ -1497,6 +1876,33 @@ int decode_video_frame(struct coded_data *cdata, void *decoder_data, struct pbuf
 
                         /* End of critical section */
 
+                        /* payload already received to the framebuffer by
+                         * the network thread (see video_recv_placement) -
+                         * if it was another framebuffer, the data are lost */
+                        if (placement != 0) {
+                                if (line_decoder->direct && placement == decoder->placement_tag) {
+                                        zero_copy_bytes += len;
+                                } else {
+                                        pckt_list[substream].erase(data_pos);
+                                }
+                                goto next_packet;
+                        }
+
+                        /* fast path - payload layout is identical to the
+                         * framebuffer one so it is placed at its offset
+                         * with a single copy, not line by line */
+                        if (line_decoder->direct) {
+                                if (line_decoder->base_offset + data_pos + len <= tile->data_len) {
+                                        memcpy(tile->data + line_decoder->base_offset + data_pos, data, len);
+                                        copied_bytes += len;
+                                } else {
+                                        if ((prints++ % 100) == 0) {
+                                                log_msg(LOG_LEVEL_ERROR, "WARNING!! Discarding input data as frame buffer is too small.\n");
+                                        }
+                                }
+                                goto next_packet;
+                        }
+
                         /* MAGIC, don't touch it, you definitely break it
                          *  *source* is data from network, *destination* is frame buffer
                          */
@@ -1546,6 +1952,7 @@ int decode_video_frame(struct coded_data *cdata, void *decoder_data, struct pbuf
                                         line_decoder->decode_line((unsigned char*)tile->data + line_decoder->base_offset + offset, source, l,
                                                         line_decoder->shifts[0], line_decoder->shifts[1],
                                                         line_decoder->shifts[2]);
+                                        copied_bytes += l;
                                         /* we decoded one line (or a part of one line) to the end of the line
                                          * so decrease *source* len by 1 line (or that part of the line */
                                         len -= line_decoder->src_linesize - s_x;
@@ -1569,12 +1976,17 @@ int decode_video_frame(struct coded_data *cdata, void *decoder_data, struct pbuf
                                 y += line_decoder->dst_pitch;  /* next line */
                         }
                 } else { /* PT_VIDEO_LDGM or external decoder */
+                        if (placement != 0) { // placed to a framebuffer of previous configuration
+                                pckt_list[substream].erase(data_pos);
+                                goto next_packet;
+                        }
                         if(!frame->tiles[substream].data) {
                                 frame->tiles[substream].data = (char *) malloc(buffer_length + PADDING);
                         }
 
                         memcpy(frame->tiles[substream].data + data_pos, (unsigned char*) data,
                                 len);
+                        staged_bytes += len;
                 }
 
 next_packet:
@@ -1609,6 +2021,9 @@ next_packet:
                 fec_msg->received_pkts_cum = stats->received_pkts_cum;
                 fec_msg->expected_pkts_cum = stats->expected_pkts_cum;
                 fec_msg->nanoPerFrameExpected = decoder->frame ? 1000000000 / decoder->frame->fps : 0;
+                fec_msg->copied_bytes = copied_bytes;
+                fec_msg->staged_bytes = staged_bytes;
+                fec_msg->zero_copy_bytes = zero_copy_bytes;
 
                 auto t0 = std::chrono::high_resolution_clock::now();
                 decoder->fec_queue.push(move(fec_msg));
@@ -61,6 +61,7 @@ struct video_desc;
 struct video_frame;
 struct state_decompress;
 struct tile;
+struct udp_placement;
 
 #ifdef __cplusplus
 extern "C" {
@@ -74,6 +75,7 @@ void video_decoder_destroy(struct state_video_decoder *decoder);
 bool video_decoder_register_display(struct state_video_decoder *decoder, struct display *display);
 void video_decoder_remove_display(struct state_video_decoder *decoder);
 bool parse_video_hdr(uint32_t *hdr, struct video_desc *desc);
+struct udp_placement *video_decoder_get_recv_placement(struct state_video_decoder *decoder);
 
 /** @} */ // end of video_rtp_decoder
 
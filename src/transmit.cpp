@@ -84,11 +84,16 @@
 #include "video_codec.h"
 
 #include <algorithm>
+#include <vector>
 
 #define TRANSMIT_MAGIC	0xe80ab15f
 
 #define FEC_MAX_MULT 10
 
+/// maximal duration of a burst of packets that are sent at once when the
+/// socket batches packets (see rtp_async_start()) and traffic shaping is on
+#define TX_SHAPER_BATCH_INTERVAL_NS 100000
+
 #ifdef HAVE_MACOSX
 #define GET_STARTTIME gettimeofday(&start, NULL)
 #define GET_STOPTIME gettimeofday(&stop, NULL)
@@ -119,6 +124,32 @@ tx_send_base(struct tx *tx, struct video_frame *frame, struct rtp *rtp_session,
 static bool set_fec(struct tx *tx, const char *fec);
 static void fec_check_messages(struct tx *tx);
 
+/**
+ * Packetization of a tile - offsets and lengths of all packets (in sending
+ * order) together with an arena for their payload headers. It is computed
+ * once and reused as long as the tile size and transmission parameters stay
+ * the same, so that sending a frame doesn't allocate.
+ */
+struct tx_packet_plan {
+        // parameters the plan was computed for
+        int tile_len = -1;
+        int hdrs_len;
+        int rtp_hdr_len;
+        unsigned mtu;
+        bool with_fec;
+        unsigned fec_symbol_size;
+        int mult_count;
+
+        struct packet {
+                int pos;        ///< offset in tile
+                int len;        ///< payload length (may be 0 with FEC_MULT)
+                bool last;      ///< end of the tile reached (the M bit is set from this packet on)
+        };
+        std::vector<packet> packets;
+        int packet_count;       ///< number of packets used for traffic shaping
+        std::vector<uint32_t> headers; ///< rtp_hdr_len bytes per packet
+};
+
 struct tx {
         struct module mod;
 
@@ -142,10 +173,15 @@ struct tx {
 
         const struct openssl_encrypt_info *enc_funcs;
         struct openssl_encrypt *encryption;
+        enum openssl_mode encryption_mode;
+        std::vector<char> encrypted_data; ///< ciphertexts of the whole tile (kept until rtp_async_wait())
+        std::vector<struct openssl_encrypt_packet> encrypt_batch;
         long long int bitrate;
 		
         struct rtpenc_h264_state *rtpenc_h264_state;
         char tmp_packet[RTP_MAX_MTU];
+
+        std::vector<struct tx_packet_plan> packet_plans; ///< indexed by substream
 };
 
 static void tx_update(struct tx *tx, struct video_frame *frame, int substream)
@@ -183,6 +219,29 @@ static void tx_update(struct tx *tx, struct video_frame *frame, int substream)
         }
 }
 
+ADD_TO_PARAM(encryption_mode, "encryption-mode",
+                "* encryption-mode=gcm|cfb|ctr\n"
+                "  Cipher mode used for encryption (default cfb), gcm is faster but requires receivers supporting it\n");
+
+static enum openssl_mode get_encryption_mode()
+{
+        const char *mode = get_commandline_param("encryption-mode");
+        if (mode == NULL) {
+                return DEFAULT_CIPHER_MODE;
+        }
+        if (strcasecmp(mode, "gcm") == 0) {
+                return MODE_AES128_GCM;
+        }
+        if (strcasecmp(mode, "cfb") == 0) {
+                return MODE_AES128_CFB;
+        }
+        if (strcasecmp(mode, "ctr") == 0) {
+                return MODE_AES128_CTR;
+        }
+        log_msg(LOG_LEVEL_ERROR, "Unknown encryption mode: %s\n", mode);
+        return MODE_AES128_NONE;
+}
+
 struct tx *tx_init(struct module *parent, unsigned mtu, enum tx_media_type media_type,
                 const char *fec, const char *encryption, long long int bitrate)
 {
@@ -193,7 +252,7 @@ struct tx *tx_init(struct module *parent, unsigned mtu, enum tx_media_type media
                 return NULL;
         }
 
-        tx = (struct tx *) calloc(1, sizeof(struct tx));
+        tx = new struct tx();
         if (tx != NULL) {
                 module_init_default(&tx->mod);
                 tx->mod.cls = MODULE_CLASS_TX;
@@ -224,8 +283,13 @@ struct tx *tx_init(struct module *parent, unsigned mtu, enum tx_media_type media
                                 module_done(&tx->mod);
                                 return NULL;
                         }
+                        tx->encryption_mode = get_encryption_mode();
+                        if (tx->encryption_mode == MODE_AES128_NONE) {
+                                module_done(&tx->mod);
+                                return NULL;
+                        }
                         if (tx->enc_funcs->init(&tx->encryption,
-                                                encryption, DEFAULT_CIPHER_MODE) != 0) {
+                                                encryption, tx->encryption_mode) != 0) {
                                 fprintf(stderr, "Unable to initialize encryption\n");
                                 module_done(&tx->mod);
                                 return NULL;
@@ -335,7 +399,7 @@ static void tx_done(struct module *mod)
 {
         struct tx *tx = (struct tx *) mod->priv_data;
         assert(tx->magic == TRANSMIT_MAGIC);
-        free(tx);
+        delete tx;
 }
 
 /*
@@ -466,6 +530,87 @@ static inline int get_data_len(bool with_fec, int mtu, int hdrs_len,
         return data_len;
 }
 
+/**
+ * Returns packetization plan for the tile, recomputes it only if the tile
+ * size or sending parameters changed since the last frame.
+ */
+static struct tx_packet_plan *tx_get_packet_plan(struct tx *tx, struct video_frame *frame,
+                unsigned int substream, int hdrs_len, int rtp_hdr_len)
+{
+        if (tx->packet_plans.size() <= substream) {
+                tx->packet_plans.resize(substream + 1);
+        }
+        struct tx_packet_plan *plan = &tx->packet_plans[substream];
+        int tile_len = frame->tiles[substream].data_len;
+        bool with_fec = frame->fec_params.type != FEC_NONE;
+        unsigned fec_symbol_size = frame->fec_params.symbol_size;
+        int mult_count = tx->fec_scheme == FEC_MULT ? tx->mult_count : 1;
+
+        if (plan->tile_len == tile_len && plan->hdrs_len == hdrs_len &&
+                        plan->rtp_hdr_len == rtp_hdr_len && plan->mtu == tx->mtu &&
+                        plan->with_fec == with_fec && plan->fec_symbol_size == fec_symbol_size &&
+                        plan->mult_count == mult_count) {
+                return plan;
+        }
+
+        plan->tile_len = tile_len;
+        plan->hdrs_len = hdrs_len;
+        plan->rtp_hdr_len = rtp_hdr_len;
+        plan->mtu = tx->mtu;
+        plan->with_fec = with_fec;
+        plan->fec_symbol_size = fec_symbol_size;
+        plan->mult_count = mult_count;
+        plan->packets.clear();
+
+        // calculate number of packets
+        int fec_symbol_offset = 0;
+        int pos = 0;
+        int packet_count = 0;
+        do {
+                pos += get_data_len(with_fec, tx->mtu, hdrs_len,
+                                fec_symbol_size, &fec_symbol_offset);
+                packet_count += 1;
+        } while (pos < tile_len);
+        plan->packet_count = packet_count * mult_count;
+
+        // with FEC_MULT, packets of the copies are interleaved
+        int mult_pos[FEC_MAX_MULT] = { 0 };
+        int mult_index = 0;
+        int mult_first_sent = 0;
+        bool last = false;
+        pos = 0;
+        fec_symbol_offset = 0;
+        do {
+                if (mult_count > 1) {
+                        pos = mult_pos[mult_index];
+                }
+                int data_len = get_data_len(with_fec, tx->mtu, hdrs_len,
+                                fec_symbol_size, &fec_symbol_offset);
+                if (pos + data_len >= tile_len) {
+                        last = true;
+                        data_len = tile_len - pos;
+                }
+                plan->packets.push_back({pos, data_len, last});
+                pos += data_len;
+
+                if (mult_count > 1) {
+                        mult_pos[mult_index] = pos;
+                        mult_first_sent ++;
+                        if(mult_index != 0 || mult_first_sent >= (mult_count - 1))
+                                        mult_index = (mult_index + 1) % mult_count;
+                        /* when trippling, we need all streams goes to end */
+                        pos = mult_pos[mult_count - 1];
+                }
+        } while (pos < tile_len);
+
+        plan->headers.resize(plan->packets.size() * rtp_hdr_len / sizeof(uint32_t));
+
+        log_msg(LOG_LEVEL_DEBUG, "[transmit] New packetization of tile %u: %d B in %zu packets.\n",
+                        substream, tile_len, plan->packets.size());
+
+        return plan;
+}
+
 static void
 tx_send_base(struct tx *tx, struct video_frame *frame, struct rtp *rtp_session,
                 uint32_t ts, int send_m,
@@ -474,7 +619,7 @@ tx_send_base(struct tx *tx, struct video_frame *frame, struct rtp *rtp_session,
 {
         struct tile *tile = &frame->tiles[substream];
 
-        int m, data_len;
+        int m = 0;
         // see definition in rtp_callback.h
 
         uint32_t rtp_hdr[100];
@@ -483,8 +628,6 @@ tx_send_base(struct tx *tx, struct video_frame *frame, struct rtp *rtp_session,
         uint32_t *video_hdr;
         uint32_t *fec_hdr;
         int pt;            /* A value specified in our packet format */
-        char *data;
-        unsigned int pos;
 #ifdef HAVE_LINUX
         struct timespec start, stop;
 #elif defined HAVE_MACOSX
@@ -494,9 +637,6 @@ tx_send_base(struct tx *tx, struct video_frame *frame, struct rtp *rtp_session,
 #endif
         long delta, overslept = 0;
         uint32_t tmp;
-        int mult_pos[FEC_MAX_MULT];
-        int mult_index = 0;
-        int mult_first_sent = 0;
 
         int hdrs_len = (rtp_is_ipv6(rtp_session) ? 40 : 20) + 8 + 12; // IP hdr size + UDP hdr size + RTP hdr size
         unsigned int fec_symbol_size = frame->fec_params.symbol_size;
@@ -507,17 +647,6 @@ tx_send_base(struct tx *tx, struct video_frame *frame, struct rtp *rtp_session,
 
         perf_record(UVP_SEND, ts);
 
-        if(tx->fec_scheme == FEC_MULT) {
-                int i;
-                for (i = 0; i < tx->mult_count; ++i) {
-                        mult_pos[i] = 0;
-                }
-                mult_index = 0;
-        }
-
-        m = 0;
-        pos = 0;
-
         if (tx->encryption) {
                 uint32_t *encryption_hdr;
                 rtp_hdr_len = sizeof(crypto_payload_hdr_t);
@@ -537,7 +666,7 @@ tx_send_base(struct tx *tx, struct video_frame *frame, struct rtp *rtp_session,
                         hdrs_len += (sizeof(video_payload_hdr_t));
                 }
 
-                encryption_hdr[0] = htonl(DEFAULT_CIPHER_MODE << 24);
+                encryption_hdr[0] = htonl(tx->encryption_mode << 24);
                 hdrs_len += sizeof(crypto_payload_hdr_t) + tx->enc_funcs->get_overhead(tx->encryption);
         } else {
                 if (frame->fec_params.type != FEC_NONE) {
@@ -584,20 +713,8 @@ tx_send_base(struct tx *tx, struct video_frame *frame, struct rtp *rtp_session,
                 fec_hdr[4] = htonl(frame->fec_params.seed);
         }
 
-        int fec_symbol_offset = 0;
-
-        // calculate number of packets
-        int packet_count = 0;
-        do {
-                pos += get_data_len(frame->fec_params.type != FEC_NONE, tx->mtu, hdrs_len,
-                                fec_symbol_size, &fec_symbol_offset);
-                packet_count += 1;
-        } while (pos < (unsigned int) tile->data_len);
-        if(tx->fec_scheme == FEC_MULT) {
-                packet_count *= tx->mult_count;
-        }
-        pos = 0;
-        fec_symbol_offset = 0;
+        struct tx_packet_plan *plan = tx_get_packet_plan(tx, frame, substream, hdrs_len, rtp_hdr_len);
+        int packet_count = plan->packet_count;
 
         long packet_rate;
         if (tx->bitrate == RATE_UNLIMITED) {
@@ -615,86 +732,91 @@ tx_send_base(struct tx *tx, struct video_frame *frame, struct rtp *rtp_session,
                 packet_rate = 1000ll * 1000 * 1000 * avg_packet_size * 8 / tx->bitrate;
         }
 
-        // initialize header array with values (except offset which is different among
-        // different packts)
-        void *rtp_headers = malloc(packet_count * rtp_hdr_len);
-        uint32_t *rtp_hdr_packet = (uint32_t *) rtp_headers;
-        for (int i = 0; i < packet_count; ++i) {
+        // fill the header arena (headers must be kept until rtp_async_wait())
+        int hdr_words = rtp_hdr_len / sizeof(uint32_t);
+        uint32_t *rtp_hdr_packet = plan->headers.data();
+        for (auto const & p : plan->packets) {
                 memcpy(rtp_hdr_packet, rtp_hdr, rtp_hdr_len);
-                rtp_hdr_packet += rtp_hdr_len / sizeof(uint32_t);
-        }
-        rtp_hdr_packet = (uint32_t *) rtp_headers;
-
-        if (!tx->encryption) {
-                rtp_async_start(rtp_session, packet_count);
+                rtp_hdr_packet[1] = htonl(p.pos + fragment_offset);
+                rtp_hdr_packet += hdr_words;
         }
+        rtp_hdr_packet = plan->headers.data();
 
-        do {
-                GET_STARTTIME;
-                if(tx->fec_scheme == FEC_MULT) {
-                        pos = mult_pos[mult_index];
+        int plan_len = plan->packets.size();
+        if (tx->encryption) {
+                // encrypt the whole tile at once (in parallel for GCM), ciphertexts
+                // are kept in the arena until the packets are sent
+                size_t stride = tx->mtu + MAX_CRYPTO_EXCEED;
+                if (tx->encrypted_data.size() < stride * plan_len) {
+                        tx->encrypted_data.resize(stride * plan_len);
                 }
+                tx->encrypt_batch.clear();
+                for (int i = 0; i < plan_len; ++i) {
+                        struct tx_packet_plan::packet const & p = plan->packets[i];
+                        if (p.len) {
+                                tx->encrypt_batch.push_back({tile->data + p.pos, p.len,
+                                                (char *) (rtp_hdr_packet + i * hdr_words),
+                                                tx->encrypted_data.data() + i * stride, 0});
+                        }
+                }
+                if (tx->enc_funcs->encrypt_batch(tx->encryption, tx->encrypt_batch.data(),
+                                tx->encrypt_batch.size(),
+                                frame->fec_params.type != FEC_NONE ? sizeof(fec_video_payload_hdr_t) :
+                                sizeof(video_payload_hdr_t)) != 0) {
+                        log_msg(LOG_LEVEL_ERROR, "[transmit] Encryption failed, dropping tile!\n");
+                        return;
+                }
+        }
+        struct openssl_encrypt_packet *encrypted = tx->encrypt_batch.data();
 
-                int offset = pos + fragment_offset;
-
-                rtp_hdr_packet[1] = htonl(offset);
+        int batch_len = rtp_async_start(rtp_session, packet_count); // packets sent between two traffic shaper waits
+        int batch_pos = 0;
+        if (packet_rate > 0) {
+                batch_len = std::max<long>(1, std::min<long>(batch_len,
+                                        TX_SHAPER_BATCH_INTERVAL_NS / packet_rate));
+        }
 
-                data = tile->data + pos;
-                data_len = get_data_len(frame->fec_params.type != FEC_NONE, tx->mtu, hdrs_len,
-                                fec_symbol_size, &fec_symbol_offset);
-                if (pos + data_len >= (unsigned int) tile->data_len) {
-                        if (send_m) {
-                                m = 1;
-                        }
-                        data_len = tile->data_len - pos;
+        for (int i = 0; i < plan_len; ++i) {
+                if (batch_pos == 0) {
+                        GET_STARTTIME;
                 }
-                pos += data_len;
-                if(data_len) { /* check needed for FEC_MULT */
-                        char encrypted_data[data_len + MAX_CRYPTO_EXCEED];
+                struct tx_packet_plan::packet const & p = plan->packets[i];
+                if (p.last && send_m) {
+                        m = 1;
+                }
+                if (p.len) { /* check needed for FEC_MULT */
+                        char *data = tile->data + p.pos;
+                        int data_len = p.len;
 
                         if (tx->encryption) {
-                                data_len = tx->enc_funcs->encrypt(tx->encryption,
-                                                data, data_len,
-                                                (char *) rtp_hdr_packet,
-                                                frame->fec_params.type != FEC_NONE ? sizeof(fec_video_payload_hdr_t) :
-                                                sizeof(video_payload_hdr_t),
-                                                encrypted_data);
-                                data = encrypted_data;
+                                data = encrypted->ciphertext;
+                                data_len = encrypted->ciphertext_len;
+                                encrypted++;
                         }
 
                         rtp_send_data_hdr(rtp_session, ts, pt, m, 0, 0,
                                   (char *) rtp_hdr_packet, rtp_hdr_len,
                                   data, data_len, 0, 0, 0);
                 }
-
-                if(tx->fec_scheme == FEC_MULT) {
-                        mult_pos[mult_index] = pos;
-                        mult_first_sent ++;
-                        if(mult_index != 0 || mult_first_sent >= (tx->mult_count - 1))
-                                        mult_index = (mult_index + 1) % tx->mult_count;
-                }
-
-                /* when trippling, we need all streams goes to end */
-                if(tx->fec_scheme == FEC_MULT) {
-                        pos = mult_pos[tx->mult_count - 1];
-                }
-                rtp_hdr_packet += rtp_hdr_len / sizeof(uint32_t);
+                rtp_hdr_packet += hdr_words;
 
                 // TRAFFIS SHAPER
-                if (pos < (unsigned int) tile->data_len) { // wait for all but last packet
+                // wait for all but last packet, with batching once per batch_len packets
+                if (i < plan_len - 1 && ++batch_pos == batch_len) {
+                        if (batch_len > 1) {
+                                rtp_async_flush(rtp_session);
+                        }
                         do {
                                 GET_STOPTIME;
                                 GET_DELTA;
-                        } while (packet_rate - delta - overslept > 0);
-                        overslept = -(packet_rate - delta - overslept);
+                        } while (packet_rate * batch_len - delta - overslept > 0);
+                        overslept = -(packet_rate * batch_len - delta - overslept);
                         //fprintf(stdout, "%ld ", overslept);
+                        batch_pos = 0;
                 }
-        } while (pos < (unsigned int) tile->data_len);
-
-        if (!tx->encryption) {
-                rtp_async_wait(rtp_session);
         }
-        free(rtp_headers);
+
+        rtp_async_wait(rtp_session);
 }
 
 /* 
@@ -743,7 +865,7 @@ void audio_tx_send(struct tx* tx, struct rtp *rtp_session, const audio_frame2 *
 
         int hdrs_len = (rtp_is_ipv6(rtp_session) ? 40 : 20) + 8 + 12 + sizeof(audio_payload_hdr_t); // MTU - IP hdr - UDP hdr - RTP hdr - payload_hdr
         if(tx->encryption) {
-                hdrs_len += sizeof(crypto_payload_hdr_t);
+                hdrs_len += sizeof(crypto_payload_hdr_t) + tx->enc_funcs->get_overhead(tx->encryption);
         }
 
         for(channel = 0; channel < buffer->get_channel_count(); ++channel)
@@ -824,7 +946,7 @@ void audio_tx_send(struct tx* tx, struct rtp *rtp_session, const audio_frame2 *
                         if(data_len) { /* check needed for FEC_MULT */
                                 char encrypted_data[data_len + MAX_CRYPTO_EXCEED];
                                 if(tx->encryption) {
-                                        crypto_hdr[0] = htonl(DEFAULT_CIPHER_MODE << 24);
+                                        crypto_hdr[0] = htonl(tx->encryption_mode << 24);
                                         data_len = tx->enc_funcs->encrypt(tx->encryption,
                                                         const_cast<char *>(data), data_len,
                                                         (char *) audio_hdr, sizeof(audio_payload_hdr_t),
@@ -911,6 +1033,7 @@ void audio_tx_send_standard(struct tx* tx, struct rtp *rtp_session,
                 payload_size = payload_size / frame_size * frame_size; // align to frame size
         }
 
+        std::vector<const char *> channel_data(buffer->get_channel_count());
 	int pos = 0;
 	do {
                 int pkt_len = std::min(payload_size, data_len - pos);
@@ -921,8 +1044,9 @@ void audio_tx_send_standard(struct tx* tx, struct rtp *rtp_session,
                         memcpy(tx->tmp_packet, buffer->get_data(0), pkt_len);
                 } else {
                         for (int ch = 0; ch < buffer->get_channel_count(); ch++) {
-                                remux_channel(tx->tmp_packet, buffer->get_data(ch) + pos / buffer->get_channel_count(), buffer->get_bps(), pkt_len / buffer->get_channel_count(), 1, buffer->get_channel_count(), 0, ch);
+                                channel_data[ch] = buffer->get_data(ch) + pos / buffer->get_channel_count();
                         }
+                        interleave_channels(tx->tmp_packet, channel_data.data(), buffer->get_bps(), pkt_len / buffer->get_channel_count(), buffer->get_channel_count());
                 }
 
                 // Update first sample timestamp
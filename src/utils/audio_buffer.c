@@ -41,12 +41,19 @@
 #include "config_win32.h"
 #endif
 
+#include <math.h>
+#include <speex/speex_resampler.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
 #include "audio/types.h"
 #include "debug.h"
 #include "host.h"
 #include "utils/audio_buffer.h"
 #include "utils/ring_buffer.h"
 
+#define MOD_NAME "[audio buffer] "
 #define WINDOW 50
 
 #undef max
@@ -60,12 +67,33 @@
 #define AGGRESSIVITY_MAX 4
 #define AGGRESSIVITY_STEP 100
 
+/*
+ * Clock drift compensation - buffer occupancy is smoothed and fed to a PI
+ * controller whose output is the relative correction of the resampling ratio.
+ * Gains give natural frequency sqrt(KI) = 0.2 rad/s and damping ~0.7. In the
+ * steady state the correction equals the relative clock drift of the sender.
+ */
+#define DRIFT_KP 0.28                  ///< proportional gain [1/s]
+#define DRIFT_KI 0.04                  ///< integral gain [1/s^2]
+#define DRIFT_OCCUPANCY_TAU 0.5        ///< time constant of occupancy smoothing [s]
+#define DRIFT_ESTIMATE_TAU 60.0        ///< time constant of reported drift averaging [s]
+#define DRIFT_MAX_ESTIMATE_PPM 1000    ///< clamp of integral term (anti-windup)
+#define DRIFT_MAX_CORRECTION_PPM 5000  ///< clamp of total correction
+#define DRIFT_RATIO_UPDATE_MS 50       ///< how often is the resampler ratio updated
+#define DRIFT_RESYNC_MIN_MS 50         ///< excess above which samples are dropped at once
+#define DRIFT_INPUT_SLACK 2            ///< frames staged for resampler above computed need
+/// denominator of resampling ratio, speex rescales fractional position by
+/// den_new/den_old in 32 bits so it must not exceed 2^16 (~15 ppm resolution)
+#define RATIO_DEN 65536
+#define STATS_INTERVAL_S 10
+
 static const int occupacy_windows[] = { 50, 200 };
 
 struct audio_buffer {
         struct audio_desc desc;
         ring_buffer_t *ring;
         int suggested_latency_ms;
+        char name[128];
 
         // moving averages
         int in_pkt_size;
@@ -75,8 +103,35 @@ struct audio_buffer {
         int last_overrun; // last overrun n output frames ago
         int aggressivity;
         int last_aggressivity_change;
+
+        // drift compensation, NULL resampler means that overruns are handled by dropping
+        SpeexResamplerState *resampler;
+        float *in_f;                    ///< interleaved input staged for resampler
+        int in_f_frames;                ///< number of frames in in_f
+        int in_f_capacity;              ///< in frames
+        float *out_f;
+        int out_f_capacity;             ///< in frames
+        char *raw;                      ///< raw samples read from ring
+        double occupancy;               ///< smoothed occupancy [s], negative if not yet measured
+        bool filled;                    ///< occupancy has reached the target at least once
+        double integral;                ///< integral of occupancy error [s^2]
+        double correction;              ///< current relative ratio correction
+        double drift;                   ///< long-term average of correction (reported drift estimate)
+        int applied_num;                ///< numerator of current ratio (over RATIO_DEN)
+        long long frames_since_ratio_update;
+
+        // statistics
+        long long stats_frames;
+        double stats_occupancy_sum;
+        double stats_target_sum;
+        int stats_reads;
+        int stats_underruns;
+        int stats_resyncs;
 };
 
+ADD_TO_PARAM(audio_buffer_drop, "audio-buffer-drop", "* audio-buffer-drop\n"
+                "  Do not compensate clock drift by resampling in audio buffer, drop samples on overrun instead.\n");
+
 struct audio_buffer *audio_buffer_init(int sample_rate, int bps, int ch_count, int suggested_latency_ms)
 {
         struct audio_buffer *buf = calloc(1, sizeof(struct audio_buffer));
@@ -93,16 +148,210 @@ struct audio_buffer *audio_buffer_init(int sample_rate, int bps, int ch_count, i
         buf->aggressivity = 1;
         buf->last_aggressivity_change = AGGRESSIVITY_STEP;
 
+        if (get_commandline_param("audio-buffer-drop") == NULL) {
+                int err = 0;
+                buf->resampler = speex_resampler_init_frac(ch_count, RATIO_DEN, RATIO_DEN, sample_rate, sample_rate,
+                                SPEEX_RESAMPLER_QUALITY_DEFAULT, &err);
+                if (err) {
+                        log_msg(LOG_LEVEL_WARNING, MOD_NAME "Cannot initialize resampler: %s, drift will not be compensated.\n",
+                                        speex_resampler_strerror(err));
+                        buf->resampler = NULL;
+                } else {
+                        speex_resampler_set_input_stride(buf->resampler, ch_count);
+                        speex_resampler_set_output_stride(buf->resampler, ch_count);
+                }
+        }
+        buf->occupancy = -1.0;
+        buf->applied_num = RATIO_DEN;
+
         return buf;
 }
 
+void audio_buffer_set_name(struct audio_buffer *buf, const char *name)
+{
+        snprintf(buf->name, sizeof buf->name, "%s: ", name);
+}
+
 void audio_buffer_destroy(struct audio_buffer *buf)
 {
         if (buf) {
                 ring_buffer_destroy(buf->ring);
+                if (buf->resampler) {
+                        speex_resampler_destroy(buf->resampler);
+                }
+                free(buf->in_f);
+                free(buf->out_f);
+                free(buf->raw);
+                free(buf);
         }
 }
 
+/// converts little-endian signed samples of arbitrary bps to floats in range [-1, 1)
+static void samples_to_float(float *out, const char *in, int count, int bps)
+{
+        for (int i = 0; i < count; ++i) {
+                int32_t val = 0;
+                memcpy((char *) &val + 4 - bps, in, bps);
+                *out++ = val / 2147483648.0f;
+                in += bps;
+        }
+}
+
+static void float_to_samples(char *out, const float *in, int count, int bps)
+{
+        for (int i = 0; i < count; ++i) {
+                float val = *in++ * 2147483648.0f;
+                int32_t ival = val >= 2147483647.0f ? INT32_MAX : val <= -2147483648.0f ? INT32_MIN : (int32_t) val;
+                memcpy(out, (char *) &ival + 4 - bps, bps);
+                out += bps;
+        }
+}
+
+static void ensure_capacity(struct audio_buffer *buf, int out_frames)
+{
+        int ch_count = buf->desc.ch_count;
+        int in_frames = out_frames + out_frames / (1000000 / DRIFT_MAX_CORRECTION_PPM) + 1 + DRIFT_INPUT_SLACK;
+        if (buf->out_f_capacity < out_frames) {
+                buf->out_f = realloc(buf->out_f, out_frames * ch_count * sizeof(float));
+                buf->out_f_capacity = out_frames;
+        }
+        if (buf->in_f_capacity < in_frames) {
+                buf->in_f = realloc(buf->in_f, in_frames * ch_count * sizeof(float));
+                buf->raw = realloc(buf->raw, in_frames * ch_count * buf->desc.bps);
+                buf->in_f_capacity = in_frames;
+        }
+}
+
+static void report_stats(struct audio_buffer *buf)
+{
+        log_msg(LOG_LEVEL_INFO, MOD_NAME "%sestimated clock drift %+.1f ppm, buffered %.1f ms (target %.1f ms), "
+                        "%d underruns, %d resyncs\n", buf->name, buf->drift * 1000000.0,
+                        buf->stats_occupancy_sum / buf->stats_reads * 1000.0,
+                        buf->stats_target_sum / buf->stats_reads * 1000.0,
+                        buf->stats_underruns, buf->stats_resyncs);
+        buf->stats_frames = 0;
+        buf->stats_occupancy_sum = buf->stats_target_sum = 0.0;
+        buf->stats_reads = buf->stats_underruns = buf->stats_resyncs = 0;
+}
+
+/**
+ * Reads max_len bytes resampled with ratio driven by PI controller so that the
+ * buffer converges to the requested latency without discarding samples.
+ */
+static int audio_buffer_read_resampled(struct audio_buffer *buf, char *out, int max_len, int requested_latency_bytes)
+{
+        const int frame_size = buf->desc.bps * buf->desc.ch_count;
+        const int sample_rate = buf->desc.sample_rate;
+        const int out_frames = max_len / frame_size;
+        const double dt = (double) out_frames / sample_rate;
+
+        ensure_capacity(buf, out_frames);
+
+        // occupancy is measured before read so the target includes data read now
+        int ring_frames = ring_get_current_size(buf->ring) / frame_size;
+        double occupancy = (double) (ring_frames + buf->in_f_frames) / sample_rate;
+        double target = (double) (requested_latency_bytes + max_len) / frame_size / sample_rate;
+        bool underrun = ring_frames + buf->in_f_frames < out_frames;
+
+        // far too much data (eg. at start or after network stall) - resampling would take too long
+        double excess = occupancy - target;
+        if (excess > max(target, DRIFT_RESYNC_MIN_MS / 1000.0)) {
+                int drop_frames = min((int) (excess * sample_rate), ring_frames);
+                for (int dropped = 0; dropped < drop_frames; ) {
+                        int len = min(drop_frames - dropped, buf->in_f_capacity);
+                        int ret = ring_buffer_read(buf->ring, buf->raw, len * frame_size) / frame_size;
+                        if (ret == 0) {
+                                drop_frames = dropped;
+                                break;
+                        }
+                        dropped += ret;
+                }
+                log_msg(LOG_LEVEL_VERBOSE, MOD_NAME "%sResync: req latency %.1f ms buffered %.1f ms dropped %d frames!\n",
+                                buf->name, target * 1000.0, occupancy * 1000.0, drop_frames);
+                occupancy -= (double) drop_frames / sample_rate;
+                buf->occupancy = occupancy;
+                buf->stats_resyncs += 1;
+        }
+
+        if (buf->occupancy < 0.0) {
+                buf->occupancy = occupancy;
+        } else {
+                buf->occupancy += min(dt / DRIFT_OCCUPANCY_TAU, 1.0) * (occupancy - buf->occupancy);
+        }
+
+        double error = buf->occupancy - target;
+        if (error >= 0.0) {
+                buf->filled = true;
+        }
+        // do not wind up the integrator while the buffer is being filled or when sender stalls
+        if (buf->filled && !underrun) {
+                const double max_integral = DRIFT_MAX_ESTIMATE_PPM / 1000000.0 / DRIFT_KI;
+                buf->integral = min(max(buf->integral + error * dt, -max_integral), max_integral);
+        }
+        buf->correction = DRIFT_KP * error + DRIFT_KI * buf->integral;
+        buf->correction = min(max(buf->correction, -DRIFT_MAX_CORRECTION_PPM / 1000000.0), DRIFT_MAX_CORRECTION_PPM / 1000000.0);
+        // reads and packet arrivals are both periodic so the measured occupancy advances
+        // in steps of a read period, average the correction to get stable estimate
+        if (buf->filled) {
+                buf->drift += min(dt / DRIFT_ESTIMATE_TAU, 1.0) * (buf->correction - buf->drift);
+        }
+
+        buf->frames_since_ratio_update += out_frames;
+        if (buf->frames_since_ratio_update >= (long long) sample_rate * DRIFT_RATIO_UPDATE_MS / 1000) {
+                buf->frames_since_ratio_update = 0;
+                int num = RATIO_DEN + (int) lround(buf->correction * RATIO_DEN);
+                if (num != buf->applied_num) {
+                        speex_resampler_set_rate_frac(buf->resampler, num, RATIO_DEN, sample_rate, sample_rate);
+                        buf->applied_num = num;
+                }
+        }
+
+        // stage input - resampler keeps its filter history but not unconsumed input
+        const int ch_count = buf->desc.ch_count;
+        int written = 0;
+        while (written < out_frames) {
+                double need_frames = ceil((double) (out_frames - written) * buf->applied_num / RATIO_DEN);
+                int need = (int) need_frames + DRIFT_INPUT_SLACK - buf->in_f_frames;
+                if (need > 0) {
+                        int read_frames = ring_buffer_read(buf->ring, buf->raw, need * frame_size) / frame_size;
+                        samples_to_float(buf->in_f + buf->in_f_frames * ch_count, buf->raw,
+                                        read_frames * ch_count, buf->desc.bps);
+                        buf->in_f_frames += read_frames;
+                }
+
+                // speex_resampler_process_interleaved_float() doesn't restore in_len for
+                // subsequent channels so channels would get out of sync, process them separately
+                spx_uint32_t in_len = 0, out_len = 0;
+                for (int i = 0; i < ch_count; ++i) {
+                        in_len = buf->in_f_frames;
+                        out_len = out_frames - written;
+                        speex_resampler_process_float(buf->resampler, i, buf->in_f + i, &in_len,
+                                        buf->out_f + written * ch_count + i, &out_len);
+                }
+                memmove(buf->in_f, buf->in_f + in_len * ch_count, (buf->in_f_frames - in_len) * ch_count * sizeof(float));
+                buf->in_f_frames -= in_len;
+                written += out_len;
+                if (out_len == 0) { // underrun
+                        break;
+                }
+        }
+        float_to_samples(out, buf->out_f, written * ch_count, buf->desc.bps);
+
+        buf->stats_frames += out_frames;
+        buf->stats_occupancy_sum += buf->occupancy;
+        buf->stats_target_sum += target;
+        buf->stats_reads += 1;
+        buf->stats_underruns += underrun ? 1 : 0;
+        if (buf->stats_frames >= (long long) sample_rate * STATS_INTERVAL_S) {
+                report_stats(buf);
+        }
+
+        log_msg(LOG_LEVEL_DEBUG, MOD_NAME "%sbuffered %f s, target %f s, correction %f ppm, drift %f ppm\n",
+                        buf->name, buf->occupancy, target, (buf->applied_num - RATIO_DEN) * 1000000.0 / RATIO_DEN, buf->drift * 1000000.0);
+
+        return written * frame_size;
+}
+
 int audio_buffer_read(struct audio_buffer *buf, char *out, int max_len)
 {
         if (buf->out_pkt_size > 0) {
@@ -111,6 +360,13 @@ int audio_buffer_read(struct audio_buffer *buf, char *out, int max_len)
                 buf->out_pkt_size = max_len;
         }
 
+        int suggested_latency_bytes = buf->suggested_latency_ms * buf->desc.bps * buf->desc.ch_count * buf->desc.sample_rate / 1000;
+        int requested_latency_bytes = max(suggested_latency_bytes, 2*max(buf->in_pkt_size, buf->out_pkt_size));
+
+        if (buf->resampler) {
+                return audio_buffer_read_resampled(buf, out, max_len, requested_latency_bytes);
+        }
+
         int ring_size = ring_get_current_size(buf->ring);
 
         for (unsigned int i = 0; i < sizeof buf->avg_occupancy / sizeof buf->avg_occupancy[0]; ++i) {
@@ -130,9 +386,6 @@ int audio_buffer_read(struct audio_buffer *buf, char *out, int max_len)
                 }
         }
 
-        int suggested_latency_bytes = buf->suggested_latency_ms * buf->desc.bps * buf->desc.ch_count * buf->desc.sample_rate / 1000;
-        int requested_latency_bytes = max(suggested_latency_bytes, 2*max(buf->in_pkt_size, buf->out_pkt_size));
-
         int ret = ring_buffer_read(buf->ring, out, max_len);
 
         // fiddle aggressivity
@@ -46,6 +46,8 @@ struct audio_buffer;
 typedef struct audio_buffer audio_buffer_t;
 
 struct audio_buffer *audio_buffer_init(int sample_rate, int bps, int ch_count, int suggested_latency_ms);
+/// sets name used to identify the buffer in statistics
+void audio_buffer_set_name(struct audio_buffer *buf, const char *name);
 void audio_buffer_destroy(struct audio_buffer *buf);
 int audio_buffer_read(struct audio_buffer *buf, char *out, int max_len);
 void audio_buffer_write(struct audio_buffer *buf, const char *in, int len);
@@ -0,0 +1,371 @@
+/**
+ * @file   utils/field_engine.cpp
+ *
+ * Scalar and AVX2 kernels of the field engine and their row-parallel driver.
+ *
+ * 10-bit formats (v210, R10k) pack 3 components into a 32-bit word. Blend
+ * averages all components of a word at once - bits that would be shifted to
+ * the neighbouring component are masked out before the subtraction:
+ * avg_ceil(a, b) = (a | b) - ((a ^ b) >> 1). R10k words are big-endian and
+ * are byte-swapped prior processing.
+ */
+/*
+ * Copyright (c) 2019 CESNET z.s.p.o.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, is permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of CESNET nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESSED OR IMPLIED WARRANTIES, INCLUDING,
+ * BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#include "config_unix.h"
+#include "config_win32.h"
+#endif // HAVE_CONFIG_H
+
+#if defined __GNUC__ && defined __x86_64__
+#define FIELD_ENGINE_X86
+#include <immintrin.h>
+#define TARGET(isa) __attribute__((target(isa)))
+#endif
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#include "utils/field_engine.h"
+#include "utils/worker.h"
+
+#define MOTION_THRESHOLD_8BIT  12 ///< component difference considered as a motion
+#define MOTION_THRESHOLD_10BIT 48
+#define CHUNK_SIZE (64 * 1024)    ///< approximate amount of data processed by one parallel_for chunk
+
+using namespace std;
+
+/**
+ * Layout of 3 10-bit components in a 32-bit word
+ */
+struct packed10_layout {
+        int shift[3];       ///< shifts of individual components
+        bool big_endian;
+        uint32_t avg_mask;  ///< component bits except the MSB ones
+};
+
+static constexpr struct packed10_layout v210_layout = { { 0, 10, 20 }, false, 0x1FF7FDFFu };
+static constexpr struct packed10_layout r10k_layout = { { 22, 12, 2 }, true, 0x7FDFF7FCu };
+
+static inline uint32_t load_word(const unsigned char *p, bool big_endian)
+{
+        uint32_t w;
+        memcpy(&w, p, sizeof w);
+        return big_endian ? __builtin_bswap32(w) : w;
+}
+
+static inline void store_word(unsigned char *p, uint32_t w, bool big_endian)
+{
+        if (big_endian) {
+                w = __builtin_bswap32(w);
+        }
+        memcpy(p, &w, sizeof w);
+}
+
+/**
+ * @name Kernels
+ * Blend kernels set both dst0 and dst1 to average of lines a and b.
+ *
+ * Motion-adaptive kernels compute the bottom-field line (bottom) placed between
+ * top-field lines top and next_top, prev_top and prev_bottom are corresponding
+ * lines of the previous frame.
+ * @{
+ */
+static void blend_bytes_scalar(const unsigned char *a, const unsigned char *b,
+                unsigned char *dst0, unsigned char *dst1, size_t len)
+{
+        for (size_t x = 0; x < len; ++x) {
+                dst0[x] = dst1[x] = (a[x] + b[x] + 1) >> 1;
+        }
+}
+
+static void motion_bytes_scalar(const unsigned char *top, const unsigned char *bottom,
+                const unsigned char *next_top, const unsigned char *prev_top,
+                const unsigned char *prev_bottom, unsigned char *dst, size_t len)
+{
+        for (size_t x = 0; x < len; ++x) {
+                int motion = max(abs(bottom[x] - prev_bottom[x]), abs(top[x] - prev_top[x]));
+                dst[x] = motion > MOTION_THRESHOLD_8BIT ? (top[x] + next_top[x] + 1) >> 1 : bottom[x];
+        }
+}
+
+static inline uint32_t blend_packed10_word(uint32_t a, uint32_t b, uint32_t avg_mask)
+{
+        return (a | b) - (((a ^ b) >> 1) & avg_mask);
+}
+
+template<const struct packed10_layout &l>
+static void blend_packed10_scalar(const unsigned char *a, const unsigned char *b,
+                unsigned char *dst0, unsigned char *dst1, size_t len)
+{
+        size_t x = 0;
+        for ( ; x + 4 <= len; x += 4) {
+                uint32_t w = blend_packed10_word(load_word(a + x, l.big_endian), load_word(b + x, l.big_endian), l.avg_mask);
+                store_word(dst0 + x, w, l.big_endian);
+                store_word(dst1 + x, w, l.big_endian);
+        }
+        blend_bytes_scalar(a + x, b + x, dst0 + x, dst1 + x, len - x);
+}
+
+template<const struct packed10_layout &l>
+static void motion_packed10_scalar(const unsigned char *top, const unsigned char *bottom,
+                const unsigned char *next_top, const unsigned char *prev_top,
+                const unsigned char *prev_bottom, unsigned char *dst, size_t len)
+{
+        size_t x = 0;
+        for ( ; x + 4 <= len; x += 4) {
+                uint32_t t = load_word(top + x, l.big_endian);
+                uint32_t b = load_word(bottom + x, l.big_endian);
+                uint32_t nt = load_word(next_top + x, l.big_endian);
+                uint32_t pt = load_word(prev_top + x, l.big_endian);
+                uint32_t pb = load_word(prev_bottom + x, l.big_endian);
+                uint32_t out = b;
+                for (int i = 0; i < 3; ++i) {
+                        int s = l.shift[i];
+                        int tc = (t >> s) & 0x3FF, bc = (b >> s) & 0x3FF;
+                        int motion = max(abs(bc - (int) ((pb >> s) & 0x3FF)), abs(tc - (int) ((pt >> s) & 0x3FF)));
+                        if (motion > MOTION_THRESHOLD_10BIT) {
+                                uint32_t interp = (tc + ((nt >> s) & 0x3FF) + 1) >> 1;
+                                out = (out & ~(0x3FFu << s)) | interp << s;
+                        }
+                }
+                store_word(dst + x, out, l.big_endian);
+        }
+        memcpy(dst + x, bottom + x, len - x);
+}
+
+#ifdef FIELD_ENGINE_X86
+TARGET("avx2") static inline __m256i bswap32_avx2(__m256i v)
+{
+        const __m256i shuf = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+                        3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+        return _mm256_shuffle_epi8(v, shuf);
+}
+
+TARGET("avx2") static inline __m256i load_words_avx2(const unsigned char *p, bool big_endian)
+{
+        __m256i v = _mm256_loadu_si256((const __m256i *)(const void *) p);
+        return big_endian ? bswap32_avx2(v) : v;
+}
+
+TARGET("avx2") static inline void store_words_avx2(unsigned char *p, __m256i v, bool big_endian)
+{
+        _mm256_storeu_si256((__m256i *)(void *) p, big_endian ? bswap32_avx2(v) : v);
+}
+
+TARGET("avx2") static void blend_bytes_avx2(const unsigned char *a, const unsigned char *b,
+                unsigned char *dst0, unsigned char *dst1, size_t len)
+{
+        size_t x = 0;
+        for ( ; x + 32 <= len; x += 32) {
+                __m256i avg = _mm256_avg_epu8(_mm256_loadu_si256((const __m256i *)(const void *)(a + x)),
+                                _mm256_loadu_si256((const __m256i *)(const void *)(b + x)));
+                _mm256_storeu_si256((__m256i *)(void *)(dst0 + x), avg);
+                _mm256_storeu_si256((__m256i *)(void *)(dst1 + x), avg);
+        }
+        blend_bytes_scalar(a + x, b + x, dst0 + x, dst1 + x, len - x);
+}
+
+TARGET("avx2") static void motion_bytes_avx2(const unsigned char *top, const unsigned char *bottom,
+                const unsigned char *next_top, const unsigned char *prev_top,
+                const unsigned char *prev_bottom, unsigned char *dst, size_t len)
+{
+        const __m256i threshold = _mm256_set1_epi8(MOTION_THRESHOLD_8BIT);
+        size_t x = 0;
+        for ( ; x + 32 <= len; x += 32) {
+                __m256i t = _mm256_loadu_si256((const __m256i *)(const void *)(top + x));
+                __m256i b = _mm256_loadu_si256((const __m256i *)(const void *)(bottom + x));
+                __m256i nt = _mm256_loadu_si256((const __m256i *)(const void *)(next_top + x));
+                __m256i pt = _mm256_loadu_si256((const __m256i *)(const void *)(prev_top + x));
+                __m256i pb = _mm256_loadu_si256((const __m256i *)(const void *)(prev_bottom + x));
+                __m256i diff_b = _mm256_or_si256(_mm256_subs_epu8(b, pb), _mm256_subs_epu8(pb, b));
+                __m256i diff_t = _mm256_or_si256(_mm256_subs_epu8(t, pt), _mm256_subs_epu8(pt, t));
+                __m256i motion = _mm256_max_epu8(diff_b, diff_t);
+                __m256i is_static = _mm256_cmpeq_epi8(_mm256_subs_epu8(motion, threshold), _mm256_setzero_si256());
+                __m256i out = _mm256_blendv_epi8(_mm256_avg_epu8(t, nt), b, is_static);
+                _mm256_storeu_si256((__m256i *)(void *)(dst + x), out);
+        }
+        motion_bytes_scalar(top + x, bottom + x, next_top + x, prev_top + x, prev_bottom + x, dst + x, len - x);
+}
+
+template<const struct packed10_layout &l>
+TARGET("avx2") static void blend_packed10_avx2(const unsigned char *a, const unsigned char *b,
+                unsigned char *dst0, unsigned char *dst1, size_t len)
+{
+        const __m256i mask = _mm256_set1_epi32(l.avg_mask);
+        size_t x = 0;
+        for ( ; x + 32 <= len; x += 32) {
+                __m256i va = load_words_avx2(a + x, l.big_endian);
+                __m256i vb = load_words_avx2(b + x, l.big_endian);
+                __m256i avg = _mm256_sub_epi32(_mm256_or_si256(va, vb),
+                                _mm256_and_si256(_mm256_srli_epi32(_mm256_xor_si256(va, vb), 1), mask));
+                store_words_avx2(dst0 + x, avg, l.big_endian);
+                store_words_avx2(dst1 + x, avg, l.big_endian);
+        }
+        blend_packed10_scalar<l>(a + x, b + x, dst0 + x, dst1 + x, len - x);
+}
+
+template<const struct packed10_layout &l>
+TARGET("avx2") static void motion_packed10_avx2(const unsigned char *top, const unsigned char *bottom,
+                const unsigned char *next_top, const unsigned char *prev_top,
+                const unsigned char *prev_bottom, unsigned char *dst, size_t len)
+{
+        const __m256i comp_mask = _mm256_set1_epi32(0x3FF);
+        const __m256i threshold = _mm256_set1_epi32(MOTION_THRESHOLD_10BIT);
+        const __m256i one = _mm256_set1_epi32(1);
+        size_t x = 0;
+        for ( ; x + 32 <= len; x += 32) {
+                __m256i t = load_words_avx2(top + x, l.big_endian);
+                __m256i b = load_words_avx2(bottom + x, l.big_endian);
+                __m256i nt = load_words_avx2(next_top + x, l.big_endian);
+                __m256i pt = load_words_avx2(prev_top + x, l.big_endian);
+                __m256i pb = load_words_avx2(prev_bottom + x, l.big_endian);
+                __m256i out = b;
+                for (int i = 0; i < 3; ++i) {
+                        __m128i s = _mm_cvtsi32_si128(l.shift[i]);
+                        __m256i tc = _mm256_and_si256(_mm256_srl_epi32(t, s), comp_mask);
+                        __m256i bc = _mm256_and_si256(_mm256_srl_epi32(b, s), comp_mask);
+                        __m256i ntc = _mm256_and_si256(_mm256_srl_epi32(nt, s), comp_mask);
+                        __m256i ptc = _mm256_and_si256(_mm256_srl_epi32(pt, s), comp_mask);
+                        __m256i pbc = _mm256_and_si256(_mm256_srl_epi32(pb, s), comp_mask);
+                        __m256i motion = _mm256_max_epi32(_mm256_abs_epi32(_mm256_sub_epi32(bc, pbc)),
+                                        _mm256_abs_epi32(_mm256_sub_epi32(tc, ptc)));
+                        __m256i moving = _mm256_cmpgt_epi32(motion, threshold);
+                        __m256i interp = _mm256_srli_epi32(_mm256_add_epi32(_mm256_add_epi32(tc, ntc), one), 1);
+                        __m256i comp = _mm256_sll_epi32(_mm256_blendv_epi8(bc, interp, moving), s);
+                        out = _mm256_or_si256(_mm256_andnot_si256(_mm256_sll_epi32(comp_mask, s), out), comp);
+                }
+                store_words_avx2(dst + x, out, l.big_endian);
+        }
+        motion_packed10_scalar<l>(top + x, bottom + x, next_top + x, prev_top + x, prev_bottom + x, dst + x, len - x);
+}
+#endif // defined FIELD_ENGINE_X86
+/**
+ * @}
+ */
+
+struct field_kernels {
+        void (*blend)(const unsigned char *a, const unsigned char *b,
+                        unsigned char *dst0, unsigned char *dst1, size_t len);
+        void (*motion)(const unsigned char *top, const unsigned char *bottom,
+                        const unsigned char *next_top, const unsigned char *prev_top,
+                        const unsigned char *prev_bottom, unsigned char *dst, size_t len);
+};
+
+enum { KERNELS_BYTES, KERNELS_V210, KERNELS_R10K, KERNELS_COUNT };
+
+static const struct field_kernels scalar_kernels[KERNELS_COUNT] = {
+        { blend_bytes_scalar, motion_bytes_scalar },
+        { blend_packed10_scalar<v210_layout>, motion_packed10_scalar<v210_layout> },
+        { blend_packed10_scalar<r10k_layout>, motion_packed10_scalar<r10k_layout> },
+};
+
+#ifdef FIELD_ENGINE_X86
+static const struct field_kernels avx2_kernels[KERNELS_COUNT] = {
+        { blend_bytes_avx2, motion_bytes_avx2 },
+        { blend_packed10_avx2<v210_layout>, motion_packed10_avx2<v210_layout> },
+        { blend_packed10_avx2<r10k_layout>, motion_packed10_avx2<r10k_layout> },
+};
+#endif
+
+static enum field_engine_isa select_isa(enum field_engine_isa max_isa)
+{
+#ifdef FIELD_ENGINE_X86
+        __builtin_cpu_init();
+        if (max_isa >= FIELD_ENGINE_AVX2 && __builtin_cpu_supports("avx2")) {
+                return FIELD_ENGINE_AVX2;
+        }
+#endif
+        return FIELD_ENGINE_SCALAR;
+}
+
+static enum field_engine_isa field_engine_isa = select_isa(FIELD_ENGINE_AVX2);
+
+enum field_engine_isa field_engine_set_max_isa(enum field_engine_isa max_isa)
+{
+        return field_engine_isa = select_isa(max_isa);
+}
+
+static const struct field_kernels *get_kernels(codec_t codec)
+{
+        int idx = codec == v210 ? KERNELS_V210 : codec == R10k ? KERNELS_R10K : KERNELS_BYTES;
+#ifdef FIELD_ENGINE_X86
+        if (field_engine_isa == FIELD_ENGINE_AVX2) {
+                return &avx2_kernels[idx];
+        }
+#endif
+        return &scalar_kernels[idx];
+}
+
+void field_engine_process(enum field_engine_op op, codec_t codec, const struct field_engine_src *src,
+                unsigned char *dst, size_t dst_pitch, size_t lines)
+{
+        const struct field_kernels *k = get_kernels(codec);
+        const size_t linesize = src->linesize;
+        if (op == FIELD_MOTION_ADAPTIVE && !src->prev) {
+                op = FIELD_BLEND;
+        }
+
+        int grain = max<size_t>(CHUNK_SIZE / (2 * linesize), 1);
+        parallel_for(0, lines / 2, [=](int start, int end) {
+                for (size_t y = 2 * start; y < 2 * (size_t) end; y += 2) {
+                        const unsigned char *top = src->top + y * linesize;
+                        const unsigned char *bottom = src->bottom + (y + 1) * linesize;
+                        unsigned char *dst0 = dst + y * dst_pitch;
+                        unsigned char *dst1 = dst0 + dst_pitch;
+                        switch (op) {
+                        case FIELD_WEAVE:
+                                memcpy(dst0, top, linesize);
+                                memcpy(dst1, bottom, linesize);
+                                break;
+                        case FIELD_BLEND:
+                                k->blend(top, bottom, dst0, dst1, linesize);
+                                break;
+                        case FIELD_MOTION_ADAPTIVE:
+                                memcpy(dst0, top, linesize);
+                                k->motion(top, bottom, y + 2 < lines ? top + 2 * linesize : top,
+                                                src->prev + y * linesize, src->prev + (y + 1) * linesize,
+                                                dst1, linesize);
+                                break;
+                        }
+                }
+        }, grain);
+
+        if (lines % 2 == 1) {
+                memcpy(dst + (lines - 1) * dst_pitch, src->top + (lines - 1) * linesize, linesize);
+        }
+}
+
@@ -0,0 +1,99 @@
+/**
+ * @file   utils/field_engine.h
+ *
+ * Row-parallel processing of interlaced fields - weaving, linear blend and
+ * motion-adaptive deinterlacing from source to destination buffer.
+ */
+/*
+ * Copyright (c) 2019 CESNET z.s.p.o.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, is permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of CESNET nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESSED OR IMPLIED WARRANTIES, INCLUDING,
+ * BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef UTILS_FIELD_ENGINE_H_
+#define UTILS_FIELD_ENGINE_H_
+
+#include "types.h"
+
+#ifdef __cplusplus
+#include <cstddef>
+extern "C" {
+#else
+#include <stddef.h>
+#endif
+
+enum field_engine_op {
+        FIELD_WEAVE,           ///< even lines are copied from top, odd ones from bottom frame
+        FIELD_BLEND,           ///< both lines of each line pair are set to their average
+        /**
+         * even lines are copied from top frame, odd lines are copied from bottom
+         * frame in static areas and interpolated from surrounding even lines where
+         * a motion against previous frame is detected
+         */
+        FIELD_MOTION_ADAPTIVE,
+};
+
+enum field_engine_isa {
+        FIELD_ENGINE_SCALAR,
+        FIELD_ENGINE_AVX2,
+};
+
+struct field_engine_src {
+        const unsigned char *top;    ///< frame providing even lines (top field)
+        const unsigned char *bottom; ///< frame providing odd lines (bottom field), may be equal to top
+        const unsigned char *prev;   ///< previous frame for FIELD_MOTION_ADAPTIVE, if NULL, FIELD_BLEND is used
+        size_t linesize;             ///< line length of source frames (bytes)
+};
+
+/**
+ * Processes fields of src to dst. Line pairs are processed concurrently.
+ *
+ * @param codec     pixel format - v210 and R10k are processed per 10-bit component,
+ *                  other formats byte-wise
+ * @param dst       destination buffer, must not overlap with source frames
+ * @param dst_pitch length of destination line in bytes (at least src->linesize)
+ * @param lines     number of lines
+ */
+void field_engine_process(enum field_engine_op op, codec_t codec, const struct field_engine_src *src,
+                unsigned char *dst, size_t dst_pitch, size_t lines);
+
+/**
+ * Limits instruction set used by the kernels (the best one supported by the
+ * CPU is used by default).
+ *
+ * @return the instruction set that will be actually used
+ */
+enum field_engine_isa field_engine_set_max_isa(enum field_engine_isa max_isa);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // UTILS_FIELD_ENGINE_H_
@@ -0,0 +1,140 @@
+/**
+ * @file   utils/mpmc_queue.h
+ *
+ * Lock-free bounded multi-producer/multi-consumer queue.
+ */
+/*
+ * Copyright (c) 2019 CESNET z.s.p.o.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, is permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of CESNET nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESSED OR IMPLIED WARRANTIES, INCLUDING,
+ * BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef MPMC_QUEUE_H_
+#define MPMC_QUEUE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#define MPMC_CACHE_LINE 64
+
+/**
+ * @brief bounded lock-free queue for any number of producers and consumers
+ *
+ * Every cell carries a sequence number telling whether it is ready to be
+ * written or read in the current lap, so that producers and consumers only
+ * contend on their own index (D. Vyukov's bounded MPMC queue). As with
+ * spsc_queue, neither push() nor pop() blocks.
+ *
+ * @tparam T type to be stored, should be cheap to copy
+ */
+template<typename T>
+class mpmc_queue {
+public:
+        /// @param capacity maximal number of items, rounded up to the power of two
+        explicit mpmc_queue(size_t capacity) {
+                size_t size = 1;
+                while (size < capacity) {
+                        size <<= 1;
+                }
+                m_cells.reset(new cell[size]);
+                for (size_t i = 0; i < size; ++i) {
+                        m_cells[i].seq.store(i, std::memory_order_relaxed);
+                }
+                m_mask = size - 1;
+        }
+
+        /// @returns false if the queue is full (item is not inserted)
+        bool push(T const & item) {
+                size_t pos = m_tail.load(std::memory_order_relaxed);
+                cell *c;
+                while (true) {
+                        c = &m_cells[pos & m_mask];
+                        size_t seq = c->seq.load(std::memory_order_acquire);
+                        intptr_t diff = (intptr_t) seq - (intptr_t) pos;
+                        if (diff == 0) {
+                                if (m_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                                        break;
+                                }
+                        } else if (diff < 0) {
+                                return false;
+                        } else {
+                                pos = m_tail.load(std::memory_order_relaxed);
+                        }
+                }
+                c->item = item;
+                c->seq.store(pos + 1, std::memory_order_release);
+                return true;
+        }
+
+        /// @returns false if the queue is empty
+        bool pop(T & item) {
+                size_t pos = m_head.load(std::memory_order_relaxed);
+                cell *c;
+                while (true) {
+                        c = &m_cells[pos & m_mask];
+                        size_t seq = c->seq.load(std::memory_order_acquire);
+                        intptr_t diff = (intptr_t) seq - (intptr_t) (pos + 1);
+                        if (diff == 0) {
+                                if (m_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                                        break;
+                                }
+                        } else if (diff < 0) {
+                                return false;
+                        } else {
+                                pos = m_head.load(std::memory_order_relaxed);
+                        }
+                }
+                item = c->item;
+                c->seq.store(pos + m_mask + 1, std::memory_order_release);
+                return true;
+        }
+
+        size_t capacity() const {
+                return m_mask + 1;
+        }
+
+private:
+        struct cell {
+                std::atomic<size_t> seq;
+                T item;
+        };
+        std::unique_ptr<cell[]> m_cells;
+        size_t m_mask;
+        char m_pad0[MPMC_CACHE_LINE];
+        std::atomic<size_t> m_tail{0}; ///< written by producers
+        char m_pad1[MPMC_CACHE_LINE];
+        std::atomic<size_t> m_head{0}; ///< written by consumers
+        char m_pad2[MPMC_CACHE_LINE];
+};
+
+#endif // MPMC_QUEUE_H_
+
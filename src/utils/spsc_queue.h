@@ -0,0 +1,127 @@
+/**
+ * @file   utils/spsc_queue.h
+ *
+ * Lock-free bounded single-producer/single-consumer queue.
+ */
+/*
+ * Copyright (c) 2019 CESNET z.s.p.o.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, is permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of CESNET nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESSED OR IMPLIED WARRANTIES, INCLUDING,
+ * BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SPSC_QUEUE_H_
+#define SPSC_QUEUE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+#define SPSC_CACHE_LINE 64
+
+/**
+ * @brief bounded lock-free queue for exactly one producer and one consumer thread
+ *
+ * Neither push() nor pop() blocks - caller is responsible for waiting (eg. on
+ * a condition variable) if the queue is full or empty, respectively. Head and
+ * tail indices are kept in separate cache lines so that the producer and the
+ * consumer do not contend (padding is used instead of alignas() to keep
+ * heap allocation with plain new correct).
+ *
+ * @tparam T type to be stored, should be cheap to copy
+ */
+template<typename T>
+class spsc_queue {
+public:
+        /// @param capacity maximal number of items, rounded up to the power of two
+        explicit spsc_queue(size_t capacity) {
+                size_t size = 1;
+                while (size < capacity) {
+                        size <<= 1;
+                }
+                m_items.resize(size);
+                m_mask = size - 1;
+        }
+
+        /// @returns false if the queue is full (item is not inserted)
+        bool push(T const & item) {
+                size_t tail = m_tail.load(std::memory_order_relaxed);
+                if (tail - m_head_cache == m_items.size()) {
+                        m_head_cache = m_head.load(std::memory_order_acquire);
+                        if (tail - m_head_cache == m_items.size()) {
+                                return false;
+                        }
+                }
+                m_items[tail & m_mask] = item;
+                m_tail.store(tail + 1, std::memory_order_release);
+                return true;
+        }
+
+        /// @returns false if the queue is empty
+        bool pop(T & item) {
+                size_t head = m_head.load(std::memory_order_relaxed);
+                if (head == m_tail_cache) {
+                        m_tail_cache = m_tail.load(std::memory_order_acquire);
+                        if (head == m_tail_cache) {
+                                return false;
+                        }
+                }
+                item = m_items[head & m_mask];
+                m_head.store(head + 1, std::memory_order_release);
+                return true;
+        }
+
+        /// may be called from any thread, the result is only approximate
+        size_t size() const {
+                size_t head = m_head.load(std::memory_order_acquire);
+                return m_tail.load(std::memory_order_acquire) - head;
+        }
+
+        bool empty() const {
+                return size() == 0;
+        }
+
+        size_t capacity() const {
+                return m_items.size();
+        }
+
+private:
+        std::vector<T> m_items;
+        size_t m_mask;
+        char m_pad0[SPSC_CACHE_LINE];
+        std::atomic<size_t> m_head{0}; ///< written by consumer
+        size_t m_tail_cache = 0;       ///< consumer's copy of m_tail
+        char m_pad1[SPSC_CACHE_LINE];
+        std::atomic<size_t> m_tail{0}; ///< written by producer
+        size_t m_head_cache = 0;       ///< producer's copy of m_head
+        char m_pad2[SPSC_CACHE_LINE];
+};
+
+#endif // SPSC_QUEUE_H_
+
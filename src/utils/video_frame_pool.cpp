@@ -0,0 +1,185 @@
+/**
+ * @file   utils/video_frame_pool.cpp
+ */
+/*
+ * Copyright (c) 2019 CESNET z.s.p.o.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, is permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of CESNET nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESSED OR IMPLIED WARRANTIES, INCLUDING,
+ * BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#include "config_unix.h"
+#include "config_win32.h"
+#endif // HAVE_CONFIG_H
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef HAVE_LINUX
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "debug.h"
+#include "host.h"
+#include "utils/video_frame_pool.h"
+
+#define HUGEPAGE_SIZE (2 * 1024 * 1024)
+#define HUGEPAGE_HDR_SIZE 64 ///< allocation header preceding the returned pointer, keeps the alignment of the data
+
+#define MOD_NAME "[frame pool] "
+
+ADD_TO_PARAM(frame_pool_mlock, "frame-pool-mlock",
+                "* frame-pool-mlock\n"
+                "  Lock huge-page backed frame buffers in memory\n");
+ADD_TO_PARAM(frame_pool_numa_node, "frame-pool-numa-node",
+                "* frame-pool-numa-node=<node>\n"
+                "  Bind huge-page backed frame buffers to NUMA node <node>\n");
+
+#ifdef HAVE_LINUX
+struct hugepage_hdr {
+        size_t map_len; ///< length of the mapping including the header
+        bool locked;
+};
+
+static void *map_hugepages(size_t len)
+{
+        static std::atomic<bool> hugetlb_failed{false};
+        void *ptr = MAP_FAILED;
+#ifdef MAP_HUGETLB
+        if (!hugetlb_failed) {
+                ptr = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+                if (ptr == MAP_FAILED) {
+                        log_msg(LOG_LEVEL_VERBOSE, MOD_NAME "Cannot map huge pages (%s), "
+                                        "using transparent huge pages instead.\n", strerror(errno));
+                        hugetlb_failed = true;
+                }
+        }
+#endif
+        if (ptr == MAP_FAILED) {
+                ptr = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                if (ptr == MAP_FAILED) {
+                        return NULL;
+                }
+#ifdef MADV_HUGEPAGE
+                madvise(ptr, len, MADV_HUGEPAGE);
+#endif
+        }
+        return ptr;
+}
+
+static void bind_to_numa_node(void *ptr, size_t len, int node)
+{
+#if defined SYS_mbind
+        const int mpol_bind = 2; // MPOL_BIND from numaif.h
+        const unsigned mpol_mf_move = 1<<1; // MPOL_MF_MOVE
+        unsigned long nodemask[4] = {};
+        if (node >= (int) (sizeof nodemask * 8)) {
+                log_msg(LOG_LEVEL_WARNING, MOD_NAME "NUMA node %d out of range.\n", node);
+                return;
+        }
+        nodemask[node / (sizeof(unsigned long) * 8)] = 1ul << (node % (sizeof(unsigned long) * 8));
+        if (syscall(SYS_mbind, ptr, len, mpol_bind, nodemask, sizeof nodemask * 8, mpol_mf_move) != 0) {
+                log_msg(LOG_LEVEL_WARNING, MOD_NAME "Cannot bind memory to NUMA node %d: %s\n",
+                                node, strerror(errno));
+        }
+#else
+        UNUSED(ptr), UNUSED(len);
+        log_msg(LOG_LEVEL_WARNING, MOD_NAME "NUMA binding of node %d not supported.\n", node);
+#endif
+}
+#endif // defined HAVE_LINUX
+
+hugepage_data_allocator::hugepage_data_allocator() : lock(false), numa_node(-1)
+{
+        if (get_commandline_param("frame-pool-mlock")) {
+                lock = true;
+        }
+        if (get_commandline_param("frame-pool-numa-node")) {
+                numa_node = atoi(get_commandline_param("frame-pool-numa-node"));
+        }
+}
+
+void *hugepage_data_allocator::allocate(size_t size)
+{
+#ifdef HAVE_LINUX
+        size_t len = (size + HUGEPAGE_HDR_SIZE + HUGEPAGE_SIZE - 1) / HUGEPAGE_SIZE * HUGEPAGE_SIZE;
+        char *ptr = (char *) map_hugepages(len);
+        if (ptr == NULL) {
+                return NULL;
+        }
+        if (numa_node >= 0) {
+                bind_to_numa_node(ptr, len, numa_node);
+        }
+
+        struct hugepage_hdr *hdr = (struct hugepage_hdr *) ptr;
+        hdr->map_len = len;
+        hdr->locked = false;
+        if (lock) {
+                if (mlock(ptr, len) == 0) {
+                        hdr->locked = true;
+                } else {
+                        log_msg(LOG_LEVEL_WARNING, MOD_NAME "Cannot lock %zu B: %s\n", len, strerror(errno));
+                }
+        }
+        // pre-fault the memory so that the first frame does not stall
+        long page_size = sysconf(_SC_PAGESIZE);
+        for (size_t off = page_size; off < len; off += page_size) {
+                ptr[off] = 0;
+        }
+
+        return ptr + HUGEPAGE_HDR_SIZE;
+#else
+        UNUSED(lock), UNUSED(numa_node);
+        return aligned_malloc(size, 4096);
+#endif
+}
+
+void hugepage_data_allocator::deallocate(void *ptr)
+{
+        if (ptr == NULL) {
+                return;
+        }
+#ifdef HAVE_LINUX
+        struct hugepage_hdr *hdr = (struct hugepage_hdr *) ((char *) ptr - HUGEPAGE_HDR_SIZE);
+        if (hdr->locked) {
+                munlock(hdr, hdr->map_len);
+        }
+        munmap(hdr, hdr->map_len);
+#else
+        aligned_free(ptr);
+#endif
+}
+
@@ -48,6 +48,9 @@
 
 #ifdef __cplusplus
 
+#include "utils/mpmc_queue.h"
+
+#include <atomic>
 #include <condition_variable>
 #include <functional>
 #include <iostream>
@@ -65,6 +68,27 @@ struct default_data_allocator {
         }
 };
 
+/**
+ * @brief allocator of large frame buffers backed by (2 MB) huge pages
+ *
+ * Uses explicit huge pages (MAP_HUGETLB) if available in the system pool,
+ * otherwise transparent huge pages are requested. Memory is pre-faulted in
+ * allocate(), optionally mlock()-ed and bound to a NUMA node, so that there
+ * is no page-fault storm when the frames are first filled after a
+ * reconfiguration. Defaults of the members are taken from the
+ * frame-pool-mlock and frame-pool-numa-node command-line parameters.
+ *
+ * On other platforms than Linux it falls back to page-aligned malloc.
+ */
+struct hugepage_data_allocator {
+        hugepage_data_allocator();
+        void *allocate(size_t size);
+        void deallocate(void *ptr);
+
+        bool lock;      ///< mlock() allocated memory
+        int numa_node;  ///< NUMA node to bind the memory to, -1 for none
+};
+
 template <typename allocator>
 struct video_frame_pool {
         public:
@@ -175,6 +199,148 @@ struct video_frame_pool {
                 allocator         m_allocator;
                 unsigned int      m_max_used_frames;
 };
+
+#define LOCKFREE_POOL_FREE_FRAMES 64 ///< size of free-frame queue if number of frames is unlimited
+
+/**
+ * @brief video_frame_pool variant that doesn't lock in get_frame() nor in the frame deleter
+ *
+ * Free frames are kept in a lock-free MPMC queue of capacity max_used_frames
+ * (or @ref LOCKFREE_POOL_FREE_FRAMES if unlimited); frames returned when it
+ * is full are deallocated. The mutex is only taken when get_frame() needs to
+ * block because max_used_frames frames are unreturned (and in destructor).
+ *
+ * Unlike video_frame_pool, reconfigure() must not be called concurrently
+ * with get_frame() - it is expected that the same thread calls both, frames
+ * may be returned from any thread.
+ */
+template <typename allocator>
+struct lockfree_video_frame_pool {
+        public:
+                /// @copydoc video_frame_pool::video_frame_pool
+                lockfree_video_frame_pool(unsigned int max_used_frames = 0) :
+                        m_free_frames(max_used_frames > 0 ? max_used_frames : LOCKFREE_POOL_FREE_FRAMES),
+                        m_generation(0), m_desc(), m_max_data_len(0), m_unreturned_frames(0),
+                        m_waiters(0), m_max_used_frames(max_used_frames) {
+                }
+
+                virtual ~lockfree_video_frame_pool() {
+                        wait_for_return([this] {return m_unreturned_frames == 0;});
+                        remove_free_frames();
+                }
+
+                void reconfigure(struct video_desc new_desc, size_t new_size) {
+                        m_desc = new_desc;
+                        m_max_data_len = new_size;
+                        m_generation++;
+                        remove_free_frames();
+                }
+
+                /// @copydoc video_frame_pool::get_frame
+                std::shared_ptr<video_frame> get_frame() {
+                        assert(m_generation != 0);
+                        while (true) {
+                                unsigned int unreturned = m_unreturned_frames;
+                                if (m_max_used_frames > 0 && unreturned >= m_max_used_frames) {
+                                        wait_for_return([this] {return m_unreturned_frames < m_max_used_frames;});
+                                        continue;
+                                }
+                                if (m_unreturned_frames.compare_exchange_weak(unreturned, unreturned + 1)) {
+                                        break;
+                                }
+                        }
+
+                        struct video_frame *ret = NULL;
+                        struct free_frame item;
+                        int generation = m_generation;
+                        while (m_free_frames.pop(item)) {
+                                if (item.generation == generation) {
+                                        ret = item.frame;
+                                        break;
+                                }
+                                deallocate_frame(item.frame); // returned during reconfiguration
+                        }
+                        if (ret == NULL) {
+                                try {
+                                        ret = vf_alloc_desc(m_desc);
+                                        for (unsigned int i = 0; i < m_desc.tile_count; ++i) {
+                                                ret->tiles[i].data = (char *)
+                                                        m_allocator.allocate(m_max_data_len);
+                                                if (ret->tiles[i].data == NULL) {
+                                                        throw std::runtime_error("Cannot allocate data");
+                                                }
+                                                ret->tiles[i].data_len = m_max_data_len;
+                                        }
+                                } catch (std::exception &e) {
+                                        std::cerr << e.what() << std::endl;
+                                        deallocate_frame(ret);
+                                        frame_returned();
+                                        throw e;
+                                }
+                        }
+                        return std::shared_ptr<video_frame>(ret, std::bind([this](struct video_frame *frame, int generation) {
+                                        if (this->m_generation != generation ||
+                                                        !m_free_frames.push(free_frame{frame, generation})) {
+                                                this->deallocate_frame(frame);
+                                        }
+                                        frame_returned();
+                                }, std::placeholders::_1, generation));
+                }
+
+                allocator & get_allocator() {
+                        return m_allocator;
+                }
+
+        private:
+                struct free_frame {
+                        struct video_frame *frame;
+                        int generation;
+                };
+
+                void frame_returned() {
+                        assert(m_unreturned_frames > 0);
+                        m_unreturned_frames -= 1;
+                        if (m_waiters > 0) {
+                                std::lock_guard<std::mutex> lk(m_lock);
+                                m_frame_returned.notify_all();
+                        }
+                }
+
+                template<typename pred_t>
+                void wait_for_return(pred_t pred) {
+                        std::unique_lock<std::mutex> lk(m_lock);
+                        m_waiters += 1;
+                        m_frame_returned.wait(lk, pred);
+                        m_waiters -= 1;
+                }
+
+                void remove_free_frames() {
+                        struct free_frame item;
+                        while (m_free_frames.pop(item)) {
+                                deallocate_frame(item.frame);
+                        }
+                }
+
+                void deallocate_frame(struct video_frame *frame) {
+                        if (frame == NULL)
+                                return;
+                        for (unsigned int i = 0; i < frame->tile_count; ++i) {
+                                m_allocator.deallocate(frame->tiles[i].data);
+                        }
+                        vf_free(frame);
+                }
+
+                mpmc_queue<struct free_frame> m_free_frames;
+                std::mutex        m_lock;
+                std::condition_variable m_frame_returned;
+                std::atomic<int>  m_generation;
+                struct video_desc m_desc;
+                size_t            m_max_data_len;
+                std::atomic<unsigned int> m_unreturned_frames;
+                std::atomic<int>  m_waiters; ///< number of threads waiting in wait_for_return()
+                allocator         m_allocator;
+                unsigned int      m_max_used_frames;
+};
 #endif //  __cplusplus
 
 #endif // VIDEO_FRAME_POOL_H_
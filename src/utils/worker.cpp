@@ -51,11 +51,25 @@
 #include "config_win32.h"
 #endif // HAVE_CONFIG_H
 
+#include "debug.h"
+#include "host.h"
 #include "utils/worker.h"
 
 #include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
 #include <queue>
 #include <set>
+#include <thread>
+#include <vector>
+
+#ifdef HAVE_LINUX
+#include <pthread.h>
+#include <sched.h>
+#endif
 
 using namespace std;
 
@@ -286,3 +300,242 @@ void *wait_task(task_result_handle_t handle)
         return instance.wait_task(handle);
 }
 
+/**
+ * @defgroup ws_pool Work-stealing pool
+ *
+ * Pool of a fixed number of threads (one less than the number of cores by
+ * default, because the caller of parallel_for() works as well) used for
+ * data-parallel work. Every worker has its own deque - it takes work from
+ * its back and, if empty, steals from the front of other workers' deques.
+ * Unlike task_run_async(), stages running parallel_for() concurrently share
+ * the same threads so that the cores are not oversubscribed.
+ * @{
+ */
+#define WS_CHUNKS_PER_THREAD 4 ///< maximal number of chunks per thread a range is split to
+#define WS_CACHE_LINE 64
+
+ADD_TO_PARAM(worker_threads, "worker-threads",
+                "* worker-threads=<n>\n"
+                "  Number of threads of the work-stealing pool used for data-parallel\n"
+                "  processing (default number of cores - 1)\n");
+ADD_TO_PARAM(worker_pin_cores, "worker-pin-cores",
+                "* worker-pin-cores\n"
+                "  Pin threads of the work-stealing pool to cores (Linux only)\n");
+
+struct ws_job {
+        ws_job(range_runnable_t f, void *d, int chunks) : func(f), data(d), remaining(chunks) {}
+        range_runnable_t func;
+        void *data;
+        atomic<int> remaining;
+        mutex lock;
+        condition_variable done_cv;
+};
+
+struct ws_task {
+        struct ws_job *job;
+        int start;
+        int end;
+};
+
+struct ws_deque {
+        mutex lock;
+        deque<ws_task> tasks;
+        char pad[WS_CACHE_LINE];
+};
+
+static thread_local int ws_worker_idx = -1; ///< index of the current pool thread, -1 if not a pool thread
+
+class ws_pool {
+        public:
+                ws_pool();
+                ~ws_pool();
+                void parallel_for(int begin, int end, int grain, range_runnable_t func, void *data);
+
+        private:
+                void worker(int idx, bool pin);
+                bool pop_or_steal(int idx, ws_task &task);
+                void execute(ws_task const &task);
+
+                vector<unique_ptr<ws_deque>> m_deques;
+                vector<thread>    m_threads;
+                atomic<int>       m_queued{0};     ///< number of tasks in all deques
+                atomic<unsigned>  m_next_deque{0}; ///< where non-pool threads put next tasks
+                mutex             m_sleep_lock;
+                condition_variable m_sleep_cv;
+                bool              m_should_exit = false;
+};
+
+ws_pool::ws_pool()
+{
+        int thread_count = (int) thread::hardware_concurrency() - 1;
+        if (get_commandline_param("worker-threads")) {
+                thread_count = atoi(get_commandline_param("worker-threads"));
+        }
+        thread_count = max(thread_count, 0);
+        bool pin = get_commandline_param("worker-pin-cores") != NULL;
+
+        for (int i = 0; i < thread_count; ++i) {
+                m_deques.emplace_back(new ws_deque);
+        }
+        for (int i = 0; i < thread_count; ++i) {
+                m_threads.emplace_back(&ws_pool::worker, this, i, pin);
+        }
+}
+
+ws_pool::~ws_pool()
+{
+        {
+                lock_guard<mutex> lk(m_sleep_lock);
+                m_should_exit = true;
+        }
+        m_sleep_cv.notify_all();
+        for (auto &t : m_threads) {
+                t.join();
+        }
+}
+
+void ws_pool::worker(int idx, bool pin)
+{
+        ws_worker_idx = idx;
+#ifdef HAVE_LINUX
+        if (pin) {
+                cpu_set_t cpuset;
+                CPU_ZERO(&cpuset);
+                // core 0 is left to the (typically non-pool) caller
+                CPU_SET((idx + 1) % thread::hardware_concurrency(), &cpuset);
+                if (pthread_setaffinity_np(pthread_self(), sizeof cpuset, &cpuset) != 0) {
+                        log_msg(LOG_LEVEL_WARNING, "[worker] Unable to pin thread %d.\n", idx);
+                }
+        }
+#else
+        UNUSED(pin);
+#endif
+
+        while (true) {
+                ws_task task;
+                if (pop_or_steal(idx, task)) {
+                        execute(task);
+                        continue;
+                }
+                unique_lock<mutex> lk(m_sleep_lock);
+                m_sleep_cv.wait(lk, [this] { return m_queued > 0 || m_should_exit; });
+                if (m_should_exit) {
+                        return;
+                }
+        }
+}
+
+/**
+ * Takes a task from the back of own deque (if called from a pool thread) or
+ * steals one from the front of other deques.
+ */
+bool ws_pool::pop_or_steal(int idx, ws_task &task)
+{
+        if (m_queued == 0) {
+                return false;
+        }
+        int count = m_deques.size();
+        if (idx >= 0) {
+                ws_deque &d = *m_deques[idx];
+                lock_guard<mutex> lk(d.lock);
+                if (!d.tasks.empty()) {
+                        task = d.tasks.back();
+                        d.tasks.pop_back();
+                        m_queued--;
+                        return true;
+                }
+        }
+        int first_victim = idx >= 0 ? idx + 1 : 0;
+        for (int i = 0; i < count; ++i) {
+                ws_deque &d = *m_deques[(first_victim + i) % count];
+                lock_guard<mutex> lk(d.lock);
+                if (!d.tasks.empty()) {
+                        task = d.tasks.front();
+                        d.tasks.pop_front();
+                        m_queued--;
+                        return true;
+                }
+        }
+        return false;
+}
+
+void ws_pool::execute(ws_task const &task)
+{
+        struct ws_job *job = task.job;
+        job->func(task.start, task.end, job->data);
+        lock_guard<mutex> lk(job->lock);
+        if (--job->remaining == 0) {
+                job->done_cv.notify_one();
+        }
+}
+
+void ws_pool::parallel_for(int begin, int end, int grain, range_runnable_t func, void *data)
+{
+        int count = end - begin;
+        grain = max(grain, 1);
+        if (count <= 0) {
+                return;
+        }
+        int chunks = min((count + grain - 1) / grain,
+                        (int) (m_threads.size() + 1) * WS_CHUNKS_PER_THREAD);
+        if (chunks <= 1 || m_threads.empty()) {
+                func(begin, end, data);
+                return;
+        }
+
+        ws_job job(func, data, chunks);
+        // first chunk is processed by the caller directly, rest is distributed
+        int chunk_start = begin + count / chunks;
+        unsigned next = ws_worker_idx >= 0 ? ws_worker_idx : m_next_deque++;
+        for (int i = 1; i < chunks; ++i) {
+                int chunk_end = begin + (long long) count * (i + 1) / chunks;
+                // nested call from a pool thread keeps the work local, others spread it
+                ws_deque &d = *m_deques[(ws_worker_idx >= 0 ? next : next + i) % m_deques.size()];
+                {
+                        lock_guard<mutex> lk(d.lock);
+                        d.tasks.push_back(ws_task{&job, chunk_start, chunk_end});
+                }
+                m_queued++;
+                chunk_start = chunk_end;
+        }
+        {
+                lock_guard<mutex> lk(m_sleep_lock);
+        }
+        m_sleep_cv.notify_all();
+
+        execute(ws_task{&job, begin, begin + count / chunks});
+
+        // help with the remaining tasks (of this or other jobs) until done
+        ws_task task;
+        while (job.remaining > 0 && pop_or_steal(ws_worker_idx, task)) {
+                execute(task);
+        }
+        unique_lock<mutex> lk(job.lock);
+        job.done_cv.wait(lk, [&job] { return job.remaining == 0; });
+}
+
+static ws_pool &get_ws_pool()
+{
+        static ws_pool pool;
+        return pool;
+}
+
+void task_run_parallel_for(int begin, int end, int grain, range_runnable_t func, void *data)
+{
+        get_ws_pool().parallel_for(begin, end, grain, func, data);
+}
+
+static void call_function(int start, int end, void *data)
+{
+        (*static_cast<std::function<void(int, int)> const *>(data))(start, end);
+}
+
+void parallel_for(int begin, int end, std::function<void(int start, int end)> const & func, int grain)
+{
+        get_ws_pool().parallel_for(begin, end, grain, call_function,
+                        const_cast<std::function<void(int, int)> *>(&func));
+}
+
+/**
+ * @}
+ */
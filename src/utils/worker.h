@@ -68,10 +68,31 @@ task_result_handle_t task_run_async(runnable_t task, void *data);
 void task_run_async_detached(runnable_t task, void *data);
 void *wait_task(task_result_handle_t handle);
 
+typedef void (*range_runnable_t)(int start, int end, void *data);
+
+/**
+ * Runs func over [begin, end) split to chunks of at least grain items in the
+ * shared work-stealing pool. The calling thread takes part in the
+ * computation and the call returns after all chunks have been processed.
+ */
+void task_run_parallel_for(int begin, int end, int grain, range_runnable_t func, void *data);
 
 #ifdef __cplusplus
 }
 #endif
 
+#ifdef __cplusplus
+#include <functional>
+
+/**
+ * @copydoc task_run_parallel_for
+ *
+ * Intended for short CPU-bound work (pixel-format conversions, tile
+ * compression, capture filters), use task_run_async() for tasks that may
+ * block for longer time.
+ */
+void parallel_for(int begin, int end, std::function<void(int start, int end)> const & func, int grain = 1);
+#endif
+
 #endif /* WORKER_H_ */
 
@@ -0,0 +1,477 @@
+/**
+ * @file   video_capture/aggregate.cpp
+ * @author Martin Pulec <pulec@cesnet.cz>
+ *
+ * @brief Aggregate video capture driver
+ */
+/*
+ * Copyright (c) 2012-2013 CESNET z.s.p.o.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, is permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of CESNET nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESSED OR IMPLIED WARRANTIES, INCLUDING,
+ * BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "config.h"
+#include "config_unix.h"
+#include "config_win32.h"
+
+#include "debug.h"
+#include "host.h"
+#include "lib_common.h"
+#include "video.h"
+#include "video_capture.h"
+
+#include "audio/audio.h"
+#include "utils/video_frame_pool.h"
+#include "video_capture/aggregate.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+#include <vector>
+
+#define MAX_QUEUE_LEN 3 ///< frames buffered per device before the oldest is dropped
+#define MAX_AUDIO_LEN (1024*1024)
+#define GRAB_TIMEOUT_MS 100
+#define STATS_INTERVAL_S 5
+
+using namespace std;
+using namespace std::chrono;
+
+/* prototypes of functions defined in this module */
+static void show_help(void);
+
+static void show_help()
+{
+        printf("Aggregate capture\n");
+        printf("Usage\n");
+        printf("\t-t aggregate[:skew=<ms>][:policy=drop|dup] -t <dev1_config> -t <dev2_config> ....]\n");
+        printf("\t\twhere devn_config is a complete configuration string of device involved in an aggregate device\n");
+        printf("\t\tskew - maximal difference of capture times of tiles of one frame (default frame time)\n");
+        printf("\t\tpolicy - drop - wait for a new tile from every device, stale tiles are dropped (default)\n");
+        printf("\t\t         dup - if a device is late more than skew, its previous tile is repeated\n");
+
+}
+
+struct queued_frame {
+        struct video_frame *frame;
+        steady_clock::time_point timestamp; ///< time when the frame was grabbed
+};
+
+struct aggregate_device {
+        struct vidcap      *device = NULL;
+        thread              grab_thread;
+        deque<queued_frame> queue;
+
+        /// frames holding data of the device frames without dispose callback
+        unique_ptr<video_frame_pool<default_data_allocator>> pool{new video_frame_pool<default_data_allocator>()};
+        struct video_desc pool_desc{};
+        unsigned int pool_data_len = 0;
+
+        struct video_frame *current = NULL; ///< frame backing corresponding tile of the output frame
+        steady_clock::time_point current_timestamp;
+};
+
+struct vidcap_aggregate_state {
+        vector<aggregate_device> devices;
+
+        mutex              lock;
+        condition_variable frame_queued_cv;
+        atomic<bool>       should_exit_threads{false};
+
+        struct video_frame *frame;
+        int frames;
+        steady_clock::time_point t0;
+
+        long long          skew_tolerance_us = -1; ///< -1 means frame time
+        enum sync_policy   policy = POLICY_DROP;
+
+        int                audio_source_index = -1;
+        struct audio_frame captured_audio;      ///< audio accumulated by grab thread of the source device
+        struct audio_frame audio;               ///< audio returned from grab
+
+        // statistics
+        long long          skew_sum_us;
+        long long          skew_max_us;
+        int                dropped;
+        int                duplicated;
+};
+
+
+static struct vidcap_type *
+vidcap_aggregate_probe(bool verbose)
+{
+        UNUSED(verbose);
+	struct vidcap_type*		vt;
+    
+	vt = (struct vidcap_type *) calloc(1, sizeof(struct vidcap_type));
+	if (vt != NULL) {
+		vt->name        = "aggregate";
+		vt->description = "Aggregate video capture";
+	}
+	return vt;
+}
+
+/**
+ * Copies frame that is valid only until next grab to a frame from the device
+ * pool - pooled frames are reused when disposed so that no allocation is
+ * needed in steady state.
+ */
+static struct video_frame *pool_copy(struct aggregate_device *dev, struct video_frame *frame)
+{
+        struct video_desc desc = video_desc_from_frame(frame);
+        unsigned int data_len = 0;
+        for (unsigned int i = 0; i < frame->tile_count; ++i) {
+                data_len = max(data_len, frame->tiles[i].data_len);
+        }
+        if (!video_desc_eq(desc, dev->pool_desc) || data_len > dev->pool_data_len) {
+                dev->pool_desc = desc;
+                dev->pool_data_len = data_len;
+                dev->pool->reconfigure(desc, data_len);
+        }
+
+        shared_ptr<video_frame> copy = dev->pool->get_frame();
+        for (unsigned int i = 0; i < frame->tile_count; ++i) {
+                copy->tiles[i].data_len = frame->tiles[i].data_len;
+                memcpy(copy->tiles[i].data, frame->tiles[i].data, frame->tiles[i].data_len);
+        }
+        char metadata[VF_METADATA_SIZE];
+        vf_store_metadata(frame, metadata);
+        vf_restore_metadata(copy.get(), metadata);
+        copy->frame_type = frame->frame_type;
+
+        struct video_frame *ret = copy.get();
+        ret->callbacks.dispose_udata = new shared_ptr<video_frame>(copy);
+        ret->callbacks.dispose = [](struct video_frame *f) { delete static_cast<shared_ptr<video_frame> *>(f->callbacks.dispose_udata); };
+        return ret;
+}
+
+static void grab_worker(struct vidcap_aggregate_state *s, int i)
+{
+        struct aggregate_device *dev = &s->devices[i];
+
+        while (!s->should_exit_threads) {
+                struct audio_frame *audio = NULL;
+                struct video_frame *frame = vidcap_grab(dev->device, &audio);
+                if (!frame) {
+                        continue;
+                }
+                auto now = steady_clock::now();
+
+                // frames without dispose callback are valid only until next grab
+                struct video_frame *frame_local = frame;
+                if (!frame->callbacks.dispose) {
+                        frame_local = pool_copy(dev, frame);
+                }
+
+                unique_lock<mutex> lk(s->lock);
+                if (s->audio_source_index == -1 && audio != NULL) {
+                        log_msg(LOG_LEVEL_NOTICE, "[aggregate] Locking device #%d as an audio source.\n", i);
+                        s->audio_source_index = i;
+                }
+                if (s->audio_source_index == i && audio != NULL) {
+                        int len = audio->data_len;
+                        if (len + s->captured_audio.data_len > s->captured_audio.max_size) {
+                                len = s->captured_audio.max_size - s->captured_audio.data_len;
+                                log_msg(LOG_LEVEL_WARNING, "[aggregate] Audio buffer overflow!\n");
+                        }
+                        memcpy(s->captured_audio.data + s->captured_audio.data_len, audio->data, len);
+                        s->captured_audio.data_len += len;
+                        s->captured_audio.bps = audio->bps;
+                        s->captured_audio.ch_count = audio->ch_count;
+                        s->captured_audio.sample_rate = audio->sample_rate;
+                }
+                if (dev->queue.size() == MAX_QUEUE_LEN) {
+                        VIDEO_FRAME_DISPOSE(dev->queue.front().frame);
+                        dev->queue.pop_front();
+                        s->dropped++;
+                }
+                dev->queue.push_back({frame_local, now});
+                lk.unlock();
+                s->frame_queued_cv.notify_one();
+        }
+}
+
+static int parse_fmt(struct vidcap_aggregate_state *s, const char *fmt)
+{
+        char *tmp = strdup(fmt);
+        char *save_ptr = NULL;
+        char *item = strtok_r(tmp, ":", &save_ptr);
+        int ret = 0;
+        while (item) {
+                if (strncmp(item, "skew=", strlen("skew=")) == 0) {
+                        s->skew_tolerance_us = atof(item + strlen("skew=")) * 1000;
+                } else if (strcmp(item, "policy=drop") == 0) {
+                        s->policy = POLICY_DROP;
+                } else if (strcmp(item, "policy=dup") == 0) {
+                        s->policy = POLICY_DUP;
+                } else {
+                        if (strcmp(item, "help") != 0) {
+                                log_msg(LOG_LEVEL_ERROR, "[aggregate] Unknown option: %s\n", item);
+                        }
+                        show_help();
+                        ret = strcmp(item, "help") == 0 ? 1 : -1;
+                        break;
+                }
+                item = strtok_r(NULL, ":", &save_ptr);
+        }
+        free(tmp);
+        return ret;
+}
+
+static void vidcap_aggregate_done(void *state);
+
+static int
+vidcap_aggregate_init(const struct vidcap_params *params, void **state)
+{
+	struct vidcap_aggregate_state *s;
+
+	printf("vidcap_aggregate_init\n");
+
+
+        s = new vidcap_aggregate_state();
+
+        if (vidcap_params_get_fmt(params)) {
+                int ret = parse_fmt(s, vidcap_params_get_fmt(params));
+                if (ret != 0) {
+                        delete s;
+                        return ret > 0 ? VIDCAP_INIT_NOERR : VIDCAP_INIT_FAIL;
+                }
+        }
+
+        int devices_cnt = 0;
+        const struct vidcap_params *tmp = params;
+        while((tmp = vidcap_params_get_next(tmp))) {
+                if (vidcap_params_get_driver(tmp) != NULL)
+                        devices_cnt++;
+                else
+                        break;
+        }
+        if (devices_cnt == 0) {
+                log_msg(LOG_LEVEL_ERROR, "[aggregate] No devices given!\n");
+                show_help();
+                delete s;
+                return VIDCAP_INIT_FAIL;
+        }
+
+        s->devices.resize(devices_cnt);
+        tmp = params;
+        for (int i = 0; i < devices_cnt; ++i) {
+                tmp = vidcap_params_get_next(tmp);
+
+                int ret = initialize_video_capture(NULL, const_cast<struct vidcap_params *>(tmp), &s->devices[i].device);
+                if(ret != 0) {
+                        fprintf(stderr, "[aggregate] Unable to initialize device %d (%s:%s).\n",
+                                        i, vidcap_params_get_driver(tmp),
+                                        vidcap_params_get_fmt(tmp));
+                        vidcap_aggregate_done(s);
+                        return VIDCAP_INIT_FAIL;
+                }
+        }
+
+        s->captured_audio.max_size = s->audio.max_size = MAX_AUDIO_LEN;
+        s->captured_audio.data = (char *) malloc(MAX_AUDIO_LEN);
+        s->audio.data = (char *) malloc(MAX_AUDIO_LEN);
+
+        s->frame = vf_alloc(devices_cnt);
+        s->t0 = steady_clock::now();
+
+        for (int i = 0; i < devices_cnt; ++i) {
+                s->devices[i].grab_thread = thread(grab_worker, s, i);
+        }
+
+        *state = s;
+	return VIDCAP_INIT_OK;
+}
+
+static void
+vidcap_aggregate_done(void *state)
+{
+	struct vidcap_aggregate_state *s = (struct vidcap_aggregate_state *) state;
+
+	assert(s != NULL);
+
+        s->should_exit_threads = true;
+        for (auto &dev : s->devices) {
+                if (dev.grab_thread.joinable()) {
+                        dev.grab_thread.join();
+                }
+        }
+
+        for (auto &dev : s->devices) {
+                for (auto &queued : dev.queue) {
+                        VIDEO_FRAME_DISPOSE(queued.frame);
+                }
+                VIDEO_FRAME_DISPOSE(dev.current);
+                if (dev.device) {
+                        vidcap_done(dev.device);
+                }
+        }
+
+        vf_free(s->frame);
+        free(s->captured_audio.data);
+        free(s->audio.data);
+        delete s;
+}
+
+/**
+ * Checks whether a frame can be assembled, see aggregate_tiles_ready().
+ * Must be called with s->lock held.
+ */
+static bool tiles_ready(struct vidcap_aggregate_state *s, steady_clock::time_point *wake_up)
+{
+        double fps = 0.0;
+        for (auto &dev : s->devices) {
+                if (!dev.queue.empty()) {
+                        fps = dev.queue.front().frame->fps;
+                }
+        }
+        auto tolerance = s->skew_tolerance_us >= 0 ? microseconds(s->skew_tolerance_us) :
+                aggregate_default_skew(fps);
+        return aggregate_tiles_ready(s->devices, s->policy, tolerance,
+                        [s](struct queued_frame &q) {
+                                VIDEO_FRAME_DISPOSE(q.frame);
+                                s->dropped++;
+                        }, steady_clock::now(), wake_up);
+}
+
+static void update_stats(struct vidcap_aggregate_state *s, long long skew_us)
+{
+        s->frames++;
+        s->skew_sum_us += skew_us;
+        s->skew_max_us = max(s->skew_max_us, skew_us);
+
+        auto now = steady_clock::now();
+        double seconds = duration_cast<duration<double>>(now - s->t0).count();
+        if (seconds >= STATS_INTERVAL_S) {
+                log_msg(LOG_LEVEL_INFO, "[aggregate cap.] %d frames in %g seconds = %g FPS, "
+                                "skew avg %.2f ms max %.2f ms, %d tiles dropped, %d duplicated\n",
+                                s->frames, seconds, s->frames / seconds,
+                                s->skew_sum_us / 1000.0 / max(s->frames, 1), s->skew_max_us / 1000.0,
+                                s->dropped, s->duplicated);
+                s->t0 = now;
+                s->frames = 0;
+                s->skew_sum_us = s->skew_max_us = 0;
+                s->dropped = s->duplicated = 0;
+        }
+}
+
+static struct video_frame *
+vidcap_aggregate_grab(void *state, struct audio_frame **audio)
+{
+	struct vidcap_aggregate_state *s = (struct vidcap_aggregate_state *) state;
+
+        *audio = NULL;
+
+        unique_lock<mutex> lk(s->lock);
+        auto timeout = steady_clock::now() + milliseconds(GRAB_TIMEOUT_MS);
+        while (true) {
+                auto wake_up = timeout;
+                if (tiles_ready(s, &wake_up)) {
+                        break;
+                }
+                if (steady_clock::now() >= timeout) {
+                        return NULL;
+                }
+                s->frame_queued_cv.wait_until(lk, min(wake_up, timeout));
+        }
+
+        // previously returned frame is no longer needed, replace tiles that have a fresh frame
+        steady_clock::time_point first = steady_clock::time_point::max();
+        steady_clock::time_point last = steady_clock::time_point::min();
+        for (auto &dev : s->devices) {
+                if (dev.queue.empty()) {
+                        s->duplicated++;
+                        continue;
+                }
+                VIDEO_FRAME_DISPOSE(dev.current);
+                dev.current = dev.queue.front().frame;
+                dev.current_timestamp = dev.queue.front().timestamp;
+                dev.queue.pop_front();
+                first = min(first, dev.current_timestamp);
+                last = max(last, dev.current_timestamp);
+        }
+
+        if (s->audio_source_index != -1 && s->captured_audio.data_len > 0) {
+                swap(s->audio.data, s->captured_audio.data);
+                s->audio.data_len = s->captured_audio.data_len;
+                s->audio.bps = s->captured_audio.bps;
+                s->audio.ch_count = s->captured_audio.ch_count;
+                s->audio.sample_rate = s->captured_audio.sample_rate;
+                s->captured_audio.data_len = 0;
+                *audio = &s->audio;
+        }
+
+        update_stats(s, duration_cast<microseconds>(last - first).count());
+        lk.unlock();
+
+        for (unsigned int i = 0; i < s->devices.size(); ++i) {
+                struct video_frame *frame = s->devices[i].current;
+                if (i == 0) {
+                        s->frame->color_spec = frame->color_spec;
+                        s->frame->interlacing = frame->interlacing;
+                        s->frame->fps = frame->fps;
+                }
+                if (frame->color_spec != s->frame->color_spec ||
+                                frame->fps != s->frame->fps ||
+                                frame->interlacing != s->frame->interlacing) {
+                        fprintf(stderr, "[aggregate] Different format detected: ");
+                        if(frame->color_spec != s->frame->color_spec)
+                                fprintf(stderr, "codec");
+                        if(frame->interlacing != s->frame->interlacing)
+                                fprintf(stderr, "interlacing");
+                        if(frame->fps != s->frame->fps)
+                                fprintf(stderr, "FPS (%.2f and %.2f)", frame->fps, s->frame->fps);
+                        fprintf(stderr, "\n");
+                        
+                        return NULL;
+                }
+                vf_get_tile(s->frame, i)->width = vf_get_tile(frame, 0)->width;
+                vf_get_tile(s->frame, i)->height = vf_get_tile(frame, 0)->height;
+                vf_get_tile(s->frame, i)->data_len = vf_get_tile(frame, 0)->data_len;
+                vf_get_tile(s->frame, i)->data = vf_get_tile(frame, 0)->data;
+        }
+
+	return s->frame;
+}
+
+static const struct video_capture_info vidcap_aggregate_info = {
+        vidcap_aggregate_probe,
+        vidcap_aggregate_init,
+        vidcap_aggregate_done,
+        vidcap_aggregate_grab,
+};
+
+REGISTER_MODULE(aggregate, &vidcap_aggregate_info, LIBRARY_CLASS_VIDEO_CAPTURE, VIDEO_CAPTURE_ABI_VERSION);
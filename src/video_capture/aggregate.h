@@ -0,0 +1,127 @@
+/**
+ * @file   video_capture/aggregate.h
+ *
+ * @brief Tile synchronization of the aggregate video capture
+ */
+/*
+ * Copyright (c) 2012-2013 CESNET z.s.p.o.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, is permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of CESNET nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESSED OR IMPLIED WARRANTIES, INCLUDING,
+ * BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef VIDEO_CAPTURE_AGGREGATE_H_
+#define VIDEO_CAPTURE_AGGREGATE_H_
+
+#include <algorithm>
+#include <chrono>
+
+enum sync_policy {
+        POLICY_DROP, ///< wait for a fresh tile from every device
+        POLICY_DUP,  ///< repeat previous tile of a device that is late
+};
+
+/**
+ * Default skew tolerance - one frame time. Free-running devices of the same
+ * frame rate always have tiles within one frame time from each other, so a
+ * frame can be assembled regardless of the phase differences of the devices.
+ */
+static inline std::chrono::microseconds aggregate_default_skew(double fps)
+{
+        return std::chrono::microseconds(fps > 0.0 ? (long long) (1000000 / fps) : 0);
+}
+
+/**
+ * Discards superseded and stale queued tiles and checks whether a frame can
+ * be assembled from the first tiles of the device queues.
+ *
+ * The reference time is the newest first-in-queue tile. A queued tile is
+ * discarded if the next tile of the same device is not newer than the
+ * reference (that one is closer) or if it was grabbed earlier than tolerance
+ * before the reference. With dup policy, the last queued tile of a device is
+ * never discarded.
+ *
+ * @param devices   devices, each having queue (deque of tiles with
+ *                  timestamp member, oldest first) and current (previous
+ *                  tile, NULL if none)
+ * @param discard   called for every discarded tile
+ * @param now       current time
+ * @param[out] wake_up time when the frame becomes ready if a late tile doesn't
+ *                  arrive (dup policy)
+ * @returns         whether the frame is ready
+ */
+template<typename devices_t, typename discard_t>
+bool aggregate_tiles_ready(devices_t &devices, enum sync_policy policy, std::chrono::microseconds tolerance,
+                discard_t discard, std::chrono::steady_clock::time_point now,
+                std::chrono::steady_clock::time_point *wake_up)
+{
+        using std::chrono::steady_clock;
+        steady_clock::time_point newest = steady_clock::time_point::min();
+        steady_clock::time_point oldest = steady_clock::time_point::max();
+        for (auto &dev : devices) {
+                if (!dev.queue.empty()) {
+                        newest = std::max(newest, dev.queue.front().timestamp);
+                }
+        }
+        if (newest == steady_clock::time_point::min()) {
+                return false;
+        }
+
+        bool all_present = true;
+        bool all_have_tile = true;
+        for (auto &dev : devices) {
+                while (!dev.queue.empty()) {
+                        bool superseded = dev.queue.size() > 1 && dev.queue[1].timestamp <= newest;
+                        bool stale = dev.queue.front().timestamp + tolerance < newest &&
+                                (dev.queue.size() > 1 || policy == POLICY_DROP);
+                        if (!superseded && !stale) {
+                                break;
+                        }
+                        discard(dev.queue.front());
+                        dev.queue.pop_front();
+                }
+                if (dev.queue.empty()) {
+                        all_present = false;
+                        all_have_tile = all_have_tile && dev.current != NULL;
+                } else {
+                        oldest = std::min(oldest, dev.queue.front().timestamp);
+                }
+        }
+
+        if (all_present) {
+                return true;
+        }
+        if (policy != POLICY_DUP || !all_have_tile || oldest == steady_clock::time_point::max()) {
+                return false;
+        }
+        *wake_up = oldest + tolerance;
+        return now >= *wake_up;
+}
+
+#endif // VIDEO_CAPTURE_AGGREGATE_H_
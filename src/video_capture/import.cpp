@@ -70,7 +70,9 @@
 
 #include <condition_variable>
 #include <chrono>
+#include <inttypes.h>
 #include <mutex>
+#include <vector>
 
 #define BUFFER_LEN_MAX 40
 #define MAX_CLIENTS 16
@@ -81,6 +83,7 @@
 #define PIPE "/tmp/ultragrid_import.fifo"
 
 #define MAX_NUMBER_WORKERS 100
+#define MAX_TILES 16
 
 using std::condition_variable;
 using std::chrono::duration;
@@ -90,6 +93,7 @@ using std::mutex;
 using std::ostringstream;
 using std::string;
 using std::unique_lock;
+using std::vector;
 
 struct processed_entry;
 struct tile_data {
@@ -103,6 +107,12 @@ struct processed_entry {
         struct tile_data tiles[];
 };
 
+/// tile position in single-file export (VIDEO_EXPORT_CONTAINER_FILE)
+struct container_tile {
+        uint64_t offset;
+        size_t data_len; ///< 0 if the frame was dropped
+};
+
 typedef enum {
         SEEK,
         FINALIZE,
@@ -182,6 +192,9 @@ struct vidcap_import_state {
         bool should_exit_at_end;
         double force_fps;
 
+        bool container;                          ///< recorded to a single file
+        vector<struct container_tile> container_index; ///< [frame * tile_count + tile]
+
         volatile bool exit_control = false;
 };
 
@@ -206,6 +219,48 @@ static bool parse_msg(char *buffer, char buffer_len, /* out */ char *message, in
 static void process_msg(struct vidcap_import_state *state, char *message) WIN32_UNUSED;
 
 static void cleanup_common(struct vidcap_import_state *s);
+static unsigned int load_container_index(struct vidcap_import_state *s);
+
+/**
+ * Reads index of single-file export.
+ * @returns tile count
+ */
+static unsigned int load_container_index(struct vidcap_import_state *s)
+{
+        string name = string(s->directory) + "/" VIDEO_EXPORT_INDEX_FILE;
+        FILE *index = fopen(name.c_str(), "r");
+        if (index == NULL) {
+                throw string("[import] Cannot open ") + name + ".\n";
+        }
+
+        struct index_line {
+                unsigned int frame, tile;
+                struct container_tile pos;
+        } line;
+        vector<index_line> lines;
+        unsigned int tile_count = 0;
+        while (fscanf(index, "%u %u %" SCNu64 " %zu", &line.frame, &line.tile, &line.pos.offset,
+                                &line.pos.data_len) == 4) {
+                if (line.frame < 1 || line.frame > (unsigned int) s->count || line.tile >= MAX_TILES) {
+                        fclose(index);
+                        throw string("[import] Invalid entry in ") + name + ".\n";
+                }
+                tile_count = max(tile_count, line.tile + 1);
+                lines.push_back(line);
+        }
+        fclose(index);
+        if (tile_count == 0) {
+                throw string("[import] Empty index ") + name + ".\n";
+        }
+
+        // frames missing in the index (eg. interrupted recording) remain empty and are skipped
+        s->container_index.assign(s->count * tile_count, container_tile());
+        for (auto const & l : lines) {
+                s->container_index[(l.frame - 1) * tile_count + l.tile] = l.pos;
+        }
+
+        return tile_count;
+}
 
 static void message_queue_clear(struct message_queue *queue) {
         queue->head = queue->tail = NULL;
@@ -424,6 +479,8 @@ try {
                         char *ptr = line + strlen("count ");
                         s->count = atoi(ptr);
                         items_found |= 1<<6;
+                } else if(strncmp(line, "container ", strlen("container ")) == 0) {
+                        s->container = true;
                 }
         }
 
@@ -440,7 +497,9 @@ try {
                         get_codec_file_extension(desc.color_spec));
 
         struct stat sb;
-        if (stat(name, &sb) == 0) {
+        if (s->container) {
+                desc.tile_count = load_container_index(s);
+        } else if (stat(name, &sb) == 0) {
                 desc.tile_count = 1;
         } else {
                 desc.tile_count = 0;
@@ -595,7 +654,7 @@ static void vidcap_import_done(void *state)
         vidcap_import_finish(state);
 
         cleanup_common(s);
-        free(s);
+        delete s;
 }
 
 /*
@@ -944,6 +1003,7 @@ struct video_reader_data {
         unsigned int tile_count;
         struct processed_entry *entry;
         bool o_direct;
+        const struct container_tile *container_tiles; ///< NULL if reading file per tile
 };
 
 #define ALLOC_ALIGN 512
@@ -964,9 +1024,17 @@ static void *video_reader_callback(void *arg)
                 if (data->tile_count > 1) {
                         sprintf(tile_idx, "_%d", i);
 	        }
-                snprintf(name, sizeof(name), "%s%s.%s",
-                                data->file_name_prefix, tile_idx,
-                                data->file_name_suffix);
+                if (data->container_tiles) {
+                        if (data->container_tiles[i].data_len == 0) { // frame dropped during export
+                                free_entry(data->entry);
+                                return NULL;
+                        }
+                        snprintf(name, sizeof(name), "%s", data->file_name_prefix);
+                } else {
+                        snprintf(name, sizeof(name), "%s%s.%s",
+                                        data->file_name_prefix, tile_idx,
+                                        data->file_name_suffix);
+                }
 
                 struct stat sb;
 
@@ -984,14 +1052,23 @@ static void *video_reader_callback(void *arg)
                         perror("open");
                         return NULL;
                 }
-                if (fstat(fd, &sb)) {
-                        perror("fstat");
-                        close(fd);
-                        free_entry(data->entry);
-                        return NULL;
+                if (data->container_tiles) {
+                        data->entry->tiles[i].data_len = data->container_tiles[i].data_len;
+                        if (lseek(fd, data->container_tiles[i].offset, SEEK_SET) == (off_t) -1) {
+                                perror("lseek");
+                                close(fd);
+                                free_entry(data->entry);
+                                return NULL;
+                        }
+                } else {
+                        if (fstat(fd, &sb)) {
+                                perror("fstat");
+                                close(fd);
+                                free_entry(data->entry);
+                                return NULL;
+                        }
+                        data->entry->tiles[i].data_len = sb.st_size;
                 }
-
-                data->entry->tiles[i].data_len = sb.st_size;
                 const int aligned_data_len = (data->entry->tiles[i].data_len + ALLOC_ALIGN - 1)
                         / ALLOC_ALIGN * ALLOC_ALIGN;
                 // alignment needed when using O_DIRECT flag
@@ -1095,8 +1172,15 @@ static void * reading_thread(void *args)
                                 &data_reader[i];
                         data->o_direct = s->o_direct;
                         data->tile_count = s->video_desc.tile_count;
-                        snprintf(data->file_name_prefix, sizeof(data->file_name_prefix),
-                                        "%s/%08d", s->directory, index + i + 1);
+                        data->container_tiles = NULL;
+                        if (s->container) {
+                                snprintf(data->file_name_prefix, sizeof(data->file_name_prefix),
+                                                "%s/" VIDEO_EXPORT_CONTAINER_FILE, s->directory);
+                                data->container_tiles = &s->container_index[(index + i) * data->tile_count];
+                        } else {
+                                snprintf(data->file_name_prefix, sizeof(data->file_name_prefix),
+                                                "%s/%08d", s->directory, index + i + 1);
+                        }
                         strncpy(data->file_name_suffix,
                                         get_codec_file_extension(s->video_desc.color_spec),
                                         sizeof(data->file_name_suffix));
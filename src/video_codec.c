@@ -62,6 +62,7 @@
 #include <string.h>
 #include "video_codec.h"
 
+#include "utils/field_engine.h"
 #include "utils/misc.h" // to_fourcc
 
 #ifdef __SSSE3__
@@ -595,20 +596,13 @@ static void vc_deinterlace_unaligned(unsigned char *src, long src_linesize, int
 
 /**
  * Extended version of vc_deinterlace(). The former version was in-place only.
- * This allows to output to different buffer.
+ * This allows to output to different buffer. Lines are processed concurrently
+ * by the field engine.
  */
-void vc_deinterlace_ex(unsigned char *src, size_t src_linesize, unsigned char *dst, size_t dst_pitch, size_t lines)
+void vc_deinterlace_ex(const unsigned char *src, size_t src_linesize, unsigned char *dst, size_t dst_pitch, size_t lines)
 {
-        for (size_t y = 0; y < lines; y += 2) {
-                for (size_t x = 0; x < src_linesize; ++x) {
-                        int val = (*src + src[src_linesize] + 1) >> 1;
-                        *dst = dst[dst_pitch] = val;
-                        src++;
-                        dst++;
-                }
-                src += src_linesize;
-                dst += dst_pitch;
-        }
+        struct field_engine_src fsrc = { src, src, NULL, src_linesize };
+        field_engine_process(FIELD_BLEND, VIDEO_CODEC_NONE, &fsrc, dst, dst_pitch, lines);
 }
 
 /**
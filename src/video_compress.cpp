@@ -43,6 +43,8 @@
 #include "config_win32.h"
 #endif // HAVE_CONFIG_H
 
+#include <algorithm>
+#include <cinttypes>
 #include <memory>
 #include <stdio.h>
 #include <string>
@@ -51,6 +53,8 @@
 #include <vector>
 
 #include "compat/platform_time.h"
+#include "debug.h"
+#include "host.h"
 #include "messaging.h"
 #include "module.h"
 #include "utils/synchronized_queue.h"
@@ -62,6 +66,8 @@
 
 using namespace std;
 
+#define LATENCY_REPORT_INTERVAL_MS 5000
+
 struct compress_state;
 
 namespace {
@@ -71,9 +77,12 @@ namespace {
 struct compress_state_real {
 private:
         compress_state_real(struct module *parent, const char *config_string);
+        bool          add_instance(struct module *parent, unsigned int i);
         void          start(struct compress_state *proxy);
         void          async_consumer(struct compress_state *s);
         thread        asynch_consumer_thread;
+        void          pipeline_collector(struct compress_state *proxy);
+        thread        pipeline_collector_thread;
 public:
         static compress_state_real *create(struct module *parent, const char *config_string,
                         struct compress_state *proxy) {
@@ -82,10 +91,26 @@ public:
                 return s;
         }
         ~compress_state_real();
+        void          report_latency(const struct video_frame *frame);
+
         const video_compress_info    *funcs;            ///< handle for the driver
-        vector<struct module *> state;                  ///< driver internal states
+        /// driver internal states - one set for each concurrently compressed
+        /// frame, each set holding one state per tile for the tile API
+        vector<vector<struct module *>> instances;
         string              compress_options; ///< compress options (for reconfiguration)
         volatile bool       discard_frames;   ///< this class is no longer active
+
+        unsigned int        pipeline_depth;   ///< number of frames compressed concurrently (sync APIs only)
+        synchronized_queue<int, -1> free_instances; ///< indices of idle instances
+        /// submitted frames in submission order, NULL handle is poison pill,
+        /// collector_exit stops the collector without passing it
+        synchronized_queue<task_result_handle_t, -1> in_flight;
+        static char         collector_exit;
+
+        uint64_t            latency_report_start; ///< compress latency statistics
+        unsigned long       latency_frames;
+        uint64_t            latency_sum;
+        uint64_t            latency_max;
 };
 }
 
@@ -107,8 +132,12 @@ struct compress_state {
  */
 struct module compress_init_noerr;
 
+static shared_ptr<video_frame> compress_frame_sync(struct compress_state_real *s,
+                vector<struct module *> &state, shared_ptr<video_frame> frame,
+                struct module *parent);
 static shared_ptr<video_frame> compress_frame_tiles(struct compress_state_real *s,
-                shared_ptr<video_frame> frame, struct module *parent);
+                vector<struct module *> &state, shared_ptr<video_frame> frame,
+                struct module *parent);
 static void compress_done(struct module *mod);
 
 /// @brief Displays list of available compressions.
@@ -133,19 +162,21 @@ static void compress_process_message(struct compress_state *proxy, struct msg_ch
         /* In this case we are only changing some parameter of compression.
          * This means that we pass the parameter to compress driver. */
         if(data->what == CHANGE_PARAMS) {
-                for(unsigned int i = 0; i < proxy->ptr->state.size(); ++i) {
-                        struct msg_change_compress_data *tmp_data =
-                                (struct msg_change_compress_data *)
-                                new_message(sizeof(struct msg_change_compress_data));
-                        tmp_data->what = data->what;
-                        strncpy(tmp_data->config_string, data->config_string,
-                                        sizeof(tmp_data->config_string) - 1);
-                        struct response *resp = send_message_to_receiver(proxy->ptr->state[i],
-                                        (struct message *) tmp_data);
-                        /// @todo
-                        /// Handle responses more inteligently (eg. aggregate).
-                        free_response(r); // frees previous response
-                        r = resp;
+                for (auto & state : proxy->ptr->instances) {
+                        for(unsigned int i = 0; i < state.size(); ++i) {
+                                struct msg_change_compress_data *tmp_data =
+                                        (struct msg_change_compress_data *)
+                                        new_message(sizeof(struct msg_change_compress_data));
+                                tmp_data->what = data->what;
+                                strncpy(tmp_data->config_string, data->config_string,
+                                                sizeof(tmp_data->config_string) - 1);
+                                struct response *resp = send_message_to_receiver(state[i],
+                                                (struct message *) tmp_data);
+                                /// @todo
+                                /// Handle responses more inteligently (eg. aggregate).
+                                free_response(r); // frees previous response
+                                r = resp;
+                        }
                 }
 
         } else {
@@ -165,9 +196,9 @@ static void compress_process_message(struct compress_state *proxy, struct msg_ch
                 if (old->funcs->compress_frame_async_push_func) {
                         // let the async processing finish
                         old->discard_frames = true;
-                        old->funcs->compress_frame_async_push_func(old->state[0], {}); // poison
+                        old->funcs->compress_frame_async_push_func(old->instances[0][0], {}); // poison
                 }
-                delete old;
+                delete old; // pipelined frames still in flight are passed before the new ones
                 proxy->ptr = new_state;
                 r = new_response(RESPONSE_OK, NULL);
         }
@@ -208,6 +239,10 @@ int compress_init(struct module *parent, const char *config_string, struct compr
         return 0;
 }
 
+ADD_TO_PARAM(compress_pipeline, "compress-pipeline",
+                "* compress-pipeline=<n>\n"
+                "  Number of frames compressed concurrently by separate encoder instances,\n"
+                "  increases throughput at the cost of latency, intra-frame codecs only (default 1)\n");
 /**
  * @brief Constructor for compress_state_real
  * @param[in] parent        parent module
@@ -216,7 +251,8 @@ int compress_init(struct module *parent, const char *config_string, struct compr
  * @retval     1            finished successfully, no state created (eg. displayed help)
  */
 compress_state_real::compress_state_real(struct module *parent, const char *config_string) :
-        funcs(nullptr), discard_frames(false)
+        funcs(nullptr), discard_frames(false), pipeline_depth(1), latency_report_start(0),
+        latency_frames(0), latency_sum(0), latency_max(0)
 {
         string compress_name;
 
@@ -246,25 +282,70 @@ compress_state_real::compress_state_real(struct module *parent, const char *conf
 
         funcs = vci;
 
-        if (funcs->init_func) {
-                state.resize(1);
-                state[0] = funcs->init_func(parent, compress_options.c_str());
-                if(!state[0]) {
+        if (!funcs->init_func) {
+                throw -1;
+        }
+
+        instances.resize(1);
+        if (!add_instance(parent, 0)) {
+                fprintf(stderr, "Compression initialization failed: %s\n", config_string);
+                throw -1;
+        }
+        if (instances[0][0] == &compress_init_noerr) {
+                throw 1;
+        }
+
+        if (get_commandline_param("compress-pipeline")) {
+                pipeline_depth = max(atoi(get_commandline_param("compress-pipeline")), 1);
+                if (pipeline_depth > 1 && funcs->compress_frame_async_push_func) {
+                        log_msg(LOG_LEVEL_WARNING, "[compress] Compression %s has its own queue, "
+                                        "ignoring compress-pipeline.\n", funcs->name);
+                        pipeline_depth = 1;
+                }
+                // separate instances would each keep its own reference frames
+                if (pipeline_depth > 1 && (!funcs->is_intra_only || !funcs->is_intra_only(instances[0][0]))) {
+                        log_msg(LOG_LEVEL_WARNING, "[compress] Compression %s is not intra-frame only "
+                                        "with given options, ignoring compress-pipeline.\n", funcs->name);
+                        pipeline_depth = 1;
+                }
+        }
+
+        instances.resize(pipeline_depth);
+        for (unsigned int i = 1; i < pipeline_depth; ++i) {
+                if (!add_instance(parent, i)) {
                         fprintf(stderr, "Compression initialization failed: %s\n", config_string);
+                        for (unsigned int j = 0; j < i; ++j) {
+                                module_done(instances[j][0]);
+                        }
                         throw -1;
                 }
-                if(state[0] == &compress_init_noerr) {
-                        throw 1;
-                }
-        } else {
-                throw -1;
         }
 }
 
+/**
+ * Initializes instance of the compress module
+ * @retval false if initialization failed (compress_init_noerr is accepted
+ *               only for the first instance)
+ */
+bool compress_state_real::add_instance(struct module *parent, unsigned int i)
+{
+        struct module *state = funcs->init_func(parent, compress_options.c_str());
+        if (!state || (state == &compress_init_noerr && i > 0)) {
+                return false;
+        }
+        instances[i].push_back(state);
+        if (state != &compress_init_noerr) {
+                free_instances.push(i);
+        }
+        return true;
+}
+
 void compress_state_real::start(struct compress_state *proxy)
 {
         if (funcs->compress_frame_async_push_func) {
                 asynch_consumer_thread = thread(&compress_state_real::async_consumer, this, proxy);
+        } else if (pipeline_depth > 1) {
+                pipeline_collector_thread = thread(&compress_state_real::pipeline_collector, this, proxy);
         }
 }
 
@@ -282,6 +363,96 @@ const char *get_compress_name(struct compress_state *proxy)
                 return NULL;
 }
 
+/**
+ * @name Pipelined Compression
+ * With compress-pipeline=<n>, up to n frames are compressed concurrently,
+ * each with its own set of driver states. The results are collected in
+ * submission order so that the frame sequence is retained.
+ * @{
+ */
+/**
+ * @brief Frame submitted to a pipeline instance.
+ */
+struct compress_pipeline_task {
+        struct compress_state_real *s;
+        int instance;                  ///< index to compress_state_real::instances
+        shared_ptr<video_frame> frame; ///< uncompressed frame
+        struct module *parent;
+        uint64_t t0;                   ///< submission time
+        shared_ptr<video_frame> ret;   ///< OUT - compressed frame, NULL if failed
+};
+
+static void *compress_pipeline_task_run(void *arg) {
+        auto *task = static_cast<compress_pipeline_task *>(arg);
+
+        task->ret = compress_frame_sync(task->s, task->s->instances[task->instance],
+                        move(task->frame), task->parent);
+        if (task->ret) {
+                task->ret->compress_start = task->t0;
+                task->ret->compress_end = time_since_epoch_in_ms();
+        }
+
+        return task;
+}
+
+namespace {
+char compress_state_real::collector_exit;
+
+/**
+ * Passes compressed frames to the proxy queue in the submission order.
+ * Frames that are in flight when the state is being replaced are still
+ * passed. The poison pill submitted with compress_frame() is always
+ * passed, the collector is stopped by the destructor with collector_exit.
+ */
+void compress_state_real::pipeline_collector(struct compress_state *proxy)
+{
+        while (true) {
+                task_result_handle_t handle = in_flight.pop();
+                if (handle == &collector_exit) {
+                        return;
+                }
+                if (!handle) {
+                        proxy->queue.push(shared_ptr<video_frame>());
+                        return;
+                }
+
+                auto *task = static_cast<compress_pipeline_task *>(wait_task(handle));
+                free_instances.push(task->instance);
+                if (task->ret) {
+                        report_latency(task->ret.get());
+                        proxy->queue.push(move(task->ret));
+                }
+                delete task;
+        }
+}
+
+/**
+ * Collects per-frame compress latency (from compress_frame() call to
+ * compressed frame) and periodically prints it.
+ */
+void compress_state_real::report_latency(const struct video_frame *frame)
+{
+        uint64_t latency = frame->compress_end - frame->compress_start;
+        latency_sum += latency;
+        latency_max = max(latency_max, latency);
+        latency_frames += 1;
+
+        if (latency_report_start == 0) {
+                latency_report_start = frame->compress_end;
+        } else if (frame->compress_end - latency_report_start >= LATENCY_REPORT_INTERVAL_MS) {
+                log_msg(LOG_LEVEL_VERBOSE, "[compress] %s: %lu frames, pipeline depth %u, "
+                                "latency avg %.1f ms, max %" PRIu64 " ms\n", funcs->name,
+                                latency_frames, pipeline_depth,
+                                (double) latency_sum / latency_frames, latency_max);
+                latency_report_start = frame->compress_end;
+                latency_frames = latency_sum = latency_max = 0;
+        }
+}
+} // end of anonymous namespace
+/**
+ * @}
+ */
+
 /**
  * @brief Compressses frame
  *
@@ -308,21 +479,24 @@ void compress_frame(struct compress_state *proxy, shared_ptr<video_frame> frame)
                 if (frame) {
                         frame->compress_start = t0;
                 }
-                s->funcs->compress_frame_async_push_func(s->state[0], frame);
+                s->funcs->compress_frame_async_push_func(s->instances[0][0], frame);
+        } else if (s->pipeline_depth > 1) {
+                if (!frame) { // poisoned pill is passed by collector after pending frames
+                        s->in_flight.push(nullptr);
+                        return;
+                }
+
+                int instance = s->free_instances.pop(); // blocks until oldest frame is done
+                auto *task = new compress_pipeline_task{s, instance, move(frame), &proxy->mod, t0, {}};
+                s->in_flight.push(task_run_async(compress_pipeline_task_run, task));
         } else {
                 if (!frame) { // pass poisoned pill
                         proxy->queue.push(shared_ptr<video_frame>());
                         return;
                 }
 
-                shared_ptr<video_frame> sync_api_frame;
-                if (s->funcs->compress_frame_func) {
-                        sync_api_frame = s->funcs->compress_frame_func(s->state[0], frame);
-                } else if(s->funcs->compress_tile_func) {
-                        sync_api_frame = compress_frame_tiles(s, frame, &proxy->mod);
-                } else {
-                        assert(!"No egliable compress API found");
-                }
+                shared_ptr<video_frame> sync_api_frame = compress_frame_sync(s, s->instances[0],
+                                move(frame), &proxy->mod);
 
                 // empty return value here represents error, but we don't want to pass it to queue, since it would
                 // be interpreted as poisoned pill
@@ -332,11 +506,35 @@ void compress_frame(struct compress_state *proxy, shared_ptr<video_frame> frame)
 
                 sync_api_frame->compress_start = t0;
                 sync_api_frame->compress_end = time_since_epoch_in_ms();
+                s->report_latency(sync_api_frame.get());
 
                 proxy->queue.push(sync_api_frame);
         }
 }
 
+/**
+ * Compresses frame with the frame or tile API
+ *
+ * @param[in]     s             compress state
+ * @param[in]     state         driver states of the used instance
+ * @param[in]     frame         uncompressed frame
+ * @param         parent        parent module
+ * @return                      compressed video frame, may be NULL if compression failed
+ */
+static shared_ptr<video_frame> compress_frame_sync(struct compress_state_real *s,
+                vector<struct module *> &state, shared_ptr<video_frame> frame,
+                struct module *parent)
+{
+        if (s->funcs->compress_frame_func) {
+                return s->funcs->compress_frame_func(state[0], frame);
+        } else if(s->funcs->compress_tile_func) {
+                return compress_frame_tiles(s, state, frame, parent);
+        } else {
+                assert(!"No egliable compress API found");
+                return {};
+        }
+}
+
 /**
  * @name Tile API Routines
  * The worker callbacks here are optimization - all tiles are processed concurrently.
@@ -370,19 +568,21 @@ static void *compress_tile_callback(void *arg) {
  * Compresses video frame with tiles API
  *
  * @param[in]     s             compress state
+ * @param[in,out] state         driver states of the used instance (one per tile)
  * @param[in]     frame         uncompressed frame
  * @param         parent        parent module (for the case when there is a need to reconfigure)
  * @return                      compressed video frame, may be NULL if compression failed
  */
 static shared_ptr<video_frame> compress_frame_tiles(struct compress_state_real *s,
-                shared_ptr<video_frame> frame, struct module *parent)
+                vector<struct module *> &state, shared_ptr<video_frame> frame,
+                struct module *parent)
 {
-        if(frame->tile_count != s->state.size()) {
-                size_t old_size = s->state.size();
-                s->state.resize(frame->tile_count);
-                for (unsigned int i = old_size; i < s->state.size(); ++i) {
-                        s->state[i] = s->funcs->init_func(parent, s->compress_options.c_str());
-                        if(!s->state[i]) {
+        if(frame->tile_count != state.size()) {
+                size_t old_size = state.size();
+                state.resize(frame->tile_count);
+                for (unsigned int i = old_size; i < state.size(); ++i) {
+                        state[i] = s->funcs->init_func(parent, s->compress_options.c_str());
+                        if(!state[i]) {
                                 fprintf(stderr, "Compression initialization failed\n");
                                 return NULL;
                         }
@@ -393,24 +593,25 @@ static shared_ptr<video_frame> compress_frame_tiles(struct compress_state_real *
         // frame pointer may no longer be valid
         frame = NULL;
 
-        vector<task_result_handle_t> task_handle(separate_tiles.size());
-
         vector <compress_worker_data> data_tile(separate_tiles.size());
         for(unsigned int i = 0; i < separate_tiles.size(); ++i) {
                 struct compress_worker_data *data = &data_tile[i];
-                data->state = s->state[i];
+                data->state = state[i];
                 data->frame = separate_tiles[i];
                 data->callback = s->funcs->compress_tile_func;
-
-                task_handle[i] = task_run_async(compress_tile_callback, data);
         }
 
+        parallel_for(0, separate_tiles.size(), [&data_tile](int start, int end) {
+                        for (int i = start; i < end; ++i) {
+                                compress_tile_callback(&data_tile[i]);
+                        }
+                });
+
         vector<shared_ptr<video_frame>> compressed_tiles(separate_tiles.size(), nullptr);
 
         bool failed = false;
         for(unsigned int i = 0; i < separate_tiles.size(); ++i) {
-                struct compress_worker_data *data = (struct compress_worker_data *)
-                        wait_task(task_handle[i]);
+                struct compress_worker_data *data = &data_tile[i];
 
                 if(!data->ret) {
                         failed = true;
@@ -450,9 +651,16 @@ compress_state_real::~compress_state_real()
         if (funcs->compress_frame_async_push_func) {
                 asynch_consumer_thread.join();
         }
+        if (pipeline_collector_thread.joinable()) {
+                // no-op if the stream has already been poisoned
+                in_flight.push(&collector_exit);
+                pipeline_collector_thread.join();
+        }
 
-        for(unsigned int i = 0; i < state.size(); ++i) {
-                module_done(state[i]);
+        for (auto & state : instances) {
+                for(unsigned int i = 0; i < state.size(); ++i) {
+                        module_done(state[i]);
+                }
         }
 }
 
@@ -460,7 +668,7 @@ namespace {
 void compress_state_real::async_consumer(struct compress_state *s)
 {
         while (true) {
-                auto frame = funcs->compress_frame_async_pop_func(state[0]);
+                auto frame = funcs->compress_frame_async_pop_func(instances[0][0]);
                 if (!discard_frames) {
                         s->queue.push(frame);
                 }
@@ -46,7 +46,7 @@
 
 #include "types.h"
 
-#define VIDEO_COMPRESS_ABI_VERSION 6
+#define VIDEO_COMPRESS_ABI_VERSION 8
 
 #ifdef __cplusplus
 extern "C" {
@@ -154,6 +154,9 @@ struct video_compress_info {
         compress_frame_async_push_t compress_frame_async_push_func; ///< Async API
         compress_frame_async_pop_t compress_frame_async_pop_func; ///< Async API
         std::list<compress_preset> (*get_presets)();    ///< list of available presets
+        /// @returns whether the instance compresses frames independently of each other,
+        /// called after init_func; may be NULL if the module uses inter-frame prediction
+        bool (*is_intra_only)(struct module *state);
 };
 
 std::shared_ptr<video_frame> compress_pop(struct compress_state *);
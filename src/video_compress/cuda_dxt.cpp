@@ -289,7 +289,8 @@ const struct video_compress_info cuda_dxt_info = {
         cuda_dxt_compress_tile,
         NULL,
         NULL,
-        [] { return list<compress_preset>{}; }
+        [] { return list<compress_preset>{}; },
+        [](struct module *) { return true; },
 };
 
 REGISTER_MODULE(cuda_dxt, &cuda_dxt_info, LIBRARY_CLASS_VIDEO_COMPRESS, VIDEO_COMPRESS_ABI_VERSION);
@@ -57,6 +57,7 @@
 #include "utils/worker.h"
 #include "video.h"
 #include "video_compress.h"
+#include "video_compress/libavcodec_conv.h"
 
 #include <map>
 #include <regex>
@@ -73,16 +74,6 @@ extern "C"
 }
 #endif
 
-#ifdef __SSE3__
-#include "pmmintrin.h"
-// compat with older Clang compiler
-#ifndef _mm_bslli_si128
-#define _mm_bslli_si128 _mm_slli_si128
-#endif
-#ifndef _mm_bsrli_si128
-#define _mm_bsrli_si128 _mm_srli_si128
-#endif
-#endif
 
 using namespace std;
 
@@ -233,15 +224,7 @@ struct state_video_compress_libav {
         AVFrame *hwframe;
 };
 
-static void to_yuv420p(AVFrame *out_frame, unsigned char *in_data, int width, int height);
-static void to_yuv422p(AVFrame *out_frame, unsigned char *in_data, int width, int height);
-static void to_yuv444p(AVFrame *out_frame, unsigned char *in_data, int width, int height);
-static void to_nv12(AVFrame *out_frame, unsigned char *in_data, int width, int height);
-static void v210_to_yuv420p10le(AVFrame *out_frame, unsigned char *in_data, int width, int height);
-static void v210_to_yuv422p10le(AVFrame *out_frame, unsigned char *in_data, int width, int height);
-static void v210_to_yuv444p10le(AVFrame *out_frame, unsigned char *in_data, int width, int height);
-typedef void (*pixfmt_callback_t)(AVFrame *out_frame, unsigned char *in_data, int width, int height);
-static pixfmt_callback_t select_pixfmt_callback(AVPixelFormat fmt, codec_t src);
+static lavc_conv_t select_pixfmt_callback(AVPixelFormat fmt, codec_t src);
 
 
 static void usage(void);
@@ -1019,305 +1002,41 @@ static bool configure_with(struct state_video_compress_libav *s, struct video_de
         return true;
 }
 
-static void to_yuv420p(AVFrame *out_frame, unsigned char *in_data, int width, int height)
-{
-        for(int y = 0; y < height; y += 2) {
-                /*  every even row */
-                unsigned char *src = in_data + y * (width * 2);
-                /*  every odd row */
-                unsigned char *src2 = in_data + (y + 1) * (width * 2);
-                unsigned char *dst_y = out_frame->data[0] + out_frame->linesize[0] * y;
-                unsigned char *dst_y2 = out_frame->data[0] + out_frame->linesize[0] * (y + 1);
-                unsigned char *dst_cb = out_frame->data[1] + out_frame->linesize[1] * y / 2;
-                unsigned char *dst_cr = out_frame->data[2] + out_frame->linesize[2] * y / 2;
-                for(int x = 0; x < width / 2; ++x) {
-                        *dst_cb++ = (*src++ + *src2++) / 2;
-                        *dst_y++ = *src++;
-                        *dst_y2++ = *src2++;
-                        *dst_cr++ = (*src++ + *src2++) / 2;
-                        *dst_y++ = *src++;
-                        *dst_y2++ = *src2++;
-                }
-        }
-}
-
-static void to_yuv422p(AVFrame *out_frame, unsigned char *src, int width, int height)
-{
-        for(int y = 0; y < (int) height; ++y) {
-                unsigned char *dst_y = out_frame->data[0] + out_frame->linesize[0] * y;
-                unsigned char *dst_cb = out_frame->data[1] + out_frame->linesize[1] * y;
-                unsigned char *dst_cr = out_frame->data[2] + out_frame->linesize[2] * y;
-                for(int x = 0; x < width; x += 2) {
-                        *dst_cb++ = *src++;
-                        *dst_y++ = *src++;
-                        *dst_cr++ = *src++;
-                        *dst_y++ = *src++;
-                }
-        }
-}
-
-static void to_yuv444p(AVFrame *out_frame, unsigned char *src, int width, int height)
-{
-        for(int y = 0; y < height; ++y) {
-                unsigned char *dst_y = out_frame->data[0] + out_frame->linesize[0] * y;
-                unsigned char *dst_cb = out_frame->data[1] + out_frame->linesize[1] * y;
-                unsigned char *dst_cr = out_frame->data[2] + out_frame->linesize[2] * y;
-                for(int x = 0; x < width; x += 2) {
-                        *dst_cb++ = *src;
-                        *dst_cb++ = *src++;
-                        *dst_y++ = *src++;
-                        *dst_cr++ = *src;
-                        *dst_cr++ = *src++;
-                        *dst_y++ = *src++;
-                }
-        }
-}
-
-static void to_nv12(AVFrame *out_frame, unsigned char *in_data, int width, int height)
-{
-        for(int y = 0; y < height; y += 2) {
-                /*  every even row */
-                unsigned char *src = in_data + y * (width * 2);
-                /*  every odd row */
-                unsigned char *src2 = in_data + (y + 1) * (width * 2);
-                unsigned char *dst_y = out_frame->data[0] + out_frame->linesize[0] * y;
-                unsigned char *dst_y2 = out_frame->data[0] + out_frame->linesize[0] * (y + 1);
-                unsigned char *dst_cbcr = out_frame->data[1] + out_frame->linesize[1] * y / 2;
-
-                int x = 0;
-#ifdef __SSE3__
-                __m128i yuv;
-                __m128i yuv2;
-                __m128i y1;
-                __m128i y2;
-                __m128i y3;
-                __m128i y4;
-                __m128i uv;
-                __m128i uv2;
-                __m128i uv3;
-                __m128i uv4;
-                __m128i ymask = _mm_set1_epi32(0xFF00FF00);
-                __m128i dsty;
-                __m128i dsty2;
-                __m128i dstuv;
-
-                for (; x < (width - 15); x += 16){
-                        yuv = _mm_lddqu_si128((__m128i const*) src);
-                        yuv2 = _mm_lddqu_si128((__m128i const*) src2);
-                        src += 16;
-                        src2 += 16;
-
-                        y1 = _mm_and_si128(ymask, yuv);
-                        y1 = _mm_bsrli_si128(y1, 1);
-                        y2 = _mm_and_si128(ymask, yuv2);
-                        y2 = _mm_bsrli_si128(y2, 1);
-
-                        uv = _mm_andnot_si128(ymask, yuv);
-                        uv2 = _mm_andnot_si128(ymask, yuv2);
-
-                        uv = _mm_avg_epu8(uv, uv2);
-
-                        yuv = _mm_lddqu_si128((__m128i const*) src);
-                        yuv2 = _mm_lddqu_si128((__m128i const*) src2);
-                        src += 16;
-                        src2 += 16;
-
-                        y3 = _mm_and_si128(ymask, yuv);
-                        y3 = _mm_bsrli_si128(y3, 1);
-                        y4 = _mm_and_si128(ymask, yuv2);
-                        y4 = _mm_bsrli_si128(y4, 1);
-
-                        uv3 = _mm_andnot_si128(ymask, yuv);
-                        uv4 = _mm_andnot_si128(ymask, yuv2);
-
-                        uv3 = _mm_avg_epu8(uv3, uv4);
-
-                        dsty = _mm_packus_epi16(y1, y3);
-                        dsty2 = _mm_packus_epi16(y2, y4);
-                        dstuv = _mm_packus_epi16(uv, uv3);
-                        _mm_storeu_si128((__m128i *) dst_y, dsty);
-                        _mm_storeu_si128((__m128i *) dst_y2, dsty2);
-                        _mm_storeu_si128((__m128i *) dst_cbcr, dstuv);
-                        dst_y += 16;
-                        dst_y2 += 16;
-                        dst_cbcr += 16;
-                }
-#endif
-                for(; x < width - 1; x += 2) {
-                        *dst_cbcr++ = (*src++ + *src2++) / 2;
-                        *dst_y++ = *src++;
-                        *dst_y2++ = *src2++;
-                        *dst_cbcr++ = (*src++ + *src2++) / 2;
-                        *dst_y++ = *src++;
-                        *dst_y2++ = *src2++;
-                }
-        }
-}
-
-static void v210_to_yuv420p10le(AVFrame *out_frame, unsigned char *in_data, int width, int height)
-{
-        for(int y = 0; y < height; y += 2) {
-                /*  every even row */
-                uint32_t *src = (uint32_t *) (in_data + y * vc_get_linesize(width, v210));
-                /*  every odd row */
-                uint32_t *src2 = (uint32_t *) (in_data + (y + 1) * vc_get_linesize(width, v210));
-                uint16_t *dst_y = (uint16_t *) (out_frame->data[0] + out_frame->linesize[0] * y);
-                uint16_t *dst_y2 = (uint16_t *) (out_frame->data[0] + out_frame->linesize[0] * (y + 1));
-                uint16_t *dst_cb = (uint16_t *) (out_frame->data[1] + out_frame->linesize[1] * y / 2);
-                uint16_t *dst_cr = (uint16_t *) (out_frame->data[2] + out_frame->linesize[2] * y / 2);
-                for(int x = 0; x < width / 6; ++x) {
-			//block 1, bits  0 -  9: U0+0
-			//block 1, bits 10 - 19: Y0
-			//block 1, bits 20 - 29: V0+1
-			//block 2, bits  0 -  9: Y1
-			//block 2, bits 10 - 19: U2+3
-			//block 2, bits 20 - 29: Y2
-			//block 3, bits  0 -  9: V2+3
-			//block 3, bits 10 - 19: Y3
-			//block 3, bits 20 - 29: U4+5
-			//block 4, bits  0 -  9: Y4
-			//block 4, bits 10 - 19: V4+5
-			//block 4, bits 20 - 29: Y5
-                        uint32_t w0_0, w0_1, w0_2, w0_3;
-                        uint32_t w1_0, w1_1, w1_2, w1_3;
-
-                        w0_0 = *src++;
-                        w0_1 = *src++;
-                        w0_2 = *src++;
-                        w0_3 = *src++;
-                        w1_0 = *src2++;
-                        w1_1 = *src2++;
-                        w1_2 = *src2++;
-                        w1_3 = *src2++;
-
-                        *dst_y++ = (w0_0 >> 10) & 0x3ff;
-                        *dst_y++ = w0_1 & 0x3ff;
-                        *dst_y++ = (w0_1 >> 20) & 0x3ff;
-                        *dst_y++ = (w0_2 >> 10) & 0x3ff;
-                        *dst_y++ = w0_3 & 0x3ff;
-                        *dst_y++ = (w0_3 >> 20) & 0x3ff;
-
-                        *dst_y2++ = (w1_0 >> 10) & 0x3ff;
-                        *dst_y2++ = w1_1 & 0x3ff;
-                        *dst_y2++ = (w1_1 >> 20) & 0x3ff;
-                        *dst_y2++ = (w1_2 >> 10) & 0x3ff;
-                        *dst_y2++ = w1_3 & 0x3ff;
-                        *dst_y2++ = (w1_3 >> 20) & 0x3ff;
-
-                        *dst_cb++ = ((w0_0 & 0x3ff) + (w1_0 & 0x3ff)) / 2;
-                        *dst_cb++ = (((w0_1 >> 10) & 0x3ff) + ((w1_1 >> 10) & 0x3ff)) / 2;
-                        *dst_cb++ = (((w0_2 >> 20) & 0x3ff) + ((w1_2 >> 20) & 0x3ff)) / 2;
-
-                        *dst_cr++ = (((w0_0 >> 20) & 0x3ff) + ((w1_0 >> 20) & 0x3ff)) / 2;
-                        *dst_cr++ = ((w0_2 & 0x3ff) + (w1_2 & 0x3ff)) / 2;
-                        *dst_cr++ = (((w0_3 >> 10) & 0x3ff) + ((w1_3 >> 10) & 0x3ff)) / 2;
-                }
-        }
-}
-
-static void v210_to_yuv422p10le(AVFrame *out_frame, unsigned char *in_data, int width, int height)
-{
-        for(int y = 0; y < height; y += 1) {
-                uint32_t *src = (uint32_t *) (in_data + y * vc_get_linesize(width, v210));
-                uint16_t *dst_y = (uint16_t *) (out_frame->data[0] + out_frame->linesize[0] * y);
-                uint16_t *dst_cb = (uint16_t *) (out_frame->data[1] + out_frame->linesize[1] * y);
-                uint16_t *dst_cr = (uint16_t *) (out_frame->data[2] + out_frame->linesize[2] * y);
-                for(int x = 0; x < width / 6; ++x) {
-                        uint32_t w0_0, w0_1, w0_2, w0_3;
-
-                        w0_0 = *src++;
-                        w0_1 = *src++;
-                        w0_2 = *src++;
-                        w0_3 = *src++;
-
-                        *dst_y++ = (w0_0 >> 10) & 0x3ff;
-                        *dst_y++ = w0_1 & 0x3ff;
-                        *dst_y++ = (w0_1 >> 20) & 0x3ff;
-                        *dst_y++ = (w0_2 >> 10) & 0x3ff;
-                        *dst_y++ = w0_3 & 0x3ff;
-                        *dst_y++ = (w0_3 >> 20) & 0x3ff;
-
-                        *dst_cb++ = w0_0 & 0x3ff;
-                        *dst_cb++ = (w0_1 >> 10) & 0x3ff;
-                        *dst_cb++ = (w0_2 >> 20) & 0x3ff;
-
-                        *dst_cr++ = (w0_0 >> 20) & 0x3ff;
-                        *dst_cr++ = w0_2 & 0x3ff;
-                        *dst_cr++ = (w0_3 >> 10) & 0x3ff;
-                }
-        }
-}
-
-static void v210_to_yuv444p10le(AVFrame *out_frame, unsigned char *in_data, int width, int height)
-{
-        for(int y = 0; y < height; y += 1) {
-                uint32_t *src = (uint32_t *) (in_data + y * vc_get_linesize(width, v210));
-                uint16_t *dst_y = (uint16_t *) (out_frame->data[0] + out_frame->linesize[0] * y);
-                uint16_t *dst_cb = (uint16_t *) (out_frame->data[1] + out_frame->linesize[1] * y);
-                uint16_t *dst_cr = (uint16_t *) (out_frame->data[2] + out_frame->linesize[2] * y);
-                for(int x = 0; x < width / 6; ++x) {
-                        uint32_t w0_0, w0_1, w0_2, w0_3;
-
-                        w0_0 = *src++;
-                        w0_1 = *src++;
-                        w0_2 = *src++;
-                        w0_3 = *src++;
-
-                        *dst_y++ = (w0_0 >> 10) & 0x3ff;
-                        *dst_y++ = w0_1 & 0x3ff;
-                        *dst_y++ = (w0_1 >> 20) & 0x3ff;
-                        *dst_y++ = (w0_2 >> 10) & 0x3ff;
-                        *dst_y++ = w0_3 & 0x3ff;
-                        *dst_y++ = (w0_3 >> 20) & 0x3ff;
-
-                        *dst_cb++ = w0_0 & 0x3ff;
-                        *dst_cb++ = w0_0 & 0x3ff;
-                        *dst_cb++ = (w0_1 >> 10) & 0x3ff;
-                        *dst_cb++ = (w0_1 >> 10) & 0x3ff;
-                        *dst_cb++ = (w0_2 >> 20) & 0x3ff;
-                        *dst_cb++ = (w0_2 >> 20) & 0x3ff;
-
-                        *dst_cr++ = (w0_0 >> 20) & 0x3ff;
-                        *dst_cr++ = (w0_0 >> 20) & 0x3ff;
-                        *dst_cr++ = w0_2 & 0x3ff;
-                        *dst_cr++ = w0_2 & 0x3ff;
-                        *dst_cr++ = (w0_3 >> 10) & 0x3ff;
-                        *dst_cr++ = (w0_3 >> 10) & 0x3ff;
-                }
-        }
-}
-
-static pixfmt_callback_t select_pixfmt_callback(AVPixelFormat fmt, codec_t src) {
+/**
+ * @returns the fastest conversion implementation supported by the CPU
+ */
+static lavc_conv_t select_pixfmt_callback(AVPixelFormat fmt, codec_t src) {
+        enum lavc_conv_id id;
 
         if (src == v210) {
                 if (fmt == AV_PIX_FMT_YUV420P10LE) {
-                        return v210_to_yuv420p10le;
+                        id = V210_TO_YUV420P10LE;
                 } else if (fmt == AV_PIX_FMT_YUV422P10LE) {
-                        return v210_to_yuv422p10le;
+                        id = V210_TO_YUV422P10LE;
                 } else if (fmt == AV_PIX_FMT_YUV444P10LE) {
-                        return v210_to_yuv444p10le;
+                        id = V210_TO_YUV444P10LE;
                 } else {
                         abort();
                 }
-        }
-
-        if (is422_8(fmt)) {
-                return to_yuv422p;
+        } else if (is422_8(fmt)) {
+                id = UYVY_TO_YUV422P;
         } else if (is420_8(fmt)) {
                 if (fmt == AV_PIX_FMT_NV12)
-                        return to_nv12;
+                        id = UYVY_TO_NV12;
                 else
-                        return to_yuv420p;
+                        id = UYVY_TO_YUV420P;
         } else if (is444_8(fmt)) {
-                return to_yuv444p;
+                id = UYVY_TO_YUV444P;
         } else {
                 log_msg(LOG_LEVEL_FATAL, "[lavc] Unknown subsampling.\n");
                 abort();
         }
+
+        return get_lavc_conv(id, get_lavc_conv_preferred_isa(id));
 }
 
 struct my_task_data {
-        void (*callback)(AVFrame *out_frame, unsigned char *in_data, int width, int height);
+        lavc_conv_t callback;
         AVFrame *out_frame;
         unsigned char *in_data;
         int width;
@@ -1328,7 +1047,7 @@ void *my_task(void *arg);
 
 void *my_task(void *arg) {
         struct my_task_data *data = (struct my_task_data *) arg;
-        data->callback(data->out_frame, data->in_data, data->width, data->height);
+        data->callback(data->out_frame->data, data->out_frame->linesize, data->in_data, data->width, data->height);
         return NULL;
 }
 
@@ -1394,7 +1113,6 @@ static shared_ptr<video_frame> libavcodec_compress_tile(struct module *mod, shar
         }
 
         {
-                task_result_handle_t handle[s->params.cpu_count];
                 struct my_task_data data[s->params.cpu_count];
                 for(int i = 0; i < s->params.cpu_count; ++i) {
                         data[i].callback = select_pixfmt_callback(s->selected_pixfmt, s->decoded_codec);
@@ -1412,14 +1130,15 @@ static shared_ptr<video_frame> libavcodec_compress_tile(struct module *mod, shar
                         data[i].width = tx->tiles[0].width;
                         data[i].in_data = decoded + i * height *
                                 vc_get_linesize(tx->tiles[0].width, s->decoded_codec);
-
-                        // run !
-                        handle[i] = task_run_async(my_task, (void *) &data[i]);
                 }
 
-                for(int i = 0; i < s->params.cpu_count; ++i) {
-                        wait_task(handle[i]);
-                }
+                // run !
+                struct my_task_data *task_data = data; // VLA cannot be captured
+                parallel_for(0, s->params.cpu_count, [task_data](int start, int end) {
+                                for (int i = start; i < end; ++i) {
+                                        my_task(&task_data[i]);
+                                }
+                        });
         }
 
         AVFrame *frame = s->in_frame;
@@ -1765,6 +1484,38 @@ static void libavcodec_check_messages(struct state_video_compress_libav *s)
 
 }
 
+/**
+ * Selects the codec the same way as configure_with() does (the encoder is
+ * opened only with the first frame).
+ *
+ * @returns true if the codec is intra-frame only (eg. MJPEG) or GOP size 1
+ *          was requested
+ */
+static bool libavcodec_is_intra_only(struct module *mod)
+{
+        struct state_video_compress_libav *s = (struct state_video_compress_libav *) mod->priv_data;
+        codec_t ug_codec = s->requested_codec_id == VIDEO_CODEC_NONE ? DEFAULT_CODEC : s->requested_codec_id;
+        AVCodecID av_codec = AV_CODEC_ID_NONE;
+
+        if (!s->backend.empty()) {
+                const AVCodec *codec = avcodec_find_encoder_by_name(s->backend.c_str());
+                if (codec) {
+                        av_codec = codec->id;
+                        ug_codec = get_ug_for_av_codec(codec->id);
+                }
+        } else if (codec_params.find(ug_codec) != codec_params.end()) {
+                av_codec = codec_params[ug_codec].av_codec;
+        }
+
+        const AVCodecDescriptor *desc = avcodec_descriptor_get(av_codec);
+        if (desc && (desc->props & AV_CODEC_PROP_INTRA_ONLY)) {
+                return true;
+        }
+        // H.264/HEVC encoders use periodic intra refresh instead of key frames
+        return s->requested_gop == 1 && (s->params.no_periodic_intra ||
+                        (ug_codec != H264 && ug_codec != H265));
+}
+
 const struct video_compress_info libavcodec_info = {
         "libavcodec",
         libavcodec_compress_init,
@@ -1773,6 +1524,7 @@ const struct video_compress_info libavcodec_info = {
         NULL,
         NULL,
         get_libavcodec_presets,
+        libavcodec_is_intra_only,
 };
 
 REGISTER_MODULE(libavcodec, &libavcodec_info, LIBRARY_CLASS_VIDEO_COMPRESS, VIDEO_COMPRESS_ABI_VERSION);
@@ -0,0 +1,737 @@
+/**
+ * @file   video_compress/libavcodec_conv.cpp
+ *
+ * Scalar, SSE4.1 and AVX2 implementations of UYVY and v210 to planar YUV
+ * conversions used by the libavcodec compress module. The implementation is
+ * selected at runtime according to CPU capabilities.
+ */
+/*
+ * Copyright (c) 2019 CESNET z.s.p.o.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, is permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of CESNET nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESSED OR IMPLIED WARRANTIES, INCLUDING,
+ * BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#include "config_unix.h"
+#include "config_win32.h"
+#endif // HAVE_CONFIG_H
+
+#include <stdint.h>
+
+#include "video_compress/libavcodec_conv.h"
+
+#if defined __GNUC__ && (defined __x86_64__ || defined __i386__)
+#define LAVC_CONV_X86 1
+#include <immintrin.h>
+#define TARGET(isa) __attribute__((target(isa)))
+#endif
+
+#define V210_BLOCK_PIXELS 6
+#define V210_BLOCK_BYTES 16
+
+/*
+ * Scalar implementations (reference)
+ */
+static void uyvy_to_yuv420p(unsigned char * const *out_data, const int *out_linesize,
+                const unsigned char *in_data, int width, int height)
+{
+        for(int y = 0; y < height; y += 2) {
+                /*  every even row */
+                const unsigned char *src = in_data + y * (width * 2);
+                /*  every odd row */
+                const unsigned char *src2 = in_data + (y + 1) * (width * 2);
+                unsigned char *dst_y = out_data[0] + out_linesize[0] * y;
+                unsigned char *dst_y2 = out_data[0] + out_linesize[0] * (y + 1);
+                unsigned char *dst_cb = out_data[1] + out_linesize[1] * y / 2;
+                unsigned char *dst_cr = out_data[2] + out_linesize[2] * y / 2;
+                for(int x = 0; x < width / 2; ++x) {
+                        *dst_cb++ = (*src++ + *src2++) / 2;
+                        *dst_y++ = *src++;
+                        *dst_y2++ = *src2++;
+                        *dst_cr++ = (*src++ + *src2++) / 2;
+                        *dst_y++ = *src++;
+                        *dst_y2++ = *src2++;
+                }
+        }
+}
+
+static void uyvy_to_yuv422p(unsigned char * const *out_data, const int *out_linesize,
+                const unsigned char *src, int width, int height)
+{
+        for(int y = 0; y < height; ++y) {
+                unsigned char *dst_y = out_data[0] + out_linesize[0] * y;
+                unsigned char *dst_cb = out_data[1] + out_linesize[1] * y;
+                unsigned char *dst_cr = out_data[2] + out_linesize[2] * y;
+                for(int x = 0; x < width; x += 2) {
+                        *dst_cb++ = *src++;
+                        *dst_y++ = *src++;
+                        *dst_cr++ = *src++;
+                        *dst_y++ = *src++;
+                }
+        }
+}
+
+static void uyvy_to_yuv444p(unsigned char * const *out_data, const int *out_linesize,
+                const unsigned char *src, int width, int height)
+{
+        for(int y = 0; y < height; ++y) {
+                unsigned char *dst_y = out_data[0] + out_linesize[0] * y;
+                unsigned char *dst_cb = out_data[1] + out_linesize[1] * y;
+                unsigned char *dst_cr = out_data[2] + out_linesize[2] * y;
+                for(int x = 0; x < width; x += 2) {
+                        *dst_cb++ = *src;
+                        *dst_cb++ = *src++;
+                        *dst_y++ = *src++;
+                        *dst_cr++ = *src;
+                        *dst_cr++ = *src++;
+                        *dst_y++ = *src++;
+                }
+        }
+}
+
+static void uyvy_to_nv12(unsigned char * const *out_data, const int *out_linesize,
+                const unsigned char *in_data, int width, int height)
+{
+        for(int y = 0; y < height; y += 2) {
+                /*  every even row */
+                const unsigned char *src = in_data + y * (width * 2);
+                /*  every odd row */
+                const unsigned char *src2 = in_data + (y + 1) * (width * 2);
+                unsigned char *dst_y = out_data[0] + out_linesize[0] * y;
+                unsigned char *dst_y2 = out_data[0] + out_linesize[0] * (y + 1);
+                unsigned char *dst_cbcr = out_data[1] + out_linesize[1] * y / 2;
+                for(int x = 0; x < width - 1; x += 2) {
+                        *dst_cbcr++ = (*src++ + *src2++) / 2;
+                        *dst_y++ = *src++;
+                        *dst_y2++ = *src2++;
+                        *dst_cbcr++ = (*src++ + *src2++) / 2;
+                        *dst_y++ = *src++;
+                        *dst_y2++ = *src2++;
+                }
+        }
+}
+
+//block 1, bits  0 -  9: U0+0
+//block 1, bits 10 - 19: Y0
+//block 1, bits 20 - 29: V0+1
+//block 2, bits  0 -  9: Y1
+//block 2, bits 10 - 19: U2+3
+//block 2, bits 20 - 29: Y2
+//block 3, bits  0 -  9: V2+3
+//block 3, bits 10 - 19: Y3
+//block 3, bits 20 - 29: U4+5
+//block 4, bits  0 -  9: Y4
+//block 4, bits 10 - 19: V4+5
+//block 4, bits 20 - 29: Y5
+
+/**
+ * Converts v210 blocks [start_block, end_block) of a line (or a pair of lines
+ * for 4:2:0 if src2 != NULL), chroma is stored chroma_rep times.
+ */
+static inline void v210_blocks_to_planar(const uint32_t *src, const uint32_t *src2,
+                uint16_t *dst_y, uint16_t *dst_y2, uint16_t *dst_cb, uint16_t *dst_cr,
+                int chroma_rep, int start_block, int end_block)
+{
+        src += start_block * 4;
+        dst_y += start_block * V210_BLOCK_PIXELS;
+        dst_cb += start_block * 3 * chroma_rep;
+        dst_cr += start_block * 3 * chroma_rep;
+        if (src2) {
+                src2 += start_block * 4;
+                dst_y2 += start_block * V210_BLOCK_PIXELS;
+        }
+        for (int x = start_block; x < end_block; ++x) {
+                uint32_t w0_0 = *src++;
+                uint32_t w0_1 = *src++;
+                uint32_t w0_2 = *src++;
+                uint32_t w0_3 = *src++;
+
+                *dst_y++ = (w0_0 >> 10) & 0x3ff;
+                *dst_y++ = w0_1 & 0x3ff;
+                *dst_y++ = (w0_1 >> 20) & 0x3ff;
+                *dst_y++ = (w0_2 >> 10) & 0x3ff;
+                *dst_y++ = w0_3 & 0x3ff;
+                *dst_y++ = (w0_3 >> 20) & 0x3ff;
+
+                uint16_t cb[3] = { (uint16_t) (w0_0 & 0x3ff), (uint16_t) ((w0_1 >> 10) & 0x3ff), (uint16_t) ((w0_2 >> 20) & 0x3ff) };
+                uint16_t cr[3] = { (uint16_t) ((w0_0 >> 20) & 0x3ff), (uint16_t) (w0_2 & 0x3ff), (uint16_t) ((w0_3 >> 10) & 0x3ff) };
+
+                if (src2) {
+                        uint32_t w1_0 = *src2++;
+                        uint32_t w1_1 = *src2++;
+                        uint32_t w1_2 = *src2++;
+                        uint32_t w1_3 = *src2++;
+
+                        *dst_y2++ = (w1_0 >> 10) & 0x3ff;
+                        *dst_y2++ = w1_1 & 0x3ff;
+                        *dst_y2++ = (w1_1 >> 20) & 0x3ff;
+                        *dst_y2++ = (w1_2 >> 10) & 0x3ff;
+                        *dst_y2++ = w1_3 & 0x3ff;
+                        *dst_y2++ = (w1_3 >> 20) & 0x3ff;
+
+                        cb[0] = (cb[0] + (w1_0 & 0x3ff)) / 2;
+                        cb[1] = (cb[1] + ((w1_1 >> 10) & 0x3ff)) / 2;
+                        cb[2] = (cb[2] + ((w1_2 >> 20) & 0x3ff)) / 2;
+                        cr[0] = (cr[0] + ((w1_0 >> 20) & 0x3ff)) / 2;
+                        cr[1] = (cr[1] + (w1_2 & 0x3ff)) / 2;
+                        cr[2] = (cr[2] + ((w1_3 >> 10) & 0x3ff)) / 2;
+                }
+
+                for (int i = 0; i < 3; ++i) {
+                        for (int j = 0; j < chroma_rep; ++j) {
+                                *dst_cb++ = cb[i];
+                                *dst_cr++ = cr[i];
+                        }
+                }
+        }
+}
+
+#define V210_LINE(data, y, width) ((const uint32_t *) ((data) + (y) * (((width) + 47) / 48 * 128)))
+#define PLANE16(out_data, out_linesize, plane, y) ((uint16_t *) ((out_data)[plane] + (out_linesize)[plane] * (y)))
+
+static void v210_to_yuv420p10le(unsigned char * const *out_data, const int *out_linesize,
+                const unsigned char *in_data, int width, int height)
+{
+        for(int y = 0; y < height; y += 2) {
+                v210_blocks_to_planar(V210_LINE(in_data, y, width), V210_LINE(in_data, y + 1, width),
+                                PLANE16(out_data, out_linesize, 0, y), PLANE16(out_data, out_linesize, 0, y + 1),
+                                PLANE16(out_data, out_linesize, 1, y / 2), PLANE16(out_data, out_linesize, 2, y / 2),
+                                1, 0, width / V210_BLOCK_PIXELS);
+        }
+}
+
+static void v210_to_yuv422p10le(unsigned char * const *out_data, const int *out_linesize,
+                const unsigned char *in_data, int width, int height)
+{
+        for(int y = 0; y < height; y += 1) {
+                v210_blocks_to_planar(V210_LINE(in_data, y, width), NULL,
+                                PLANE16(out_data, out_linesize, 0, y), NULL,
+                                PLANE16(out_data, out_linesize, 1, y), PLANE16(out_data, out_linesize, 2, y),
+                                1, 0, width / V210_BLOCK_PIXELS);
+        }
+}
+
+static void v210_to_yuv444p10le(unsigned char * const *out_data, const int *out_linesize,
+                const unsigned char *in_data, int width, int height)
+{
+        for(int y = 0; y < height; y += 1) {
+                v210_blocks_to_planar(V210_LINE(in_data, y, width), NULL,
+                                PLANE16(out_data, out_linesize, 0, y), NULL,
+                                PLANE16(out_data, out_linesize, 1, y), PLANE16(out_data, out_linesize, 2, y),
+                                2, 0, width / V210_BLOCK_PIXELS);
+        }
+}
+
+#ifdef LAVC_CONV_X86
+/*
+ * SSE4.1 implementations
+ *
+ * UYVY converters process 16 pixels at once and continue with scalar code
+ * for the rest of the line. v210 converters write whole 16-byte vectors for
+ * every 6-pixel block (so that the next block overwrites the excess), thus
+ * the last block of a line is always converted by the scalar code.
+ */
+
+/// splits 16 UYVY pixels to 16 luma and 8+8 chroma samples (Cb in lower, Cr in upper half)
+TARGET("sse4.1") static inline void uyvy16_split_sse(const unsigned char *src, __m128i *y, __m128i *uv)
+{
+        const __m128i shuf = _mm_setr_epi8(1, 3, 5, 7, 9, 11, 13, 15, 0, 4, 8, 12, 2, 6, 10, 14);
+        __m128i a = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) src), shuf);
+        __m128i b = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (src + 16)), shuf);
+        *y = _mm_unpacklo_epi64(a, b);
+        *uv = _mm_unpackhi_epi32(a, b);
+}
+
+/// (a + b) / 2 rounded down as the scalar code does (_mm_avg_epu8 rounds up)
+TARGET("sse4.1") static inline __m128i avg_floor_epu8_sse(__m128i a, __m128i b)
+{
+        return _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), _mm_set1_epi8(1)));
+}
+
+TARGET("sse4.1") static void uyvy_to_yuv420p_sse41(unsigned char * const *out_data, const int *out_linesize,
+                const unsigned char *in_data, int width, int height)
+{
+        for(int y = 0; y < height; y += 2) {
+                const unsigned char *src = in_data + y * (width * 2);
+                const unsigned char *src2 = in_data + (y + 1) * (width * 2);
+                unsigned char *dst_y = out_data[0] + out_linesize[0] * y;
+                unsigned char *dst_y2 = out_data[0] + out_linesize[0] * (y + 1);
+                unsigned char *dst_cb = out_data[1] + out_linesize[1] * y / 2;
+                unsigned char *dst_cr = out_data[2] + out_linesize[2] * y / 2;
+                int x = 0;
+                for (; x + 16 <= width; x += 16) {
+                        __m128i y1, y2, uv1, uv2;
+                        uyvy16_split_sse(src + 2 * x, &y1, &uv1);
+                        uyvy16_split_sse(src2 + 2 * x, &y2, &uv2);
+                        __m128i uv = avg_floor_epu8_sse(uv1, uv2);
+                        _mm_storeu_si128((__m128i *) (dst_y + x), y1);
+                        _mm_storeu_si128((__m128i *) (dst_y2 + x), y2);
+                        _mm_storel_epi64((__m128i *) (dst_cb + x / 2), uv);
+                        _mm_storel_epi64((__m128i *) (dst_cr + x / 2), _mm_unpackhi_epi64(uv, uv));
+                }
+                for (; x < width - 1; x += 2) {
+                        dst_cb[x / 2] = (src[2 * x] + src2[2 * x]) / 2;
+                        dst_y[x] = src[2 * x + 1];
+                        dst_y2[x] = src2[2 * x + 1];
+                        dst_cr[x / 2] = (src[2 * x + 2] + src2[2 * x + 2]) / 2;
+                        dst_y[x + 1] = src[2 * x + 3];
+                        dst_y2[x + 1] = src2[2 * x + 3];
+                }
+        }
+}
+
+TARGET("sse4.1") static void uyvy_to_yuv422p_sse41(unsigned char * const *out_data, const int *out_linesize,
+                const unsigned char *in_data, int width, int height)
+{
+        for(int y = 0; y < height; ++y) {
+                const unsigned char *src = in_data + y * (width * 2);
+                unsigned char *dst_y = out_data[0] + out_linesize[0] * y;
+                unsigned char *dst_cb = out_data[1] + out_linesize[1] * y;
+                unsigned char *dst_cr = out_data[2] + out_linesize[2] * y;
+                int x = 0;
+                for (; x + 16 <= width; x += 16) {
+                        __m128i luma, uv;
+                        uyvy16_split_sse(src + 2 * x, &luma, &uv);
+                        _mm_storeu_si128((__m128i *) (dst_y + x), luma);
+                        _mm_storel_epi64((__m128i *) (dst_cb + x / 2), uv);
+                        _mm_storel_epi64((__m128i *) (dst_cr + x / 2), _mm_unpackhi_epi64(uv, uv));
+                }
+                for (; x < width; x += 2) {
+                        dst_cb[x / 2] = src[2 * x];
+                        dst_y[x] = src[2 * x + 1];
+                        dst_cr[x / 2] = src[2 * x + 2];
+                        dst_y[x + 1] = src[2 * x + 3];
+                }
+        }
+}
+
+TARGET("sse4.1") static void uyvy_to_yuv444p_sse41(unsigned char * const *out_data, const int *out_linesize,
+                const unsigned char *in_data, int width, int height)
+{
+        for(int y = 0; y < height; ++y) {
+                const unsigned char *src = in_data + y * (width * 2);
+                unsigned char *dst_y = out_data[0] + out_linesize[0] * y;
+                unsigned char *dst_cb = out_data[1] + out_linesize[1] * y;
+                unsigned char *dst_cr = out_data[2] + out_linesize[2] * y;
+                int x = 0;
+                for (; x + 16 <= width; x += 16) {
+                        __m128i luma, uv;
+                        uyvy16_split_sse(src + 2 * x, &luma, &uv);
+                        _mm_storeu_si128((__m128i *) (dst_y + x), luma);
+                        _mm_storeu_si128((__m128i *) (dst_cb + x), _mm_unpacklo_epi8(uv, uv));
+                        _mm_storeu_si128((__m128i *) (dst_cr + x), _mm_unpackhi_epi8(uv, uv));
+                }
+                for (; x < width; x += 2) {
+                        dst_cb[x] = dst_cb[x + 1] = src[2 * x];
+                        dst_y[x] = src[2 * x + 1];
+                        dst_cr[x] = dst_cr[x + 1] = src[2 * x + 2];
+                        dst_y[x + 1] = src[2 * x + 3];
+                }
+        }
+}
+
+TARGET("sse4.1") static void uyvy_to_nv12_sse41(unsigned char * const *out_data, const int *out_linesize,
+                const unsigned char *in_data, int width, int height)
+{
+        const __m128i mask = _mm_set1_epi16(0x00ff);
+        for(int y = 0; y < height; y += 2) {
+                const unsigned char *src = in_data + y * (width * 2);
+                const unsigned char *src2 = in_data + (y + 1) * (width * 2);
+                unsigned char *dst_y = out_data[0] + out_linesize[0] * y;
+                unsigned char *dst_y2 = out_data[0] + out_linesize[0] * (y + 1);
+                unsigned char *dst_cbcr = out_data[1] + out_linesize[1] * y / 2;
+                int x = 0;
+                for (; x + 16 <= width; x += 16) {
+                        __m128i a1 = _mm_loadu_si128((const __m128i *) (src + 2 * x));
+                        __m128i b1 = _mm_loadu_si128((const __m128i *) (src + 2 * x + 16));
+                        __m128i a2 = _mm_loadu_si128((const __m128i *) (src2 + 2 * x));
+                        __m128i b2 = _mm_loadu_si128((const __m128i *) (src2 + 2 * x + 16));
+                        _mm_storeu_si128((__m128i *) (dst_y + x), _mm_packus_epi16(_mm_srli_epi16(a1, 8), _mm_srli_epi16(b1, 8)));
+                        _mm_storeu_si128((__m128i *) (dst_y2 + x), _mm_packus_epi16(_mm_srli_epi16(a2, 8), _mm_srli_epi16(b2, 8)));
+                        __m128i uv1 = _mm_packus_epi16(_mm_and_si128(a1, mask), _mm_and_si128(b1, mask));
+                        __m128i uv2 = _mm_packus_epi16(_mm_and_si128(a2, mask), _mm_and_si128(b2, mask));
+                        _mm_storeu_si128((__m128i *) (dst_cbcr + x), avg_floor_epu8_sse(uv1, uv2));
+                }
+                for (; x < width - 1; x += 2) {
+                        dst_cbcr[x] = (src[2 * x] + src2[2 * x]) / 2;
+                        dst_y[x] = src[2 * x + 1];
+                        dst_y2[x] = src2[2 * x + 1];
+                        dst_cbcr[x + 1] = (src[2 * x + 2] + src2[2 * x + 2]) / 2;
+                        dst_y[x + 1] = src[2 * x + 3];
+                        dst_y2[x + 1] = src2[2 * x + 3];
+                }
+        }
+}
+
+/**
+ * Unpacks v210 block(s) - 6 luma samples to 16-bit words 0-5, Cb to words 0-2
+ * and Cr to words 4-6 of uv (for each 128-bit lane).
+ */
+#define V210_UNPACK(vec, pfx, sfx, w, luma, uv) do { \
+        const vec mask = pfx##_set1_epi32(0x3ff); \
+        vec a = pfx##_and_##sfx(w, mask); \
+        vec b = pfx##_and_##sfx(pfx##_srli_epi32(w, 10), mask); \
+        vec c = pfx##_and_##sfx(pfx##_srli_epi32(w, 20), mask); \
+        vec p0 = pfx##_packus_epi32(a, b); /* a0 a1 a2 a3 b0 b1 b2 b3 */ \
+        vec p1 = pfx##_packus_epi32(c, c); /* c0 c1 c2 c3 c0 c1 c2 c3 */ \
+        luma = pfx##_or_##sfx(pfx##_shuffle_epi8(p0, V210_SHUF(8, 9, 2, 3, -1, -1, 12, 13, 6, 7, -1, -1, -1, -1, -1, -1)), \
+                        pfx##_shuffle_epi8(p1, V210_SHUF(-1, -1, -1, -1, 2, 3, -1, -1, -1, -1, 6, 7, -1, -1, -1, -1))); \
+        uv = pfx##_or_##sfx(pfx##_shuffle_epi8(p0, V210_SHUF(0, 1, 10, 11, -1, -1, -1, -1, -1, -1, 4, 5, 14, 15, -1, -1)), \
+                        pfx##_shuffle_epi8(p1, V210_SHUF(-1, -1, -1, -1, 4, 5, -1, -1, 0, 1, -1, -1, -1, -1, -1, -1))); \
+} while(0)
+
+/// stores unpacked v210 block - 6 Y, 3 Cb and 3 Cr samples (chroma_rep times), writes past them
+TARGET("sse4.1") static inline void v210_store_block_sse(__m128i luma, __m128i uv, uint16_t *dst_y,
+                uint16_t *dst_cb, uint16_t *dst_cr, int chroma_rep)
+{
+        _mm_storeu_si128((__m128i *) dst_y, luma);
+        if (chroma_rep == 1) {
+                _mm_storel_epi64((__m128i *) dst_cb, uv);
+                _mm_storel_epi64((__m128i *) dst_cr, _mm_unpackhi_epi64(uv, uv));
+        } else {
+                _mm_storeu_si128((__m128i *) dst_cb, _mm_unpacklo_epi16(uv, uv));
+                _mm_storeu_si128((__m128i *) dst_cr, _mm_unpackhi_epi16(uv, uv));
+        }
+}
+
+#define V210_SHUF _mm_setr_epi8
+TARGET("sse4.1") static void v210_to_planar_sse41(unsigned char * const *out_data, const int *out_linesize,
+                const unsigned char *in_data, int width, int height, bool subsample_vertically, int chroma_rep)
+{
+        int blocks = width / V210_BLOCK_PIXELS;
+        for(int y = 0; y < height; y += subsample_vertically ? 2 : 1) {
+                const uint32_t *src = V210_LINE(in_data, y, width);
+                const uint32_t *src2 = subsample_vertically ? V210_LINE(in_data, y + 1, width) : NULL;
+                uint16_t *dst_y = PLANE16(out_data, out_linesize, 0, y);
+                uint16_t *dst_y2 = subsample_vertically ? PLANE16(out_data, out_linesize, 0, y + 1) : NULL;
+                int chroma_y = subsample_vertically ? y / 2 : y;
+                uint16_t *dst_cb = PLANE16(out_data, out_linesize, 1, chroma_y);
+                uint16_t *dst_cr = PLANE16(out_data, out_linesize, 2, chroma_y);
+                int x = 0;
+                for (; x + 1 < blocks; ++x) {
+                        __m128i luma, uv;
+                        V210_UNPACK(__m128i, _mm, si128, _mm_loadu_si128((const __m128i *) (src + 4 * x)), luma, uv);
+                        if (src2) {
+                                __m128i luma2, uv2;
+                                V210_UNPACK(__m128i, _mm, si128, _mm_loadu_si128((const __m128i *) (src2 + 4 * x)), luma2, uv2);
+                                _mm_storeu_si128((__m128i *) (dst_y2 + x * V210_BLOCK_PIXELS), luma2);
+                                uv = _mm_srli_epi16(_mm_add_epi16(uv, uv2), 1);
+                        }
+                        v210_store_block_sse(luma, uv, dst_y + x * V210_BLOCK_PIXELS,
+                                        dst_cb + x * 3 * chroma_rep, dst_cr + x * 3 * chroma_rep, chroma_rep);
+                }
+                v210_blocks_to_planar(src, src2, dst_y, dst_y2, dst_cb, dst_cr, chroma_rep, x, blocks);
+        }
+}
+#undef V210_SHUF
+
+TARGET("sse4.1") static void v210_to_yuv420p10le_sse41(unsigned char * const *out_data, const int *out_linesize,
+                const unsigned char *in_data, int width, int height)
+{
+        v210_to_planar_sse41(out_data, out_linesize, in_data, width, height, true, 1);
+}
+
+TARGET("sse4.1") static void v210_to_yuv422p10le_sse41(unsigned char * const *out_data, const int *out_linesize,
+                const unsigned char *in_data, int width, int height)
+{
+        v210_to_planar_sse41(out_data, out_linesize, in_data, width, height, false, 1);
+}
+
+TARGET("sse4.1") static void v210_to_yuv444p10le_sse41(unsigned char * const *out_data, const int *out_linesize,
+                const unsigned char *in_data, int width, int height)
+{
+        v210_to_planar_sse41(out_data, out_linesize, in_data, width, height, false, 2);
+}
+
+/*
+ * AVX2 implementations - 32 UYVY pixels or 2 v210 blocks at once
+ */
+
+/// splits 32 UYVY pixels to 32 luma and 16+16 chroma samples (Cb in lower, Cr in upper lane)
+TARGET("avx2") static inline void uyvy32_split_avx2(const unsigned char *src, __m256i *y, __m256i *uv)
+{
+        const __m256i shuf = _mm256_setr_epi8(1, 3, 5, 7, 9, 11, 13, 15, 0, 4, 8, 12, 2, 6, 10, 14,
+                        1, 3, 5, 7, 9, 11, 13, 15, 0, 4, 8, 12, 2, 6, 10, 14);
+        __m256i a = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *) src), shuf);
+        __m256i b = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *) (src + 32)), shuf);
+        *y = _mm256_permute4x64_epi64(_mm256_unpacklo_epi64(a, b), 0xD8);
+        *uv = _mm256_permutevar8x32_epi32(_mm256_unpackhi_epi32(a, b), _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+}
+
+TARGET("avx2") static inline __m256i avg_floor_epu8_avx2(__m256i a, __m256i b)
+{
+        return _mm256_sub_epi8(_mm256_avg_epu8(a, b), _mm256_and_si256(_mm256_xor_si256(a, b), _mm256_set1_epi8(1)));
+}
+
+TARGET("avx2") static void uyvy_to_yuv420p_avx2(unsigned char * const *out_data, const int *out_linesize,
+                const unsigned char *in_data, int width, int height)
+{
+        for(int y = 0; y < height; y += 2) {
+                const unsigned char *src = in_data + y * (width * 2);
+                const unsigned char *src2 = in_data + (y + 1) * (width * 2);
+                unsigned char *dst_y = out_data[0] + out_linesize[0] * y;
+                unsigned char *dst_y2 = out_data[0] + out_linesize[0] * (y + 1);
+                unsigned char *dst_cb = out_data[1] + out_linesize[1] * y / 2;
+                unsigned char *dst_cr = out_data[2] + out_linesize[2] * y / 2;
+                int x = 0;
+                for (; x + 32 <= width; x += 32) {
+                        __m256i y1, y2, uv1, uv2;
+                        uyvy32_split_avx2(src + 2 * x, &y1, &uv1);
+                        uyvy32_split_avx2(src2 + 2 * x, &y2, &uv2);
+                        __m256i uv = avg_floor_epu8_avx2(uv1, uv2);
+                        _mm256_storeu_si256((__m256i *) (dst_y + x), y1);
+                        _mm256_storeu_si256((__m256i *) (dst_y2 + x), y2);
+                        _mm_storeu_si128((__m128i *) (dst_cb + x / 2), _mm256_castsi256_si128(uv));
+                        _mm_storeu_si128((__m128i *) (dst_cr + x / 2), _mm256_extracti128_si256(uv, 1));
+                }
+                for (; x < width - 1; x += 2) {
+                        dst_cb[x / 2] = (src[2 * x] + src2[2 * x]) / 2;
+                        dst_y[x] = src[2 * x + 1];
+                        dst_y2[x] = src2[2 * x + 1];
+                        dst_cr[x / 2] = (src[2 * x + 2] + src2[2 * x + 2]) / 2;
+                        dst_y[x + 1] = src[2 * x + 3];
+                        dst_y2[x + 1] = src2[2 * x + 3];
+                }
+        }
+}
+
+TARGET("avx2") static void uyvy_to_yuv422p_avx2(unsigned char * const *out_data, const int *out_linesize,
+                const unsigned char *in_data, int width, int height)
+{
+        for(int y = 0; y < height; ++y) {
+                const unsigned char *src = in_data + y * (width * 2);
+                unsigned char *dst_y = out_data[0] + out_linesize[0] * y;
+                unsigned char *dst_cb = out_data[1] + out_linesize[1] * y;
+                unsigned char *dst_cr = out_data[2] + out_linesize[2] * y;
+                int x = 0;
+                for (; x + 32 <= width; x += 32) {
+                        __m256i luma, uv;
+                        uyvy32_split_avx2(src + 2 * x, &luma, &uv);
+                        _mm256_storeu_si256((__m256i *) (dst_y + x), luma);
+                        _mm_storeu_si128((__m128i *) (dst_cb + x / 2), _mm256_castsi256_si128(uv));
+                        _mm_storeu_si128((__m128i *) (dst_cr + x / 2), _mm256_extracti128_si256(uv, 1));
+                }
+                for (; x < width; x += 2) {
+                        dst_cb[x / 2] = src[2 * x];
+                        dst_y[x] = src[2 * x + 1];
+                        dst_cr[x / 2] = src[2 * x + 2];
+                        dst_y[x + 1] = src[2 * x + 3];
+                }
+        }
+}
+
+TARGET("avx2") static void uyvy_to_yuv444p_avx2(unsigned char * const *out_data, const int *out_linesize,
+                const unsigned char *in_data, int width, int height)
+{
+        for(int y = 0; y < height; ++y) {
+                const unsigned char *src = in_data + y * (width * 2);
+                unsigned char *dst_y = out_data[0] + out_linesize[0] * y;
+                unsigned char *dst_cb = out_data[1] + out_linesize[1] * y;
+                unsigned char *dst_cr = out_data[2] + out_linesize[2] * y;
+                int x = 0;
+                for (; x + 32 <= width; x += 32) {
+                        __m256i luma, uv;
+                        uyvy32_split_avx2(src + 2 * x, &luma, &uv);
+                        __m256i cb = _mm256_cvtepu8_epi16(_mm256_castsi256_si128(uv));
+                        __m256i cr = _mm256_cvtepu8_epi16(_mm256_extracti128_si256(uv, 1));
+                        _mm256_storeu_si256((__m256i *) (dst_y + x), luma);
+                        _mm256_storeu_si256((__m256i *) (dst_cb + x), _mm256_or_si256(cb, _mm256_slli_epi16(cb, 8)));
+                        _mm256_storeu_si256((__m256i *) (dst_cr + x), _mm256_or_si256(cr, _mm256_slli_epi16(cr, 8)));
+                }
+                for (; x < width; x += 2) {
+                        dst_cb[x] = dst_cb[x + 1] = src[2 * x];
+                        dst_y[x] = src[2 * x + 1];
+                        dst_cr[x] = dst_cr[x + 1] = src[2 * x + 2];
+                        dst_y[x + 1] = src[2 * x + 3];
+                }
+        }
+}
+
+TARGET("avx2") static void uyvy_to_nv12_avx2(unsigned char * const *out_data, const int *out_linesize,
+                const unsigned char *in_data, int width, int height)
+{
+        const __m256i mask = _mm256_set1_epi16(0x00ff);
+        for(int y = 0; y < height; y += 2) {
+                const unsigned char *src = in_data + y * (width * 2);
+                const unsigned char *src2 = in_data + (y + 1) * (width * 2);
+                unsigned char *dst_y = out_data[0] + out_linesize[0] * y;
+                unsigned char *dst_y2 = out_data[0] + out_linesize[0] * (y + 1);
+                unsigned char *dst_cbcr = out_data[1] + out_linesize[1] * y / 2;
+                int x = 0;
+                for (; x + 32 <= width; x += 32) {
+                        __m256i a1 = _mm256_loadu_si256((const __m256i *) (src + 2 * x));
+                        __m256i b1 = _mm256_loadu_si256((const __m256i *) (src + 2 * x + 32));
+                        __m256i a2 = _mm256_loadu_si256((const __m256i *) (src2 + 2 * x));
+                        __m256i b2 = _mm256_loadu_si256((const __m256i *) (src2 + 2 * x + 32));
+                        __m256i y1 = _mm256_packus_epi16(_mm256_srli_epi16(a1, 8), _mm256_srli_epi16(b1, 8));
+                        __m256i y2 = _mm256_packus_epi16(_mm256_srli_epi16(a2, 8), _mm256_srli_epi16(b2, 8));
+                        __m256i uv1 = _mm256_packus_epi16(_mm256_and_si256(a1, mask), _mm256_and_si256(b1, mask));
+                        __m256i uv2 = _mm256_packus_epi16(_mm256_and_si256(a2, mask), _mm256_and_si256(b2, mask));
+                        _mm256_storeu_si256((__m256i *) (dst_y + x), _mm256_permute4x64_epi64(y1, 0xD8));
+                        _mm256_storeu_si256((__m256i *) (dst_y2 + x), _mm256_permute4x64_epi64(y2, 0xD8));
+                        _mm256_storeu_si256((__m256i *) (dst_cbcr + x),
+                                        _mm256_permute4x64_epi64(avg_floor_epu8_avx2(uv1, uv2), 0xD8));
+                }
+                for (; x < width - 1; x += 2) {
+                        dst_cbcr[x] = (src[2 * x] + src2[2 * x]) / 2;
+                        dst_y[x] = src[2 * x + 1];
+                        dst_y2[x] = src2[2 * x + 1];
+                        dst_cbcr[x + 1] = (src[2 * x + 2] + src2[2 * x + 2]) / 2;
+                        dst_y[x + 1] = src[2 * x + 3];
+                        dst_y2[x + 1] = src2[2 * x + 3];
+                }
+        }
+}
+
+#define V210_SHUF(...) _mm256_setr_epi8(__VA_ARGS__, __VA_ARGS__)
+TARGET("avx2") static void v210_to_planar_avx2(unsigned char * const *out_data, const int *out_linesize,
+                const unsigned char *in_data, int width, int height, bool subsample_vertically, int chroma_rep)
+{
+        int blocks = width / V210_BLOCK_PIXELS;
+        for(int y = 0; y < height; y += subsample_vertically ? 2 : 1) {
+                const uint32_t *src = V210_LINE(in_data, y, width);
+                const uint32_t *src2 = subsample_vertically ? V210_LINE(in_data, y + 1, width) : NULL;
+                uint16_t *dst_y = PLANE16(out_data, out_linesize, 0, y);
+                uint16_t *dst_y2 = subsample_vertically ? PLANE16(out_data, out_linesize, 0, y + 1) : NULL;
+                int chroma_y = subsample_vertically ? y / 2 : y;
+                uint16_t *dst_cb = PLANE16(out_data, out_linesize, 1, chroma_y);
+                uint16_t *dst_cr = PLANE16(out_data, out_linesize, 2, chroma_y);
+                int x = 0;
+                for (; x + 2 < blocks; x += 2) {
+                        __m256i luma, uv;
+                        V210_UNPACK(__m256i, _mm256, si256, _mm256_loadu_si256((const __m256i *) (src + 4 * x)), luma, uv);
+                        if (src2) {
+                                __m256i luma2, uv2;
+                                V210_UNPACK(__m256i, _mm256, si256, _mm256_loadu_si256((const __m256i *) (src2 + 4 * x)), luma2, uv2);
+                                _mm_storeu_si128((__m128i *) (dst_y2 + x * V210_BLOCK_PIXELS), _mm256_castsi256_si128(luma2));
+                                _mm_storeu_si128((__m128i *) (dst_y2 + (x + 1) * V210_BLOCK_PIXELS), _mm256_extracti128_si256(luma2, 1));
+                                uv = _mm256_srli_epi16(_mm256_add_epi16(uv, uv2), 1);
+                        }
+                        v210_store_block_sse(_mm256_castsi256_si128(luma), _mm256_castsi256_si128(uv),
+                                        dst_y + x * V210_BLOCK_PIXELS,
+                                        dst_cb + x * 3 * chroma_rep, dst_cr + x * 3 * chroma_rep, chroma_rep);
+                        v210_store_block_sse(_mm256_extracti128_si256(luma, 1), _mm256_extracti128_si256(uv, 1),
+                                        dst_y + (x + 1) * V210_BLOCK_PIXELS,
+                                        dst_cb + (x + 1) * 3 * chroma_rep, dst_cr + (x + 1) * 3 * chroma_rep, chroma_rep);
+                }
+                v210_blocks_to_planar(src, src2, dst_y, dst_y2, dst_cb, dst_cr, chroma_rep, x, blocks);
+        }
+}
+#undef V210_SHUF
+
+TARGET("avx2") static void v210_to_yuv420p10le_avx2(unsigned char * const *out_data, const int *out_linesize,
+                const unsigned char *in_data, int width, int height)
+{
+        v210_to_planar_avx2(out_data, out_linesize, in_data, width, height, true, 1);
+}
+
+TARGET("avx2") static void v210_to_yuv422p10le_avx2(unsigned char * const *out_data, const int *out_linesize,
+                const unsigned char *in_data, int width, int height)
+{
+        v210_to_planar_avx2(out_data, out_linesize, in_data, width, height, false, 1);
+}
+
+TARGET("avx2") static void v210_to_yuv444p10le_avx2(unsigned char * const *out_data, const int *out_linesize,
+                const unsigned char *in_data, int width, int height)
+{
+        v210_to_planar_avx2(out_data, out_linesize, in_data, width, height, false, 2);
+}
+#endif // defined LAVC_CONV_X86
+
+/**
+ * The preferred ISA is chosen per converter according to tools/lavc_conv_bench
+ * (3840x2160, single core). The kernels are mostly store-bound and AVX2 is
+ * used only where it was not slower than SSE4.1 on any of the measured
+ * machines.
+ */
+static const struct {
+        const char *name;
+        enum lavc_conv_isa preferred_isa;
+        lavc_conv_t scalar;
+#ifdef LAVC_CONV_X86
+        lavc_conv_t sse41;
+        lavc_conv_t avx2;
+#endif
+} lavc_convs[] = {
+#ifdef LAVC_CONV_X86
+#define CONV(name, isa, fn) { name, isa, fn, fn##_sse41, fn##_avx2 }
+#else
+#define CONV(name, isa, fn) { name, isa, fn }
+#endif
+        CONV("UYVY->yuv420p", LAVC_CONV_SSE41, uyvy_to_yuv420p),
+        CONV("UYVY->yuv422p", LAVC_CONV_AVX2, uyvy_to_yuv422p),
+        CONV("UYVY->yuv444p", LAVC_CONV_AVX2, uyvy_to_yuv444p),
+        CONV("UYVY->nv12", LAVC_CONV_SSE41, uyvy_to_nv12),
+        CONV("v210->yuv420p10le", LAVC_CONV_SSE41, v210_to_yuv420p10le),
+        CONV("v210->yuv422p10le", LAVC_CONV_SSE41, v210_to_yuv422p10le),
+        CONV("v210->yuv444p10le", LAVC_CONV_SSE41, v210_to_yuv444p10le),
+#undef CONV
+};
+
+enum lavc_conv_isa get_lavc_conv_isa(enum lavc_conv_isa max_isa)
+{
+#ifdef LAVC_CONV_X86
+        if (max_isa >= LAVC_CONV_AVX2 && __builtin_cpu_supports("avx2")) {
+                return LAVC_CONV_AVX2;
+        }
+        if (max_isa >= LAVC_CONV_SSE41 && __builtin_cpu_supports("sse4.1")) {
+                return LAVC_CONV_SSE41;
+        }
+#else
+        (void) max_isa;
+#endif
+        return LAVC_CONV_SCALAR;
+}
+
+lavc_conv_t get_lavc_conv(enum lavc_conv_id id, enum lavc_conv_isa max_isa)
+{
+        switch (get_lavc_conv_isa(max_isa)) {
+#ifdef LAVC_CONV_X86
+        case LAVC_CONV_AVX2:
+                return lavc_convs[id].avx2;
+        case LAVC_CONV_SSE41:
+                return lavc_convs[id].sse41;
+#endif
+        default:
+                return lavc_convs[id].scalar;
+        }
+}
+
+enum lavc_conv_isa get_lavc_conv_preferred_isa(enum lavc_conv_id id)
+{
+        return get_lavc_conv_isa(lavc_convs[id].preferred_isa);
+}
+
+const char *get_lavc_conv_name(enum lavc_conv_id id)
+{
+        return lavc_convs[id].name;
+}
+
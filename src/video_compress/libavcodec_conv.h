@@ -0,0 +1,97 @@
+/**
+ * @file   video_compress/libavcodec_conv.h
+ *
+ * SIMD-accelerated conversions of UltraGrid pixel formats to libavcodec
+ * planar input formats.
+ */
+/*
+ * Copyright (c) 2019 CESNET z.s.p.o.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, is permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of CESNET nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESSED OR IMPLIED WARRANTIES, INCLUDING,
+ * BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef LIBAVCODEC_CONV_H_
+#define LIBAVCODEC_CONV_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Conversions from UltraGrid packed pixel formats to the planar formats
+ * accepted by libavcodec encoders.
+ */
+enum lavc_conv_id {
+        UYVY_TO_YUV420P,
+        UYVY_TO_YUV422P,
+        UYVY_TO_YUV444P,
+        UYVY_TO_NV12,
+        V210_TO_YUV420P10LE,
+        V210_TO_YUV422P10LE,
+        V210_TO_YUV444P10LE,
+        LAVC_CONV_COUNT
+};
+
+/// instruction set of the conversion implementation
+enum lavc_conv_isa {
+        LAVC_CONV_SCALAR,
+        LAVC_CONV_SSE41,
+        LAVC_CONV_AVX2,
+};
+
+/**
+ * @param out_data     output planes (AVFrame::data)
+ * @param out_linesize output linesizes (AVFrame::linesize)
+ * @param in_data      input lines, linesize is vc_get_linesize(width, codec)
+ * @param height       number of lines, must be even for 4:2:0 formats
+ */
+typedef void (*lavc_conv_t)(unsigned char * const *out_data, const int *out_linesize,
+                const unsigned char *in_data, int width, int height);
+
+/**
+ * Returns the fastest implementation supported by the CPU that doesn't use
+ * newer instruction set than max_isa. All implementations give bit-exact
+ * results.
+ */
+lavc_conv_t get_lavc_conv(enum lavc_conv_id id, enum lavc_conv_isa max_isa);
+/// @returns instruction set of the implementation returned by get_lavc_conv()
+enum lavc_conv_isa get_lavc_conv_isa(enum lavc_conv_isa max_isa);
+/**
+ * @returns instruction set that performed best for the conversion and is
+ * supported by the CPU, to be passed to get_lavc_conv() as max_isa
+ */
+enum lavc_conv_isa get_lavc_conv_preferred_isa(enum lavc_conv_id id);
+const char *get_lavc_conv_name(enum lavc_conv_id id);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LIBAVCODEC_CONV_H_
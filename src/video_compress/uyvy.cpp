@@ -124,7 +124,7 @@ struct state_video_compress_uyvy {
 
         int gl_format;
 
-        video_frame_pool<default_data_allocator> *pool;
+        lockfree_video_frame_pool<hugepage_data_allocator> *pool;
 };
 
 int uyvy_configure_with(struct state_video_compress_uyvy *s, struct video_frame *tx);
@@ -156,7 +156,7 @@ struct module * uyvy_compress_init(struct module *parent, const char *)
 
         gl_context_make_current(NULL);
 
-        s->pool = new video_frame_pool<default_data_allocator>();
+        s->pool = new lockfree_video_frame_pool<hugepage_data_allocator>();
 
         module_init_default(&s->module_data);
         s->module_data.cls = MODULE_CLASS_DATA;
@@ -306,7 +306,8 @@ const struct video_compress_info uyvy_info = {
         NULL,
         NULL,
         NULL,
-        [] {return list<compress_preset>{}; }
+        [] {return list<compress_preset>{}; },
+        [](struct module *) { return true; },
 };
 
 REGISTER_MODULE(uyvy, &uyvy_info, LIBRARY_CLASS_VIDEO_COMPRESS, VIDEO_COMPRESS_ABI_VERSION);
@@ -394,6 +394,8 @@ int display_get_property(struct display *d, int property, void *val, size_t *len
                         *(int *) val = PITCH_DEFAULT;
                         *len = sizeof(int);
                         return TRUE;
+                case DISPLAY_PROPERTY_ACCEPTS_EXTERNAL_FRAMES: // frames are passed to postprocessor
+                        return FALSE;
 		case DISPLAY_PROPERTY_CODECS:
 			{
                                 codec_t display_codecs[20], pp_codecs[20];
@@ -77,12 +77,15 @@ static struct video_frame *display_dummy_getf(void *state)
         return ((dummy_display_state *) state)->f;
 }
 
-static int display_dummy_putf(void *state, struct video_frame * /* frame */, int flags)
+static int display_dummy_putf(void *state, struct video_frame *frame, int flags)
 {
+        auto s = (dummy_display_state *) state;
+        if (frame != s->f) { // external frame
+                vf_free(frame);
+        }
         if (flags == PUTF_DISCARD) {
                 return 0;
         }
-        auto s = (dummy_display_state *) state;
         auto curr_time = steady_clock::now();
         s->frames += 1;
         double seconds = duration_cast<duration<double>>(curr_time - s->t0).count();
@@ -111,6 +114,13 @@ static int display_dummy_get_property(void *, int property, void *val, size_t *l
                         
                         *len = sizeof(codecs);
                         break;
+                case DISPLAY_PROPERTY_ACCEPTS_EXTERNAL_FRAMES:
+                        if (sizeof(int) > *len) {
+                                return FALSE;
+                        }
+                        *(int *) val = TRUE;
+                        *len = sizeof(int);
+                        break;
                 default:
                         return FALSE;
         }
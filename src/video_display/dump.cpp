@@ -117,6 +117,9 @@ static int display_dump_putf(void *state, struct video_frame *frame, int)
         if (frame) {
                 export_video(s->e, frame);
         }
+        if (frame != s->f) { // external frame
+                vf_free(frame);
+        }
 
         return 0;
 }
@@ -139,9 +142,19 @@ static int display_dump_get_property(void *, int property, void *val, size_t *le
                         }
                         break;
                 case DISPLAY_PROPERTY_VIDEO_MODE:
+                        if (sizeof(int) > *len) {
+                                return FALSE;
+                        }
                         *(int *) val = DISPLAY_PROPERTY_VIDEO_SEPARATE_TILES;
                         *len = sizeof(int);
                         break;
+                case DISPLAY_PROPERTY_ACCEPTS_EXTERNAL_FRAMES:
+                        if (sizeof(int) > *len) {
+                                return FALSE;
+                        }
+                        *(int *) val = TRUE;
+                        *len = sizeof(int);
+                        break;
                 default:
                         return FALSE;
         }
@@ -40,52 +40,67 @@
 #include "config_unix.h"
 #include "config_win32.h"
 #include "debug.h"
+#include "host.h"
 #include "lib_common.h"
 #include "video.h"
 #include "video_display.h"
 
+#include <algorithm>
 #include <condition_variable>
 #include <chrono>
-#include <list>
-#include <map>
-#include <vector>
+#include <deque>
 #include <memory>
 #include <mutex>
-#include <queue>
+#include <string>
 #include <thread>
-#include <unordered_map>
+#include <vector>
 
 using namespace std;
+using namespace std::chrono;
 
-static constexpr int BUFFER_LEN = 5;
-static constexpr unsigned int IN_QUEUE_MAX_BUFFER_LEN = 5;
+static constexpr unsigned int DEFAULT_SINK_QUEUE_LEN = 2;
 static constexpr int SKIP_FIRST_N_FRAMES_IN_STREAM = 5;
+static constexpr seconds STATS_INTERVAL(5);
+
+struct queued_frame {
+        shared_ptr<struct video_frame> frame; ///< nullptr means end of stream
+        steady_clock::time_point enqueued;
+};
 
+/**
+ * Each display is fed by its own thread from a bounded queue so that a slow
+ * display doesn't hold the others. Displays accepting external frames
+ * (@ref DISPLAY_PROPERTY_ACCEPTS_EXTERNAL_FRAMES) get a view of the shared
+ * frame, the others get a copy in their own framebuffer.
+ */
 struct sub_display {
         struct display *real_display;
+        string name;
+        bool zero_copy;
         thread disp_thread;
+        thread feeder_thread;
+
+        mutex lock;
+        condition_variable cv;
+        deque<queued_frame> queue;
+        unsigned long dropped = 0; ///< protected by lock
 };
 
 struct state_multiplier_common {
         ~state_multiplier_common() {
 
                 for(auto& disp : displays){
-                        display_done(disp.real_display);
+                        display_done(disp->real_display);
                 }
         }
 
-        std::vector<struct sub_display> displays;
-
-        struct video_desc display_desc;
-
-        queue<struct video_frame *> incoming_queue;
-        condition_variable in_queue_decremented_cv;
+        std::vector<unique_ptr<struct sub_display>> displays;
+        unsigned int queue_len = DEFAULT_SINK_QUEUE_LEN;
 
         mutex lock;
-        condition_variable cv;
+        int skipped = 0;
 
         struct module *parent;
-        thread worker_thread;
 };
 
 struct state_multiplier {
@@ -93,6 +108,10 @@ struct state_multiplier {
         struct video_desc desc;
 };
 
+ADD_TO_PARAM(multiplier_queue, "multiplier-queue",
+                "* multiplier-queue=<n>\n"
+                "  Number of frames queued for each multiplier display, the oldest is dropped when full (default 2)\n");
+
 static void show_help(){
         printf("Multiplier display\n");
         printf("Usage:\n");
@@ -128,11 +147,13 @@ static void *display_multiplier_init(struct module *parent, const char *fmt, uns
                 return &display_init_noerr;
         }
         s->common = shared_ptr<state_multiplier_common>(new state_multiplier_common());
-
-        struct sub_display disp;
+        if (get_commandline_param("multiplier-queue")) {
+                s->common->queue_len = max(atoi(get_commandline_param("multiplier-queue")), 1);
+        }
 
         char *saveptr;
         for(char *token = strtok_r(fmt_copy, "#", &saveptr); token; token = strtok_r(NULL, "#", &saveptr)){
+                unique_ptr<struct sub_display> disp(new sub_display());
                 requested_display = token;
                 printf("%s\n", token);
                 cfg = NULL;
@@ -141,10 +162,17 @@ static void *display_multiplier_init(struct module *parent, const char *fmt, uns
                         *delim = '\0';
                         cfg = delim + 1;
                 }
-                if (initialize_video_display(parent, requested_display, cfg, flags, NULL, &disp.real_display) != 0) {
+                if (initialize_video_display(parent, requested_display, cfg, flags, NULL, &disp->real_display) != 0) {
                         LOG(LOG_LEVEL_FATAL) << "[multiplier] Unable to initialize a display " << requested_display << "!\n";
                         abort();
                 }
+                disp->name = requested_display;
+                int accepts_external = FALSE;
+                size_t len = sizeof accepts_external;
+                disp->zero_copy = display_get_property(disp->real_display, DISPLAY_PROPERTY_ACCEPTS_EXTERNAL_FRAMES,
+                                &accepts_external, &len) && accepts_external;
+                LOG(LOG_LEVEL_VERBOSE) << "[multiplier] Display " << disp->name << (disp->zero_copy ?
+                                " accepts shared frames.\n" : " needs frames to be copied.\n");
 
                 s->common->displays.push_back(std::move(disp));
         }
@@ -155,62 +183,97 @@ static void *display_multiplier_init(struct module *parent, const char *fmt, uns
         return s;
 }
 
-static void check_reconf(struct state_multiplier_common *s, struct video_desc desc)
+static void shared_frame_view_deleter(struct video_frame *frame)
 {
-        if (!video_desc_eq(desc, s->display_desc)) {
-                s->display_desc = desc;
-                fprintf(stderr, "RECONFIGURED\n");
-                for(auto& disp : s->displays){
-                        display_reconfigure(disp.real_display, s->display_desc, VIDEO_NORMAL);
-                }
+        delete (shared_ptr<struct video_frame> *) frame->callbacks.dispose_udata;
+}
+
+/**
+ * Creates a frame pointing to data of the shared frame that holds a reference
+ * to it until vf_free()-ed.
+ */
+static struct video_frame *shared_frame_view(shared_ptr<struct video_frame> const & frame)
+{
+        struct video_frame *view = vf_alloc_desc(video_desc_from_frame(frame.get()));
+        for (unsigned int i = 0; i < frame->tile_count; ++i) {
+                view->tiles[i].data = frame->tiles[i].data;
+                view->tiles[i].data_len = frame->tiles[i].data_len;
         }
+        char metadata[VF_METADATA_SIZE];
+        vf_store_metadata(frame.get(), metadata);
+        vf_restore_metadata(view, metadata);
+        view->callbacks.dispose_udata = new shared_ptr<struct video_frame>(frame);
+        view->callbacks.data_deleter = shared_frame_view_deleter;
+        return view;
 }
 
-static void display_multiplier_worker(void *state)
+static void display_multiplier_feeder(struct sub_display *disp)
 {
-        shared_ptr<struct state_multiplier_common> s = ((struct state_multiplier *)state)->common;
-        int skipped = 0;
+        struct video_desc display_desc{};
+        steady_clock::time_point stats_start = steady_clock::now();
+        unsigned long frames = 0;
+        duration<double> latency_sum{}, latency_max{};
 
         while (1) {
-                struct video_frame *frame;
+                queued_frame item;
                 {
-                        unique_lock<mutex> lg(s->lock);
-                        s->cv.wait(lg, [s]{return s->incoming_queue.size() > 0;});
-                        frame = s->incoming_queue.front();
-                        s->incoming_queue.pop();
-                        s->in_queue_decremented_cv.notify_one();
+                        unique_lock<mutex> lk(disp->lock);
+                        disp->cv.wait(lk, [disp]{return disp->queue.size() > 0;});
+                        item = move(disp->queue.front());
+                        disp->queue.pop_front();
                 }
 
-                if (!frame) {
-                        for (auto& disp : s->displays) {
-                                display_put_frame(disp.real_display, NULL, PUTF_BLOCKING);
-                        }
+                if (!item.frame) {
+                        display_put_frame(disp->real_display, NULL, PUTF_BLOCKING);
                         break;
                 }
 
-                if (skipped < SKIP_FIRST_N_FRAMES_IN_STREAM){
-                        skipped++;
-                        vf_free(frame);
-                        continue;
+                struct video_desc desc = video_desc_from_frame(item.frame.get());
+                if (!video_desc_eq(desc, display_desc)) {
+                        display_desc = desc;
+                        fprintf(stderr, "RECONFIGURED\n");
+                        display_reconfigure(disp->real_display, display_desc, VIDEO_NORMAL);
                 }
 
-                check_reconf(s.get(), video_desc_from_frame(frame));
-
-                for (auto& disp : s->displays) {
-                        struct video_frame *real_display_frame = display_get_frame(disp.real_display);
-                        memcpy(real_display_frame->tiles[0].data, frame->tiles[0].data, frame->tiles[0].data_len);
-                        display_put_frame(disp.real_display, real_display_frame, PUTF_BLOCKING);
+                struct video_frame *real_display_frame;
+                if (disp->zero_copy) {
+                        real_display_frame = shared_frame_view(item.frame);
+                } else {
+                        real_display_frame = display_get_frame(disp->real_display);
+                        for (unsigned int i = 0; i < min(item.frame->tile_count, real_display_frame->tile_count); ++i) {
+                                memcpy(real_display_frame->tiles[i].data, item.frame->tiles[i].data, item.frame->tiles[i].data_len);
+                        }
+                }
+                item.frame.reset();
+                display_put_frame(disp->real_display, real_display_frame, PUTF_BLOCKING);
+
+                auto now = steady_clock::now();
+                duration<double> latency = now - item.enqueued;
+                latency_sum += latency;
+                latency_max = max(latency_max, latency);
+                frames += 1;
+                if (now - stats_start > STATS_INTERVAL) {
+                        unsigned long dropped;
+                        {
+                                lock_guard<mutex> lk(disp->lock);
+                                dropped = disp->dropped;
+                                disp->dropped = 0;
+                        }
+                        LOG(LOG_LEVEL_INFO) << "[multiplier] " << disp->name << ": " << frames << " frames, " <<
+                                dropped << " dropped, latency avg " << latency_sum.count() * 1000.0 / frames <<
+                                " ms, max " << latency_max.count() * 1000.0 << " ms\n";
+                        stats_start = now;
+                        frames = 0;
+                        latency_sum = latency_max = duration<double>{};
                 }
-
-                vf_free(frame);
         }
 }
 
 /**
  * Multiplier main loop
  *
- * Runs threads for all slave displays except the first one and an additional
- * one for this display. For the first display given on command-line it then
+ * Runs threads for all slave displays except the first one and feeder
+ * threads for all of them. For the first display given on command-line it then
  * switches to its run-loop. This allows a flawless run on macOS where a GUI
  * worker (GL/SDL) needs to be run in the main thread to work properly.
  */
@@ -219,19 +282,23 @@ static void display_multiplier_run(void *state)
         shared_ptr<struct state_multiplier_common> s = ((struct state_multiplier *)state)->common;
 
         for (int i = 1; i < (int) s->displays.size(); i++) {
-                s->displays[i].disp_thread = thread(display_run, s->displays[i].real_display);
+                s->displays[i]->disp_thread = thread(display_run, s->displays[i]->real_display);
         }
 
-        s->worker_thread = thread(display_multiplier_worker, state);
+        for (auto & disp : s->displays) {
+                disp->feeder_thread = thread(display_multiplier_feeder, disp.get());
+        }
 
         // run the displays[0] worker
         if (s->displays.size() > 0) {
-                display_run(s->displays[0].real_display);
+                display_run(s->displays[0]->real_display);
         }
 
-        s->worker_thread.join();
+        for (auto & disp : s->displays) {
+                disp->feeder_thread.join();
+        }
         for (int i = 1; i < (int) s->displays.size(); i++) {
-                s->displays[i].disp_thread.join();
+                s->displays[i]->disp_thread.join();
         }
 }
 
@@ -248,25 +315,39 @@ static struct video_frame *display_multiplier_getf(void *state)
         return vf_alloc_desc_data(s->desc);
 }
 
+/**
+ * Passes the frame to all displays. Never blocks - if a display is too slow,
+ * the oldest frame in its queue is dropped.
+ */
 static int display_multiplier_putf(void *state, struct video_frame *frame, int flags)
 {
         shared_ptr<struct state_multiplier_common> s = ((struct state_multiplier *)state)->common;
 
         if (flags == PUTF_DISCARD) {
                 vf_free(frame);
-        } else {
-                unique_lock<mutex> lg(s->lock);
-                if (s->incoming_queue.size() >= IN_QUEUE_MAX_BUFFER_LEN) {
-                        fprintf(stderr, "Multiplier: queue full!\n");
-                }
-                if (flags == PUTF_NONBLOCK && s->incoming_queue.size() >= IN_QUEUE_MAX_BUFFER_LEN) {
+                return 0;
+        }
+
+        if (frame) {
+                lock_guard<mutex> lk(s->lock);
+                if (s->skipped < SKIP_FIRST_N_FRAMES_IN_STREAM) {
+                        s->skipped++;
                         vf_free(frame);
-                        return 1;
+                        return 0;
+                }
+        }
+
+        queued_frame item{shared_ptr<struct video_frame>(frame, vf_free), steady_clock::now()};
+        for (auto & disp : s->displays) {
+                {
+                        lock_guard<mutex> lk(disp->lock);
+                        if (frame && disp->queue.size() >= s->queue_len) {
+                                disp->queue.pop_front();
+                                disp->dropped += 1;
+                        }
+                        disp->queue.push_back(item);
                 }
-                s->in_queue_decremented_cv.wait(lg, [s]{return s->incoming_queue.size() < IN_QUEUE_MAX_BUFFER_LEN;});
-                s->incoming_queue.push(frame);
-                lg.unlock();
-                s->cv.notify_one();
+                disp->cv.notify_one();
         }
 
         return 0;
@@ -288,7 +369,15 @@ static int display_multiplier_get_property(void *state, int property, void *val,
 
         }
         //TODO Find common properties, for now just return properties of the first display
-        return display_get_property(s->displays[0].real_display, property, val, len);
+        if (property == DISPLAY_PROPERTY_ACCEPTS_EXTERNAL_FRAMES) { // putf just takes a reference
+                if (*len < sizeof(int)) {
+                        return FALSE;
+                }
+                *(int *) val = TRUE;
+                *len = sizeof(int);
+                return TRUE;
+        }
+        return display_get_property(s->displays[0]->real_display, property, val, len);
 }
 
 static int display_multiplier_reconfigure(void *state, struct video_desc desc)
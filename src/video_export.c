@@ -52,90 +52,316 @@
 #include "config_win32.h"
 #endif /* HAVE_CONFIG_H */
 
-#include <compat/platform_semaphore.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
 #include <pthread.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
 
 #include "debug.h"
+#include "host.h"
+#include "utils/misc.h"
 #include "video.h"
 #include "video_codec.h"
 #include "video_export.h"
 
-#define MAX_QUEUE_SIZE 300
+#define MOD_NAME "[Video export] "
+
+#define MAX_QUEUE_SIZE 300 ///< maximal number of frames waiting to be written
+#define MAX_TILES 16
+#define MAX_WRITER_THREADS 64
+#define DEFAULT_WRITER_THREADS 2
+#define DEFAULT_BUFFER_SIZE (512ll * 1024 * 1024)
+/// alignment of buffers, write lengths and container offsets (needed by O_DIRECT)
+#define IO_ALIGN 4096
+#define CONTAINER_PREALLOC_CHUNK (256ll * 1024 * 1024)
+
+#define ALIGN_UP(x) (((x) + IO_ALIGN - 1) / IO_ALIGN * IO_ALIGN)
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
 
 /*
- * we do not need to have possible stalls, so IO is performend in a separate thread
+ * we do not need to have possible stalls, so IO is performend in separate threads
+ *
+ * Frames are copied to a preallocated ring buffer (pool) and written by writer
+ * threads. Pool space is released in frame order, so memory usage is bounded
+ * by the pool size - frames that do not fit are dropped.
  */
 static void *video_export_thread(void *arg);
 void output_summary(struct video_export *s);
 
-struct output_entry;
-
-struct output_entry {
-        char *filename;
-        char *data;
-        int data_len;
+enum job_state {
+        JOB_FILLING, ///< being copied to the pool
+        JOB_QUEUED,
+        JOB_WRITING,
+        JOB_DONE,
+};
 
-        struct output_entry *next;
+struct export_job {
+        uint32_t frame;             ///< frame number (1-based, as in file names)
+        unsigned int tile_count;
+        const char *extension;
+        size_t pool_offset;         ///< position of the first tile in pool, tiles are IO_ALIGN-aligned
+        size_t tile_len[MAX_TILES];
+        uint64_t file_offset;       ///< container mode - position of the first tile in the file
+        enum job_state state;
 };
 
 struct video_export {
         char *path;
 
         uint32_t total;
+        uint32_t dropped;
 
         pthread_mutex_t lock;
-        struct output_entry * volatile head,
-                            * volatile tail;
-        volatile int queue_len;
-        sem_t semaphore;
+        pthread_cond_t job_cv;
+        struct export_job jobs[MAX_QUEUE_SIZE]; ///< ring of jobs in frame order
+        int first_job;
+        int job_count;
+        int dispatched;                         ///< number of jobs (from the first one) taken by writers
+        bool should_exit;
+
+        char *pool;
+        size_t pool_size;
+        size_t pool_head;                       ///< end of the last allocated job
+
+        bool direct;                            ///< use O_DIRECT
+
+        // single-file container mode
+        int container_fd;                       ///< -1 if writing a file per tile
+        FILE *index;
+        uint64_t container_offset;              ///< end of the last enqueued frame
+        uint64_t preallocated;
+        pthread_mutex_t prealloc_lock;
 
         struct video_desc saved_desc;
 
-        pthread_t thread_id;
+        int thread_count;
+        pthread_t thread_id[MAX_WRITER_THREADS];
 };
 
-static void *video_export_thread(void *arg)
+ADD_TO_PARAM(video_export_threads, "video-export-threads", "* video-export-threads=<n>\n"
+                "  Number of threads writing exported video frames (default 2).\n");
+ADD_TO_PARAM(video_export_buffer, "video-export-buffer", "* video-export-buffer=<size>\n"
+                "  Memory used to buffer exported video frames (default 512M), frames are dropped when full.\n");
+ADD_TO_PARAM(video_export_container, "video-export-container", "* video-export-container\n"
+                "  Export video to a single file " VIDEO_EXPORT_CONTAINER_FILE " indexed by "
+                VIDEO_EXPORT_INDEX_FILE " instead of a file per frame.\n");
+
+static struct export_job *get_job(struct video_export *s, int idx)
 {
-        struct video_export *s = (struct video_export *) arg;
+        return &s->jobs[(s->first_job + idx) % MAX_QUEUE_SIZE];
+}
 
-        while(1) {
-                platform_sem_wait(&s->semaphore);
-                struct output_entry *current;
+/**
+ * Reserves len bytes in the pool, space is released in job order so the
+ * occupied part is contiguous (modulo wrap-around).
+ */
+static bool pool_alloc(struct video_export *s, size_t len, size_t *offset)
+{
+        if (s->job_count == 0) {
+                s->pool_head = 0;
+        }
+        size_t tail = s->job_count > 0 ? get_job(s, 0)->pool_offset : 0;
 
-                pthread_mutex_lock(&s->lock);
-                {
-                        current = s->head;
-                        s->head = s->head->next;
-                        s->queue_len -= 1;
+        if (s->job_count == 0 || s->pool_head > tail) {
+                if (s->pool_size - s->pool_head >= len) {
+                        *offset = s->pool_head;
+                } else if (tail >= len) { // wrap around
+                        *offset = 0;
+                } else {
+                        return false;
                 }
-                pthread_mutex_unlock(&s->lock);
+        } else if (s->pool_head < tail && tail - s->pool_head >= len) {
+                *offset = s->pool_head;
+        } else {
+                return false;
+        }
+        s->pool_head = *offset + len;
+        return true;
+}
+
+static void release_done_jobs(struct video_export *s)
+{
+        while (s->job_count > 0 && get_job(s, 0)->state == JOB_DONE) {
+                s->first_job = (s->first_job + 1) % MAX_QUEUE_SIZE;
+                s->job_count -= 1;
+                s->dispatched -= 1;
+        }
+}
 
-                assert((current->data == NULL && current->data_len == 0) ||
-                                (current->data != NULL && current->data_len != 0));
+static void direct_unsupported(struct video_export *s)
+{
+        pthread_mutex_lock(&s->lock);
+        if (s->direct) {
+                log_msg(LOG_LEVEL_WARNING, MOD_NAME "O_DIRECT not supported by the filesystem, using buffered IO.\n");
+                s->direct = false;
+        }
+        pthread_mutex_unlock(&s->lock);
+}
 
-                // poison
-                if(current->data == NULL) {
-                        return NULL;
+/// switches fd to buffered IO if the filesystem doesn't support O_DIRECT
+static bool disable_direct(struct video_export *s, int fd)
+{
+#ifdef O_DIRECT
+        int flags = fcntl(fd, F_GETFL);
+        if (flags == -1 || (flags & O_DIRECT) == 0 || fcntl(fd, F_SETFL, flags & ~O_DIRECT) == -1) {
+                return false;
+        }
+        direct_unsupported(s);
+        return true;
+#else
+        UNUSED(s), UNUSED(fd);
+        return false;
+#endif
+}
+
+static int open_output(struct video_export *s, const char *name)
+{
+        int flags = O_WRONLY | O_CREAT | O_TRUNC | O_BINARY;
+#ifdef O_DIRECT
+        if (s->direct) {
+                int fd = open(name, flags | O_DIRECT, 0666);
+                if (fd != -1 || errno != EINVAL) {
+                        return fd;
                 }
+                direct_unsupported(s);
+        }
+#endif
+        return open(name, flags, 0666);
+}
 
-                FILE *out = fopen(current->filename, "wb");
-                if (out == NULL) {
-                        perror("fopen");
+static bool write_at(struct video_export *s, int fd, const char *data, size_t len, uint64_t offset)
+{
+        while (len > 0) {
+#ifdef WIN32
+                ssize_t ret = _lseeki64(fd, offset, SEEK_SET) == -1 ? -1 : write(fd, data, len);
+#else
+                ssize_t ret = pwrite(fd, data, len, offset);
+#endif
+                if (ret < 0) {
+                        if (errno == EINTR || (errno == EINVAL && disable_direct(s, fd))) {
+                                continue;
+                        }
+                        return false;
+                }
+                data += ret;
+                len -= ret;
+                offset += ret;
+        }
+        return true;
+}
+
+/// preallocates container file ahead of writes to reduce fragmentation and metadata updates
+static void container_preallocate(struct video_export *s, uint64_t end)
+{
+#if defined HAVE_LINUX && defined FALLOC_FL_KEEP_SIZE
+        pthread_mutex_lock(&s->prealloc_lock);
+        while (s->preallocated < end) {
+                if (fallocate(s->container_fd, FALLOC_FL_KEEP_SIZE, s->preallocated, CONTAINER_PREALLOC_CHUNK) != 0) {
+                        s->preallocated = UINT64_MAX; // not supported, do not try again
+                        break;
+                }
+                s->preallocated += CONTAINER_PREALLOC_CHUNK;
+        }
+        pthread_mutex_unlock(&s->prealloc_lock);
+#else
+        UNUSED(s), UNUSED(end);
+#endif
+}
+
+static void write_job(struct video_export *s, struct export_job *job)
+{
+        const char *data = s->pool + job->pool_offset;
+        uint64_t file_offset = job->file_offset;
+
+        for (unsigned int i = 0; i < job->tile_count; ++i) {
+                size_t aligned_len = ALIGN_UP(job->tile_len[i]);
+                if (s->container_fd != -1) {
+                        container_preallocate(s, file_offset + aligned_len);
+                        if (!write_at(s, s->container_fd, data, aligned_len, file_offset)) {
+                                log_msg(LOG_LEVEL_ERROR, MOD_NAME "Cannot write frame %" PRIu32 ": %s\n", job->frame, strerror(errno));
+                        }
                 } else {
-                        if (fwrite(current->data, current->data_len, 1, out) != 1) {
-                                perror("fwrite");
+                        char name[1024];
+                        if (job->tile_count == 1) {
+                                snprintf(name, sizeof name, "%s/%08" PRIu32 ".%s", s->path, job->frame, job->extension);
+                        } else {
+                                // add also tile index
+                                snprintf(name, sizeof name, "%s/%08" PRIu32 "_%u.%s", s->path, job->frame, i, job->extension);
                         }
-                        fclose(out);
+                        int fd = open_output(s, name);
+                        if (fd == -1) {
+                                log_msg(LOG_LEVEL_ERROR, MOD_NAME "Cannot open %s: %s\n", name, strerror(errno));
+                        } else {
+                                // O_DIRECT writes whole blocks, padding is truncated afterwards
+                                bool direct = s->direct;
+                                if (!write_at(s, fd, data, direct ? aligned_len : job->tile_len[i], 0) ||
+                                                (direct && ftruncate(fd, job->tile_len[i]) != 0)) {
+                                        log_msg(LOG_LEVEL_ERROR, MOD_NAME "Cannot write %s: %s\n", name, strerror(errno));
+                                }
+                                close(fd);
+                        }
+                }
+                data += aligned_len;
+                file_offset += aligned_len;
+        }
+}
+
+static void *video_export_thread(void *arg)
+{
+        struct video_export *s = (struct video_export *) arg;
+
+        pthread_mutex_lock(&s->lock);
+        while (1) {
+                while (!s->should_exit && !(s->dispatched < s->job_count &&
+                                        get_job(s, s->dispatched)->state == JOB_QUEUED)) {
+                        pthread_cond_wait(&s->job_cv, &s->lock);
                 }
-                free(current->data);
-                free(current->filename);
-                free(current);
+                // queue is drained before exiting
+                if (!(s->dispatched < s->job_count && get_job(s, s->dispatched)->state == JOB_QUEUED)) {
+                        break;
+                }
+                struct export_job *job = get_job(s, s->dispatched);
+                job->state = JOB_WRITING;
+                s->dispatched += 1;
+                pthread_mutex_unlock(&s->lock);
+
+                write_job(s, job);
+
+                pthread_mutex_lock(&s->lock);
+                job->state = JOB_DONE;
+                release_done_jobs(s);
         }
+        pthread_mutex_unlock(&s->lock);
 
-        // never get here
+        return NULL;
+}
+
+static bool init_container(struct video_export *s)
+{
+        char name[1024];
+        snprintf(name, sizeof name, "%s/" VIDEO_EXPORT_INDEX_FILE, s->path);
+        s->index = fopen(name, "w");
+        if (s->index == NULL) {
+                log_msg(LOG_LEVEL_ERROR, MOD_NAME "Cannot create %s: %s\n", name, strerror(errno));
+                return false;
+        }
+        snprintf(name, sizeof name, "%s/" VIDEO_EXPORT_CONTAINER_FILE, s->path);
+        s->container_fd = open_output(s, name);
+        if (s->container_fd == -1) {
+                log_msg(LOG_LEVEL_ERROR, MOD_NAME "Cannot create %s: %s\n", name, strerror(errno));
+                return false;
+        }
+        return true;
 }
 
 struct video_export * video_export_init(const char *path)
@@ -145,22 +371,60 @@ struct video_export * video_export_init(const char *path)
         s = (struct video_export *) calloc(1, sizeof(struct video_export));
         assert(s != NULL);
 
-        platform_sem_init(&s->semaphore, 0, 0);
         pthread_mutex_init(&s->lock, NULL);
-        s->total = s->queue_len = 0;
+        pthread_mutex_init(&s->prealloc_lock, NULL);
+        pthread_cond_init(&s->job_cv, NULL);
         assert(path != NULL);
         s->path = strdup(path);
-        s->head = s->tail = NULL;
+        s->container_fd = -1;
+#ifdef O_DIRECT
+        s->direct = true;
+#endif
+
+        s->thread_count = DEFAULT_WRITER_THREADS;
+        if (get_commandline_param("video-export-threads")) {
+                s->thread_count = atoi(get_commandline_param("video-export-threads"));
+                s->thread_count = s->thread_count < 1 ? 1 : s->thread_count > MAX_WRITER_THREADS ?
+                        MAX_WRITER_THREADS : s->thread_count;
+        }
+        s->pool_size = DEFAULT_BUFFER_SIZE;
+        if (get_commandline_param("video-export-buffer")) {
+                long long size = unit_evaluate(get_commandline_param("video-export-buffer"));
+                s->pool_size = size > IO_ALIGN ? ALIGN_UP(size) : IO_ALIGN;
+        }
+        // pages are not touched until used, so it is not an issue to allocate larger pool
+        s->pool = (char *) aligned_malloc(s->pool_size, IO_ALIGN);
+        if (s->pool == NULL) {
+                log_msg(LOG_LEVEL_ERROR, MOD_NAME "Cannot allocate buffer of %zu B.\n", s->pool_size);
+                goto error;
+        }
+
+        if (get_commandline_param("video-export-container")) {
+#ifdef WIN32
+                s->thread_count = 1; // no pwrite(), writes use shared file position
+#endif
+                if (!init_container(s)) {
+                        goto error;
+                }
+        }
 
         memset(&s->saved_desc, 0, sizeof(s->saved_desc));
 
-        if(pthread_create(&s->thread_id, NULL, video_export_thread, s) != 0) {
-                fprintf(stderr, "[Video exporter] Failed to create thread.\n");
-                free(s);
-                return NULL;
+        for (int i = 0; i < s->thread_count; ++i) {
+                if (pthread_create(&s->thread_id[i], NULL, video_export_thread, s) != 0) {
+                        fprintf(stderr, "[Video exporter] Failed to create thread.\n");
+                        s->thread_count = i;
+                        video_export_destroy(s);
+                        return NULL;
+                }
         }
 
         return s;
+
+error:
+        s->thread_count = 0;
+        video_export_destroy(s);
+        return NULL;
 }
 
 void output_summary(struct video_export *s)
@@ -183,6 +447,9 @@ void output_summary(struct video_export *s)
         fprintf(summary, "fps %.2f\n", s->saved_desc.fps);
         fprintf(summary, "interlacing %d\n", (int) s->saved_desc.interlacing);
         fprintf(summary, "count %d\n", s->total);
+        if (s->container_fd != -1) {
+                fprintf(summary, "container %s\n", VIDEO_EXPORT_CONTAINER_FILE);
+        }
 
         fclose(summary);
 }
@@ -190,34 +457,55 @@ void output_summary(struct video_export *s)
 void video_export_destroy(struct video_export *s)
 {
         if(s) {
-                // poison
-                struct output_entry *entry = calloc(sizeof(struct output_entry), 1);
-
                 pthread_mutex_lock(&s->lock);
-                {
-                        if(s->head) {
-                                s->tail->next = entry;
-                                s->tail = entry;
-                        } else {
-                                s->head = s->tail = entry;
-                        }
-                }
+                s->should_exit = true;
                 pthread_mutex_unlock(&s->lock);
-                platform_sem_post(&s->semaphore);
+                pthread_cond_broadcast(&s->job_cv);
 
-                pthread_join(s->thread_id, NULL);
-                pthread_mutex_destroy(&s->lock);
+                for (int i = 0; i < s->thread_count; ++i) {
+                        pthread_join(s->thread_id[i], NULL);
+                }
+
+                if (s->container_fd != -1) {
+                        // drop preallocated space beyond the last frame
+                        if (ftruncate(s->container_fd, s->container_offset) != 0) {
+                                perror(MOD_NAME "ftruncate");
+                        }
+                        close(s->container_fd);
+                }
+                if (s->index) {
+                        fclose(s->index);
+                }
 
                 // write summary
                 if(s->total > 0) {
                         output_summary(s);
+                        log_msg(LOG_LEVEL_INFO, MOD_NAME "Exported %" PRIu32 " frames, %" PRIu32 " dropped.\n",
+                                        s->total - s->dropped, s->dropped);
                 }
 
+                pthread_cond_destroy(&s->job_cv);
+                pthread_mutex_destroy(&s->prealloc_lock);
+                pthread_mutex_destroy(&s->lock);
+                aligned_free(s->pool);
                 free(s->path);
                 free(s);
         }
 }
 
+static void drop_frame(struct video_export *s, unsigned int tile_count, const char *reason)
+{
+        log_msg(LOG_LEVEL_WARNING, MOD_NAME "%s, not saving frame %" PRIu32 ".\n", reason, s->total + 1);
+        if (s->index) {
+                // keep the index complete, empty tiles are skipped on import
+                for (unsigned int i = 0; i < tile_count; ++i) {
+                        fprintf(s->index, "%" PRIu32 " %u 0 0\n", s->total + 1, i);
+                }
+        }
+        s->dropped += 1;
+        s->total += 1; // we increment total size to keep the index
+}
+
 void video_export(struct video_export *s, struct video_frame *frame)
 {
         if(!s) {
@@ -235,49 +523,54 @@ void video_export(struct video_export *s, struct video_frame *frame)
                 }
         }
 
+        if (frame->tile_count > MAX_TILES) {
+                drop_frame(s, frame->tile_count, "Too many tiles");
+                return;
+        }
+
+        size_t len = 0;
         for (unsigned int i = 0; i < frame->tile_count; ++i) {
                 assert(frame->tiles[i].data != NULL && frame->tiles[i].data_len != 0);
+                len += ALIGN_UP(frame->tiles[i].data_len);
+        }
 
-                struct output_entry *entry = malloc(sizeof(struct output_entry));
-
-                entry->data_len = frame->tiles[i].data_len;
-                entry->data = (char *) malloc(entry->data_len);
-                entry->filename = malloc(512);
-                entry->next = NULL;
-
-                if(frame->tile_count == 1) {
-                        snprintf(entry->filename, 512, "%s/%08d.%s", s->path, s->total + 1, get_codec_file_extension(frame->color_spec));
-                } else {
-                        // add also tile index
-                        snprintf(entry->filename, 512, "%s/%08d_%d.%s", s->path, s->total + 1, i, get_codec_file_extension(frame->color_spec));
-                }
-                memcpy(entry->data, frame->tiles[i].data, entry->data_len);
-
-                pthread_mutex_lock(&s->lock);
-                {
-                        // check if we do not occupy too much memory
-                        if(s->queue_len >= MAX_QUEUE_SIZE) {
-                                fprintf(stderr, "[Video export] Maximal queue size (%d) exceeded, not saving frame %d.\n",
-                                                MAX_QUEUE_SIZE,
-                                                s->total++); // we increment total size to keep the index
-                                pthread_mutex_unlock(&s->lock);
-                                free(entry->data);
-                                free(entry);
-                                return;
-                        }
-
-                        if(s->head) {
-                                s->tail->next = entry;
-                                s->tail = entry;
-                        } else {
-                                s->head = s->tail = entry;
-                        }
-                        s->queue_len += 1;
-                }
+        pthread_mutex_lock(&s->lock);
+        size_t pool_offset;
+        // check if we do not occupy too much memory
+        if (s->job_count == MAX_QUEUE_SIZE || !pool_alloc(s, len, &pool_offset)) {
                 pthread_mutex_unlock(&s->lock);
-
-                platform_sem_post(&s->semaphore);
+                drop_frame(s, frame->tile_count, "Export buffer full");
+                return;
         }
+        struct export_job *job = get_job(s, s->job_count);
+        s->job_count += 1;
+        job->state = JOB_FILLING;
+        pthread_mutex_unlock(&s->lock);
+
+        job->frame = s->total + 1;
+        job->tile_count = frame->tile_count;
+        job->extension = get_codec_file_extension(frame->color_spec);
+        job->pool_offset = pool_offset;
+        job->file_offset = s->container_offset;
+
+        char *data = s->pool + pool_offset;
+        for (unsigned int i = 0; i < frame->tile_count; ++i) {
+                size_t tile_len = frame->tiles[i].data_len;
+                job->tile_len[i] = tile_len;
+                memcpy(data, frame->tiles[i].data, tile_len);
+                memset(data + tile_len, 0, ALIGN_UP(tile_len) - tile_len);
+                if (s->index) {
+                        fprintf(s->index, "%" PRIu32 " %u %" PRIu64 " %zu\n", job->frame, i,
+                                        s->container_offset + (data - (s->pool + pool_offset)), tile_len);
+                }
+                data += ALIGN_UP(tile_len);
+        }
+        s->container_offset += len;
+
+        pthread_mutex_lock(&s->lock);
+        job->state = JOB_QUEUED;
+        pthread_mutex_unlock(&s->lock);
+        pthread_cond_signal(&s->job_cv);
 
         s->total += 1;
 }
@@ -50,6 +50,9 @@
 #define _VIDEO_EXPORT_H_
 
 #define VIDEO_EXPORT_SUMMARY_VERSION 1
+/// single-file container mode - frame data and index ("<frame> <tile> <offset> <length>" per line)
+#define VIDEO_EXPORT_CONTAINER_FILE "video.data"
+#define VIDEO_EXPORT_INDEX_FILE "video.index"
 
 #ifdef __cplusplus
 extern "C" {
@@ -85,7 +85,9 @@ video_rxtx::video_rxtx(map<string, param_u> const &params): m_port_id("default")
         module_register(&m_receiver_mod, static_cast<struct module *>(params.at("parent").ptr));
 
         try {
-                int ret = compress_init(&m_sender_mod, static_cast<const char *>(params.at("compression").ptr),
+                // NULL compression - caller passes already compressed frames
+                int ret = params.at("compression").ptr == nullptr ? 0 :
+                        compress_init(&m_sender_mod, static_cast<const char *>(params.at("compression").ptr),
                                 &m_compression);
                 if(ret != 0) {
                         if(ret < 0) {
@@ -112,9 +114,13 @@ video_rxtx::video_rxtx(map<string, param_u> const &params): m_port_id("default")
 
 video_rxtx::~video_rxtx() {
         join();
-        if (!m_poisoned && m_compression) {
+        if (!m_poisoned) {
                 send(NULL);
-                compress_pop(m_compression);
+                if (m_compression) {
+                        compress_pop(m_compression);
+                } else {
+                        m_precompressed.pop();
+                }
         }
         module_done(CAST_MODULE(m_compression));
         module_done(&m_receiver_mod);
@@ -152,7 +158,11 @@ void video_rxtx::send(shared_ptr<video_frame> frame) {
         if (!frame && m_poisoned) {
                 return;
         }
-        compress_frame(m_compression, frame);
+        if (m_compression) {
+                compress_frame(m_compression, frame);
+        } else {
+                m_precompressed.push(frame);
+        }
         if (!frame) {
                 m_poisoned = true;
         }
@@ -188,7 +198,7 @@ void *video_rxtx::sender_loop() {
 
                 shared_ptr<video_frame> tx_frame;
 
-                tx_frame = compress_pop(m_compression);
+                tx_frame = m_compression ? compress_pop(m_compression) : m_precompressed.pop();
                 if (!tx_frame)
                         goto exit;
 
@@ -44,8 +44,9 @@
 #include <string>
 
 #include "module.h"
+#include "utils/synchronized_queue.h"
 
-#define VIDEO_RXTX_ABI_VERSION 2
+#define VIDEO_RXTX_ABI_VERSION 3
 
 struct display;
 struct module;
@@ -109,7 +110,8 @@ private:
                 return NULL;
         }
 
-        struct compress_state *m_compression;
+        struct compress_state *m_compression; ///< NULL if frames are passed already compressed
+        synchronized_queue<std::shared_ptr<video_frame>, 1> m_precompressed; ///< used if m_compression is NULL
         pthread_mutex_t m_lock;
         struct exporter *m_exporter;
 
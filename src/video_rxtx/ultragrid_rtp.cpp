@@ -325,6 +325,10 @@ struct vcodec_state *ultragrid_rtp_video_rxtx::new_video_decoder(struct display
         return state;
 }
 
+ADD_TO_PARAM(decoder_no_recv_placement, "decoder-no-recv-placement", "* decoder-no-recv-placement\n"
+                "  Do not receive uncompressed video payloads directly to the framebuffer. Only the most\n"
+                "  recently connected sender is received that way anyway.\n");
+
 void *ultragrid_rtp_video_rxtx::receiver_loop()
 {
         uint32_t ts;
@@ -430,6 +434,15 @@ void *ultragrid_rtp_video_rxtx::receiver_loop()
                                         exit_uv(1);
                                         break;
                                 }
+                                // Receive uncompressed payloads directly to the framebuffer. The socket
+                                // has only one placement, so each new participant replaces the
+                                // registration of the previous one and only the most recent sender
+                                // is received without copying.
+                                if (get_commandline_param("decoder-no-recv-placement") == NULL) {
+                                        rtp_set_recv_placement(m_network_devices[0],
+                                                        video_decoder_get_recv_placement(((struct vcodec_state *) cp->decoder_state)->decoder),
+                                                        sizeof(video_payload_hdr_t));
+                                }
 #endif // SHARED_DECODER
                         }
 
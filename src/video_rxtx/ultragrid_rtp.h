@@ -58,6 +58,8 @@ public:
 
         // transcoder functions
         friend ssize_t hd_rum_decompress_write(void *state, void *buf, size_t count);
+        friend bool hd_rum_decompress_write_owned(void *state, char *buf, size_t count,
+                        void (*deleter)(char *buf, void *udata), void *udata);
 private:
         static void *receiver_thread(void *arg);
         virtual void send_frame(std::shared_ptr<video_frame>);
@@ -45,27 +45,42 @@
 #include <pthread.h>
 #include <stdlib.h>
 #include "lib_common.h"
+#include "utils/field_engine.h"
 #include "video.h"
 #include "video_display.h"
 #include "vo_postprocess.h"
 
 struct state_deinterlace {
-        struct video_frame *out;
+        struct video_frame *in[2]; ///< input frames are alternated so that the previous one is retained
+        struct video_frame *prev;  ///< previous processed input frame (NULL after reconfiguration)
+        enum field_engine_op op;
 };
 
 static void usage()
 {
         printf("Deinterlaces output video frames.\nUsage:\n");
-        printf("\t-p deinterlace\n");
+        printf("\t-p deinterlace[:blend|:motion]\n");
+        printf("\t\tblend  - linear blend of line pairs (default)\n");
+        printf("\t\tmotion - motion adaptive, keeps full vertical resolution in static areas\n");
 }
 
 static void * deinterlace_init(const char *config) {
-        if(config && strcmp(config, "help") == 0) {
-                usage();
-                return NULL;
+        enum field_engine_op op = FIELD_BLEND;
+
+        if (config) {
+                if (strcmp(config, "help") == 0) {
+                        usage();
+                        return NULL;
+                } else if (strcmp(config, "motion") == 0) {
+                        op = FIELD_MOTION_ADAPTIVE;
+                } else if (strcmp(config, "blend") != 0 && strlen(config) > 0) {
+                        log_msg(LOG_LEVEL_ERROR, "[deinterlace] Unknown config: %s\n", config);
+                        return NULL;
+                }
         }
 
         struct state_deinterlace *s = new state_deinterlace();
+        s->op = op;
 
         return s;
 }
@@ -79,9 +94,12 @@ static int deinterlace_reconfigure(void *state, struct video_desc desc)
 {
         struct state_deinterlace *s = (struct state_deinterlace *) state;
 
-        vf_free(s->out);
         assert(desc.tile_count == 1);
-        s->out = vf_alloc_desc_data(desc);
+        for (auto & in : s->in) {
+                vf_free(in);
+                in = vf_alloc_desc_data(desc);
+        }
+        s->prev = NULL;
 
         return TRUE;
 }
@@ -90,20 +108,22 @@ static struct video_frame * deinterlace_getf(void *state)
 {
         struct state_deinterlace *s = (struct state_deinterlace *) state;
 
-        return s->out;
+        return s->in[s->prev == s->in[0] ? 1 : 0];
 }
 
 static bool deinterlace_postprocess(void *state, struct video_frame *in, struct video_frame *out, int req_pitch)
 {
-        UNUSED(state);
-        assert (req_pitch == vc_get_linesize(in->tiles[0].width, in->color_spec));
+        struct state_deinterlace *s = (struct state_deinterlace *) state;
+        size_t linesize = vc_get_linesize(in->tiles[0].width, in->color_spec);
+        assert (req_pitch >= (int) linesize);
         assert (video_desc_eq(video_desc_from_frame(out), video_desc_from_frame(in)));
-        assert (in->tiles[0].data_len <= vc_get_linesize(in->tiles[0].width, in->color_spec) * in->tiles[0].height);
-        assert (out->tiles[0].data_len <= vc_get_linesize(in->tiles[0].width, in->color_spec) * in->tiles[0].height);
+        assert (in->tiles[0].data_len <= linesize * in->tiles[0].height);
 
-        vc_deinterlace((unsigned char *) in->tiles[0].data, vc_get_linesize(in->tiles[0].width,
-                                in->color_spec), in->tiles[0].height);
-        memcpy(out->tiles[0].data, in->tiles[0].data, in->tiles[0].data_len);
+        struct field_engine_src src = { (unsigned char *) in->tiles[0].data, (unsigned char *) in->tiles[0].data,
+                s->prev ? (unsigned char *) s->prev->tiles[0].data : NULL, linesize };
+        field_engine_process(s->op, in->color_spec, &src, (unsigned char *) out->tiles[0].data,
+                        req_pitch, in->tiles[0].height);
+        s->prev = in;
 
         return true;
 }
@@ -112,7 +132,8 @@ static void deinterlace_done(void *state)
 {
         struct state_deinterlace *s = (struct state_deinterlace *) state;
         
-        vf_free(s->out);
+        vf_free(s->in[0]);
+        vf_free(s->in[1]);
         delete s;
 }
 
@@ -120,7 +141,7 @@ static void deinterlace_get_out_desc(void *state, struct video_desc *out, int *i
 {
         struct state_deinterlace *s = (struct state_deinterlace *) state;
 
-        *out = video_desc_from_frame(s->out);
+        *out = video_desc_from_frame(s->in[0]);
 
         UNUSED(in_display_mode);
         //*in_display_mode = DISPLAY_PROPERTY_VIDEO_MERGED;
@@ -54,9 +54,11 @@
 #include <chrono>
 #include <pthread.h>
 #include <stdlib.h>
+#include <thread>
 
 #include "debug.h"
 #include "lib_common.h"
+#include "utils/field_engine.h"
 #include "video.h"
 #include "video_display.h"
 #include "vo_postprocess.h"
@@ -163,47 +165,30 @@ static struct video_frame * df_getf(void *state)
 static bool df_postprocess(void *state, struct video_frame *in, struct video_frame *out, int req_pitch)
 {
         struct state_df *s = (struct state_df *) state;
-        unsigned int y;
+        struct field_engine_src src;
+        src.linesize = vc_get_linesize(s->in->tiles[0].width, s->in->color_spec);
+        src.prev = NULL;
 
         if(in != NULL) {
-                char *src = s->buffers[(s->buffer_current + 1) % 2] + vc_get_linesize(s->in->tiles[0].width, s->in->color_spec);
-                char *dst = out->tiles[0].data + req_pitch;
-                for (y = 0; y < out->tiles[0].height; y += 2) {
-                        memcpy(dst, src, vc_get_linesize(s->in->tiles[0].width, s->in->color_spec));
-                        dst += 2 * req_pitch;
-                        src += 2 * vc_get_linesize(s->in->tiles[0].width, s->in->color_spec);
-                }
-                src = s->buffers[s->buffer_current];
-                dst = out->tiles[0].data;
-                for (y = 1; y < out->tiles[0].height; y += 2) {
-                        memcpy(dst, src, vc_get_linesize(s->in->tiles[0].width, s->in->color_spec));
-                        dst += 2 * req_pitch;
-                        src += 2 * vc_get_linesize(s->in->tiles[0].width, s->in->color_spec);
-                }
+                // top field of the current frame woven with bottom field of the previous one
+                src.top = (unsigned char *) s->buffers[s->buffer_current];
+                src.bottom = (unsigned char *) s->buffers[(s->buffer_current + 1) % 2];
         } else {
-                char *src = s->buffers[s->buffer_current];
-                char *dst = out->tiles[0].data;
-                for (y = 0; y < out->tiles[0].height; ++y) {
-                        memcpy(dst, src, vc_get_linesize(s->in->tiles[0].width, s->in->color_spec));
-                        dst += req_pitch;
-                        src += vc_get_linesize(s->in->tiles[0].width, s->in->color_spec);
-                }
+                src.top = src.bottom = (unsigned char *) s->buffers[s->buffer_current];
         }
 
-        if (s->deinterlace) {
-                vc_deinterlace((unsigned char *) out->tiles[0].data, vc_get_linesize(out->tiles[0].width, out->color_spec), out->tiles[0].height);
-        }
+        field_engine_process(s->deinterlace ? FIELD_BLEND : FIELD_WEAVE, s->in->color_spec, &src,
+                        (unsigned char *) out->tiles[0].data, req_pitch, out->tiles[0].height);
 
         if (!s->nodelay) {
                 // In following code we fix timing in order not to pass both frames
-                // in bulk but rather we busy-wait half of the frame time.
+                // in bulk but rather we postpone the other one by half of the frame time.
                 if (in) {
                         s->frame_received = std::chrono::steady_clock::now();
                 } else {
-                        decltype(s->frame_received) t;
-                        do {
-                                t = std::chrono::steady_clock::now();
-                        } while (std::chrono::duration_cast<std::chrono::duration<double>>(t - s->frame_received).count() <= 0.5 / out->fps);
+                        std::this_thread::sleep_until(s->frame_received +
+                                        std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                                std::chrono::duration<double>(0.5 / out->fps)));
                 }
         }
 
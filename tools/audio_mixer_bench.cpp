@@ -0,0 +1,187 @@
+/**
+ * @file   tools/audio_mixer_bench.cpp
+ *
+ * Benchmark of the audio mixer (audio/playback/mixer.cpp) - time of one mixer
+ * tick (20 ms of audio) for growing participant count: mixing only, for both
+ * mixing algorithms, and mixing followed by per-participant encoding. Scalar,
+ * SSE2 and AVX2 kernels are compared, results must match the scalar ones.
+ *
+ * Usage: audio_mixer_bench [codec [channels [duration_s]]]
+ */
+/*
+ * Copyright (c) 2019 CESNET z.s.p.o.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, is permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of CESNET nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESSED OR IMPLIED WARRANTIES, INCLUDING,
+ * BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#include "config_unix.h"
+#include "config_win32.h"
+#endif // HAVE_CONFIG_H
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "audio/codec.h"
+#include "audio/mixer_kernels.h"
+#include "audio/utils.h"
+#include "host.h"
+#include "utils/worker.h"
+
+using namespace std;
+
+#define SAMPLE_RATE 48000
+#define SAMPLES_PER_FRAME (SAMPLE_RATE / 25)
+
+static const char *isa_names[] = { "scalar", "SSE2", "AVX2" };
+static const int participant_counts[] = { 2, 8, 16, 32, 60 };
+
+void exit_uv(int status);
+
+void exit_uv(int status)
+{
+        exit(status);
+}
+
+template<typename F>
+static double measure(F const & f, double duration, long long *iterations)
+{
+        auto start = chrono::steady_clock::now();
+        double elapsed;
+        *iterations = 0;
+        do {
+                f();
+                *iterations += 1;
+                elapsed = chrono::duration_cast<chrono::duration<double>>(chrono::steady_clock::now() - start).count();
+        } while (elapsed < duration);
+        return elapsed;
+}
+
+template<typename mix_algo>
+static void mix(vector<mixer_mix_t> & mixed, vector<vector<mixer_sample_t>> const & input,
+                vector<vector<mixer_sample_t>> & output)
+{
+        fill(mixed.begin(), mixed.end(), 0);
+        for (unsigned i = 0; i < input.size(); ++i) {
+                output[i] = input[i]; // audio_buffer_read() in the mixer
+                audio_mixer_add(mixed.data(), output[i].data(), output[i].size());
+        }
+        for (auto & o : output) {
+                audio_mixer_subtract<mix_algo>(mixed.data(), o.data(), o.size());
+        }
+}
+
+int main(int argc, char *argv[])
+{
+        const char *codec = argc > 1 ? argv[1] : "PCM";
+        int channels = argc > 2 ? atoi(argv[2]) : 2;
+        double duration = argc > 3 ? atof(argv[3]) : 0.5;
+        int sample_count = SAMPLES_PER_FRAME * channels;
+
+        cout << "Codec: " << codec << ", channels: " << channels << ", detected ISA: " <<
+                isa_names[audio_mixer_set_max_isa(AUDIO_MIXER_AVX2)] << "\n";
+
+        for (int participants : participant_counts) {
+                mt19937 gen(participants);
+                vector<vector<mixer_sample_t>> input(participants, vector<mixer_sample_t>(sample_count));
+                // two speakers loud enough to get occasionally over logarithmic mixer threshold, others noise
+                for (int i = 0; i < participants; ++i) {
+                        int amplitude = i < 2 ? 20000 : 256;
+                        for (auto & s : input[i]) {
+                                s = (int) (gen() % (2 * amplitude)) - amplitude;
+                        }
+                }
+                vector<vector<mixer_sample_t>> output(input);
+                vector<mixer_mix_t> mixed(sample_count);
+                vector<struct audio_codec_state *> coders(participants);
+                vector<audio_frame2> frames(participants);
+                for (int i = 0; i < participants; ++i) {
+                        coders[i] = audio_codec_init_cfg(codec, AUDIO_CODER);
+                        if (!coders[i]) {
+                                cerr << "Unable to initialize codec " << codec << "!\n";
+                                return 1;
+                        }
+                        frames[i].init(channels, AC_PCM, sizeof(mixer_sample_t), SAMPLE_RATE);
+                }
+
+                cout << participants << " participants:\n";
+                vector<vector<mixer_sample_t>> reference[2];
+                for (int isa = AUDIO_MIXER_SCALAR; isa <= AUDIO_MIXER_AVX2; ++isa) {
+                        if (audio_mixer_set_max_isa((enum audio_mixer_isa) isa) != isa) {
+                                continue;
+                        }
+                        long long iterations;
+                        double elapsed = measure([&]{ mix<logarithmic_mix_algo>(mixed, input, output); }, duration, &iterations);
+                        double log_us = elapsed / iterations * 1000000.0;
+                        if (reference[1].empty()) {
+                                reference[1] = output;
+                        }
+                        bool ok = output == reference[1];
+
+                        elapsed = measure([&]{ mix<linear_mix_algo>(mixed, input, output); }, duration, &iterations);
+                        double lin_us = elapsed / iterations * 1000000.0;
+                        if (reference[0].empty()) {
+                                reference[0] = output;
+                        }
+                        ok = ok && output == reference[0];
+
+                        elapsed = measure([&]{
+                                        mix<linear_mix_algo>(mixed, input, output);
+                                        parallel_for(0, participants, [&](int start, int end) {
+                                                for (int i = start; i < end; ++i) {
+                                                        for (int ch = 0; ch < channels; ++ch) {
+                                                                frames[i].resize(ch, SAMPLES_PER_FRAME * sizeof(mixer_sample_t));
+                                                                demux_channel(const_cast<char *>(frames[i].get_data(ch)), (char *) output[i].data(),
+                                                                                sizeof(mixer_sample_t), sample_count * sizeof(mixer_sample_t), channels, ch);
+                                                        }
+                                                        const audio_frame2 *uncompressed = &frames[i];
+                                                        while (audio_codec_compress(coders[i], uncompressed)) {
+                                                                uncompressed = NULL;
+                                                        }
+                                                }
+                                        });
+                                }, duration, &iterations);
+                        double enc_us = elapsed / iterations * 1000000.0;
+
+                        cout << "\t" << isa_names[isa] << ":\tmix linear " << lin_us << " us, logarithmic " <<
+                                log_us << " us, mix+encode " << enc_us << " us per tick" << (ok ? "" : ", WRONG RESULT!") << "\n";
+                }
+                for (auto c : coders) {
+                        audio_codec_done(c);
+                }
+        }
+
+        return 0;
+}
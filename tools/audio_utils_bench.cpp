@@ -0,0 +1,295 @@
+/**
+ * @file   tools/audio_utils_bench.cpp
+ *
+ * Benchmark of sample format and channel conversion functions (audio/utils.cpp)
+ * for 16, 24 and 32-bit samples and growing channel count - time to process
+ * 20 ms of 96 kHz audio. The original per-sample implementation ("old") is
+ * compared with scalar, SSE2, SSSE3 and AVX2 variants, whose results must match
+ * the original ones.
+ *
+ * Usage: audio_utils_bench [duration_s]
+ */
+/*
+ * Copyright (c) 2019 CESNET z.s.p.o.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, is permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of CESNET nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESSED OR IMPLIED WARRANTIES, INCLUDING,
+ * BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#include "config_unix.h"
+#include "config_win32.h"
+#endif // HAVE_CONFIG_H
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "audio/utils.h"
+#include "host.h"
+
+using namespace std;
+
+#define SAMPLE_RATE 96000
+#define FRAMES (SAMPLE_RATE / 50)
+
+static const char *isa_names[] = { "scalar", "SSE2", "SSSE3", "AVX2" };
+static const int channel_counts[] = { 2, 8, 64 };
+static const int bps_list[] = { 2, 3, 4 };
+
+void exit_uv(int status);
+
+void exit_uv(int status)
+{
+        exit(status);
+}
+
+template<typename F>
+static double measure(F const & f, double duration, long long *iterations)
+{
+        auto start = chrono::steady_clock::now();
+        double elapsed;
+        *iterations = 0;
+        do {
+                f();
+                *iterations += 1;
+                elapsed = chrono::duration_cast<chrono::duration<double>>(chrono::steady_clock::now() - start).count();
+        } while (elapsed < duration);
+        return elapsed;
+}
+
+/*
+ * Reference implementations - the original per-sample code.
+ */
+static void ref_change_bps(char *out, int out_bps, const char *in, int in_bps, int in_len)
+{
+        for (int i = 0; i < in_len / in_bps; i++) {
+                int32_t in_value = format_from_in_bps(in, in_bps);
+                int32_t out_value;
+                if (in_bps > out_bps) {
+                        out_value = in_value >> (in_bps * 8 - out_bps * 8);
+                } else {
+                        out_value = (int32_t) ((uint32_t) in_value << (out_bps * 8 - in_bps * 8));
+                }
+                format_to_out_bps(out, out_bps, out_value);
+                in += in_bps;
+                out += out_bps;
+        }
+}
+
+static void ref_mux_and_mix_channel(char *out, const char *in, int bps, int in_len, int out_stream_channels, int pos_in_stream, double scale)
+{
+        out += pos_in_stream * bps;
+        for (int i = 0; i < in_len / bps; i++) {
+                int32_t in_value = format_from_in_bps(in, bps);
+                int32_t out_value = format_from_in_bps(out, bps);
+                // out-of-range conversion to int32_t is undefined, the kernels saturate it
+                double new_value_d = (double)in_value * scale + out_value;
+                int32_t new_value = new_value_d > INT32_MAX ? INT32_MAX : new_value_d < INT32_MIN ? INT32_MIN : (int32_t) new_value_d;
+                format_to_out_bps(out, bps, new_value);
+                in += bps;
+                out += out_stream_channels * bps;
+        }
+}
+
+/// the original running float average is replaced by exact sum so that the result is comparable
+static double ref_get_avg_volume(const char *data, int bps, int in_len, int stream_channels, int pos_in_stream)
+{
+        double average_vol = 0;
+        data += pos_in_stream * bps;
+        for (int i = 0; i < in_len / bps; i++) {
+                int32_t in_value = format_from_in_bps(data, bps);
+                average_vol += fabs((double) in_value / ((1ll << (bps * 8 - 1)) - 1));
+                data += bps * stream_channels;
+        }
+        return average_vol / (in_len / bps);
+}
+
+/// original implementation, timed only
+static double ref_get_avg_volume_running(const char *data, int bps, int in_len, int stream_channels, int pos_in_stream)
+{
+        float average_vol = 0;
+        data += pos_in_stream * bps;
+        for (int i = 0; i < in_len / bps; i++) {
+                int32_t in_value = format_from_in_bps(data, bps);
+                average_vol = average_vol * (i / ((double) i + 1)) +
+                        fabs(((double) in_value / ((1 << (bps * 8 - 1)) - 1)) / (i + 1));
+                data += bps * stream_channels;
+        }
+        return average_vol;
+}
+
+static void ref_remux_channel(char *out, const char *in, int bps, int in_len, int in_stream_channels, int out_stream_channels, int pos_in_stream, int pos_out_stream)
+{
+        in += pos_in_stream * bps;
+        out += pos_out_stream * bps;
+        for (int i = 0; i < in_len / (in_stream_channels * bps); ++i) {
+                memcpy(out, in, bps);
+                out += bps * out_stream_channels;
+                in += bps * in_stream_channels;
+        }
+}
+
+static void ref_deinterleave(vector<vector<char>> & out, const vector<char> & in, int bps, int channels)
+{
+        for (int f = 0; f < FRAMES; ++f) {
+                for (int ch = 0; ch < channels; ++ch) {
+                        memcpy(out[ch].data() + f * bps, in.data() + (f * channels + ch) * bps, bps);
+                }
+        }
+}
+
+struct test_case {
+        const char *name;
+        function<void()> old;   ///< original implementation
+        function<void()> run;
+        function<bool()> check; ///< compares output with the reference one
+};
+
+int main(int argc, char *argv[])
+{
+        double duration = argc > 1 ? atof(argv[1]) : 0.2;
+        bool all_ok = true;
+
+        cout << "Detected ISA: " << isa_names[audio_utils_set_max_isa(AUDIO_UTILS_AVX2)] << "\n";
+
+        for (int bps : bps_list) {
+                for (int channels : channel_counts) {
+                        mt19937 gen(bps * channels);
+                        const int len = FRAMES * channels * bps;
+                        vector<char> interleaved(len);
+                        for (auto & b : interleaved) {
+                                b = (char) gen();
+                        }
+                        vector<vector<char>> planar(channels, vector<char>(FRAMES * bps));
+                        vector<vector<char>> ref_planar(planar);
+                        ref_deinterleave(ref_planar, interleaved, bps, channels);
+                        vector<char *> planar_ptrs(channels);
+                        vector<const char *> ref_planar_ptrs(channels);
+                        for (int ch = 0; ch < channels; ++ch) {
+                                planar_ptrs[ch] = planar[ch].data();
+                                ref_planar_ptrs[ch] = ref_planar[ch].data();
+                        }
+                        vector<char> out(len * 4);
+                        vector<char> ref_out(len * 4);
+                        int conv_bps = bps == 4 ? 2 : 4; // 16->32, 24->32, 32->16
+                        ref_change_bps(ref_out.data(), conv_bps, interleaved.data(), bps, len);
+                        vector<char> ref_conv(ref_out.begin(), ref_out.begin() + len / bps * conv_bps);
+                        vector<char> ref_back(len);
+                        ref_change_bps(ref_back.data(), bps, ref_conv.data(), conv_bps, ref_conv.size());
+                        vector<char> ref_mixed[2];
+                        const double scales[2] = { 1.0, 0.7 };
+                        for (int i = 0; i < 2; ++i) {
+                                ref_mixed[i] = interleaved;
+                                for (int ch = 0; ch < channels; ++ch) {
+                                        ref_mux_and_mix_channel(ref_mixed[i].data(), ref_planar[ch].data(), bps, FRAMES * bps, channels, ch, scales[i]);
+                                }
+                        }
+                        double volume = 0.0;
+                        double ref_volume = 0.0;
+                        for (int ch = 0; ch < channels; ++ch) {
+                                ref_volume += ref_get_avg_volume(interleaved.data(), bps, FRAMES * bps, channels, ch);
+                        }
+
+                        vector<test_case> tests = {
+                                { "deinterleave", [&]{ for (int ch = 0; ch < channels; ++ch) {
+                                                ref_remux_channel(planar[ch].data(), interleaved.data(), bps, len, channels, 1, ch, 0); } },
+                                        [&]{ deinterleave_channels(planar_ptrs.data(), interleaved.data(), bps, len, channels); },
+                                        [&]{ return planar == ref_planar; } },
+                                { "demux", [&]{ for (int ch = 0; ch < channels; ++ch) {
+                                                ref_remux_channel(planar[ch].data(), interleaved.data(), bps, len, channels, 1, ch, 0); } },
+                                        [&]{ for (int ch = 0; ch < channels; ++ch) {
+                                                demux_channel(planar[ch].data(), interleaved.data(), bps, len, channels, ch); } },
+                                        [&]{ return planar == ref_planar; } },
+                                { "interleave", [&]{ for (int ch = 0; ch < channels; ++ch) {
+                                                ref_remux_channel(out.data(), ref_planar[ch].data(), bps, FRAMES * bps, 1, channels, 0, ch); } },
+                                        [&]{ interleave_channels(out.data(), ref_planar_ptrs.data(), bps, FRAMES * bps, channels); },
+                                        [&]{ return equal(interleaved.begin(), interleaved.end(), out.begin()); } },
+                                { "remux", [&]{ for (int ch = 0; ch < channels; ++ch) {
+                                                ref_remux_channel(out.data(), ref_planar[ch].data(), bps, FRAMES * bps, 1, channels, 0, ch); } },
+                                        [&]{ for (int ch = 0; ch < channels; ++ch) {
+                                                remux_channel(out.data(), ref_planar[ch].data(), bps, FRAMES * bps, 1, channels, 0, ch); } },
+                                        [&]{ return equal(interleaved.begin(), interleaved.end(), out.begin()); } },
+                                { "change_bps", [&]{ ref_change_bps(out.data(), conv_bps, interleaved.data(), bps, len); },
+                                        [&]{ change_bps(out.data(), conv_bps, interleaved.data(), bps, len); },
+                                        [&]{ return equal(ref_conv.begin(), ref_conv.end(), out.begin()); } },
+                                { "change_bps back", [&]{ ref_change_bps(out.data(), bps, ref_conv.data(), conv_bps, ref_conv.size()); },
+                                        [&]{ change_bps(out.data(), bps, ref_conv.data(), conv_bps, ref_conv.size()); },
+                                        [&]{ return equal(ref_back.begin(), ref_back.end(), out.begin()); } },
+                                { "mix", [&]{ copy(interleaved.begin(), interleaved.end(), out.begin());
+                                                for (int ch = 0; ch < channels; ++ch) {
+                                                        ref_mux_and_mix_channel(out.data(), ref_planar[ch].data(), bps, FRAMES * bps, channels, ch, scales[0]); } },
+                                        [&]{ copy(interleaved.begin(), interleaved.end(), out.begin());
+                                                for (int ch = 0; ch < channels; ++ch) {
+                                                        mux_and_mix_channel(out.data(), ref_planar[ch].data(), bps, FRAMES * bps, channels, ch, scales[0]); } },
+                                        [&]{ return equal(ref_mixed[0].begin(), ref_mixed[0].end(), out.begin()); } },
+                                { "mix scaled", [&]{ copy(interleaved.begin(), interleaved.end(), out.begin());
+                                                for (int ch = 0; ch < channels; ++ch) {
+                                                        ref_mux_and_mix_channel(out.data(), ref_planar[ch].data(), bps, FRAMES * bps, channels, ch, scales[1]); } },
+                                        [&]{ copy(interleaved.begin(), interleaved.end(), out.begin());
+                                                for (int ch = 0; ch < channels; ++ch) {
+                                                        mux_and_mix_channel(out.data(), ref_planar[ch].data(), bps, FRAMES * bps, channels, ch, scales[1]); } },
+                                        [&]{ return equal(ref_mixed[1].begin(), ref_mixed[1].end(), out.begin()); } },
+                                { "avg volume", [&]{ volume = 0.0; for (int ch = 0; ch < channels; ++ch) {
+                                                volume += ref_get_avg_volume_running(interleaved.data(), bps, FRAMES * bps, channels, ch); } },
+                                        [&]{ volume = 0.0; for (int ch = 0; ch < channels; ++ch) {
+                                                volume += get_avg_volume(interleaved.data(), bps, FRAMES * bps, channels, ch); } },
+                                        [&]{ return fabs(volume - ref_volume) <= 1e-9 * ref_volume; } },
+                        };
+
+                        cout << bps * 8 << "-bit, " << channels << " channels (us per 20 ms):\n";
+                        for (auto & t : tests) {
+                                cout << "\t" << t.name << ":";
+                                long long iterations;
+                                double elapsed = measure(t.old, duration, &iterations);
+                                cout << "\told " << elapsed / iterations * 1000000.0;
+                                for (int isa = AUDIO_UTILS_SCALAR; isa <= AUDIO_UTILS_AVX2; ++isa) {
+                                        if (audio_utils_set_max_isa((enum audio_utils_isa) isa) != isa) {
+                                                continue;
+                                        }
+                                        fill(planar.begin(), planar.end(), vector<char>(FRAMES * bps));
+                                        fill(out.begin(), out.end(), 0);
+                                        elapsed = measure(t.run, duration, &iterations);
+                                        bool ok = t.check();
+                                        all_ok = all_ok && ok;
+                                        cout << "\t" << isa_names[isa] << " " << elapsed / iterations * 1000000.0 << (ok ? "" : " WRONG RESULT!");
+                                }
+                                cout << "\n";
+                        }
+                }
+        }
+
+        return all_ok ? 0 : 1;
+}
@@ -0,0 +1,173 @@
+/**
+ * @file   tools/crypto_bench.cpp
+ *
+ * Benchmark of OpenSSL encryption (crypto/openssl_encrypt.h) - throughput of
+ * per-packet encrypt() and per-frame encrypt_batch() for available cipher
+ * modes. Encrypted packets are decrypted back and compared with the input.
+ *
+ * Usage: crypto_bench [frame_len [packet_len [duration_s]]]
+ */
+/*
+ * Copyright (c) 2019 CESNET z.s.p.o.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, is permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of CESNET nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESSED OR IMPLIED WARRANTIES, INCLUDING,
+ * BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#include "config_unix.h"
+#include "config_win32.h"
+#endif // HAVE_CONFIG_H
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "crypto/openssl_decrypt.h"
+#include "crypto/openssl_encrypt.h"
+#include "host.h"
+#include "lib_common.h"
+
+using namespace std;
+
+#define AAD_LEN 24
+
+static const struct {
+        enum openssl_mode mode;
+        const char *name;
+} modes[] = {
+#ifdef HAVE_AES_CTR128_ENCRYPT
+        { MODE_AES128_CTR, "CTR" },
+#endif
+        { MODE_AES128_CFB, "CFB" },
+        { MODE_AES128_GCM, "GCM" },
+};
+
+void exit_uv(int status);
+
+void exit_uv(int status)
+{
+        exit(status);
+}
+
+template<typename F>
+static double measure(F const & f, double duration, long long *iterations)
+{
+        auto start = chrono::steady_clock::now();
+        double elapsed;
+        *iterations = 0;
+        do {
+                f();
+                *iterations += 1;
+                elapsed = chrono::duration_cast<chrono::duration<double>>(chrono::steady_clock::now() - start).count();
+        } while (elapsed < duration);
+        return elapsed;
+}
+
+int main(int argc, char *argv[])
+{
+        size_t frame_len = argc > 1 ? atol(argv[1]) : 3840 * 2160 * 2;
+        int packet_len = argc > 2 ? atoi(argv[2]) : 8900;
+        double duration = argc > 3 ? atof(argv[3]) : 1.0;
+
+        uv_argv = argv;
+        open_all("ultragrid_*.so");
+        auto enc_funcs = static_cast<const struct openssl_encrypt_info *>(load_library("openssl_encrypt",
+                                LIBRARY_CLASS_UNDEFINED, OPENSSL_ENCRYPT_ABI_VERSION));
+        auto dec_funcs = static_cast<const struct openssl_decrypt_info *>(load_library("openssl_decrypt",
+                                LIBRARY_CLASS_UNDEFINED, OPENSSL_DECRYPT_ABI_VERSION));
+        if (!enc_funcs || !dec_funcs) {
+                cerr << "OpenSSL support not compiled in!\n";
+                return 1;
+        }
+
+        int packet_count = (frame_len + packet_len - 1) / packet_len;
+        int stride = packet_len + MAX_CRYPTO_EXCEED;
+        vector<char> frame(frame_len);
+        vector<char> aad(packet_count * AAD_LEN);
+        mt19937 gen(0);
+        for (auto & c : frame) {
+                c = gen();
+        }
+        for (auto & c : aad) {
+                c = gen();
+        }
+        vector<char> ciphertext(packet_count * stride);
+        vector<struct openssl_encrypt_packet> packets(packet_count);
+        for (int i = 0; i < packet_count; ++i) {
+                packets[i] = { frame.data() + i * packet_len,
+                        (int) min<size_t>(packet_len, frame_len - i * packet_len),
+                        aad.data() + i * AAD_LEN, ciphertext.data() + i * stride, 0 };
+        }
+
+        cout << "Frame size: " << frame_len << " B, " << packet_count << " packets of " <<
+                packet_len << " B\n";
+
+        struct openssl_decrypt *decrypt;
+        dec_funcs->init(&decrypt, "passphrase");
+        vector<char> plaintext(packet_len);
+        for (auto const & m : modes) {
+                struct openssl_encrypt *encrypt;
+                if (enc_funcs->init(&encrypt, "passphrase", m.mode) != 0) {
+                        cout << "\t" << m.name << ":\tinit failed\n";
+                        continue;
+                }
+                long long iterations;
+                double elapsed = measure([&]{
+                                for (auto & p : packets) {
+                                        p.ciphertext_len = enc_funcs->encrypt(encrypt, p.plaintext,
+                                                        p.plaintext_len, p.aad, AAD_LEN, p.ciphertext);
+                                }
+                        }, duration, &iterations);
+                double single_mbps = iterations * frame_len / elapsed / 1000000.0;
+
+                elapsed = measure([&]{ enc_funcs->encrypt_batch(encrypt, packets.data(), packet_count, AAD_LEN); },
+                                duration, &iterations);
+                double batch_mbps = iterations * frame_len / elapsed / 1000000.0;
+
+                bool ok = true;
+                for (auto const & p : packets) {
+                        int len = dec_funcs->decrypt(decrypt, p.ciphertext, p.ciphertext_len,
+                                        p.aad, AAD_LEN, plaintext.data(), m.mode);
+                        ok = ok && len == p.plaintext_len && memcmp(plaintext.data(), p.plaintext, len) == 0;
+                }
+
+                cout << "\t" << m.name << ":\tencrypt " << single_mbps << " MB/s, batch " <<
+                        batch_mbps << " MB/s, overhead " << enc_funcs->get_overhead(encrypt) <<
+                        " B" << (ok ? "" : ", WRONG RESULT!") << "\n";
+                enc_funcs->destroy(encrypt);
+        }
+        dec_funcs->destroy(decrypt);
+
+        return 0;
+}
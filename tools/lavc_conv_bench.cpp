@@ -0,0 +1,137 @@
+/**
+ * @file   tools/lavc_conv_bench.cpp
+ *
+ * Benchmark of libavcodec input conversions (see video_compress/libavcodec_conv.h)
+ * - throughput of scalar, SSE4.1 and AVX2 implementations. SIMD results are
+ * checked to be bit-exact with the scalar ones. The implementation used by the
+ * compress module is marked with an asterisk.
+ *
+ * Usage: lavc_conv_bench [<width> <height> [<seconds>]]
+ */
+/*
+ * Copyright (c) 2019 CESNET, z. s. p. o.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, is permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of CESNET nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESSED OR IMPLIED WARRANTIES, INCLUDING,
+ * BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#include "config_unix.h"
+#include "config_win32.h"
+#endif // HAVE_CONFIG_H
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "host.h"
+#include "video.h"
+#include "video_compress/libavcodec_conv.h"
+
+using namespace std;
+
+static const char *isa_names[] = { "scalar", "SSE4.1", "AVX2" };
+
+void exit_uv(int status);
+
+void exit_uv(int status)
+{
+        exit(status);
+}
+
+struct planes {
+        planes(int width, int height) {
+                for (int i = 0; i < 3; ++i) {
+                        // enough for 4:4:4 16-bit with some padding
+                        linesize[i] = (width * 2 + 63) / 64 * 64;
+                        buf[i].assign(linesize[i] * height, 0);
+                        data[i] = buf[i].data();
+                }
+        }
+        vector<unsigned char> buf[3];
+        unsigned char *data[3];
+        int linesize[3];
+};
+
+int main(int argc, char *argv[])
+{
+        int width = argc > 2 ? atoi(argv[1]) : 3840;
+        int height = argc > 2 ? atoi(argv[2]) : 2160;
+        double duration = argc > 3 ? atof(argv[3]) : 1.0;
+
+        cout << "Resolution: " << width << "x" << height << ", detected ISA: " <<
+                isa_names[get_lavc_conv_isa(LAVC_CONV_AVX2)] << "\n";
+
+        vector<unsigned char> in(vc_get_linesize(width, v210) * height);
+        mt19937 gen(0);
+        for (auto & b : in) {
+                b = gen();
+        }
+
+        for (int id = 0; id < LAVC_CONV_COUNT; ++id) {
+                codec_t in_codec = id >= V210_TO_YUV420P10LE ? v210 : UYVY;
+                size_t in_size = vc_get_linesize(width, in_codec) * height;
+                planes reference(width, height);
+                get_lavc_conv((enum lavc_conv_id) id, LAVC_CONV_SCALAR)(reference.data, reference.linesize, in.data(), width, height);
+
+                cout << get_lavc_conv_name((enum lavc_conv_id) id) << ":\n";
+                for (int isa = LAVC_CONV_SCALAR; isa <= LAVC_CONV_AVX2; ++isa) {
+                        if (get_lavc_conv_isa((enum lavc_conv_isa) isa) != isa) {
+                                continue;
+                        }
+                        lavc_conv_t conv = get_lavc_conv((enum lavc_conv_id) id, (enum lavc_conv_isa) isa);
+                        planes out(width, height);
+                        conv(out.data, out.linesize, in.data(), width, height);
+                        bool exact = true;
+                        for (int i = 0; i < 3; ++i) {
+                                exact = exact && out.buf[i] == reference.buf[i];
+                        }
+
+                        long long frames = 0;
+                        auto start = chrono::steady_clock::now();
+                        double elapsed;
+                        do {
+                                conv(out.data, out.linesize, in.data(), width, height);
+                                frames += 1;
+                                elapsed = chrono::duration_cast<chrono::duration<double>>(chrono::steady_clock::now() - start).count();
+                        } while (elapsed < duration);
+
+                        cout << (get_lavc_conv_preferred_isa((enum lavc_conv_id) id) == isa ? "  * " : "\t") <<
+                                isa_names[isa] << ":\t" <<
+                                frames * in_size / elapsed / 1000000000.0 << " GB/s (input), " <<
+                                frames / elapsed << " fps" << (exact ? "" : ", OUTPUT DIFFERS FROM SCALAR!") << "\n";
+                }
+        }
+
+        return 0;
+}
+
@@ -0,0 +1,163 @@
+/**
+ * @file   tools/ldgm_bench.cpp
+ *
+ * Benchmark of the CPU LDGM coder (ldgm/src/ldgm-session-cpu.cpp) - encode
+ * and decode throughput for the standard k/m/c presets with scalar, SSE2,
+ * AVX2 and AVX-512 XOR kernels. Decoded data are compared with the original.
+ *
+ * Usage: ldgm_bench [<seconds>]
+ */
+/*
+ * Copyright (c) 2019 CESNET z.s.p.o.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, is permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of CESNET nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESSED OR IMPLIED WARRANTIES, INCLUDING,
+ * BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#include "config_unix.h"
+#include "config_win32.h"
+#endif // HAVE_CONFIG_H
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <random>
+#include <vector>
+
+#include "host.h"
+#include "ldgm/src/ldgm-session-cpu.h"
+#include "ldgm/matrix-gen/matrix-generator.h"
+
+using namespace std;
+
+static const char *isa_names[] = { "scalar", "SSE2", "AVX2", "AVX-512" };
+
+/// presets from src/rtp/ldgm.cpp (uncompressed FullHD) and the default one
+static const struct {
+        const char *name;
+        int frame_size;
+        int k, m, c;
+        double loss;
+} presets[] = {
+        { "FullHD, 9000 B, 2 %", 1920 * 1080 * 2, 1500, 180, 5, 2.0 },
+        { "FullHD, 9000 B, 5 %", 1920 * 1080 * 2, 1000, 300, 6, 5.0 },
+        { "FullHD, 9000 B, 10 %", 1920 * 1080 * 2, 1000, 500, 7, 10.0 },
+        { "FullHD, 1500 B, 5 %", 1920 * 1080 * 2, 1500, 650, 6, 5.0 },
+        { "4K, default 256/192/5, 2 %", 3840 * 2160 * 2, 256, 192, 5, 2.0 },
+};
+
+void exit_uv(int status);
+
+void exit_uv(int status)
+{
+        exit(status);
+}
+
+int main(int argc, char *argv[])
+{
+        double duration = argc > 1 ? atof(argv[1]) : 1.0;
+
+        cout << "Detected ISA: " << isa_names[ldgm_cpu_set_max_isa(LDGM_CPU_AVX512)] << "\n";
+
+        for (auto const & p : presets) {
+                char fname[256];
+                snprintf(fname, sizeof fname, "/tmp/ldgm_bench-%d-%d-%d.bin", p.k, p.m, p.c);
+                if (generate_ldgm_matrix(fname, p.k, p.m, p.c, 1, 0) != 0) {
+                        cerr << "Unable to generate matrix " << fname << "\n";
+                        return 1;
+                }
+                LDGM_session_cpu session;
+                session.set_params(p.k, p.m, p.c);
+                session.set_pcMatrix(fname);
+
+                vector<char> frame(p.frame_size);
+                mt19937 gen(0);
+                for (auto & b : frame) {
+                        b = gen();
+                }
+                int buf_size;
+                char *buf = session.encode_frame(frame.data(), p.frame_size, &buf_size);
+                int ps = session.get_packet_size();
+
+                // lose symbols with the preset probability
+                map<int, int> valid_data;
+                uniform_real_distribution<double> dist(0.0, 100.0);
+                int lost = 0;
+                for (int i = 0; i < p.k + p.m; ++i) {
+                        if (dist(gen) < p.loss) {
+                                lost += 1;
+                        } else {
+                                valid_data[i * ps] = ps;
+                        }
+                }
+
+                cout << p.name << " (k=" << p.k << " m=" << p.m << " c=" << p.c << ", symbol " << ps <<
+                        " B, " << lost << " symbols lost):\n";
+                for (int isa = LDGM_CPU_SCALAR; isa <= LDGM_CPU_AVX512; ++isa) {
+                        if (ldgm_cpu_set_max_isa((enum ldgm_cpu_isa) isa) != isa) {
+                                continue;
+                        }
+                        long long iterations = 0;
+                        auto start = chrono::steady_clock::now();
+                        double elapsed;
+                        do {
+                                session.encode(buf, buf + p.k * ps);
+                                iterations += 1;
+                                elapsed = chrono::duration_cast<chrono::duration<double>>(chrono::steady_clock::now() - start).count();
+                        } while (elapsed < duration);
+                        double enc_mbps = iterations * p.frame_size / elapsed / 1000000.0;
+
+                        iterations = 0;
+                        int decoded = 0;
+                        start = chrono::steady_clock::now();
+                        do {
+                                int out_size;
+                                char *out = session.decode_frame(buf, buf_size, &out_size, valid_data);
+                                if (out_size == p.frame_size && memcmp(out, frame.data(), p.frame_size) == 0) {
+                                        decoded += 1;
+                                }
+                                iterations += 1;
+                                elapsed = chrono::duration_cast<chrono::duration<double>>(chrono::steady_clock::now() - start).count();
+                        } while (elapsed < duration);
+                        double dec_mbps = iterations * p.frame_size / elapsed / 1000000.0;
+
+                        cout << "\t" << isa_names[isa] << ":\tencode " << enc_mbps << " MB/s, decode " <<
+                                dec_mbps << " MB/s (" << decoded << "/" << iterations << " recovered)\n";
+                }
+                session.free_out_buf(buf);
+                remove(fname);
+        }
+
+        return 0;
+}
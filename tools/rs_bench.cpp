@@ -0,0 +1,164 @@
+/**
+ * @file   tools/rs_bench.cpp
+ *
+ * Benchmark of Reed-Solomon FEC (rs/fec.h) - encode and decode throughput of
+ * scalar, SSSE3 and AVX2 GF(256) kernels for typical k/n. Decoded data are
+ * checked against the original.
+ *
+ * Usage: rs_bench [<frame_bytes> [<seconds>]]
+ */
+/*
+ * Copyright (c) 2019 CESNET z.s.p.o.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, is permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of CESNET nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESSED OR IMPLIED WARRANTIES, INCLUDING,
+ * BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#include "config_unix.h"
+#include "config_win32.h"
+#endif // HAVE_CONFIG_H
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "host.h"
+
+extern "C" {
+#include "rs/fec.h"
+}
+
+using namespace std;
+
+static const char *isa_names[] = { "scalar", "SSSE3", "AVX2" };
+static const unsigned int configs[][2] = { { 128, 224 }, { 200, 250 }, { 160, 200 }, { 64, 96 } };
+
+void exit_uv(int status);
+
+void exit_uv(int status)
+{
+        exit(status);
+}
+
+template<typename F>
+static double measure(F const & f, double duration, long long *iterations)
+{
+        auto start = chrono::steady_clock::now();
+        double elapsed;
+        *iterations = 0;
+        do {
+                f();
+                *iterations += 1;
+                elapsed = chrono::duration_cast<chrono::duration<double>>(chrono::steady_clock::now() - start).count();
+        } while (elapsed < duration);
+        return elapsed;
+}
+
+int main(int argc, char *argv[])
+{
+        size_t frame_len = argc > 1 ? atol(argv[1]) : 3840 * 2160 * 2;
+        double duration = argc > 2 ? atof(argv[2]) : 1.0;
+
+        cout << "Frame size: " << frame_len << " B, detected ISA: " <<
+                isa_names[fec_set_max_isa(FEC_ISA_AVX2)] << "\n";
+
+        for (auto const & cfg : configs) {
+                unsigned int k = cfg[0];
+                unsigned int n = cfg[1];
+                size_t ss = (frame_len + k - 1) / k;
+                fec_t *code = fec_new(k, n);
+
+                vector<unsigned char> data(ss * n);
+                mt19937 gen(0);
+                for (size_t i = 0; i < ss * k; ++i) {
+                        data[i] = gen();
+                }
+                vector<const gf *> src(k);
+                for (unsigned int i = 0; i < k; ++i) {
+                        src[i] = &data[i * ss];
+                }
+                vector<gf *> fecs(n - k);
+                vector<unsigned int> block_nums(n - k);
+                for (unsigned int i = 0; i < n - k; ++i) {
+                        fecs[i] = &data[(k + i) * ss];
+                        block_nums[i] = k + i;
+                }
+
+                // lose first min(k, n - k) primary blocks, replace them with secondary
+                unsigned int lost = min(k, n - k);
+                vector<const gf *> inpkts(src);
+                vector<unsigned int> index(k);
+                for (unsigned int i = 0; i < k; ++i) {
+                        index[i] = i;
+                }
+                for (unsigned int i = 0; i < lost; ++i) {
+                        inpkts[i] = fecs[i];
+                        index[i] = k + i;
+                }
+                vector<unsigned char> out_data(ss * lost);
+                vector<gf *> outpkts(lost);
+                for (unsigned int i = 0; i < lost; ++i) {
+                        outpkts[i] = &out_data[i * ss];
+                }
+
+                cout << "k=" << k << " n=" << n << " (" << lost << " blocks lost):\n";
+                vector<unsigned char> reference;
+                for (int isa = FEC_ISA_SCALAR; isa <= FEC_ISA_AVX2; ++isa) {
+                        if (fec_set_max_isa((enum fec_isa) isa) != isa) {
+                                continue;
+                        }
+                        long long iterations;
+                        double elapsed = measure([&]{ fec_encode(code, src.data(), fecs.data(), block_nums.data(), n - k, ss); },
+                                        duration, &iterations);
+                        double enc_gbps = iterations * ss * k / elapsed / 1000000000.0;
+                        vector<unsigned char> parity(data.begin() + ss * k, data.end());
+                        if (reference.empty()) {
+                                reference = parity;
+                        }
+
+                        elapsed = measure([&]{ fec_decode(code, inpkts.data(), outpkts.data(), index.data(), ss); },
+                                        duration, &iterations);
+                        double dec_gbps = iterations * ss * k / elapsed / 1000000000.0;
+                        bool ok = parity == reference;
+                        for (unsigned int i = 0; i < lost; ++i) {
+                                ok = ok && equal(out_data.begin() + i * ss, out_data.begin() + (i + 1) * ss, data.begin() + i * ss);
+                        }
+
+                        cout << "\t" << isa_names[isa] << ":\tencode " << enc_gbps << " GB/s, decode " <<
+                                dec_gbps << " GB/s" << (ok ? "" : ", WRONG RESULT!") << "\n";
+                }
+                fec_free(code);
+        }
+
+        return 0;
+}
@@ -0,0 +1,144 @@
+/**
+ * @file   tools/udp_send_bench.cpp
+ *
+ * Loopback benchmark of UDP send paths - per-packet sendmsg() versus batched
+ * sendmmsg() and sendmmsg() with UDP GSO (see udp_async_start()).
+ *
+ * Usage: udp_send_bench [<payload_size> [<seconds>]]
+ */
+/*
+ * Copyright (c) 2019 CESNET, z. s. p. o.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, is permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of CESNET nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESSED OR IMPLIED WARRANTIES, INCLUDING,
+ * BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#include "config_unix.h"
+#include "config_win32.h"
+#endif // HAVE_CONFIG_H
+
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+#include "host.h"
+#include "rtp/net_udp.h"
+#include "rtp/rtp.h"
+
+#define BENCH_PORT 5104
+#define PACKETS_PER_FRAME 1024
+
+using namespace std;
+
+void exit_uv(int status);
+
+void exit_uv(int status)
+{
+        exit(status);
+}
+
+static double get_cpu_time()
+{
+        struct rusage usage;
+#ifdef RUSAGE_THREAD
+        getrusage(RUSAGE_THREAD, &usage);
+#else
+        getrusage(RUSAGE_SELF, &usage);
+#endif
+        return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+                (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000000.0;
+}
+
+static void run(const char *mode, int payload_size, double duration)
+{
+        commandline_params["udp-send-batch"] = mode;
+        socket_udp *s = udp_init("127.0.0.1", 0, BENCH_PORT, 255, 4, false);
+        if (!s) {
+                cerr << "Unable to create socket!\n";
+                return;
+        }
+        udp_set_send_buf(s, 16 * 1024 * 1024);
+
+        vector<char> data(payload_size * PACKETS_PER_FRAME);
+        uint32_t payload_hdr[6] = {};
+        long long packets = 0;
+        double cpu_start = get_cpu_time();
+        auto start = chrono::steady_clock::now();
+        double elapsed;
+
+        do {
+                udp_async_start(s, PACKETS_PER_FRAME);
+                for (int i = 0; i < PACKETS_PER_FRAME; ++i) {
+                        // mimic rtp_send_data_hdr() - RTP header allocated per packet
+                        char *rtp_hdr = (char *) calloc(1, 20 + RTP_PACKET_HEADER_SIZE);
+                        struct iovec vector[3];
+                        vector[0].iov_base = rtp_hdr + RTP_PACKET_HEADER_SIZE;
+                        vector[0].iov_len = 12;
+                        vector[1].iov_base = payload_hdr;
+                        vector[1].iov_len = sizeof payload_hdr;
+                        vector[2].iov_base = data.data() + i * payload_size;
+                        vector[2].iov_len = payload_size;
+                        udp_sendv(s, vector, 3, rtp_hdr);
+                }
+                udp_async_wait(s);
+                packets += PACKETS_PER_FRAME;
+                elapsed = chrono::duration_cast<chrono::duration<double>>(chrono::steady_clock::now() - start).count();
+        } while (elapsed < duration);
+
+        double cpu = get_cpu_time() - cpu_start;
+        double gbits = packets * (payload_size + 12 + sizeof payload_hdr) * 8 / 1000000000.0;
+        cout << mode << ":\t" << (long long) (packets / elapsed) << " packets/s, "
+                << gbits / elapsed << " Gbps, " << cpu / gbits << " CPU s per Gbit\n";
+
+        udp_exit(s);
+}
+
+int main(int argc, char *argv[])
+{
+        int payload_size = argc > 1 ? atoi(argv[1]) : 8000;
+        double duration = argc > 2 ? atof(argv[2]) : 3.0;
+
+        // sink that is never read - the kernel drops datagrams once its buffer is full
+        socket_udp *sink = udp_init("127.0.0.1", BENCH_PORT, 0, 255, 4, false);
+        if (!sink) {
+                cerr << "Unable to bind port " << BENCH_PORT << "!\n";
+                return 1;
+        }
+
+        cout << "Payload size: " << payload_size << " B\n";
+        for (auto mode : { "none", "mmsg", "gso" }) {
+                run(mode, payload_size, duration);
+        }
+
+        udp_exit(sink);
+        return 0;
+}
+
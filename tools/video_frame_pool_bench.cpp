@@ -0,0 +1,160 @@
+/**
+ * @file   tools/video_frame_pool_bench.cpp
+ *
+ * Microbenchmark of video frame pools - get/return throughput of
+ * video_frame_pool and lockfree_video_frame_pool under N threads and cost of
+ * allocating and first filling a large (8K UYVY) frame with the default and
+ * the huge-page allocator.
+ *
+ * Usage: video_frame_pool_bench [<max_threads> [<seconds>]]
+ */
+/*
+ * Copyright (c) 2019 CESNET, z. s. p. o.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, is permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of CESNET nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESSED OR IMPLIED WARRANTIES, INCLUDING,
+ * BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#include "config_unix.h"
+#include "config_win32.h"
+#endif // HAVE_CONFIG_H
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "host.h"
+#include "utils/video_frame_pool.h"
+#include "video.h"
+
+#define FRAME_WIDTH 7680
+#define FRAME_HEIGHT 4320
+
+using namespace std;
+
+void exit_uv(int status);
+
+void exit_uv(int status)
+{
+        exit(status);
+}
+
+static struct video_desc get_desc(int width, int height)
+{
+        struct video_desc desc{};
+        desc.width = width;
+        desc.height = height;
+        desc.color_spec = UYVY;
+        desc.fps = 30;
+        desc.tile_count = 1;
+        return desc;
+}
+
+template <typename pool_t>
+static void bench_get_return(const char *name, int thread_count, double duration)
+{
+        pool_t pool;
+        // small frames - measures the pool overhead, not the allocation
+        pool.reconfigure(get_desc(64, 64), vc_get_linesize(64, UYVY) * 64);
+        atomic<bool> should_exit{false};
+        atomic<long long> total{0};
+
+        vector<thread> threads;
+        for (int i = 0; i < thread_count; ++i) {
+                threads.emplace_back([&]() {
+                        long long count = 0;
+                        while (!should_exit) {
+                                for (int j = 0; j < 1000; ++j) {
+                                        // hold two frames to exercise the free list
+                                        auto f1 = pool.get_frame();
+                                        auto f2 = pool.get_frame();
+                                }
+                                count += 2000;
+                        }
+                        total += count;
+                });
+        }
+        this_thread::sleep_for(chrono::duration<double>(duration));
+        should_exit = true;
+        for (auto &t : threads) {
+                t.join();
+        }
+        cout << name << ", " << thread_count << " thread(s):\t" <<
+                total / duration / 1000000.0 << " M get/return per second\n";
+}
+
+template <typename allocator>
+static void bench_alloc(const char *name, int iterations)
+{
+        allocator alloc;
+        size_t len = vc_get_linesize(FRAME_WIDTH, UYVY) * FRAME_HEIGHT;
+        double alloc_time = 0.0, fill_time = 0.0;
+        volatile char sink = 0;
+
+        for (int i = 0; i < iterations; ++i) {
+                auto t0 = chrono::steady_clock::now();
+                char *data = (char *) alloc.allocate(len);
+                auto t1 = chrono::steady_clock::now();
+                if (data == NULL) {
+                        cerr << name << ": allocation failed\n";
+                        return;
+                }
+                memset(data, i, len);
+                sink = sink + data[len - 1]; // keep the memset from being optimized out
+                auto t2 = chrono::steady_clock::now();
+                alloc.deallocate(data);
+                alloc_time += chrono::duration_cast<chrono::duration<double>>(t1 - t0).count();
+                fill_time += chrono::duration_cast<chrono::duration<double>>(t2 - t1).count();
+        }
+        cout << name << ":\t" << alloc_time / iterations * 1000.0 << " ms allocate, " <<
+                fill_time / iterations * 1000.0 << " ms first fill of " <<
+                len / 1000000.0 << " MB frame\n";
+}
+
+int main(int argc, char *argv[])
+{
+        int max_threads = argc > 1 ? atoi(argv[1]) : thread::hardware_concurrency();
+        double duration = argc > 2 ? atof(argv[2]) : 1.0;
+
+        for (int threads = 1; threads <= max_threads; threads *= 2) {
+                bench_get_return<video_frame_pool<default_data_allocator>>("video_frame_pool", threads, duration);
+                bench_get_return<lockfree_video_frame_pool<default_data_allocator>>("lockfree_video_frame_pool", threads, duration);
+        }
+
+        bench_alloc<default_data_allocator>("default_data_allocator", 10);
+        bench_alloc<hugepage_data_allocator>("hugepage_data_allocator", 10);
+
+        return 0;
+}
+
@@ -0,0 +1,152 @@
+#include <cppunit/config/SourcePrefix.h>
+#include "aggregate_test.h"
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <sstream>
+#include <vector>
+
+#include "video_capture/aggregate.h"
+
+using namespace std;
+using namespace std::chrono;
+
+// Registers the fixture into the 'registry'
+CPPUNIT_TEST_SUITE_REGISTRATION( aggregate_test );
+
+namespace {
+struct test_tile {
+        steady_clock::time_point timestamp;
+};
+
+struct test_device {
+        deque<test_tile> queue;
+        const test_tile *current = nullptr;
+        test_tile last;
+};
+
+/**
+ * Simulates free-running devices with given phases (in fractions of frame
+ * time) and returns count of assembled frames.
+ */
+int simulate(vector<double> const & phases, enum sync_policy policy, microseconds tolerance, int periods)
+{
+        const microseconds period(1000000 / 30);
+        const steady_clock::time_point start{};
+        struct event {
+                steady_clock::time_point t;
+                size_t device;
+                bool operator<(event const & other) const { return t < other.t; }
+        };
+        vector<event> events;
+        for (size_t i = 0; i < phases.size(); ++i) {
+                for (int n = 0; n < periods; ++n) {
+                        // +-1 ms alternating jitter
+                        microseconds jitter((n % 2 ? 1000 : -1000) * (i % 2 ? 1 : -1));
+                        events.push_back({start + period * n + duration_cast<microseconds>(period * phases[i]) + jitter, i});
+                }
+        }
+        sort(events.begin(), events.end());
+
+        vector<test_device> devices(phases.size());
+        int frames = 0;
+        for (auto const & e : events) {
+                devices[e.device].queue.push_back({e.t});
+                steady_clock::time_point wake_up;
+                while (aggregate_tiles_ready(devices, policy, tolerance, [](test_tile &) {}, e.t, &wake_up)) {
+                        for (auto & dev : devices) {
+                                if (!dev.queue.empty()) {
+                                        dev.last = dev.queue.front();
+                                        dev.current = &dev.last;
+                                        dev.queue.pop_front();
+                                }
+                        }
+                        frames += 1;
+                }
+        }
+        return frames;
+}
+} // end of anonymous namespace
+
+aggregate_test::aggregate_test()
+{
+}
+
+aggregate_test::~aggregate_test()
+{
+}
+
+void
+aggregate_test::setUp()
+{
+}
+
+void
+aggregate_test::tearDown()
+{
+}
+
+/**
+ * Free-running devices with phases spread over more than half of frame time
+ * must still produce frames with the default policy and tolerance.
+ */
+void
+aggregate_test::testStaggeredDevices()
+{
+        const int periods = 90;
+        vector<vector<double>> configs = {
+                { 0.0, 1.0 / 3, 2.0 / 3 },
+                { 0.0, 0.25, 0.5, 0.75 },
+                { 0.0, 0.9, 0.45, 0.95 },
+        };
+        for (auto const & phases : configs) {
+                int frames = simulate(phases, POLICY_DROP, aggregate_default_skew(30), periods);
+                ostringstream oss;
+                oss << phases.size() << " devices: " << frames << " frames of " << periods;
+                CPPUNIT_ASSERT_MESSAGE(oss.str(), frames >= periods - 2);
+        }
+}
+
+/**
+ * From a backlog of queued tiles, the one closest to the other devices is
+ * taken.
+ */
+void
+aggregate_test::testClosestTileSelected()
+{
+        const steady_clock::time_point t0{};
+        const milliseconds period(33);
+        vector<test_device> devices(2);
+        for (int i = 0; i < 3; ++i) {
+                devices[0].queue.push_back({t0 + i * period});
+        }
+        devices[1].queue.push_back({t0 + 2 * period + milliseconds(5)});
+
+        steady_clock::time_point wake_up;
+        int discarded = 0;
+        CPPUNIT_ASSERT(aggregate_tiles_ready(devices, POLICY_DROP, aggregate_default_skew(30),
+                                [&discarded](test_tile &) { discarded++; }, t0 + 3 * period, &wake_up));
+        CPPUNIT_ASSERT_EQUAL(2, discarded);
+        CPPUNIT_ASSERT(devices[0].queue.front().timestamp == t0 + 2 * period);
+}
+
+/**
+ * With dup policy, the frame is assembled with previous tile of a device
+ * that stopped delivering once the tolerance elapses.
+ */
+void
+aggregate_test::testDupLateDevice()
+{
+        const steady_clock::time_point t0{};
+        const microseconds tolerance = aggregate_default_skew(30);
+        vector<test_device> devices(2);
+        devices[1].current = &devices[1].last;
+        devices[0].queue.push_back({t0});
+
+        steady_clock::time_point wake_up;
+        CPPUNIT_ASSERT(!aggregate_tiles_ready(devices, POLICY_DUP, tolerance, [](test_tile &) {}, t0, &wake_up));
+        CPPUNIT_ASSERT(wake_up == t0 + tolerance);
+        CPPUNIT_ASSERT(aggregate_tiles_ready(devices, POLICY_DUP, tolerance, [](test_tile &) {}, t0 + tolerance, &wake_up));
+        CPPUNIT_ASSERT(!aggregate_tiles_ready(devices, POLICY_DROP, tolerance, [](test_tile &) {}, t0 + tolerance, &wake_up));
+}
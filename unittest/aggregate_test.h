@@ -0,0 +1,25 @@
+#ifndef AGGREGATE_TEST_H
+#define AGGREGATE_TEST_H
+
+#include <cppunit/extensions/HelperMacros.h>
+
+class aggregate_test : public CPPUNIT_NS::TestFixture
+{
+  CPPUNIT_TEST_SUITE( aggregate_test );
+  CPPUNIT_TEST( testStaggeredDevices );
+  CPPUNIT_TEST( testClosestTileSelected );
+  CPPUNIT_TEST( testDupLateDevice );
+  CPPUNIT_TEST_SUITE_END();
+
+public:
+  aggregate_test();
+  ~aggregate_test();
+  void setUp();
+  void tearDown();
+
+  void testStaggeredDevices();
+  void testClosestTileSelected();
+  void testDupLateDevice();
+};
+
+#endif //  AGGREGATE_TEST_H